@@ -0,0 +1,521 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* oqt_bench: timings for the main decoding and encoding functions, and
+ * for the count, calcqts, sortblocks, mergechanges and geometry
+ * operations run end to end on a single input file. The results are
+ * written as json, so that runs on the same machine can be compared
+ * between commits.
+ *
+ * usage: oqt_bench input.pbf [outfn=oqt_bench.json] [reps=5] [numchan=N]
+ *            [workdir=...] [label=...] [targetsize=...] [minsize=...]
+ *            [nomicro] [noe2e]
+ *
+ * Each microbenchmark is run once to warm up, then reps times. Inputs not
+ * taken from the file are generated from a fixed seed, and every
+ * benchmark reports a checksum of its output, so differences in results
+ * as well as timings can be seen between runs. */
+
+#include "oqt/count.hpp"
+#include "oqt/calcqts/calcqts.hpp"
+#include "oqt/sorting/qttree.hpp"
+#include "oqt/sorting/qttreegroups.hpp"
+#include "oqt/sorting/sortblocks.hpp"
+#include "oqt/sorting/mergechanges.hpp"
+#include "oqt/geometry/process.hpp"
+#include "oqt/geometry/addwaynodes.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
+#include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/readminimal.hpp"
+#include "oqt/pbfformat/readblockscaller.hpp"
+#include "oqt/pbfformat/writeblock.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/elements/quadtree.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/utils/pbf/varint.hpp"
+#include "oqt/utils/pbf/packedint.hpp"
+#include "oqt/utils/compress.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/telemetry.hpp"
+#include "oqt/utils/date.hpp"
+#include "oqt/utils/operatingsystem.hpp"
+
+#include "picojson.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <experimental/filesystem>
+
+using namespace oqt;
+
+struct bench_counts {
+    size_t items;
+    size_t bytes;
+    uint64 checksum;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point st) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-st).count();
+}
+
+template <class Func>
+picojson::value run_bench(const std::string& name, size_t reps, Func func) {
+    
+    bench_counts counts = func(); //warm up
+    std::vector<double> times;
+    for (size_t i=0; i < reps; i++) {
+        auto st = std::chrono::steady_clock::now();
+        auto cc = func();
+        times.push_back(seconds_since(st));
+        if (cc.checksum != counts.checksum) {
+            throw std::domain_error("benchmark "+name+" not reproducible");
+        }
+    }
+    std::sort(times.begin(), times.end());
+    double total=0;
+    for (auto& t: times) { total+=t; }
+    
+    double min = times.front();
+    double median = times[times.size()/2];
+    
+    picojson::object res;
+    res["name"] = picojson::value(name);
+    res["reps"] = picojson::value(double(reps));
+    res["items"] = picojson::value(double(counts.items));
+    res["bytes"] = picojson::value(double(counts.bytes));
+    res["min"] = picojson::value(min);
+    res["median"] = picojson::value(median);
+    res["mean"] = picojson::value(total/reps);
+    res["max"] = picojson::value(times.back());
+    res["ns_per_item"] = picojson::value(counts.items>0 ? min*1e9/counts.items : 0.0);
+    res["mb_per_sec"] = picojson::value(min>0 ? counts.bytes/min/1024.0/1024.0 : 0.0);
+    res["checksum"] = picojson::value(std::to_string(counts.checksum));
+    
+    Logger::Message() << name << ": " << counts.items << " items, " << counts.bytes << " bytes, min "
+        << min << "s, median " << median << "s, " << (counts.items>0 ? min*1e9/counts.items : 0.0) << " ns/item";
+    return picojson::value(res);
+}
+
+
+std::vector<std::shared_ptr<FileBlock>> read_data_blocks(const std::string& fn) {
+    std::ifstream infile(fn, std::ios::in | std::ios::binary);
+    if (!infile.good()) {
+        throw std::domain_error("can't open "+fn);
+    }
+    std::vector<std::shared_ptr<FileBlock>> result;
+    for (int64 i=0; ; i++) {
+        auto fb = read_file_block(i, infile);
+        if (!fb || fb->blocktype.empty()) { break; }
+        if (fb->blocktype=="OSMData") {
+            result.push_back(fb);
+        }
+    }
+    return result;
+}
+
+bool is_sorted_file(const std::string& fn) {
+    auto head = get_header_block(fn);
+    return head && !head->Index().empty();
+}
+
+picojson::array run_micro(const std::string& infn, const std::string& blocksfn, size_t reps) {
+    picojson::array result;
+    
+    auto fileblocks = read_data_blocks(infn);
+    std::vector<std::string> datas;
+    size_t compressed_bytes=0, data_bytes=0;
+    for (auto& fb: fileblocks) {
+        compressed_bytes += fb->data.size();
+        datas.push_back(fb->get_data());
+        data_bytes += datas.back().size();
+    }
+    Logger::Message() << "read " << fileblocks.size() << " blocks, " << compressed_bytes << " compressed, " << data_bytes << " uncompressed bytes";
+    
+    std::vector<PrimitiveBlockPtr> blocks;
+    for (size_t i=0; i < datas.size(); i++) {
+        blocks.push_back(read_primitive_block(i, datas[i], false));
+    }
+    
+    std::vector<std::string> packed_refs;
+    size_t packed_refs_bytes=0;
+    for (auto& bl: blocks) {
+        for (auto& o: bl->Objects()) {
+            if (o->Type()==ElementType::Way) {
+                packed_refs.push_back(write_packed_delta(std::dynamic_pointer_cast<Way>(o)->Refs()));
+                packed_refs_bytes += packed_refs.back().size();
+            }
+        }
+    }
+    
+    std::mt19937_64 rng(20180101);
+    
+    std::vector<uint64> varint_vals(1000000);
+    for (auto& v: varint_vals) {
+        //mostly small values, as found in delta encoded data
+        uint64 val = rng();
+        uint64 shift = rng() % 64;
+        v = val >> shift;
+    }
+    std::string varint_data = write_packed_int(varint_vals);
+    
+    result.push_back(run_bench("read_unsigned_varint", reps, [&]() {
+        bench_counts cc{0, varint_data.size(), 0};
+        size_t pos=0;
+        while (pos < varint_data.size()) {
+            cc.checksum += read_unsigned_varint(varint_data, pos);
+            cc.items++;
+        }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("read_packed_int", reps, [&]() {
+        auto vv = read_packed_int(varint_data);
+        bench_counts cc{vv.size(), varint_data.size(), 0};
+        for (auto& v: vv) { cc.checksum += v; }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("read_packed_delta_refs", reps, [&]() {
+        bench_counts cc{0, packed_refs_bytes, 0};
+        for (auto& p: packed_refs) {
+            auto vv = read_packed_delta(p);
+            cc.items += vv.size();
+            for (auto& v: vv) { cc.checksum += v; }
+        }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("decompress", reps, [&]() {
+        bench_counts cc{fileblocks.size(), compressed_bytes, 0};
+        for (auto& fb: fileblocks) {
+            if (fb->compressed) {
+                cc.checksum += decompress(fb->data, fb->uncompressed_size).size();
+            } else {
+                cc.checksum += fb->data.size();
+            }
+        }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("read_primitive_block", reps, [&]() {
+        bench_counts cc{0, data_bytes, 0};
+        for (size_t i=0; i < datas.size(); i++) {
+            auto bl = read_primitive_block(i, datas[i], false);
+            cc.items += bl->size();
+            for (auto& o: bl->Objects()) { cc.checksum += o->Id(); }
+        }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("read_minimal_block", reps, [&]() {
+        bench_counts cc{0, data_bytes, 0};
+        for (size_t i=0; i < datas.size(); i++) {
+            auto bl = read_minimal_block(i, datas[i]);
+            size_t n = bl->nodes.size() + bl->ways.size() + bl->relations.size() + bl->geometries.size();
+            cc.items += n;
+            cc.checksum += n;
+            for (auto& w: bl->ways) { cc.checksum += w.id; }
+        }
+        return cc;
+    }));
+    
+    result.push_back(run_bench("pack_primitive_block", reps, [&]() {
+        bench_counts cc{0, 0, 0};
+        for (auto& bl: blocks) {
+            auto pp = pack_primitive_block(bl, true, false, true, true);
+            cc.items += bl->size();
+            cc.bytes += pp.size();
+            cc.checksum += std::hash<std::string>()(pp);
+        }
+        return cc;
+    }));
+    
+    std::vector<bbox> boxes(1000000);
+    for (auto& bx: boxes) {
+        int64 x = (rng() % 3600000000ll) - 1800000000ll;
+        int64 y = (rng() % 1700000000ll) - 850000000ll;
+        uint64 val = rng();
+        uint64 shift = 40 + (rng() % 24);
+        int64 sz = val >> shift;
+        bx = bbox(x, y, std::min<int64>(x+sz, 1800000000ll), std::min<int64>(y+sz, 850000000ll));
+    }
+    std::vector<int64> qts(boxes.size());
+    
+    result.push_back(run_bench("quadtree_calculate", reps, [&]() {
+        bench_counts cc{boxes.size(), 0, 0};
+        for (size_t i=0; i < boxes.size(); i++) {
+            auto& bx = boxes[i];
+            qts[i] = quadtree::calculate(bx.minx, bx.miny, bx.maxx, bx.maxy, 0.05, 17);
+            cc.checksum += qts[i];
+        }
+        return cc;
+    }));
+    
+    std::shared_ptr<QtTree> groups;
+    result.push_back(run_bench("qttree_add", reps, [&]() {
+        auto tree = make_tree_empty();
+        for (auto& q: qts) {
+            tree->add(q, 1);
+        }
+        groups = find_groups_copy(tree, 4000, 1000);
+        return bench_counts{qts.size(), 0, groups->size()};
+    }));
+    
+    result.push_back(run_bench("qttree_find_tile", reps, [&]() {
+        bench_counts cc{qts.size(), 0, 0};
+        for (auto& q: qts) {
+            cc.checksum += groups->find_tile(q).qt;
+        }
+        return cc;
+    }));
+    
+    if (blocksfn.empty()) {
+        Logger::Message() << "no sorted file: skip get_lonlats";
+        return result;
+    }
+    
+    std::vector<PrimitiveBlockPtr> sorted_blocks;
+    if (blocksfn==infn) {
+        sorted_blocks = blocks;
+    } else {
+        auto ff = read_data_blocks(blocksfn);
+        for (size_t i=0; i < ff.size(); i++) {
+            sorted_blocks.push_back(read_primitive_block(i, ff[i]->get_data(), false));
+        }
+    }
+    
+    result.push_back(run_bench("get_lonlats", reps, [&]() {
+        bench_counts cc{0, 0, 0};
+        auto lls = geometry::make_lonlatstore();
+        for (auto& bl: sorted_blocks) {
+            lls->add_tile(bl);
+            for (auto& o: bl->Objects()) {
+                if (o->Type()==ElementType::Way) {
+                    auto ll = lls->get_lonlats(std::dynamic_pointer_cast<Way>(o));
+                    cc.items += ll.size();
+                    for (auto& l: ll) { cc.checksum += l.lon + l.lat; }
+                }
+            }
+        }
+        lls->finish();
+        return cc;
+    }));
+    
+    return result;
+}
+
+template <class Func>
+picojson::value run_step(const std::string& name, const std::string& outfn, Func func) {
+    Logger::Get().reset_timing();
+    Telemetry::Get().reset();
+    Telemetry::Get().enable(false);
+    
+    auto st = std::chrono::steady_clock::now();
+    func();
+    double tt = seconds_since(st);
+    
+    Telemetry::Get().disable();
+    
+    picojson::object res;
+    res["name"] = picojson::value(name);
+    res["seconds"] = picojson::value(tt);
+    if (!outfn.empty()) {
+        res["output_size"] = picojson::value(double(file_size(outfn)));
+    }
+    picojson::value stages;
+    std::string err = picojson::parse(stages, Telemetry::Get().report_json());
+    if (err.empty()) {
+        res["telemetry"] = stages;
+    }
+    Telemetry::Get().reset();
+    
+    Logger::Message() << "e2e " << name << ": " << tt << "s";
+    return picojson::value(res);
+}
+
+picojson::array run_e2e(const std::string& infn, const std::string& workdir, size_t numchan,
+    int64 targetsize, int64 minsize, std::string& blocksfn) {
+    
+    picojson::array result;
+    
+    bbox box{-1800000000,-900000000,1800000000,900000000};
+    std::vector<LonLat> poly;
+    int64 timestamp=0;
+    
+    result.push_back(run_step("count", "", [&]() {
+        auto rbc = make_read_blocks_caller(infn, box, poly, timestamp);
+        run_count(rbc, false, numchan, false, false, ReadBlockFlags::Empty, true);
+    }));
+    
+    if (blocksfn.empty()) {
+        std::string qtsfn = workdir+"/bench-qts.pbf";
+        blocksfn = workdir+"/bench-blocks.pbf";
+        
+        result.push_back(run_step("calcqts", qtsfn, [&]() {
+            run_calcqts(infn, qtsfn, numchan, true, true, 0.05, 17, true);
+        }));
+        
+        result.push_back(run_step("sortblocks", blocksfn, [&]() {
+            auto tree = make_qts_tree_maxlevel(qtsfn, numchan, 15);
+            auto groups = find_groups_copy(tree, targetsize, minsize, numchan);
+            tree.reset();
+            run_sortblocks(infn, qtsfn, blocksfn, 0, numchan, groups, blocksfn+"-interim", 0, false, true);
+        }));
+        
+        result.push_back(run_step("count_blocks", "", [&]() {
+            auto rbc = make_read_blocks_caller(blocksfn, box, poly, timestamp);
+            run_count(rbc, false, numchan, false, false, ReadBlockFlags::Empty, true);
+        }));
+    }
+    
+    std::string mergedfn = workdir+"/bench-merged.pbf";
+    result.push_back(run_step("mergechanges", mergedfn, [&]() {
+        run_mergechanges(blocksfn, mergedfn, numchan, false, false, box, poly, 0, mergedfn+"-interim", 500, true, false);
+    }));
+    
+    std::string sortedfn = workdir+"/bench-sorted.pbf";
+    result.push_back(run_step("mergechanges_sortobjs", sortedfn, [&]() {
+        run_mergechanges(blocksfn, sortedfn, numchan, true, false, box, poly, 0, sortedfn+"-interim", 500, true, false);
+    }));
+    
+    result.push_back(run_step("geometry", "", [&]() {
+        geometry::GeometryParameters params;
+        params.filenames = {blocksfn};
+        auto head = get_header_block(blocksfn);
+        for (auto& q: head->Index()) {
+            params.locs[std::get<0>(q)].push_back({0, std::get<1>(q)});
+        }
+        params.numchan = numchan;
+        params.box = box;
+        params.all_objs = true;
+        params.all_other_keys = true;
+        params.feature_keys = {"building","landuse","natural","highway","amenity","leisure","boundary","place","waterway"};
+        params.add_multipolygons = true;
+        params.add_boundary_polygons = true;
+        
+        size_t nobjs=0;
+        geometry::process_geometry(params, [&nobjs](PrimitiveBlockPtr bl) {
+            if (bl) { nobjs += bl->size(); }
+        });
+    }));
+    
+    return result;
+}
+
+int main(int argc, char** argv) {
+    if (argc<2) {
+        std::cout << "usage: oqt_bench input.pbf [outfn=oqt_bench.json] [reps=5] [numchan=N] [workdir=...] [label=...] [targetsize=...] [minsize=...] [nomicro] [noe2e]\n";
+        return 1;
+    }
+    
+    std::string infn = argv[1];
+    std::string outfn = "oqt_bench.json";
+    std::string workdir;
+    std::string label;
+    size_t reps=5;
+    size_t numchan=std::thread::hardware_concurrency();
+    int64 targetsize=40000;
+    int64 minsize=20000;
+    bool micro=true;
+    bool e2e=true;
+    
+    for (int i=2; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        std::string key = arg;
+        std::string val = "";
+        auto eqp = arg.find("=");
+        if (eqp < std::string::npos) {
+            key=arg.substr(0,eqp+1);
+            val=arg.substr(eqp+1,arg.size());
+        }
+        
+        if (key=="outfn=") {
+            outfn = val;
+        } else if (key=="reps=") {
+            reps = std::stoull(val);
+        } else if (key=="numchan=") {
+            numchan = std::stoull(val);
+        } else if (key=="workdir=") {
+            workdir = val;
+        } else if (key=="label=") {
+            label = val;
+        } else if (key=="targetsize=") {
+            targetsize = std::stoll(val);
+        } else if (key=="minsize=") {
+            minsize = std::stoll(val);
+        } else if (key=="nomicro") {
+            micro=false;
+        } else if (key=="noe2e") {
+            e2e=false;
+        } else {
+            Logger::Message() << "unrecognised argument " << arg;
+            return 1;
+        }
+    }
+    if (reps==0) { reps=1; }
+    if (workdir.empty()) {
+        workdir = infn.substr(0,infn.size()-4)+"-bench";
+    }
+    
+    
+    picojson::object result;
+    result["input"] = picojson::value(infn);
+    result["input_size"] = picojson::value(double(file_size(infn)));
+    result["label"] = picojson::value(label);
+    result["date"] = picojson::value(date_str(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()));
+    result["numchan"] = picojson::value(double(numchan));
+    result["hardware_concurrency"] = picojson::value(double(std::thread::hardware_concurrency()));
+    result["reps"] = picojson::value(double(reps));
+#ifdef __VERSION__
+    result["compiler"] = picojson::value(std::string(__VERSION__));
+#endif
+#ifdef NDEBUG
+    result["ndebug"] = picojson::value(true);
+#else
+    result["ndebug"] = picojson::value(false);
+#endif
+    
+    std::string blocksfn;
+    if (is_sorted_file(infn)) {
+        blocksfn = infn;
+    }
+    
+    if (e2e) {
+        std::experimental::filesystem::create_directories(workdir);
+        result["e2e"] = picojson::value(run_e2e(infn, workdir, numchan, targetsize, minsize, blocksfn));
+    }
+    if (micro) {
+        result["micro"] = picojson::value(run_micro(infn, blocksfn, reps));
+    }
+    
+    std::ofstream outf(outfn, std::ios::out);
+    outf << picojson::value(result).serialize(true);
+    outf.close();
+    Logger::Message() << "wrote " << outfn;
+    
+    return 0;
+}
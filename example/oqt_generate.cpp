@@ -0,0 +1,786 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+/* oqt_generate: writes a synthetic osm pbf file, laid out like a planet
+ * file (nodes, then ways, then relations, each sorted by id), for testing
+ * calcqts, sortblocks, update and geometry at scale.
+ *
+ * usage: oqt_generate out.pbf [nodes=1000000] [ways=nodes/8]
+ *            [relations=ways/50] [idstride=1] [clusters=64] [runlength=256]
+ *            [taggednodes=0.03] [arearuns=0.4] [seed=1] [blocksize=8000]
+ *            [timestamp=2019-01-01] [numchan=N]
+ *            [changes=0] [changesize=10000]
+ *
+ * Every object is a function of its index and the seed, so nothing is kept
+ * in memory between blocks, and the blocks are generated in parallel.
+ *
+ * Nodes are laid out in runs of runlength consecutive ids, as nodes added
+ * together in real data are. Each run is placed around one of the
+ * clusters, chosen with a skewed distribution so that some clusters are
+ * much denser than others. A line run is a chain of nodes, split between
+ * its ways with shared end points. An area run is a set of closed rings,
+ * in pairs of an outer ring and a smaller inner ring with the same centre:
+ * multipolygon relations are made from these pairs. Other relations are
+ * routes (the ways of a line run, with some stop nodes) and collections of
+ * earlier relations, which may themselves be collections.
+ *
+ * With idstride greater than 1, object i is given an id between
+ * i*idstride+1 and (i+1)*idstride, giving sparse ids.
+ *
+ * With changes=N, N osmChange files out-change-000.osc.gz... are also
+ * written. Each modifies nodes, ways and relations from the generated
+ * file, creates new tagged nodes, and deletes ways, with versions and
+ * timestamps increasing from one file to the next. */
+
+#include "oqt/elements/block.hpp"
+#include "oqt/elements/node.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/elements/relation.hpp"
+#include "oqt/elements/header.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
+#include "oqt/pbfformat/writeblock.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/utils/compress.hpp"
+#include "oqt/utils/date.hpp"
+#include "oqt/utils/geometry.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/multithreadedcallback.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+using namespace oqt;
+
+struct GenerateParams {
+    GenerateParams() : seed(1), nodes(1000000), ways(-1), relations(-1), idstride(1),
+        clusters(64), runlength(256), tagged_nodes(0.03), area_runs(0.4), blocksize(8000),
+        timestamp(1546300800), numchan(std::thread::hardware_concurrency()),
+        changes(0), changesize(10000) {}
+    
+    uint64 seed;
+    int64 nodes;
+    int64 ways;
+    int64 relations;
+    int64 idstride;
+    int64 clusters;
+    int64 runlength;
+    double tagged_nodes;
+    double area_runs;
+    size_t blocksize;
+    int64 timestamp;
+    size_t numchan;
+    size_t changes;
+    size_t changesize;
+};
+
+struct weighted_tag {
+    const char* key;
+    const char* val;
+    double weight;
+};
+
+const std::vector<weighted_tag> node_tags = {
+    {"highway", "crossing", 10}, {"highway", "bus_stop", 6}, {"highway", "traffic_signals", 5},
+    {"natural", "tree", 12}, {"barrier", "gate", 5}, {"power", "tower", 8},
+    {"amenity", "bench", 4}, {"amenity", "restaurant", 3}, {"amenity", "cafe", 2},
+    {"amenity", "place_of_worship", 1}, {"shop", "convenience", 2}, {"shop", "supermarket", 1},
+    {"place", "village", 0.5}, {"place", "hamlet", 1}, {"tourism", "hotel", 0.5}
+};
+
+const std::vector<weighted_tag> line_tags = {
+    {"highway", "residential", 30}, {"highway", "service", 20}, {"highway", "track", 10},
+    {"highway", "footway", 12}, {"highway", "unclassified", 6}, {"highway", "tertiary", 4},
+    {"highway", "secondary", 2}, {"highway", "primary", 1.5}, {"highway", "motorway", 0.5},
+    {"waterway", "stream", 5}, {"waterway", "river", 0.5}, {"railway", "rail", 1},
+    {"barrier", "fence", 4}, {"power", "line", 2}
+};
+
+const std::vector<weighted_tag> area_tags = {
+    {"building", "yes", 60}, {"building", "house", 15}, {"landuse", "residential", 4},
+    {"landuse", "farmland", 3}, {"landuse", "forest", 2}, {"natural", "water", 2},
+    {"natural", "wood", 2}, {"leisure", "park", 2}, {"leisure", "pitch", 1},
+    {"amenity", "parking", 3}, {"amenity", "school", 0.5}
+};
+
+const std::vector<weighted_tag> multipolygon_tags = {
+    {"building", "yes", 4}, {"landuse", "forest", 3}, {"natural", "water", 3},
+    {"landuse", "residential", 2}, {"leisure", "park", 1}, {"amenity", "university", 0.2}
+};
+
+const std::vector<const char*> route_types = {"bus", "hiking", "bicycle", "road", "tram", "foot"};
+const std::vector<const char*> collection_types = {"route_master", "site", "collection", "network"};
+
+const int64 max_lon = 1800000000;
+const int64 max_lat = 850000000;
+
+class Generator {
+    public:
+        Generator(const GenerateParams& params_) : params(params_) {
+            if (params.ways<0) { params.ways = params.nodes/8; }
+            if (params.relations<0) { params.relations = params.ways/50; }
+            if (params.idstride<1) { params.idstride=1; }
+            if (params.runlength<2) { params.runlength=2; }
+            if (params.clusters<1) { params.clusters=1; }
+            
+            numruns = (params.nodes + params.runlength-1) / params.runlength;
+            if ((params.ways>0) && (numruns==0)) {
+                throw std::domain_error("can't make ways without any nodes");
+            }
+            
+            weights_total(node_tags, node_tags_total);
+            weights_total(line_tags, line_tags_total);
+            weights_total(area_tags, area_tags_total);
+            weights_total(multipolygon_tags, multipolygon_tags_total);
+        }
+        
+        const GenerateParams& Params() const { return params; }
+        
+        size_t num_blocks(ElementType ty) const {
+            int64 n = (ty==ElementType::Node) ? params.nodes : (ty==ElementType::Way) ? params.ways : params.relations;
+            return (n + params.blocksize-1) / params.blocksize;
+        }
+        
+        PrimitiveBlockPtr make_block(int64 index, ElementType ty, int64 first, int64 last) const {
+            auto block = std::make_shared<PrimitiveBlock>(index, last-first);
+            for (int64 i=first; i < last; i++) {
+                if (ty==ElementType::Node) {
+                    block->add(make_node(i, 0, changetype::Normal));
+                } else if (ty==ElementType::Way) {
+                    block->add(make_way(i, 0, changetype::Normal));
+                } else {
+                    block->add(make_relation(i, 0, changetype::Normal));
+                }
+            }
+            return block;
+        }
+        
+        ElementPtr make_node(int64 i, size_t change, changetype ct) const {
+            auto ll = node_lonlat(i);
+            if (change>0) {
+                //move a short distance
+                ll.lon = clip(ll.lon + int64(hash(201, i, change) % 2001) - 1000, max_lon);
+                ll.lat = clip(ll.lat + int64(hash(202, i, change) % 2001) - 1000, max_lat);
+            }
+            return std::make_shared<Node>(ct, object_id(ElementType::Node, i), 0,
+                make_info(ElementType::Node, i, change), make_node_tags(i), ll.lon, ll.lat);
+        }
+        
+        ElementPtr make_created_node(int64 i, size_t change) const {
+            //new ids follow on from the last node in the file
+            int64 id = (params.nodes + 1)*params.idstride + i + 1;
+            int64 near = hash(211, i, change) % params.nodes;
+            auto ll = node_lonlat(near);
+            ll.lon = clip(ll.lon + int64(hash(212, i, change) % 20001) - 10000, max_lon);
+            ll.lat = clip(ll.lat + int64(hash(213, i, change) % 20001) - 10000, max_lat);
+            
+            std::vector<Tag> tags;
+            tags.push_back(pick_tag(node_tags, node_tags_total, hash(214, i, change)));
+            tags.push_back(Tag("name", "New "+std::to_string(i)));
+            
+            ElementInfo info = make_info(ElementType::Node, params.nodes+i, 0);
+            info.version = 1;
+            info.timestamp = change_timestamp(change, i);
+            return std::make_shared<Node>(changetype::Create, id, 0, info, tags, ll.lon, ll.lat);
+        }
+        
+        ElementPtr make_way(int64 j, size_t change, changetype ct) const {
+            
+            auto tags = make_way_tags(j);
+            if (change>0) {
+                tags.push_back(Tag("note", "change "+std::to_string(change)));
+            }
+            return std::make_shared<Way>(ct, object_id(ElementType::Way, j), 0,
+                make_info(ElementType::Way, j, change), tags, way_refs(j));
+        }
+        
+        ElementPtr make_relation(int64 k, size_t change, changetype ct) const {
+            std::vector<Tag> tags;
+            std::vector<Member> mems;
+            relation_contents(k, tags, mems);
+            if (change>0) {
+                tags.push_back(Tag("note", "change "+std::to_string(change)));
+                //drop members deleted by this or an earlier change file
+                mems.erase(std::remove_if(mems.begin(), mems.end(), [this,change](const Member& m) {
+                    if (m.type!=ElementType::Way) { return false; }
+                    size_t d = way_deleted_in((m.ref-1) / params.idstride);
+                    return (d>0) && (d<=change);
+                }), mems.end());
+            }
+            return std::make_shared<Relation>(ct, object_id(ElementType::Relation, k), 0,
+                make_info(ElementType::Relation, k, change), tags, mems);
+        }
+        
+        bool way_deletable(int64 j) const {
+            return (hash(221, j) % 16)==0;
+        }
+        
+        //! The change file which may delete way \param j, or 0 if it is never deleted
+        size_t way_deleted_in(int64 j) const {
+            if ((params.changes==0) || !way_deletable(j)) { return 0; }
+            return 1 + hash(223, j) % params.changes;
+        }
+        
+        int64 change_timestamp(size_t change, int64 i) const {
+            return params.timestamp + 3600*(change-1) + int64(hash(222, i, change) % 3600);
+        }
+        
+        ElementInfo make_info(ElementType ty, int64 i, size_t change) const {
+            uint64 salt = 100 + uint64(ty);
+            
+            //most objects have only a few versions
+            int64 version = 1 + int64(-std::log(1.0-unit(hash(salt, i, 1))) * 1.5);
+            if (version>200) { version=200; }
+            int64 ts = params.timestamp - int64(hash(salt, i, 2) % (10*365*86400ll));
+            
+            //a few users make most of the edits
+            double u = unit(hash(salt, i, 3));
+            int64 uid = 1 + int64(u*u*u*100000);
+            
+            if (change>0) {
+                version += change;
+                ts = change_timestamp(change, i);
+                uid = 1 + (hash(salt, i, 4+change) % 5000);
+            }
+            int64 changeset = (ts - 1100000000) / 30 + (uid % 30);
+            return ElementInfo(version, ts, changeset, uid, user_name(uid), true);
+        }
+        
+        std::string user_name(int64 uid) const {
+            //include some names which need escaping, or aren't ascii
+            if ((uid % 97)==0) { return "usér "+std::to_string(uid); }
+            if ((uid % 193)==0) { return "A&B <"+std::to_string(uid)+">"; }
+            if ((uid % 389)==0) { return "\xe4\xb8\xad\xe6\x96\x87"+std::to_string(uid); }
+            return "user"+std::to_string(uid);
+        }
+        
+        int64 object_id(ElementType ty, int64 i) const {
+            if (params.idstride==1) { return i+1; }
+            return i*params.idstride + 1 + int64(hash(10+uint64(ty), i) % params.idstride);
+        }
+        
+        std::vector<Tag> make_node_tags(int64 i) const {
+            std::vector<Tag> tags;
+            if (unit(hash(20, i)) >= params.tagged_nodes) {
+                return tags;
+            }
+            tags.push_back(pick_tag(node_tags, node_tags_total, hash(21, i)));
+            if ((hash(22, i) % 3)==0) {
+                tags.push_back(Tag("name", "Node "+std::to_string(i)));
+            }
+            return tags;
+        }
+        
+        std::vector<Tag> make_way_tags(int64 j) const {
+            std::vector<Tag> tags;
+            int64 r = way_run(j);
+            int64 m = j - way_first(r);
+            int64 ng = num_groups(r);
+            if (ng>0) {
+                if (((m % ng) % 2)==1) {
+                    //inner rings are left untagged, for the multipolygons
+                    return tags;
+                }
+                auto t = pick_tag(area_tags, area_tags_total, hash(30, j));
+                tags.push_back(t);
+                if ((t.key.str()=="building") && ((hash(31, j) % 4)==0)) {
+                    tags.push_back(Tag("addr:housenumber", std::to_string(1 + hash(32, j) % 200)));
+                }
+            } else {
+                auto t = pick_tag(line_tags, line_tags_total, hash(33, j));
+                tags.push_back(t);
+                if ((t.key.str()=="highway") && ((hash(34, j) % 2)==0)) {
+                    tags.push_back(Tag("name", "Street "+std::to_string(r)));
+                }
+                if ((hash(35, j) % 5)==0) {
+                    tags.push_back(Tag("surface", (hash(36,j)%2) ? "asphalt" : "unpaved"));
+                }
+            }
+            return tags;
+        }
+        
+        std::vector<int64> way_refs(int64 j) const {
+            int64 r = way_run(j);
+            int64 m = j - way_first(r);
+            int64 first_node = r*params.runlength;
+            int64 len = run_length(r);
+            
+            std::vector<int64> refs;
+            int64 ng = num_groups(r);
+            if (ng>0) {
+                int64 gs = group_size(r);
+                int64 g = m % ng;
+                for (int64 v=0; v < gs; v++) {
+                    refs.push_back(object_id(ElementType::Node, first_node + g*gs + v));
+                }
+                refs.push_back(refs.front());
+                return refs;
+            }
+            
+            int64 nw = way_first(r+1) - way_first(r);
+            int64 a = m*(len-1) / nw;
+            int64 b = (m+1)*(len-1) / nw;
+            if (b <= a) { b = std::min(a+1, len-1); }
+            for (int64 k=a; k <= b; k++) {
+                refs.push_back(object_id(ElementType::Node, first_node + k));
+            }
+            return refs;
+        }
+        
+        void relation_contents(int64 k, std::vector<Tag>& tags, std::vector<Member>& mems) const {
+            double u = unit(hash(40, k));
+            if ((u < 0.6) && add_multipolygon(k, tags, mems)) {
+                return;
+            }
+            if ((u >= 0.85) && (k >= 2)) {
+                add_collection(k, tags, mems);
+                return;
+            }
+            add_route(k, tags, mems);
+        }
+        
+        uint64 hash(uint64 salt, uint64 a, uint64 b=0) const {
+            return mix(mix(mix(params.seed ^ (salt << 48)) ^ a) ^ b);
+        }
+        
+        static double unit(uint64 h) {
+            return (h >> 11) * (1.0/9007199254740992.0);
+        }
+        
+    private:
+        GenerateParams params;
+        int64 numruns;
+        double node_tags_total, line_tags_total, area_tags_total, multipolygon_tags_total;
+        
+        static uint64 mix(uint64 x) {
+            //splitmix64 finaliser
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+        
+        static int64 clip(int64 v, int64 mx) {
+            return std::max(-mx, std::min(mx, v));
+        }
+        
+        static void weights_total(const std::vector<weighted_tag>& tt, double& total) {
+            total=0;
+            for (auto& t: tt) { total += t.weight; }
+        }
+        
+        static Tag pick_tag(const std::vector<weighted_tag>& tt, double total, uint64 h) {
+            double w = unit(h)*total;
+            for (auto& t: tt) {
+                if (w < t.weight) { return Tag(t.key, t.val); }
+                w -= t.weight;
+            }
+            return Tag(tt.back().key, tt.back().val);
+        }
+        
+        int64 run_length(int64 r) const {
+            return std::min(params.runlength, params.nodes - r*params.runlength);
+        }
+        
+        bool is_area_run(int64 r) const {
+            return unit(hash(50, r)) < params.area_runs;
+        }
+        
+        int64 group_size(int64 r) const {
+            return 4 + int64(hash(51, r) % 9);
+        }
+        
+        //! number of complete rings in run r, or 0 for a line run
+        int64 num_groups(int64 r) const {
+            if (!is_area_run(r)) { return 0; }
+            return run_length(r) / group_size(r);
+        }
+        
+        //! first way in run r: ways are spread evenly over the runs
+        int64 way_first(int64 r) const {
+            return (r*params.ways + numruns-1) / numruns;
+        }
+        
+        int64 way_run(int64 j) const {
+            return (j*numruns) / params.ways;
+        }
+        
+        LonLat cluster_centre(int64 c) const {
+            return LonLat{int64(hash(60, c) % (2*1700000000ll)) - 1700000000ll,
+                          int64(hash(61, c) % 1300000000ll) - 600000000ll};
+        }
+        
+        LonLat run_origin(int64 r) const {
+            double u = unit(hash(62, r));
+            int64 c = int64(u*u*params.clusters);
+            
+            //between about 0.1 and 3 degrees across
+            double sigma = 1000000 + unit(hash(63, c))*30000000;
+            
+            //box-muller
+            double u1 = 1.0 - unit(hash(64, r));
+            double u2 = unit(hash(65, r));
+            double rad = std::sqrt(-2*std::log(u1)) * sigma;
+            auto cc = cluster_centre(c);
+            return LonLat{clip(cc.lon + int64(rad*std::cos(2*M_PI*u2)), max_lon),
+                          clip(cc.lat + int64(rad*std::sin(2*M_PI*u2)), max_lat)};
+        }
+        
+        LonLat node_lonlat(int64 i) const {
+            int64 r = i / params.runlength;
+            int64 k = i % params.runlength;
+            auto origin = run_origin(r);
+            
+            int64 ng = num_groups(r);
+            if ((ng>0) && (k < ng*group_size(r))) {
+                int64 gs = group_size(r);
+                int64 g = k / gs;
+                int64 v = k % gs;
+                int64 q = g / 2;
+                
+                //outer and inner rings share a centre, about 50m across
+                double radius = 2500 + unit(hash(70, r, q))*5000;
+                if ((g % 2)==1) { radius /= 3; }
+                double angle = 2*M_PI*(double(v)/gs + unit(hash(71, r, q)));
+                return LonLat{clip(origin.lon + (q%8)*25000 + int64(radius*std::cos(angle)), max_lon),
+                              clip(origin.lat + (q/8)*25000 + int64(radius*std::sin(angle)), max_lat)};
+            }
+            
+            //a roughly straight line, with steps of around 50m
+            double dir = 2*M_PI*unit(hash(72, r));
+            double step = 3000 + unit(hash(73, r))*5000;
+            int64 jitter = int64(hash(74, i) % 401) - 200;
+            return LonLat{clip(origin.lon + int64(k*step*std::cos(dir)) + jitter, max_lon),
+                          clip(origin.lat + int64(k*step*std::sin(dir)) - jitter, max_lat)};
+        }
+        
+        bool add_multipolygon(int64 k, std::vector<Tag>& tags, std::vector<Member>& mems) const {
+            if (params.ways==0) { return false; }
+            int64 r0 = way_run(hash(80, k) % params.ways);
+            for (int64 t=0; t < 64; t++) {
+                int64 r = (r0+t) % numruns;
+                int64 nw = way_first(r+1) - way_first(r);
+                int64 ng = num_groups(r);
+                if ((ng<2) || (nw<2)) {
+                    continue;
+                }
+                int64 j = way_first(r);
+                mems.push_back(Member(ElementType::Way, object_id(ElementType::Way, j), "outer"));
+                mems.push_back(Member(ElementType::Way, object_id(ElementType::Way, j+1), "inner"));
+                if ((ng>=4) && (nw>=4) && ((hash(81, k) % 3)==0)) {
+                    mems.push_back(Member(ElementType::Way, object_id(ElementType::Way, j+2), "outer"));
+                    mems.push_back(Member(ElementType::Way, object_id(ElementType::Way, j+3), "inner"));
+                }
+                tags.push_back(Tag("type", "multipolygon"));
+                tags.push_back(pick_tag(multipolygon_tags, multipolygon_tags_total, hash(82, k)));
+                return true;
+            }
+            return false;
+        }
+        
+        void add_route(int64 k, std::vector<Tag>& tags, std::vector<Member>& mems) const {
+            tags.push_back(Tag("type", "route"));
+            tags.push_back(Tag("route", route_types[hash(90, k) % route_types.size()]));
+            tags.push_back(Tag("ref", std::to_string(1 + hash(91, k) % 999)));
+            if (params.ways==0) {
+                return;
+            }
+            
+            int64 r = way_run(hash(92, k) % params.ways);
+            int64 first_node = r*params.runlength;
+            int64 len = run_length(r);
+            for (int64 s=0; s < 3; s++) {
+                mems.push_back(Member(ElementType::Node, object_id(ElementType::Node, first_node + hash(93, k, s) % len), "stop"));
+            }
+            for (int64 j=way_first(r); (j < way_first(r+1)) && (j < way_first(r)+50); j++) {
+                mems.push_back(Member(ElementType::Way, object_id(ElementType::Way, j), ""));
+            }
+        }
+        
+        void add_collection(int64 k, std::vector<Tag>& tags, std::vector<Member>& mems) const {
+            tags.push_back(Tag("type", collection_types[hash(100, k) % collection_types.size()]));
+            tags.push_back(Tag("name", "Collection "+std::to_string(k)));
+            
+            //members are earlier relations, which may also be collections
+            int64 n = 2 + hash(101, k) % 5;
+            int64 last=-1;
+            for (int64 s=0; s < n; s++) {
+                int64 back = 1 + hash(102, k, s) % 32;
+                if (back > k) { back = k; }
+                int64 m = k - back;
+                if (m==last) { continue; }
+                last=m;
+                mems.push_back(Member(ElementType::Relation, object_id(ElementType::Relation, m), ((s%2)==0) ? "" : "subarea"));
+            }
+        }
+};
+
+
+void write_blocks(const Generator& gen, const std::string& outfn) {
+    auto& params = gen.Params();
+    
+    auto head = std::make_shared<Header>();
+    head->SetBBox(bbox(-max_lon, -max_lat, max_lon, max_lat));
+    head->SetWriter("oqt_generate");
+    
+    size_t numchan = std::max<size_t>(params.numchan, 1);
+    auto writers = multi_threaded_callback<keystring>::make(make_pbffilewriter_callback(outfn, head), numchan, "write blocks");
+    
+    std::vector<std::pair<ElementType, size_t>> types{
+        {ElementType::Node, gen.num_blocks(ElementType::Node)},
+        {ElementType::Way, gen.num_blocks(ElementType::Way)},
+        {ElementType::Relation, gen.num_blocks(ElementType::Relation)}};
+    size_t total = types[0].second + types[1].second + types[2].second;
+    
+    Logger::Message() << "writing " << params.nodes << " nodes, " << params.ways << " ways, "
+        << params.relations << " relations in " << total << " blocks to " << outfn;
+    
+    auto make_blocks = [&gen, &params, &types, total, numchan, &writers](size_t t) {
+        for (size_t b=t; b < total; b+=numchan) {
+            size_t tb = b;
+            ElementType ty = ElementType::Node;
+            int64 count = params.nodes;
+            if (tb >= types[0].second) {
+                tb -= types[0].second;
+                ty = ElementType::Way;
+                count = params.ways;
+                if (tb >= types[1].second) {
+                    tb -= types[1].second;
+                    ty = ElementType::Relation;
+                    count = params.relations;
+                }
+            }
+            int64 first = tb*params.blocksize;
+            int64 last = std::min<int64>(first+params.blocksize, count);
+            
+            auto block = gen.make_block(b, ty, first, last);
+            auto packed = pack_primitive_block(block, false, false, true, true);
+            writers[t](std::make_shared<keystring>(0, prepare_file_block("OSMData", packed)));
+            
+            if ((t==0) && ((b/numchan) % 100)==0) {
+                Logger::Progress(100.0*b/total) << "generated " << b << " of " << total << " blocks";
+            }
+        }
+        writers[t](nullptr);
+    };
+    
+    std::vector<std::future<void>> futs;
+    for (size_t t=0; t < numchan; t++) {
+        futs.push_back(std::async(std::launch::async, make_blocks, t));
+    }
+    for (auto& f: futs) {
+        f.get();
+    }
+    Logger::Get().time("write blocks");
+}
+
+void write_xml_escaped(std::ostream& out, const std::string& str) {
+    for (auto c: str) {
+        switch (c) {
+            case '&': out << "&amp;"; break;
+            case '<': out << "&lt;"; break;
+            case '>': out << "&gt;"; break;
+            case '"': out << "&quot;"; break;
+            case '\'': out << "&apos;"; break;
+            default: out << c;
+        }
+    }
+}
+
+void write_xml_coord(std::ostream& out, int64 v) {
+    if (v<0) { out << "-"; v=-v; }
+    out << (v / 10000000) << ".";
+    std::string frac = std::to_string(v % 10000000);
+    out << std::string(7-frac.size(), '0') << frac;
+}
+
+void write_xml_element(std::ostream& out, ElementPtr ele) {
+    const char* name = (ele->Type()==ElementType::Node) ? "node" : (ele->Type()==ElementType::Way) ? "way" : "relation";
+    auto& info = ele->Info();
+    out << "  <" << name << " id=\"" << ele->Id() << "\" version=\"" << info.version
+        << "\" timestamp=\"" << date_str(info.timestamp) << "Z\" uid=\"" << info.user_id << "\" user=\"";
+    write_xml_escaped(out, info.user);
+    out << "\" changeset=\"" << info.changeset << "\"";
+    if (ele->Type()==ElementType::Node) {
+        auto nd = std::dynamic_pointer_cast<Node>(ele);
+        out << " lat=\""; write_xml_coord(out, nd->Lat());
+        out << "\" lon=\""; write_xml_coord(out, nd->Lon());
+        out << "\"";
+    }
+    out << ">\n";
+    if (ele->Type()==ElementType::Way) {
+        for (auto& r: std::dynamic_pointer_cast<Way>(ele)->Refs()) {
+            out << "   <nd ref=\"" << r << "\"/>\n";
+        }
+    } else if (ele->Type()==ElementType::Relation) {
+        for (auto& m: std::dynamic_pointer_cast<Relation>(ele)->Members()) {
+            out << "   <member type=\"" << ((m.type==ElementType::Node) ? "node" : (m.type==ElementType::Way) ? "way" : "relation")
+                << "\" ref=\"" << m.ref << "\" role=\"";
+            write_xml_escaped(out, m.role);
+            out << "\"/>\n";
+        }
+    }
+    for (auto& t: ele->Tags()) {
+        out << "   <tag k=\"";
+        write_xml_escaped(out, t.key.str());
+        out << "\" v=\"";
+        write_xml_escaped(out, t.val);
+        out << "\"/>\n";
+    }
+    out << "  </" << name << ">\n";
+}
+
+std::string make_change_file(const Generator& gen, size_t change) {
+    auto& params = gen.Params();
+    std::vector<ElementPtr> created, modified, deleted;
+    std::set<int64> deleted_ways;
+    
+    for (size_t q=0; q < params.changesize; q++) {
+        double u = gen.unit(gen.hash(230, q, change));
+        uint64 pick = gen.hash(231, q, change);
+        
+        if ((u < 0.6) && (params.nodes>0)) {
+            modified.push_back(gen.make_node(pick % params.nodes, change, changetype::Modify));
+        } else if (u < 0.75) {
+            created.push_back(gen.make_created_node((change-1)*params.changesize + q, change));
+        } else if ((u < 0.92) && (params.ways>0)) {
+            int64 j = pick % params.ways;
+            if (gen.way_deletable(j)) { j = (j+1) % params.ways; }
+            if (!gen.way_deletable(j)) {
+                modified.push_back(gen.make_way(j, change, changetype::Modify));
+            }
+        } else if ((u < 0.97) && (params.ways>0)) {
+            //only ways chosen by way_deletable are deleted, so they are never
+            //modified, and each only in the change file given by way_deleted_in
+            int64 j = pick % params.ways;
+            for (size_t n=0; (n < 64*params.changes) && (gen.way_deleted_in(j)!=change); n++) {
+                j = (j+1) % params.ways;
+            }
+            if ((gen.way_deleted_in(j)==change) && deleted_ways.insert(j).second) {
+                deleted.push_back(gen.make_way(j, change, changetype::Delete));
+            }
+        } else if (params.relations>0) {
+            modified.push_back(gen.make_relation(pick % params.relations, change, changetype::Modify));
+        }
+    }
+    
+    std::stringstream out;
+    out << "<?xml version='1.0' encoding='UTF-8'?>\n";
+    out << "<osmChange version=\"0.6\" generator=\"oqt_generate\">\n";
+    for (auto& sect: std::vector<std::pair<const char*, std::vector<ElementPtr>*>>{{"create", &created}, {"modify", &modified}, {"delete", &deleted}}) {
+        if (sect.second->empty()) { continue; }
+        out << " <" << sect.first << ">\n";
+        for (auto& e: *sect.second) {
+            write_xml_element(out, e);
+        }
+        out << " </" << sect.first << ">\n";
+    }
+    out << "</osmChange>\n";
+    return out.str();
+}
+
+void write_change_files(const Generator& gen, const std::string& outfn) {
+    auto& params = gen.Params();
+    std::string prefix = outfn.substr(0, outfn.size()-4);
+    for (size_t c=1; c <= params.changes; c++) {
+        std::string num = std::to_string(c-1);
+        std::string fn = prefix + "-change-" + std::string(num.size()<3 ? 3-num.size() : 0, '0') + num + ".osc.gz";
+        
+        auto data = make_change_file(gen, c);
+        std::ofstream outf(fn, std::ios::out | std::ios::binary);
+        outf << compress_gzip(fn.substr(0, fn.size()-3), data);
+        outf.close();
+        Logger::Message() << "wrote " << fn << " [" << data.size() << " bytes uncompressed]";
+    }
+    if (params.changes>0) {
+        Logger::Get().time("write change files");
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc<2) {
+        std::cout << "usage: oqt_generate out.pbf [nodes=1000000] [ways=nodes/8] [relations=ways/50] [idstride=1] "
+            << "[clusters=64] [runlength=256] [taggednodes=0.03] [arearuns=0.4] [seed=1] [blocksize=8000] "
+            << "[timestamp=2019-01-01] [numchan=N] [changes=0] [changesize=10000]\n";
+        return 1;
+    }
+    
+    std::string outfn = argv[1];
+    GenerateParams params;
+    
+    for (int i=2; i < argc; i++) {
+        std::string arg(argv[i]);
+
+        std::string key = arg;
+        std::string val = "";
+        auto eqp = arg.find("=");
+        if (eqp < std::string::npos) {
+            key=arg.substr(0,eqp+1);
+            val=arg.substr(eqp+1,arg.size());
+        }
+        
+        if (key=="nodes=") {
+            params.nodes = std::stoll(val);
+        } else if (key=="ways=") {
+            params.ways = std::stoll(val);
+        } else if (key=="relations=") {
+            params.relations = std::stoll(val);
+        } else if (key=="idstride=") {
+            params.idstride = std::stoll(val);
+        } else if (key=="clusters=") {
+            params.clusters = std::stoll(val);
+        } else if (key=="runlength=") {
+            params.runlength = std::stoll(val);
+        } else if (key=="taggednodes=") {
+            params.tagged_nodes = std::stod(val);
+        } else if (key=="arearuns=") {
+            params.area_runs = std::stod(val);
+        } else if (key=="seed=") {
+            params.seed = std::stoull(val);
+        } else if (key=="blocksize=") {
+            params.blocksize = std::stoull(val);
+        } else if (key=="timestamp=") {
+            params.timestamp = read_date(val);
+        } else if (key=="numchan=") {
+            params.numchan = std::stoull(val);
+        } else if (key=="changes=") {
+            params.changes = std::stoull(val);
+        } else if (key=="changesize=") {
+            params.changesize = std::stoull(val);
+        } else {
+            Logger::Message() << "unrecognised argument " << arg;
+            return 1;
+        }
+    }
+    if (params.blocksize==0) { params.blocksize=8000; }
+    
+    Generator gen(params);
+    write_blocks(gen, outfn);
+    write_change_files(gen, outfn);
+    Logger::Get().timing_messages();
+    return 0;
+}
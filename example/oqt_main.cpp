@@ -32,12 +32,24 @@
 #include "oqt/calcqts/calcqtsinmem.hpp"
 #include <fstream>
 #include "oqt/update/applychange.hpp"
+#include "oqt/update/compactchanges.hpp"
+#include "oqt/update/updateqts.hpp"
+#include "oqt/update/xmlchange.hpp"
+#include "oqt/elements/node.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/elements/relation.hpp"
+#include "gzstream.hpp"
+#include <experimental/filesystem>
 #include "oqt/sorting/mergechanges.hpp"
 #include "oqt/sorting/sortblocks.hpp"
 
 #include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/idtileindex.hpp"
 #include "oqt/utils/logger.hpp"
+#include "oqt/utils/telemetry.hpp"
 #include "oqt/utils/date.hpp"
+#include "oqt/utils/operatingsystem.hpp"
+#include "oqt/utils/string.hpp"
 
 
 using namespace oqt;
@@ -180,6 +192,82 @@ ReadBlockFlags read_flags(size_t ii) {
     return ans;
 }
 
+//! Compare the serial xmlinspector reader with read_xml_change_files_parallel
+//! over all osc and osc.gz files in directory \param dir.
+void bench_read_changes(const std::string& dir, size_t numchan) {
+    namespace fs = std::experimental::filesystem;
+    std::vector<std::string> fns;
+    for (const auto& p: fs::directory_iterator(dir)) {
+        auto fn = p.path().string();
+        if (ends_with(fn, ".osc.gz") || ends_with(fn, ".osc")) {
+            fns.push_back(fn);
+        }
+    }
+    std::sort(fns.begin(), fns.end());
+    if (fns.empty()) {
+        throw std::domain_error("no osc files in "+dir);
+    }
+    int64 tot_size=0;
+    for (const auto& fn: fns) { tot_size += file_size(fn); }
+    Logger::Message() << "reading " << fns.size() << " files, " << tot_size << " bytes";
+    Logger::Get().time("list files");
+
+    auto em = std::make_shared<typeid_element_map>();
+    for (const auto& fn: fns) {
+        if (ends_with(fn, ".gz")) {
+            gzstream::igzstream src_fl(fn.c_str());
+            read_xml_change_file_em(&src_fl, em, true);
+        } else {
+            std::ifstream src_fl(fn, std::ios::in);
+            read_xml_change_file_em(&src_fl, em, true);
+        }
+    }
+    Logger::Get().time("read_xml_change_file_em");
+
+    auto objs = read_xml_change_files_parallel(fns, numchan, true);
+    Logger::Get().time("read_xml_change_files_parallel");
+
+    size_t diffs=0;
+    if (objs.size()!=em->size()) {
+        diffs = std::max(objs.size(), em->size()) - std::min(objs.size(), em->size());
+    }
+    auto it = em->begin();
+    for (size_t i=0; (i < objs.size()) && (it!=em->end()); i++, ++it) {
+        const auto& o = objs[i];
+        const auto& e = it->second;
+        if ((o->InternalId()!=e->InternalId()) || (o->ChangeType()!=e->ChangeType())
+            || (o->Info().version!=e->Info().version) || (o->Info().timestamp!=e->Info().timestamp)
+            || (o->Info().user!=e->Info().user) || (o->Tags().size()!=e->Tags().size())) {
+            diffs++;
+            continue;
+        }
+        for (size_t j=0; j < o->Tags().size(); j++) {
+            if ((o->Tags()[j].key!=e->Tags()[j].key) || (o->Tags()[j].val!=e->Tags()[j].val)) {
+                diffs++;
+                break;
+            }
+        }
+        if (o->Type()==ElementType::Node) {
+            auto on = std::dynamic_pointer_cast<Node>(o);
+            auto en = std::dynamic_pointer_cast<Node>(e);
+            if ((on->Lon()!=en->Lon()) || (on->Lat()!=en->Lat())) { diffs++; }
+        } else if (o->Type()==ElementType::Way) {
+            if (std::dynamic_pointer_cast<Way>(o)->Refs()!=std::dynamic_pointer_cast<Way>(e)->Refs()) { diffs++; }
+        } else if (o->Type()==ElementType::Relation) {
+            const auto& om = std::dynamic_pointer_cast<Relation>(o)->Members();
+            const auto& emm = std::dynamic_pointer_cast<Relation>(e)->Members();
+            if (om.size()!=emm.size()) { diffs++; continue; }
+            for (size_t j=0; j < om.size(); j++) {
+                if ((om[j].type!=emm[j].type) || (om[j].ref!=emm[j].ref) || (om[j].role!=emm[j].role)) {
+                    diffs++;
+                    break;
+                }
+            }
+        }
+    }
+    Logger::Message() << em->size() << " objects, " << diffs << " differences";
+}
+
 int main(int argc, char** argv) {
     
     Logger::Set(std::make_shared<Logger_stdout>());
@@ -225,6 +313,9 @@ int main(int argc, char** argv) {
     bool use_48bit_quadtrees=true;
     bool fixstrs=false;
     bool seperate_filelocs=true;
+    bool idtileindex=false;
+    std::string telemetryfn;
+    std::string tracefn;
     //bool usefindgroupscopy=false;
     if (argc>3) {
         for (int i=3; i < argc; i++) {
@@ -309,8 +400,14 @@ int main(int argc, char** argv) {
                 Logger::Message() << "use_48bit_quadtrees=false";
             } else if (key=="fixstrs") {
                 fixstrs=true;
+            } else if (key=="idtileindex") {
+                idtileindex=true;
             } else if (key=="notseperatefilelocs") {
                 seperate_filelocs=false;
+            } else if (key=="telemetry=") {
+                telemetryfn = val;
+            } else if (key=="trace=") {
+                tracefn = val;
             } else {
                Logger::Message() << "unrecongisned argument " << arg;
                return 1;
@@ -328,6 +425,10 @@ int main(int argc, char** argv) {
 
     //auto lg = make_default_logger();
 
+    if (!telemetryfn.empty() || !tracefn.empty()) {
+        Telemetry::Get().enable(!tracefn.empty());
+    }
+    
     int resp=0;
     if (operation == "count") {
         
@@ -376,7 +477,7 @@ int main(int argc, char** argv) {
                 if (max_depth>15) { throw std::domain_error("use_tree with too large a max_depth??"); }
                 groups=tree;
             } else {
-                groups = find_groups_copy(tree,targetsize,minsize);
+                groups = find_groups_copy(tree,targetsize,minsize,numchan);
                 Logger::Message() << "find groups";
                 Logger::Get().time("find groups");
                 tree.reset();
@@ -387,11 +488,16 @@ int main(int argc, char** argv) {
         
         checkstats();
         if (inmem) {
-            resp = run_sortblocks_inmem(origfn,qtsfn,outfn,timestamp, numchan, groups, fixstrs);
+            //the weights of a tree from find_groups_copy match the objects in each tile
+            resp = run_sortblocks_inmem(origfn,qtsfn,outfn,timestamp, numchan, groups, fixstrs, !use_tree);
         } else {
             
             resp = run_sortblocks(origfn,qtsfn,outfn,timestamp,  numchan, groups, tempfn, grptiles, fixstrs, seperate_filelocs);
         }
+        if (idtileindex) {
+            write_idtile_index(outfn, numchan, "");
+            Logger::Get().time("write idtile index");
+        }
         Logger::Get().timing_messages();
 
     } else if (operation=="mergechanges") {
@@ -413,6 +519,23 @@ int main(int argc, char** argv) {
         }
         run_applychange(origfn, outfn, numchan, changes);
         Logger::Get().timing_messages();
+    } else if (operation=="compactchanges") {
+        if (outfn.empty()) {
+            outfn = origfn.substr(0,origfn.size()-5)+std::string("-compacted.pbfc");
+        }
+        std::vector<std::string> fls{origfn};
+        fls.insert(fls.end(), changes.begin(), changes.end());
+        merge_change_files("", fls, outfn, numchan);
+        Logger::Get().timing_messages();
+    } else if (operation=="updateqts") {
+        if (outfn.empty()) {
+            outfn = qtsfn.substr(0,qtsfn.size()-4)+std::string("-updated.pbf");
+        }
+        run_update_qts(origfn, qtsfn, changes, outfn, numchan, buffer, (max_depth==0 ? 17 : max_depth));
+        Logger::Get().timing_messages();
+    } else if (operation=="benchreadchanges") {
+        bench_read_changes(origfn, numchan);
+        Logger::Get().timing_messages();
     } else if (operation=="readfile") {
         
         std::ifstream file(origfn, std::ios::binary | std::ios::in);
@@ -432,6 +555,13 @@ int main(int argc, char** argv) {
         Logger::Message() << "uncompressed size: " << tl;
     }
     
+    if (!telemetryfn.empty()) {
+        Telemetry::Get().write_report(telemetryfn);
+    }
+    if (!tracefn.empty()) {
+        Telemetry::Get().write_trace(tracefn);
+    }
+    
             
         
         
@@ -40,7 +40,10 @@ class BaseGeometry : public Element {
         virtual ElementType OriginalType() const=0;
         virtual bbox Bounds() const=0;
 
-        virtual std::string Wkb(bool transform, bool srid) const=0;
+        /*! Well known binary representation. If \param zoom is not -1,
+         * only the vertices needed at that zoom level are included (see
+         * oqt/geometry/simplify.hpp) */
+        virtual std::string Wkb(bool transform, bool srid, int64 zoom=-1) const=0;
 
         virtual std::optional<int64> MinZoom() const { return minzoom; }
         void SetMinZoom(int64 mz) { minzoom = mz; }
@@ -63,7 +66,7 @@ class GeometryPacked : public BaseGeometry {
         
         virtual ElementType OriginalType() const;
         virtual bbox Bounds() const;
-        virtual std::string Wkb(bool transform, bool srid) const;
+        virtual std::string Wkb(bool transform, bool srid, int64 zoom=-1) const;
         virtual std::list<PbfTag> pack_extras() const;
         
         virtual ElementPtr copy();
@@ -0,0 +1,140 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef ELEMENTS_SYMBOL_HPP
+#define ELEMENTS_SYMBOL_HPP
+
+#include "oqt/common.hpp"
+#include <string>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include <optional>
+
+namespace oqt {
+
+/*! An interned string. Tag keys are drawn from a small set of values
+ * repeated many times, so each distinct string is stored once in a
+ * process-wide symbol table and a Symbol is just a pointer to its entry.
+ * Entries are never removed, so the table should not be used for high
+ * cardinality strings such as tag values, member roles or user names.
+ *
+ * A Symbol converts implicitly to and from std::string, so it can be used
+ * in place of the std::string members it replaces. Two symbols are equal
+ * only if they refer to the same entry, so comparing them is a pointer
+ * comparison. */
+class Symbol {
+    public:
+        struct Entry {
+            std::string str;
+            uint32_t id;
+        };
+        
+        Symbol();
+        Symbol(const std::string& s);
+        Symbol(const char* s);
+        
+        const std::string& str() const { return entry->str; }
+        operator const std::string&() const { return entry->str; }
+        
+        //! the position of this symbol in the symbol table: the empty string is 0
+        uint32_t id() const { return entry->id; }
+        
+        size_t size() const { return entry->str.size(); }
+        bool empty() const { return entry->str.empty(); }
+        const char* c_str() const { return entry->str.c_str(); }
+        char operator[](size_t i) const { return entry->str[i]; }
+        
+        template <class... Args>
+        size_t find(Args&&... args) const { return entry->str.find(std::forward<Args>(args)...); }
+        
+        template <class... Args>
+        std::string substr(Args&&... args) const { return entry->str.substr(std::forward<Args>(args)...); }
+        
+        bool operator==(const Symbol& other) const { return entry==other.entry; }
+        bool operator!=(const Symbol& other) const { return entry!=other.entry; }
+        bool operator<(const Symbol& other) const { return entry->str < other.entry->str; }
+        
+    private:
+        const Entry* entry;
+};
+
+inline bool operator==(const Symbol& l, const std::string& r) { return l.str()==r; }
+inline bool operator==(const std::string& l, const Symbol& r) { return l==r.str(); }
+inline bool operator==(const Symbol& l, const char* r) { return l.str()==r; }
+inline bool operator==(const char* l, const Symbol& r) { return r.str()==l; }
+inline bool operator!=(const Symbol& l, const std::string& r) { return l.str()!=r; }
+inline bool operator!=(const std::string& l, const Symbol& r) { return l!=r.str(); }
+inline bool operator!=(const Symbol& l, const char* r) { return l.str()!=r; }
+inline bool operator!=(const char* l, const Symbol& r) { return r.str()!=l; }
+inline bool operator<(const Symbol& l, const std::string& r) { return l.str()<r; }
+inline bool operator<(const std::string& l, const Symbol& r) { return l<r.str(); }
+
+inline std::string operator+(const Symbol& l, const std::string& r) { return l.str()+r; }
+inline std::string operator+(const std::string& l, const Symbol& r) { return l+r.str(); }
+inline std::string operator+(const Symbol& l, const char* r) { return l.str()+r; }
+inline std::string operator+(const char* l, const Symbol& r) { return l+r.str(); }
+
+inline std::ostream& operator<<(std::ostream& os, const Symbol& s) { return os << s.str(); }
+
+//! number of distinct symbols interned so far
+size_t symbol_table_size();
+
+/*! Interns the entries of a block string table as they are first used, so
+ * that each tag key in a block is only looked up in the symbol table
+ * once. Other strings are returned as they are with string(). If \param cache is false each call interns the
+ * string directly: use this when only a few entries will be needed. */
+class SymbolCache {
+    public:
+        explicit SymbolCache(const std::vector<std::string>& strings_, bool cache=true) : strings(strings_) {
+            if (cache) {
+                symbols.resize(strings.size());
+            }
+        }
+        
+        Symbol symbol(uint64 idx) {
+            if (symbols.empty()) {
+                return Symbol(strings.at(idx));
+            }
+            auto& sym = symbols.at(idx);
+            if (!sym) {
+                sym = Symbol(strings[idx]);
+            }
+            return *sym;
+        }
+        
+        const std::string& string(uint64 idx) const { return strings.at(idx); }
+        const std::vector<std::string>& string_table() const { return strings; }
+        
+    private:
+        const std::vector<std::string>& strings;
+        std::vector<std::optional<Symbol>> symbols;
+};
+}
+
+namespace std {
+template<> struct hash<oqt::Symbol> {
+    size_t operator()(const oqt::Symbol& s) const { return std::hash<const void*>()(s.c_str()); }
+};
+}
+
+#endif
@@ -23,13 +23,16 @@
 #ifndef ELEMENTS_TAG_HPP
 #define ELEMENTS_TAG_HPP
 
+#include "oqt/elements/symbol.hpp"
 #include <string>
 #include <vector>
 namespace oqt {
+//! tag keys are interned (see symbol.hpp): values are stored directly
 struct Tag {
-    Tag() : key(""), val("") {}
-    Tag(std::string k, std::string v) : key(k), val(v) {}
-    std::string key,val;
+    Tag() : key(), val("") {}
+    Tag(const Symbol& k, std::string v) : key(k), val(std::move(v)) {}
+    Symbol key;
+    std::string val;
 };
 typedef std::vector<Tag> tagvector;
 }
@@ -38,6 +38,8 @@ class LonLatStore {
     public:
         virtual void add_tile(PrimitiveBlockPtr block)=0;
         virtual std::vector<LonLat> get_lonlats(std::shared_ptr<Way> way)=0;
+        //! Locations for each way in \param block, in order
+        virtual std::vector<std::vector<LonLat>> get_lonlats_block(PrimitiveBlockPtr block)=0;
         virtual void finish()=0;
         virtual ~LonLatStore() {}
 };
@@ -50,6 +52,11 @@ typedef std::function<void(PrimitiveBlockPtr)> block_callback;
 block_callback make_addwaynodes_cb(block_callback cb);
 block_callback make_waynodes_cb_split(block_callback cb);
 
+/*! As make_addwaynodes_cb, but the ways in each block are resolved by
+ * \param numchan worker threads, each given the chain of ancestor tiles
+ * for its block. Blocks are passed to \param cb in order. */
+block_callback make_addwaynodes_cb_parallel(block_callback cb, size_t numchan);
+
 }}
 
 #endif //ADDWAYNODES_HPP
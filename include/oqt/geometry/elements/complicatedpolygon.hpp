@@ -68,7 +68,13 @@ class ComplicatedPolygon : public BaseGeometry {
         virtual std::list<PbfTag> pack_extras() const;
         virtual bbox Bounds() const;
         
-        virtual std::string Wkb(bool transform, bool srid) const;
+        virtual std::string Wkb(bool transform, bool srid, int64 zoom=-1) const;
+        
+        //! set the vertex zooms of each ring part
+        void CalcVertexZooms();
+        
+        //! the parts with only the vertices needed at \param zoom. Rings left with fewer than four points are dropped
+        std::vector<PolygonPart> SimplifiedParts(int64 zoom) const;
         
     private:
         
@@ -88,6 +94,7 @@ class ComplicatedPolygon : public BaseGeometry {
 };
 
 std::string polygon_part_wkb(const PolygonPart& part, bool transform, bool srid);
+std::string polygon_parts_wkb(const std::vector<PolygonPart>& parts, bool transform, bool srid);
 
 
 }
@@ -50,7 +50,7 @@ class Point : public BaseGeometry {
         virtual std::list<PbfTag> pack_extras() const;
         virtual bbox Bounds() const;
 
-        virtual std::string Wkb(bool transform, bool srid) const;
+        virtual std::string Wkb(bool transform, bool srid, int64 zoom=-1) const;
 
         
 
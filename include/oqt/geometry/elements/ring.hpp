@@ -35,6 +35,7 @@ struct Ring {
         std::vector<int64> refs;
         std::vector<LonLat> lonlats;
         bool reversed;
+        std::vector<uint8_t> vertex_zooms;
     };
     
     std::vector<Part> parts;
@@ -48,6 +49,11 @@ std::vector<int64> ringpart_refs(const Ring& ring);
 
 void reverse_ring(Ring& ring);
 
+//! set the vertex_zooms of each part of \param ring
+void calc_ring_vertex_zooms(Ring& ring);
+//! return \param ring with only the vertices needed at \param zoom
+Ring simplify_ring(const Ring& ring, int64 zoom);
+
 
 std::string pack_ring(const Ring& rps);
 size_t ringpart_numpoints(const Ring& rpv);
@@ -60,12 +60,18 @@ class SimplePolygon : public BaseGeometry {
         virtual std::list<PbfTag> pack_extras() const;
         virtual bbox Bounds() const;
 
-        virtual std::string Wkb(bool transform, bool srid) const;
+        virtual std::string Wkb(bool transform, bool srid, int64 zoom=-1) const;
+        
+        //! the lowest zoom at which each vertex is needed, empty if not simplified
+        const std::vector<uint8_t>& VertexZooms() const;
+        void SetVertexZooms(const std::vector<uint8_t>& vertex_zooms_);
+        void CalcVertexZooms();
         
     private:
         
         std::vector<int64> refs;
         std::vector<LonLat> lonlats;
+        std::vector<uint8_t> vertex_zooms;
         std::optional<int64> zorder;
         std::optional<int64> layer;
         double area;
@@ -64,6 +64,22 @@ std::shared_ptr<BlockHandler> make_multipolygons(
     const bbox& box,
     bool boundary, bool multipolygon, int64 max_number_errors);
 
+/*! As make_multipolygons, but only the collection of relations and their
+ * member ways is serial. Relations are finished by \param numchan worker
+ * threads, and the resulting blocks passed to \param callback in the same
+ * order as make_multipolygons. */
+std::function<void(primblock_ptr)> make_multipolygons_callback(
+    std::function<void(primblock_ptr)> callback,
+    std::function<void(mperrorvec&)> errors_callback,
+    const std::set<std::string>& feature_keys,  
+    const std::set<std::string>& other_keys,
+    const std::set<std::string>& drop_keys,
+    bool all_other_keys,
+    bool all_objs, 
+    const bbox& box,
+    bool boundary, bool multipolygon, int64 max_number_errors,
+    size_t numchan);
+
 }}
 
 #endif //MULTIPOLYGONS_HPP
@@ -0,0 +1,85 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef GEOMETRY_POSTGISCOPY_HPP
+#define GEOMETRY_POSTGISCOPY_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/geometry/utils.hpp"
+
+namespace oqt {
+namespace geometry {
+
+/*! Tables written by the PostGIS COPY writer. Points come from nodes,
+ * lines from Linestring and polygons from both SimplePolygon and
+ * ComplicatedPolygon objects. */
+enum class PostgisCopyTable {
+    Point=0,
+    Line,
+    Polygon
+};
+
+struct PostgisCopyParameters {
+    PostgisCopyParameters() : prefix(""), table_prefix("planet_osm_"), transform(true), jsonb_tags(false) {}
+    
+    //! output files are prefix+"point.copy", prefix+"line.copy" and prefix+"polygon.copy"
+    std::string prefix;
+    std::string table_prefix;
+    
+    //! write coordinates as spherical mercator (epsg:3857) rather than epsg:4326
+    bool transform;
+    
+    //! tags column as jsonb rather than hstore
+    bool jsonb_tags;
+};
+
+std::string postgiscopy_table_name(PostgisCopyTable table);
+std::string postgiscopy_filename(const PostgisCopyParameters& params, PostgisCopyTable table);
+
+/*! CREATE TABLE and COPY FROM STDIN statements matching the columns
+ * written for \param table. */
+std::string postgiscopy_table_sql(const PostgisCopyParameters& params, PostgisCopyTable table);
+
+/*! Encode each geometry block as rows of the three tables, in the
+ * PostgreSQL binary COPY format, and append them to the output files.
+ * Returns \param numchan callbacks: the encoding is done in the calling
+ * thread of each callback, the results are written in order by a single
+ * writer thread. If \param callbacks is not empty each block is first
+ * passed on to callbacks[i]. */
+std::vector<block_callback> make_postgiscopy_callbacks(
+    std::vector<block_callback> callbacks,
+    const PostgisCopyParameters& params, size_t numchan);
+
+/*! Append the rows for all geometries in \param block to
+ * \param tables[PostgisCopyTable]. Returns the number of rows added. */
+size_t write_postgiscopy_block(std::vector<std::string>& tables, PrimitiveBlockPtr block, bool transform, bool jsonb_tags);
+
+/*! Check \param filename is a well formed binary COPY file for
+ * \param table, including the encoding of each field (hstore or jsonb
+ * tags and the EWKB geometry). Returns the number of rows, throws
+ * std::domain_error at the first problem found. */
+int64 validate_postgiscopy_file(const std::string& filename, PostgisCopyTable table, bool jsonb_tags);
+
+}
+}
+
+#endif
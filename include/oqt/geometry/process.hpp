@@ -30,10 +30,13 @@
 #include "oqt/geometry/multipolygons.hpp"
 #include "oqt/geometry/handlerelations.hpp"
 #include "oqt/geometry/findminzoom.hpp"
+#include "oqt/geometry/postgiscopy.hpp"
+#include "oqt/geometry/vectortile.hpp"
 
 #include "oqt/sorting/qttree.hpp"
 
 #include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/pbfformat/blockcache.hpp"
 
 #include "oqt/geometry/utils.hpp"
 
@@ -46,7 +49,7 @@ struct GeometryParameters {
     GeometryParameters() 
         : numchan(4), numblocks(512), all_other_keys(false), all_objs(false), box(), add_multipolygons(false),
             add_boundary_polygons(false), recalcqts(false), outfn(""), indexed(false),
-            max_min_zoom_level(0), max_number_errors(1000) {}
+            max_min_zoom_level(0), max_number_errors(1000), simplify(false) {}
     
     std::vector<std::string> filenames;
     
@@ -79,6 +82,17 @@ struct GeometryParameters {
     int64 max_min_zoom_level;
     int64 max_number_errors;
     
+    //! store per-vertex simplification zooms (see simplify.hpp) with each geometry
+    bool simplify;
+    
+    //! if postgiscopy.prefix is set, also write binary COPY files for PostGIS
+    PostgisCopyParameters postgiscopy;
+    
+    //! if vectortiles.outfn is set, also write mapbox vector tiles
+    VectorTileParameters vectortiles;
+    
+    //! if set, keep decoded tiles to use when the same tiles are read again
+    BlockCachePtr block_cache;
 };
 
 block_callback make_geomprogress(const src_locs_map& locs);
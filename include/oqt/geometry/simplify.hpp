@@ -0,0 +1,62 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef GEOMETRY_SIMPLIFY_HPP
+#define GEOMETRY_SIMPLIFY_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/geometry/utils.hpp"
+
+namespace oqt {
+namespace geometry {
+
+/*! Vertex zooms give, for each vertex of a line or ring, the lowest zoom
+ * level at which the vertex is needed. They are found with Douglas-Peucker
+ * in spherical mercator: a vertex is needed at zoom z if it is further
+ * than simplify_tolerance(z) from the line between its neighbours in the
+ * simplification. The first and last vertices are always needed. Vertices
+ * which are never needed (e.g. collinear) have zoom vertex_zoom_never. */
+const uint8_t vertex_zoom_never = 255;
+
+//! the tolerance in mercator metres: one pixel of a 256 pixel tile
+double simplify_tolerance(int64 zoom);
+
+/*! Find vertex zooms for \param lonlats. If \param is_ring, the two most
+ * significant vertices are always needed, so that the ring keeps at least
+ * three distinct points. */
+std::vector<uint8_t> calc_vertex_zooms(const std::vector<LonLat>& lonlats, bool is_ring);
+
+//! Return the vertices of \param lonlats needed at \param zoom
+std::vector<LonLat> simplify_lonlats(const std::vector<LonLat>& lonlats, const std::vector<uint8_t>& vertex_zooms, int64 zoom);
+
+/*! Set the vertex zooms of all Linestring, SimplePolygon and
+ * ComplicatedPolygon objects in \param block. The parts of each
+ * ComplicatedPolygon ring are simplified separately, with fixed end
+ * points, so that a way shared by several polygons (or used by a
+ * polygon and a line) is simplified the same way in each. Returns the
+ * number of geometries changed. */
+size_t simplify_geometries(PrimitiveBlockPtr block);
+
+}
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef GEOMETRY_VECTORTILE_HPP
+#define GEOMETRY_VECTORTILE_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/geometry/utils.hpp"
+
+namespace oqt {
+namespace geometry {
+
+struct VectorTileParameters {
+    VectorTileParameters() : outfn(""), directory(false), min_zoom(0), max_zoom(14), extent(4096), buffer(64) {}
+    
+    /*! Output archive filename. This uses the same container as the
+     * other oqt files, with one "VectorTile" block for each tile, keyed
+     * by the tile's quadtree. If directory is set, tiles are instead
+     * written uncompressed to outfn/z/x/y.pbf. */
+    std::string outfn;
+    bool directory;
+    
+    //! max_zoom can be at most 24, the depth of the quadtree
+    int64 min_zoom;
+    int64 max_zoom;
+    
+    //! tile coordinate extent, and the buffer around each tile (both in tile units)
+    int64 extent;
+    int64 buffer;
+};
+
+/*! Collect the features of each geometry block into Mapbox Vector Tiles.
+ * A feature is included in all tiles from its MinZoom (or max_zoom if
+ * not set) to max_zoom, clipped to the tile plus buffer and quantised
+ * into tile coordinates. Points, lines and polygons go to layers
+ * "point", "line" and "polygon".
+ * 
+ * Returns \param numchan callbacks, each clipping the blocks it is
+ * passed. The blocks passed to each callback should be in quadtree
+ * order: each tile is then encoded and written as soon as no later
+ * block can add to it, so only the tiles near the blocks being read are
+ * held. If the blocks are out of order all tiles are held until each
+ * callback has been passed nullptr. The archive is written in quadtree
+ * order. If \param callbacks is not empty each block is first passed
+ * on to callbacks[i]. */
+std::vector<block_callback> make_vectortile_callbacks(
+    std::vector<block_callback> callbacks,
+    const VectorTileParameters& params, size_t numchan);
+
+//! Read (uncompressed) tile \param x, \param y, \param z from archive \param filename. Returns an empty string if not present
+std::string read_vectortile(const std::string& filename, int64 x, int64 y, int64 z);
+
+}
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef PBFFORMAT_BLOCKCACHE_HPP
+#define PBFFORMAT_BLOCKCACHE_HPP
+
+#include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/idset.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/elements/block.hpp"
+#include "oqt/elements/minimalblock.hpp"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+
+namespace oqt {
+
+struct BlockCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t num_blocks;
+    size_t bytes;
+    size_t max_bytes;
+};
+
+/*! Estimate the memory held by the decoded \param block: a fixed size for
+ * each object of its type, plus its tags, refs, members and any strings
+ * too long to be stored inline. Geometries are counted from the length of
+ * their packed coordinates. */
+size_t estimate_block_size(const PrimitiveBlock& block);
+size_t estimate_block_size(const minimal::Block& block);
+
+/*! A thread safe, least recently used, cache of decoded blocks, as merged
+ * from a tile's main and change file blobs by read_blocks_merge. Blocks are
+ * keyed by the set of files, the tile quadtree, the ReadBlockFlags and the
+ * IdSet filter (compared by address: the cache keeps a reference to each
+ * filter used). The size of each block is taken from
+ * estimate_block_size, and blocks are dropped once the total exceeds
+ * max_bytes. This is an estimate of the decoded size, which is several
+ * times the size of the pbf data.
+ * 
+ * The cached blocks are shared, so must not be changed: use
+ * readpbffile_detail::merge_keyedblob_cached, which returns a copy of the
+ * block but not of the objects it contains. The objects are shared with
+ * every other reader of the cache, so must not be changed either (with
+ * SetTags, SetQuadtree etc): copy them first. */
+class BlockCache {
+    public:
+        BlockCache(size_t max_bytes_) : max_bytes(max_bytes_), bytes(0), hits(0), misses(0), evictions(0) {}
+        
+        template <class BlockType>
+        std::shared_ptr<BlockType> get(const std::string& fileset, int64 qt, ReadBlockFlags flags, IdSetPtr filter) {
+            return std::static_pointer_cast<BlockType>(get_internal(make_key<BlockType>(fileset, qt, flags, filter)));
+        }
+        
+        template <class BlockType>
+        void put(const std::string& fileset, int64 qt, ReadBlockFlags flags, IdSetPtr filter, std::shared_ptr<BlockType> block) {
+            put_internal(make_key<BlockType>(fileset, qt, flags, filter), filter, block, estimate_block_size(*block));
+        }
+        
+        void clear();
+        BlockCacheStats stats();
+        
+    private:
+        typedef std::tuple<std::string, int64, int, const IdSet*, bool> key_type;
+        struct Entry {
+            key_type key;
+            std::shared_ptr<void> block;
+            IdSetPtr filter;
+            size_t size;
+        };
+        
+        template <class BlockType>
+        static key_type make_key(const std::string& fileset, int64 qt, ReadBlockFlags flags, IdSetPtr filter) {
+            return std::make_tuple(fileset, qt, static_cast<int>(flags), filter.get(), std::is_same<BlockType, minimal::Block>::value);
+        }
+        
+        std::shared_ptr<void> get_internal(const key_type& key);
+        void put_internal(const key_type& key, IdSetPtr filter, std::shared_ptr<void> block, size_t size);
+        
+        std::mutex mutex;
+        std::list<Entry> entries; //most recently used first
+        std::map<key_type, std::list<Entry>::iterator> index;
+        size_t max_bytes;
+        size_t bytes;
+        size_t hits, misses, evictions;
+};
+
+typedef std::shared_ptr<BlockCache> BlockCachePtr;
+
+//! Key for a list of files, as used by BlockCache
+std::string block_cache_fileset(const std::vector<std::string>& filenames);
+
+}
+
+#endif //PBFFORMAT_BLOCKCACHE_HPP
@@ -48,6 +48,11 @@ std::shared_ptr<FileBlock> read_file_block(int64 index, std::istream& infile);
 
 std::string prepare_file_block(const std::string& blocktype, const std::string& data, int compress_level=-1);
 
+/*! Makes a file block from \param data which is already compressed, as
+ * held in FileBlock::data. An \param uncompressed_size of zero means
+ * \param data is not compressed, as with decompress. */
+std::string prepare_file_block_compressed(const std::string& blocktype, const std::string& data, size_t uncompressed_size);
+
 }
 
 #endif //PBFFORMAT_FILEBLOCK_HPP
@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef PBFFORMAT_IDTILEINDEX_HPP
+#define PBFFORMAT_IDTILEINDEX_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/elements/block.hpp"
+#include "oqt/elements/minimalblock.hpp"
+
+#include <map>
+#include <mutex>
+
+namespace oqt {
+
+/*! Finds the tile holding each object in a quadtree sorted file. The
+ * index file holds the quadtree of each tile, followed by the objects
+ * sorted by InternalId in chunks of a few thousand. Each chunk stores its
+ * ids as deltas and its tile numbers as runs, and is compressed. A
+ * directory of the first id of each chunk is searched to find the chunk
+ * for an id, so the file is memory mapped and only the chunks needed for
+ * a lookup are read. */
+class IdTileIndex {
+    public:
+        virtual size_t num_tiles() const=0;
+        virtual size_t num_entries() const=0;
+        virtual int64 tile_quadtree(size_t tile) const=0;
+        
+        /*! Find the tile quadtree of each object of type \param ty with
+         * ids \param ids. Ids not present are skipped. The result is
+         * sorted by id. */
+        virtual std::vector<std::pair<int64,int64>> find(ElementType ty, const std::vector<int64>& ids) const=0;
+        
+        //! The distinct quadtrees of the tiles holding \param ids
+        virtual std::vector<int64> find_tiles(ElementType ty, const std::vector<int64>& ids) const=0;
+        
+        virtual ~IdTileIndex() {}
+};
+
+std::shared_ptr<IdTileIndex> open_idtile_index(const std::string& fn);
+
+/*! Collects the objects of each tile of a quadtree sorted file, then
+ * writes them as an IdTileIndex. Tiles can be added from several
+ * threads. Every \param spill_entries objects the collected entries are
+ * sorted and written to a temporary run file \param tempfn+"-run"+n, in
+ * the same compressed chunks as the index, and finish merges the runs. */
+class IdTileIndexBuilder {
+    public:
+        //! \param qts the quadtrees of the tiles, in file order
+        IdTileIndexBuilder(const std::vector<int64>& qts, const std::string& tempfn, size_t spill_entries=1<<26);
+        
+        void add(PrimitiveBlockPtr block);
+        void add(minimal::BlockPtr block);
+        
+        //! Sort and write the index to \param fn, returning the number of objects
+        size_t finish(const std::string& fn);
+        
+    private:
+        std::vector<int64> qts;
+        std::map<int64,uint32_t> tile_numbers;
+        std::string tempfn;
+        size_t spill_entries;
+        std::mutex mutex;
+        std::vector<std::pair<uint64,uint32_t>> entries;
+        std::vector<std::pair<std::string,size_t>> runs;
+        
+        uint32_t tile_number(int64 qt);
+        void add_entries(const std::vector<std::pair<uint64,uint32_t>>& ee);
+};
+
+/*! Write an IdTileIndex for the quadtree sorted file \param fn to
+ * \param outfn, or fn+"-idtile.idx" if empty. */
+size_t write_idtile_index(const std::string& fn, size_t numchan, const std::string& outfn);
+
+}
+
+#endif //PBFFORMAT_IDTILEINDEX_HPP
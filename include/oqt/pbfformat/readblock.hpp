@@ -29,6 +29,7 @@
 #include "oqt/elements/header.hpp"
 #include "oqt/elements/quadtree.hpp"
 #include "oqt/utils/pbf/protobuf.hpp"
+#include <set>
 namespace oqt {
     
 enum class ReadBlockFlags {
@@ -63,13 +64,45 @@ inline bool has_flag(ReadBlockFlags lhs, ReadBlockFlags rhs) {
     );
 }*/
 
+//! Selects which fields of each node, way and relation are decoded. Fields
+//! which are not selected are skipped over without being unpacked, and are
+//! left at their default values. Object ids are always read. Geometry
+//! objects are passed to the read_geometry_func unchanged.
+struct ReadFields {
+    bool coords=true;       //node lon and lat
+    bool refs=true;         //way refs
+    bool members=true;      //relation member types and refs
+    bool roles=true;        //relation member roles
+    bool quadtree=true;
+    
+    bool version=true;
+    bool timestamp=true;
+    bool changeset=true;
+    bool user_id=true;
+    bool user=true;
+    bool visible=true;
+    
+    bool tags=true;
+    std::set<std::string> tag_keys; //if not empty, only tags with these keys are kept
+    
+    bool info() const { return version || timestamp || changeset || user_id || user || visible; }
+    bool strings() const { return tags || user || (members && roles); }
+    
+    //! returns the tag_keys filter as a mask over a block's string table,
+    //! or an empty vector if all tags are to be kept
+    std::vector<bool> tag_key_mask(const std::vector<std::string>& stringtable) const;
+};
+typedef std::shared_ptr<ReadFields> ReadFieldsPtr;
+
+
 typedef std::function<ElementPtr(ElementType, const std::string&, const std::vector<std::string>&, changetype)> read_geometry_func;
 PrimitiveBlockPtr read_primitive_block(int64 idx, const std::string& data, bool change,
     ReadBlockFlags flags=ReadBlockFlags::Empty, IdSetPtr ids=IdSetPtr(),
-    read_geometry_func readGeometry = read_geometry_func());
+    read_geometry_func readGeometry = read_geometry_func(), ReadFieldsPtr fields=ReadFieldsPtr());
 
 std::tuple<int64,ElementInfo,std::vector<Tag>,int64,std::list<PbfTag> >
-    read_common(ElementType ty, const std::string& data, const std::vector<std::string>& stringtable, IdSetPtr ids);
+    read_common(ElementType ty, const std::string& data, const std::vector<std::string>& stringtable, IdSetPtr ids,
+        ReadFieldsPtr fields=ReadFieldsPtr());
 
 std::vector<std::string> read_string_table(const std::string& data);
 int64 read_quadtree(const std::string& data);
@@ -81,13 +114,13 @@ void read_filelocs_json(HeaderPtr head, int64 fl, const std::string& filename, c
 
 PrimitiveBlockPtr read_primitive_block_new(int64 idx, const std::string& data, bool change,
     ReadBlockFlags flags=ReadBlockFlags::Empty, IdSetPtr ids=IdSetPtr(),
-    read_geometry_func readGeometry = read_geometry_func());
+    read_geometry_func readGeometry = read_geometry_func(), ReadFieldsPtr fields=ReadFieldsPtr());
 
 void read_primitive_block_new_into(
     PrimitiveBlockPtr primblock,
     const std::string& data, bool change,
     ReadBlockFlags flags=ReadBlockFlags::Empty, IdSetPtr ids=IdSetPtr(),
-    read_geometry_func readGeometry = read_geometry_func());
+    read_geometry_func readGeometry = read_geometry_func(), ReadFieldsPtr fields=ReadFieldsPtr());
 
 }
 #endif //PBFFORMAT_READBLOCK_HPP
@@ -25,6 +25,8 @@
 
 #include "oqt/pbfformat/idset.hpp"
 #include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/pbfformat/blockcache.hpp"
 
 #include "oqt/elements/block.hpp"
 #include "oqt/elements/minimalblock.hpp"
@@ -35,6 +37,8 @@
 namespace oqt {
 
 
+//! Filenames, with \param prfx prepended, and end dates from \param prfx filelist.json
+std::vector<std::pair<std::string,int64>> read_filelist(const std::string& prfx);
 std::pair<std::vector<std::string>,int64> read_filenames(const std::string& prfx, int64 enddate);
 class ReadBlocksCaller {
     public:
@@ -43,7 +47,26 @@ class ReadBlocksCaller {
         
         virtual void read_primitive_nothread(primitiveblock_callback cb, ReadBlockFlags flags, IdSetPtr filter)=0;
         virtual void read_minimal_nothread(minimalblock_callback cb, ReadBlockFlags flags, IdSetPtr filter)=0;
+        
+        /*! Returns true if read_blobs can be used: the quadtree of each
+         * tile must be known without decoding it, as from the tile index
+         * in the file header. */
+        virtual bool can_read_blobs()=0;
+        
+        /*! Calls \param cbs with the compressed blobs for each tile,
+         * keyed by quadtree, without decoding them. The first blob is
+         * from the main file, followed by any from change files. */
+        virtual void read_blobs(std::vector<keyedblob_callback> cbs)=0;
+        
         virtual size_t num_tiles()=0;
+        
+        /*! Keeps the decoded tiles in \param cache, so that reading the
+         * same tiles again does not decompress and merge them. Only used
+         * when reading tiles merged from a list of files. */
+        virtual void set_block_cache(BlockCachePtr cache)=0;
+        
+        //! The cache set by set_block_cache, if any
+        virtual BlockCachePtr block_cache()=0;
 };
 
 std::shared_ptr<ReadBlocksCaller> make_read_blocks_caller(
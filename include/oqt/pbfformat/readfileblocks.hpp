@@ -31,6 +31,7 @@
 #include "oqt/pbfformat/readfileparallel.hpp"
 #include "oqt/elements/combineblocks.hpp"
 #include "oqt/pbfformat/idset.hpp"
+#include "oqt/pbfformat/blockcache.hpp"
 #include "oqt/utils/multithreadedcallback.hpp"
 #include "oqt/utils/threadedcallback.hpp"
 #include "oqt/utils/operatingsystem.hpp"
@@ -46,7 +47,8 @@ PrimitiveBlockPtr read_as_primitiveblock(
     std::shared_ptr<FileBlock> bl, 
     IdSetPtr idset, 
     bool ischange,
-    ReadBlockFlags objflags);
+    ReadBlockFlags objflags,
+    ReadFieldsPtr fields=ReadFieldsPtr());
 
 minimal::BlockPtr read_as_minimalblock(
     std::shared_ptr<FileBlock> bl, 
@@ -164,7 +166,8 @@ std::vector<std::function<void(std::shared_ptr<SourceType>)>> wrap_callbacks(
                 } else {
                     cb(nullptr);
                 }
-            }
+            },
+            "decode blocks"
         ));
     }
     
@@ -311,6 +314,41 @@ namespace readpbffile_detail {
         comb->index = bl->idx;
         return comb;
     }
+    
+    //! Copies a block from a BlockCache, with the position of \param bl
+    inline PrimitiveBlockPtr copy_cached_block(PrimitiveBlockPtr block, std::shared_ptr<KeyedBlob> bl) {
+        auto result = std::make_shared<PrimitiveBlock>(bl->idx, 0);
+        result->CopyMetadata(block);
+        result->Objects() = block->Objects();
+        result->SetFileProgress(bl->file_progress);
+        return result;
+    }
+    
+    inline minimal::BlockPtr copy_cached_block(minimal::BlockPtr block, std::shared_ptr<KeyedBlob> bl) {
+        auto result = std::make_shared<minimal::Block>(*block);
+        result->index = bl->idx;
+        result->file_progress = bl->file_progress;
+        return result;
+    }
+    
+    //! As merge_keyedblob, using the block in \param cache if present
+    template <class BlockType>
+    std::shared_ptr<BlockType> merge_keyedblob_cached(
+        BlockCachePtr cache, const std::string& fileset,
+        std::shared_ptr<KeyedBlob> bl,
+        ReadBlockFlags objflags, IdSetPtr ids) {
+        
+        if (!cache) {
+            return merge_keyedblob<BlockType>(bl, objflags, ids);
+        }
+        
+        auto block = cache->get<BlockType>(fileset, bl->key, objflags, ids);
+        if (!block) {
+            block = merge_keyedblob<BlockType>(bl, objflags, ids);
+            cache->put<BlockType>(fileset, bl->key, objflags, ids, block);
+        }
+        return copy_cached_block(block, bl);
+    }
 }
 
 
@@ -321,13 +359,13 @@ void read_blocks_split_merge(
     std::vector<std::string> filenames,
     std::vector<std::function<void(std::shared_ptr<BlockType>)>> callbacks,
     src_locs_map locs,
-    IdSetPtr filter, ReadBlockFlags objflags, size_t buffer=0) {
-
+    IdSetPtr filter, ReadBlockFlags objflags, size_t buffer=0, BlockCachePtr cache=nullptr) {
 
 
+    std::string fileset = cache ? block_cache_fileset(filenames) : "";
     auto convblocks = wrap_callbacks<KeyedBlob, BlockType>(callbacks, 
-        [objflags, filter](std::shared_ptr<KeyedBlob> kb) {
-            return readpbffile_detail::merge_keyedblob<BlockType>(kb, objflags, filter);
+        [objflags, filter, cache, fileset](std::shared_ptr<KeyedBlob> kb) {
+            return readpbffile_detail::merge_keyedblob_cached<BlockType>(cache, fileset, kb, objflags, filter);
         });
 
 
@@ -346,11 +384,11 @@ void read_blocks_merge(
     std::vector<std::string> filenames,
     std::function<void(std::shared_ptr<BlockType>)> callback,
     src_locs_map locs, size_t numchan,
-    IdSetPtr filter, ReadBlockFlags objflags, size_t buffer=0) {
+    IdSetPtr filter, ReadBlockFlags objflags, size_t buffer=0, BlockCachePtr cache=nullptr) {
 
 
     auto cbs = multi_threaded_callback<BlockType>::make(callback, numchan);
-    read_blocks_split_merge(filenames,cbs,locs,filter,objflags,buffer);
+    read_blocks_split_merge(filenames,cbs,locs,filter,objflags,buffer,cache);
     
 }
 
@@ -362,13 +400,13 @@ void read_blocks_merge_nothread(
     std::vector<std::string> filenames,
     std::function<void(std::shared_ptr<BlockType>)> callback,
     src_locs_map locs,
-    IdSetPtr filter, ReadBlockFlags objflags) {
-    
+    IdSetPtr filter, ReadBlockFlags objflags, BlockCachePtr cache=nullptr) {
     
     
-    auto cb = [filter,objflags,callback](std::shared_ptr<KeyedBlob> kb) {
+    std::string fileset = cache ? block_cache_fileset(filenames) : "";
+    auto cb = [filter,objflags,callback,cache,fileset](std::shared_ptr<KeyedBlob> kb) {
         if (kb) {
-            callback(readpbffile_detail::merge_keyedblob<BlockType>(kb, objflags, filter));
+            callback(readpbffile_detail::merge_keyedblob_cached<BlockType>(cache, fileset, kb, objflags, filter));
         } else {
             callback(std::shared_ptr<BlockType>());
         }
@@ -36,6 +36,7 @@ struct KeyedBlob {
 };
 
 typedef std::map<int64,std::vector<std::pair<size_t,int64>>> src_locs_map;
+typedef std::function<void(std::shared_ptr<KeyedBlob>)> keyedblob_callback;
 
 void read_some_split_locs_parallel_callback(const std::vector<std::string>& files, std::vector<std::function<void(std::shared_ptr<KeyedBlob>)>> callbacks, const src_locs_map& src_locs);
 size_t read_some_split_buffered_keyed_callback(const std::vector<std::string>& files, std::vector<std::function<void(std::shared_ptr<KeyedBlob>)>> callbacks, size_t index_offset, const src_locs_map& locs, bool finish_callbacks);
@@ -0,0 +1,126 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef PBFFORMAT_TILESTORE_HPP
+#define PBFFORMAT_TILESTORE_HPP
+
+#include "oqt/pbfformat/blockcache.hpp"
+#include "oqt/pbfformat/idtileindex.hpp"
+#include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/elements/block.hpp"
+#include "oqt/utils/bbox.hpp"
+#include "oqt/utils/geometry.hpp"
+
+namespace oqt {
+
+class IdTileStore;
+
+/*! Queries a quadtree sorted file, or a prefix directory with a
+ * filelist.json of the original file and its change files. The file list
+ * and tile index of each file are read once when the store is opened,
+ * and the merged tiles are kept in a BlockCache, so that many small
+ * queries can be answered from one process. All methods can be called
+ * from several threads at once. */
+class TileStore {
+    public:
+        /*! Open \param prfx, which is either a .pbf file with a tile index
+         * or a directory prefix with a filelist.json. Up to
+         * \param cache_size bytes of decoded tiles are cached. If the
+         * first file has an IdTileIndex (as written by write_idtile_index)
+         * it is used by find_objects. */
+        TileStore(const std::string& prfx, size_t numchan, size_t cache_size);
+        
+        /*! The quadtrees of the tiles overlapping \param box, and
+         * \param poly if not empty. */
+        std::vector<int64> tiles(const bbox& box, const std::vector<LonLat>& poly) const;
+        
+        /*! Read and merge the tiles overlapping \param box and \param poly
+         * (if not empty), using only the change files up to
+         * \param enddate (or all if 0). Objects are not filtered: each
+         * tile is returned whole, in quadtree order. */
+        std::vector<PrimitiveBlockPtr> query(const bbox& box, const std::vector<LonLat>& poly, int64 enddate, ReadBlockFlags objflags) const;
+        
+        //! As query, for the tiles in \param qts
+        std::vector<PrimitiveBlockPtr> read_tiles(const std::vector<int64>& qts, int64 enddate, ReadBlockFlags objflags) const;
+        
+        /*! Find the objects of type \param ty with ids \param ids in the
+         * tiles \param qts, as found from an id index. Objects not
+         * present are skipped. Throws if \param qts is empty: use
+         * scan_objects to search every tile. */
+        std::vector<ElementPtr> get_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate, const std::vector<int64>& qts) const;
+        
+        /*! As get_objects, reading only the tiles holding \param ids. If
+         * an IdTileStore has been set which is up to date with the last
+         * file, and all the files are used for \param enddate, the tiles
+         * are found from it, including objects created or moved by the
+         * change files. If only the first file is used for
+         * \param enddate, the tiles are found from its IdTileIndex.
+         * Otherwise throws: the IdTileIndex only describes the first file,
+         * so objects created by the change files, or moved by them to
+         * another tile, would not be found. */
+        std::vector<ElementPtr> find_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate) const;
+        
+        /*! As get_objects, searching every tile. The tiles are read a few
+         * at a time and are not added to the cache, so that a scan does
+         * not evict the tiles kept for other queries. */
+        std::vector<ElementPtr> scan_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate) const;
+        
+        //! Use \param index for find_objects: call before any queries.
+        void set_id_index(std::shared_ptr<IdTileIndex> index) { id_index_=index; }
+        std::shared_ptr<IdTileIndex> id_index() const { return id_index_; }
+        
+        //! Use \param store for find_objects: call before any queries.
+        void set_id_store(std::shared_ptr<IdTileStore> store) { id_store_=store; }
+        std::shared_ptr<IdTileStore> id_store() const { return id_store_; }
+        
+        const std::vector<std::string>& filenames() const { return filenames_; }
+        const std::vector<int64>& enddates() const { return enddates_; }
+        const bbox& box() const { return box_; }
+        size_t num_tiles() const { return locs.size(); }
+        
+        BlockCachePtr cache() const { return cache_; }
+        
+    private:
+        std::vector<std::string> filenames_;
+        std::vector<int64> enddates_;
+        src_locs_map locs;
+        bbox box_;
+        size_t numchan;
+        BlockCachePtr cache_;
+        std::shared_ptr<IdTileIndex> id_index_;
+        std::shared_ptr<IdTileStore> id_store_;
+        
+        //! Number of files to use for \param enddate, and the BlockCache key
+        std::pair<size_t,std::string> find_files(int64 enddate) const;
+        
+        std::vector<PrimitiveBlockPtr> read_tiles_cached(const std::vector<int64>& qts, int64 enddate, ReadBlockFlags objflags, bool use_cache) const;
+        std::vector<ElementPtr> search_tiles(ElementType ty, const std::vector<int64>& ids, int64 enddate, std::vector<int64> qts, bool use_cache) const;
+};
+
+typedef std::shared_ptr<TileStore> TileStorePtr;
+
+TileStorePtr make_tilestore(const std::string& prfx, size_t numchan, size_t cache_size);
+
+}
+
+#endif //PBFFORMAT_TILESTORE_HPP
@@ -52,6 +52,22 @@ write_file_callback make_pbffilewriter_callback(const std::string& filename, Hea
 write_file_callback make_pbffilewriter_filelocs_callback(const std::string& filename, HeaderPtr head);
 write_file_callback make_pbffilewriter_indexed_callback(const std::string& filename, HeaderPtr head);
 
+/*! Returns one callback for each of \param callbacks. Each compresses
+ * the packed blocks passed to it (with prepare_file_block) on its own
+ * thread, then passes them on to the matching callback, so compression
+ * runs on a separate pool from packing. Blocks passed to each callback
+ * stay in order. */
+std::vector<write_file_callback> make_compress_callbacks(std::vector<write_file_callback> callbacks, const std::string& blocktype="OSMData", int complevel=-1);
+
+struct KeyedBlob;
+/*! As make_compress_callbacks, for blocks as held in KeyedBlob::blobs:
+ * each callback takes the first blob of each KeyedBlob. A blob with a
+ * non-zero uncompressed size is already compressed (as read with
+ * read_blobs) and is only framed with prepare_file_block_compressed,
+ * otherwise it is compressed. Copied and compressed blocks passed to
+ * each callback stay in order. */
+std::vector<std::function<void(std::shared_ptr<KeyedBlob>)>> make_compress_blob_callbacks(std::vector<write_file_callback> callbacks, const std::string& blocktype="OSMData", int complevel=-1);
+
 
 void rewrite_indexed_file(std::string filename, std::string tempfilename, HeaderPtr head, block_index& idx);
 void sort_block_index(block_index& index);
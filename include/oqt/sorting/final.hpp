@@ -26,6 +26,7 @@
 
 #include "oqt/sorting/common.hpp"
 #include "oqt/elements/block.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
 
 
 namespace oqt {
@@ -35,6 +36,13 @@ std::vector<primitiveblock_callback> make_final_packers(std::shared_ptr<PbfFileW
 std::vector<primitiveblock_callback> make_final_packers_sync(std::shared_ptr<PbfFileWriter> write_file_obj, size_t numchan, int64 timestamp, bool writeqts, bool asthread);
 std::vector<primitiveblock_callback> make_final_packers_cb(std::function<void(keystring_ptr)> ks_cb, size_t numchan, int64 timestamp, bool writeqts, bool asthread);
 
+/*! Returns callbacks which write tiles read as KeyedBlobs to
+ * \param write_file_obj, keyed by quadtree. Tiles with a single source
+ * blob (i.e. with no changes) are copied without being decompressed,
+ * keeping their original block dates. Others are merged, then packed
+ * and compressed as with make_final_packers_sync. */
+std::vector<keyedblob_callback> make_final_packers_passthrough(std::shared_ptr<PbfFileWriter> write_file_obj, size_t numchan, int64 timestamp);
+
 
 }
 
@@ -25,6 +25,7 @@
 
 #include "oqt/common.hpp"
 #include <map>
+#include <vector>
 namespace oqt {
 
 
@@ -68,5 +69,19 @@ std::shared_ptr<QtTree> make_tree_empty();
 
 std::function<void(std::shared_ptr<count_map>)> make_addcountmaptree(std::shared_ptr<QtTree> tree, size_t maxlevel);
 
+//! (quadtree, count) pairs, sorted by quadtree, with each quadtree once
+typedef std::vector<std::pair<int64,int64>> qt_histogram;
+
+//! Sort and count \param qts, merging the result into \param hist
+void add_qt_histogram(qt_histogram& hist, std::vector<int64>& qts);
+qt_histogram merge_qt_histograms(const qt_histogram& left, const qt_histogram& right);
+
+//! Merge \param hists in pairs, using up to \param numchan threads
+qt_histogram reduce_qt_histograms(std::vector<qt_histogram> hists, size_t numchan);
+
+/*! Build a tree from \param hist. As the quadtrees are added in order,
+ * the tiles' idx values are also in quadtree order. */
+std::shared_ptr<QtTree> make_tree_histogram(const qt_histogram& hist);
+
 }
 #endif
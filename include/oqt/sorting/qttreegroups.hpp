@@ -27,6 +27,10 @@
 
 namespace oqt {
 std::shared_ptr<QtTree> find_groups_copy(std::shared_ptr<QtTree> tree, int64 target, int64 minsize);
+
+/*! As find_groups_copy, with each pass over the tree split between
+ * \param numchan threads. The groups found are the same. */
+std::shared_ptr<QtTree> find_groups_copy(std::shared_ptr<QtTree> tree, int64 target, int64 minsize, size_t numchan);
 void tree_rollup(std::shared_ptr<QtTree> tree, int64 minsize);
 std::shared_ptr<QtTree> tree_round_copy(std::shared_ptr<QtTree> tree, int64 maxlevel);
 
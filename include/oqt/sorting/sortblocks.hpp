@@ -52,8 +52,13 @@ int run_sortblocks(
     int64 timestamp, size_t numchan, std::shared_ptr<QtTree> groups,
     const std::string& tempfn, size_t grptiles, bool fixstrs, bool seperate_filelocs);
 
+/*! Sort \param origfn into the tiles of \param groups, holding all the
+ * objects in memory. Set \param exact_weights if the weight of each tile
+ * is exactly the number of objects which will be found in it, as for a
+ * tree from find_groups_copy: tiles are then packed as soon as all their
+ * objects have been read. */
 int run_sortblocks_inmem(const std::string& origfn, const std::string& qtsfn, const std::string& outfn,
-    int64 timestamp, size_t numchan, std::shared_ptr<QtTree> groups, bool fixstrs);
+    int64 timestamp, size_t numchan, std::shared_ptr<QtTree> groups, bool fixstrs, bool exact_weights=false);
 
 
 
@@ -0,0 +1,42 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef UPDATE_COMPACTCHANGES_HPP
+#define UPDATE_COMPACTCHANGES_HPP
+
+#include "oqt/common.hpp"
+
+namespace oqt {
+
+/*! Merge the consecutive change files \param prfx+\param fls into a single
+ * change file \param outfn, keeping the same tile keys. Where an object
+ * appears in the same tile in more than one file the latest is kept, so
+ * reading the base file merged with \param outfn gives the same result as
+ * merging with all of \param fls. Tiles found in only one file are copied
+ * without decoding them, and so keep that file's dates. Returns the number
+ * of tiles and the file length. */
+std::pair<int64,int64> merge_change_files(
+    const std::string& prfx, const std::vector<std::string>& fls,
+    const std::string& outfn, size_t numchan);
+
+}
+#endif
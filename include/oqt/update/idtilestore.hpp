@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef UPDATE_IDTILESTORE_HPP
+#define UPDATE_IDTILESTORE_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/calcqts/qtstore.hpp"
+#include "oqt/elements/block.hpp"
+#include "oqt/sorting/qttree.hpp"
+#include "oqt/update/xmlchange.hpp"
+
+namespace oqt {
+
+//! Location of one object: id is the InternalId, quadtree<0 marks a deleted object
+struct IdTileEntry {
+    int64 id;
+    int64 quadtree;
+    int64 tile;
+};
+
+/*! Persistent map from object InternalId to (quadtree, tile), held as a
+ * directory of sorted, memory mapped runs. Each update file adds a new
+ * run, newer runs override older ones, and runs of similar size are merged
+ * as they accumulate so that the number of runs stays logarithmic in the
+ * number of updates. */
+class IdTileStore {
+    public:
+        //! Name of the last file added, or of the original file
+        virtual const std::string& last_file() const=0;
+        virtual size_t num_runs() const=0;
+        virtual size_t num_entries() const=0;
+
+        /*! Find entries for \param ids, which must be sorted. Ids which are
+         * not present, or have been deleted, are skipped. */
+        virtual std::vector<IdTileEntry> find(const std::vector<int64>& ids) const=0;
+
+        /*! Add \param entries, the objects written to file \param fn, as a
+         * new run, merging runs if needed. */
+        virtual void add(std::vector<IdTileEntry> entries, const std::string& fn)=0;
+
+        //! Merge all runs into one, dropping deleted entries
+        virtual void compact()=0;
+
+        /*! Rename the last file, when it has been replaced by a merged
+         * change file with the same tiles. */
+        virtual void set_last_file(const std::string& fn)=0;
+
+        virtual ~IdTileStore() {}
+};
+
+//! Open an existing store in directory \param path
+std::shared_ptr<IdTileStore> open_idtilestore(const std::string& path);
+
+/*! Create a new store in directory \param path from the original file
+ * \param prfx+\param fls[0] and the change files \param fls[1:]. */
+std::shared_ptr<IdTileStore> build_idtilestore(const std::string& path, const std::string& prfx, const std::vector<std::string>& fls, size_t numchan);
+
+//! Find the entries for objects written to a change file as \param tiles
+std::vector<IdTileEntry> find_idtile_entries(const std::vector<PrimitiveBlockPtr>& tiles);
+
+/*! As add_orig_elements, but find the original allocations and quadtrees
+ * of the changed objects from \param store rather than by scanning the
+ * index files. The tiles holding nodes referenced by changed ways and
+ * relations are still read for their locations. */
+std::tuple<
+    std::shared_ptr<QtStore>, //orig allocs
+    std::shared_ptr<QtStore>, //qts
+    std::shared_ptr<QtTree>   //tree
+> add_orig_elements_idtilestore(
+        typeid_element_map_ptr objs,
+        const std::string& prfx,
+        const std::vector<std::string>& fls,
+        std::shared_ptr<IdTileStore> store);
+
+}
+#endif
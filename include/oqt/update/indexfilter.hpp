@@ -0,0 +1,56 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef UPDATE_INDEXFILTER_HPP
+#define UPDATE_INDEXFILTER_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/elements/header.hpp"
+#include "oqt/pbfformat/idset.hpp"
+#include "oqt/pbfformat/objsidset.hpp"
+#include <set>
+
+namespace oqt {
+
+/*! Write \param fn-filter.pbf, a coarse index of the ids in
+ * \param fn-index.pbf. The ids of each element type are split into ranges
+ * of 2^\param range_bits consecutive ids, and for each range the file
+ * lists the tiles holding any id in it. The file starts with a
+ * FilterHeader block holding the size and modification time of
+ * \param fn-index.pbf, followed by a FilterTiles block with the location
+ * of each tile's IndexBlock, and FilterRanges blocks for each element
+ * type. */
+size_t write_index_filter_file(const std::string& fn, size_t numchan, size_t range_bits=8);
+
+/*! Find the tiles of \param fn containing any of \param ids. Each id is
+ * looked up once in the ranges of \param fn-filter.pbf, written with
+ * \param range_bits: only the blocks of \param fn-index.pbf for the
+ * tiles listed for these ranges are then read to check exactly. */
+std::set<int64> check_index_filter_file(const std::string& fn, HeaderPtr head, size_t numchan, std::shared_ptr<ObjsIdSet> ids, size_t range_bits);
+
+/*! Find the tiles of \param fn containing any of \param ids, using
+ * check_index_filter_file if \param fn-filter.pbf exists and was written
+ * from the current \param fn-index.pbf, otherwise check_index_file. */
+std::set<int64> check_index(const std::string& fn, HeaderPtr head, size_t numchan, IdSetPtr ids);
+
+}
+#endif
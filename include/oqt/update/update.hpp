@@ -32,8 +32,10 @@
 #include <set>
 namespace oqt {
 
-size_t write_index_file(const std::string& srcfn, size_t numchan, const std::string& destfn);
-std::set<int64> check_index_file(const std::string& idxfn, HeaderPtr header, size_t numchan, IdSetPtr ids);
+/*! Write the ids of the objects in each tile of \param srcfn to \param destfn.
+ * If \param idtile is true, also write an IdTileIndex to srcfn+"-idtile.idx". */
+size_t write_index_file(const std::string& srcfn, size_t numchan, const std::string& destfn, bool idtile=false);
+std::set<int64> check_index_file(const std::string& idxfn, HeaderPtr header, size_t numchan, IdSetPtr ids, std::vector<int64> locs={});
 
 std::vector<PrimitiveBlockPtr> read_file_blocks(
     const std::string& fn, std::vector<int64> locs, size_t numchan,
@@ -77,7 +79,7 @@ std::vector<PrimitiveBlockPtr> find_change_tiles(
     int64 startdate,
     int64 enddate);
 
-std::pair<int64,int64> find_change_all(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn);
+std::pair<int64,int64> find_change_all(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn, size_t numchan=4, const std::string& idtilestore="");
 
 std::shared_ptr<ObjsIdSet> make_idset(typeid_element_map_ptr em);
 }
@@ -0,0 +1,46 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef UPDATE_UPDATEQTS_HPP
+#define UPDATE_UPDATEQTS_HPP
+
+#include "oqt/common.hpp"
+#include "oqt/update/xmlchange.hpp"
+
+namespace oqt {
+
+/*! Read osc, osc.gz and pbfc change files into \param em, keeping the
+ * highest version of each object. */
+void read_change_files(const std::vector<std::string>& changes, typeid_element_map_ptr em, size_t numchan);
+
+/*! Write a new quadtree file for \param origfn with \param changes
+ * applied, starting from the existing \param qtsfn. Only the objects
+ * touched by the changes are recalculated: changed objects, ways with
+ * moved nodes, the nodes of those ways, and relations with any affected
+ * member. All other quadtrees are copied from \param qtsfn. */
+size_t run_update_qts(
+    const std::string& origfn, const std::string& qtsfn,
+    const std::vector<std::string>& changes, const std::string& outfn,
+    size_t numchan, double buffer, size_t max_depth);
+
+}
+#endif
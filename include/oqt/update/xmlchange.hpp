@@ -36,5 +36,21 @@ typedef std::shared_ptr<typeid_element_map> typeid_element_map_ptr;
 
 void read_xml_change_file_em(std::istream* fl, typeid_element_map_ptr em, bool allow_missing_users);
 void read_xml_change_em(const std::string& data, typeid_element_map_ptr em, bool allow_missing_users);
+
+/*! Parse the osmChange document \param data in place, returning the
+ * objects in document order. Faster than read_xml_change for large
+ * documents. */
+std::vector<ElementPtr> read_xml_change_objects(const std::string& data, bool allow_missing_users);
+
+/*! Sort \param objs by InternalId, keeping only the highest version of
+ * each object. */
+void merge_change_objects(std::vector<ElementPtr>& objs);
+
+/*! Read osc and osc.gz files \param fns using \param numchan threads.
+ * Returns the highest version of each object, sorted by InternalId. */
+std::vector<ElementPtr> read_xml_change_files_parallel(const std::vector<std::string>& fns, size_t numchan, bool allow_missing_users);
+
+//! Add \param objs (sorted by InternalId) to \param em, keeping the highest version
+void add_change_objects(typeid_element_map_ptr em, const std::vector<ElementPtr>& objs);
 }
 #endif
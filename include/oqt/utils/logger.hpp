@@ -27,6 +27,7 @@
 
 
 #include "oqt/utils/timing.hpp"
+#include "oqt/utils/telemetry.hpp"
 
 
 namespace oqt {
@@ -52,6 +53,9 @@ class Logger {
 
         virtual void time(const std::string& msg) {
             msgs.push_back(std::make_pair(msg, std::chrono::high_resolution_clock::now()));
+            if (!msg.empty()) {
+                Telemetry::Get().add_trace_marker(msg);
+            }
         }
         virtual void timing_messages() {
             size_t ln=5;
@@ -35,18 +35,23 @@ template <class T>
 class multi_threaded_callback {
     public:
         typedef std::function<void(std::shared_ptr<T>)> callback_func;
-        multi_threaded_callback(callback_func func, size_t numchan) :
+        /*! \param name names the stage in the telemetry report: if empty,
+         * the stage is named after the item type and
+         * numbered, so each unnamed stage is reported separately. */
+        multi_threaded_callback(callback_func func, size_t numchan, const std::string& name="") :
             queues(numchan), rem(numchan), error(false) {
-
+            
+            auto stats = callback_stage_stats<T>("multi_threaded_callback", name);
             for (size_t i=0; i < numchan; i++) {
                 queues[i] = std::make_shared<single_queue<T>>();
+                queues[i]->set_stats(stats);
             }
-            fut = std::async(std::launch::async, add_all_queue, queues, func, std::ref(error));
+            fut = std::async(std::launch::async, add_all_queue, queues, func, std::ref(error), stats);
         }
         virtual ~multi_threaded_callback() {}
 
-        static std::vector<callback_func> make(callback_func func, size_t numchan) {
-            auto mtc = std::make_shared<multi_threaded_callback<T>>(func, numchan);
+        static std::vector<callback_func> make(callback_func func, size_t numchan, const std::string& name="") {
+            auto mtc = std::make_shared<multi_threaded_callback<T>>(func, numchan, name);
             std::vector<callback_func> result;
             for (size_t i=0; i < numchan; i++) {
                 result.push_back([mtc,i](std::shared_ptr<T> bl) { mtc->call(i, bl); });
@@ -57,10 +62,11 @@ class multi_threaded_callback {
 
 
     private:
-        static std::exception_ptr add_all_queue(std::vector<std::shared_ptr<single_queue<T>>> queues, callback_func func, std::atomic<bool>& error) {
+        static std::exception_ptr add_all_queue(std::vector<std::shared_ptr<single_queue<T>>> queues, callback_func func, std::atomic<bool>& error, StageStatsPtr stats) {
             size_t ii=0;
             for (auto fb = queues[ii%queues.size()]->wait_and_pop(); fb; fb=queues[ii%queues.size()]->wait_and_pop()) {
                 try {
+                    StageTimer timer(stats, stats ? telemetry_item_bytes(*fb) : 0);
                     func(fb);
                     ii++;
                 } catch (...) {
@@ -29,6 +29,8 @@
 namespace oqt {
 
 int64 file_size(const std::string& fn);
+//! last modification time of \param fn, in nanoseconds
+int64 file_timestamp(const std::string& fn);
 void checkstats();
 int64 getmemval(size_t pid);
 std::string getmem(size_t pid);
@@ -44,6 +44,9 @@ std::string write_packed_int(const std::vector<uint64>& vals);
 size_t packed_delta_length(const std::vector<int64>& vals, size_t last);
 size_t write_packed_delta_in_place(std::string& out, size_t pos, const std::vector<int64>& vals, size_t last);
 
+size_t packed_int_length(const std::vector<uint64>& vals);
+size_t write_packed_int_in_place(std::string& out, size_t pos, const std::vector<uint64>& vals);
+
 size_t packed_delta_length_func(std::function<int64(size_t)>, size_t len);
 size_t write_packed_delta_in_place_func(std::string& out, size_t pos, std::function<int64(size_t)>, size_t len);
 
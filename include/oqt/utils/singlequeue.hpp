@@ -29,6 +29,8 @@
 #include <atomic>
 #include <iostream>
 
+#include "oqt/utils/telemetry.hpp"
+
 namespace oqt {
 
 template<class T>
@@ -41,6 +43,8 @@ class single_queue {
     std::condition_variable ready_to_read;
     std::condition_variable ready_to_write;
     std::exception_ptr ex;
+    
+    StageStatsPtr stats;
 
     public:
         single_queue() : pending_writers(1) {};
@@ -49,10 +53,16 @@ class single_queue {
         bool valid() {
             return pending_writers>0;
         }
+        
+        void set_stats(StageStatsPtr stats_) {
+            stats=stats_;
+        }
 
         void wait_and_push(std::shared_ptr<T> newval) {
+            int64 st = stats ? stats->start_push(bool(newval)) : 0;
             std::unique_lock<std::mutex> lk(wmut);
             ready_to_write.wait(lk,[this]()->bool{return !obj;});
+            if (stats) { stats->finish_push(st); }
             if (!valid()) {
                 if (ex) {
                     std::rethrow_exception(ex);
@@ -79,8 +89,10 @@ class single_queue {
         }
 
         std::shared_ptr<T> wait_and_pop() {
+            int64 st = stats ? stats->start_pop() : 0;
             std::unique_lock<std::mutex> lk(wmut);
             ready_to_read.wait(lk,[this]()->bool{return (pending_writers==0) || obj;});
+            if (stats) { stats->finish_pop(st, bool(obj)); }
             std::shared_ptr<T> ans=obj;
             obj.reset();
             ready_to_write.notify_one();
@@ -116,6 +128,8 @@ class single_queue_unique {
     std::condition_variable ready_to_read;
     std::condition_variable ready_to_write;
     std::exception_ptr ex;
+    
+    StageStatsPtr stats;
 
     public:
         single_queue_unique() : pending_writers(1) {};
@@ -124,10 +138,16 @@ class single_queue_unique {
         bool valid() {
             return pending_writers>0;
         }
+        
+        void set_stats(StageStatsPtr stats_) {
+            stats=stats_;
+        }
 
         void wait_and_push(std::unique_ptr<T> newval) {
+            int64 st = stats ? stats->start_push(bool(newval)) : 0;
             std::unique_lock<std::mutex> lk(wmut);
             ready_to_write.wait(lk,[this]()->bool{return !obj;});
+            if (stats) { stats->finish_push(st); }
             if (!valid()) {
                 if (ex) {
                     std::rethrow_exception(ex);
@@ -154,8 +174,10 @@ class single_queue_unique {
         }
 
         std::unique_ptr<T> wait_and_pop() {
+            int64 st = stats ? stats->start_pop() : 0;
             std::unique_lock<std::mutex> lk(wmut);
             ready_to_read.wait(lk,[this]()->bool{return (pending_writers==0) || obj;});
+            if (stats) { stats->finish_pop(st, bool(obj)); }
             std::unique_ptr<T> ans=std::move(obj);
             obj.reset();
             ready_to_write.notify_one();
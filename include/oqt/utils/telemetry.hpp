@@ -0,0 +1,179 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#ifndef UTILS_TELEMETRY_HPP
+#define UTILS_TELEMETRY_HPP
+
+#include "oqt/common.hpp"
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <typeinfo>
+
+namespace oqt {
+
+/*! Returns the current time in nanoseconds, from a steady clock. */
+int64 telemetry_now();
+
+/*! Counters for one named pipeline stage, summed over each thread (or
+ * call site) using that name. Times are in nanoseconds. busy is the time
+ * spent handling items, not counting time spent blocked handing results
+ * on to later stages. push_wait is the time producers spent waiting to
+ * hand items to the stage, and pop_wait the time the stage spent waiting
+ * for items. queued is the number of items handed to the stage (or
+ * waiting to be) which have not yet been started. */
+struct StageStats {
+    StageStats(const std::string& name_) :
+        name(name_), instances(0), busy(0), push_wait(0), pop_wait(0),
+        items(0), bytes(0), queued(0), max_queued(0) {}
+    
+    std::string name;
+    std::atomic<int64> instances;
+    std::atomic<int64> busy, push_wait, pop_wait;
+    std::atomic<int64> items, bytes;
+    std::atomic<int64> queued, max_queued;
+    
+    int64 start_push(bool have_item);
+    void finish_push(int64 start);
+    int64 start_pop();
+    void finish_pop(int64 start, bool have_item);
+    void add_busy(int64 start, int64 nbytes, int64 blocked);
+};
+typedef std::shared_ptr<StageStats> StageStatsPtr;
+
+/*! The total time the current thread has spent blocked in
+ * StageStats::finish_push, i.e. waiting on the stages after it. */
+int64& telemetry_thread_push_wait();
+
+
+/*! Collects StageStats for the whole process. Does nothing until enabled:
+ * stage() then returns nullptr, and all the instrumented code skips
+ * timing. When tracing is also enabled, each busy period is recorded as
+ * a chrome trace event (as viewed in chrome://tracing or perfetto). */
+class Telemetry {
+    public:
+        static Telemetry& Get();
+        
+        void enable(bool trace);
+        void disable();
+        bool enabled() const { return is_enabled; }
+        bool tracing() const { return is_tracing; }
+        
+        /*! Clears all stages and trace events. Stages already held by
+         * running callbacks are kept but no longer reported. */
+        void reset();
+        
+        /*! Returns the stats for stage \param name, or nullptr if
+         * telemetry is not enabled. \param new_instance should be false
+         * when called for each item, rather than once for each thread or
+         * object handling the stage. */
+        StageStatsPtr stage(const std::string& name, bool new_instance=true);
+        
+        /*! Returns the stats for a new stage named \param prefix followed
+         * by a number not yet used, so that unnamed stages are reported
+         * separately. Returns nullptr if telemetry is not enabled. */
+        StageStatsPtr unique_stage(const std::string& prefix);
+        
+        void add_trace_event(const std::string& name, int64 start, int64 end);
+        void add_trace_marker(const std::string& name);
+        
+        std::string report_json() const;
+        std::string trace_json() const;
+        void write_report(const std::string& filename) const;
+        void write_trace(const std::string& filename) const;
+        
+    private:
+        Telemetry() : is_enabled(false), is_tracing(false), start_time(0), dropped_events(0) {}
+        
+        struct TraceEvent {
+            std::string name;
+            char phase;
+            int64 tid;
+            int64 start;
+            int64 duration;
+        };
+        
+        std::atomic<bool> is_enabled;
+        std::atomic<bool> is_tracing;
+        int64 start_time;
+        
+        mutable std::mutex mutex;
+        std::map<std::string,StageStatsPtr> stages;
+        std::vector<TraceEvent> events;
+        size_t dropped_events;
+};
+
+/*! Records a single busy period of a stage: from construction until
+ * destruction, less any time the thread spent blocked pushing to later
+ * stages in between. Does nothing if \param stats is nullptr. */
+class StageTimer {
+    public:
+        StageTimer(StageStatsPtr stats_, int64 nbytes_=0) :
+            stats(stats_), start(stats ? telemetry_now() : 0), nbytes(nbytes_),
+            push_wait_start(stats ? telemetry_thread_push_wait() : 0) {}
+        
+        ~StageTimer() {
+            if (stats) {
+                stats->add_busy(start, nbytes, telemetry_thread_push_wait()-push_wait_start);
+            }
+        }
+        
+        void add_bytes(int64 n) { nbytes += n; }
+        
+    private:
+        StageStatsPtr stats;
+        int64 start;
+        int64 nbytes;
+        int64 push_wait_start;
+};
+
+
+std::string demangle_type_name(const char* name);
+
+/*! Returns the stats for a callback stage: \param name if given, or
+ * otherwise a new stage named after \param kind, the item type and a
+ * number, so that unnamed stages are not merged together. */
+template <class T>
+StageStatsPtr callback_stage_stats(const std::string& kind, const std::string& name) {
+    if (!Telemetry::Get().enabled()) {
+        return nullptr;
+    }
+    if (!name.empty()) {
+        return Telemetry::Get().stage(name);
+    }
+    return Telemetry::Get().unique_stage(kind+"<"+demangle_type_name(typeid(T).name())+">");
+}
+
+/*! The size in bytes of an item passed between stages, where this is
+ * known without walking the item. */
+template <class T>
+int64 telemetry_item_bytes(const T&) { return 0; }
+
+int64 telemetry_item_bytes(const std::pair<int64,std::string>& ks);
+struct FileBlock;
+int64 telemetry_item_bytes(const FileBlock& fb);
+struct KeyedBlob;
+int64 telemetry_item_bytes(const KeyedBlob& kb);
+
+}
+
+#endif //UTILS_TELEMETRY_HPP
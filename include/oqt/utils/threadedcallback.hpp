@@ -37,38 +37,46 @@ template <class T>
 class threaded_callback {
     public:
         typedef std::function<void(std::shared_ptr<T>)> callback_func;
-        threaded_callback(callback_func func) :
+        /*! \param name names the stage in the telemetry report: if empty,
+         * the stage is named after the item type and
+         * numbered, so each unnamed stage is reported separately. */
+        threaded_callback(callback_func func, const std::string& name="") :
 
             queue(std::make_shared<single_queue<T>>()), error(false), rem(1) {
             
-            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error));
+            auto stats = callback_stage_stats<T>("threaded_callback", name);
+            queue->set_stats(stats);
+            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error), stats);
 
         }
         
-        threaded_callback(callback_func func, size_t numchan) :
+        threaded_callback(callback_func func, size_t numchan, const std::string& name="") :
 
             queue(std::make_shared<single_queue<T>>()), error(false), rem(numchan) {
             
-            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error));
+            auto stats = callback_stage_stats<T>("threaded_callback", name);
+            queue->set_stats(stats);
+            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error), stats);
 
         }
 
 
 
-        static callback_func make(callback_func func) {
-            auto tc = std::make_shared<threaded_callback<T>>(func);
+        static callback_func make(callback_func func, const std::string& name="") {
+            auto tc = std::make_shared<threaded_callback<T>>(func,name);
             return [tc](std::shared_ptr<T> b) { tc->call(b); };
         }
-        static callback_func make(callback_func func, size_t numchan) {
-            auto tc = std::make_shared<threaded_callback<T>>(func,numchan);
+        static callback_func make(callback_func func, size_t numchan, const std::string& name="") {
+            auto tc = std::make_shared<threaded_callback<T>>(func,numchan,name);
             return [tc](std::shared_ptr<T> b) { tc->call(b); };
         }
 
 
     private:
-        static std::exception_ptr add_all_queue(std::shared_ptr<single_queue<T>> queue, std::function<void(std::shared_ptr<T>)> func, std::atomic<bool>& error) {
+        static std::exception_ptr add_all_queue(std::shared_ptr<single_queue<T>> queue, std::function<void(std::shared_ptr<T>)> func, std::atomic<bool>& error, StageStatsPtr stats) {
             for (auto fb = queue->wait_and_pop(); fb; fb=queue->wait_and_pop()) {
                 try {
+                    StageTimer timer(stats, stats ? telemetry_item_bytes(*fb) : 0);
                     func(fb);
                 } catch (...) {
                     std::cout << "callback failed [tc]" << std::endl;
@@ -132,38 +140,46 @@ template <class T>
 class threaded_callback_unique {
     public:
         typedef std::function<void(std::unique_ptr<T>)> callback_func;
-        threaded_callback_unique(callback_func func) :
+        /*! \param name names the stage in the telemetry report: if empty,
+         * the stage is named after the item type and
+         * numbered, so each unnamed stage is reported separately. */
+        threaded_callback_unique(callback_func func, const std::string& name="") :
 
             queue(std::make_shared<single_queue_unique<T>>()), error(false), rem(1) {
             
-            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error));
+            auto stats = callback_stage_stats<T>("threaded_callback_unique", name);
+            queue->set_stats(stats);
+            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error), stats);
 
         }
         
-        threaded_callback_unique(callback_func func, size_t numchan) :
+        threaded_callback_unique(callback_func func, size_t numchan, const std::string& name="") :
 
             queue(std::make_shared<single_queue_unique<T>>()), error(false), rem(numchan) {
             
-            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error));
+            auto stats = callback_stage_stats<T>("threaded_callback_unique", name);
+            queue->set_stats(stats);
+            fut = std::async(std::launch::async, add_all_queue, queue, func, std::ref(error), stats);
 
         }
 
 
 
-        static callback_func make(callback_func func) {
-            auto tc = std::make_shared<threaded_callback_unique<T>>(func);
+        static callback_func make(callback_func func, const std::string& name="") {
+            auto tc = std::make_shared<threaded_callback_unique<T>>(func,name);
             return [tc](std::unique_ptr<T>&& b) { tc->call(std::move(b)); };
         }
-        static callback_func make(callback_func func, size_t numchan) {
-            auto tc = std::make_shared<threaded_callback_unique<T>>(func,numchan);
+        static callback_func make(callback_func func, size_t numchan, const std::string& name="") {
+            auto tc = std::make_shared<threaded_callback_unique<T>>(func,numchan,name);
             return [tc](std::shared_ptr<T>&& b) { tc->call(std::move(b)); };
         }
 
 
     private:
-        static std::exception_ptr add_all_queue(std::shared_ptr<single_queue_unique<T>> queue, callback_func func, std::atomic<bool>& error) {
+        static std::exception_ptr add_all_queue(std::shared_ptr<single_queue_unique<T>> queue, callback_func func, std::atomic<bool>& error, StageStatsPtr stats) {
             for (auto fb = std::move(queue->wait_and_pop()); fb; fb=std::move(queue->wait_and_pop())) {
                 try {
+                    StageTimer timer(stats, stats ? telemetry_item_bytes(*fb) : 0);
                     func(std::move(fb));
                 } catch (...) {
                     std::cout << "callback failed [tc]" << std::endl;
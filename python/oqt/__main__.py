@@ -65,6 +65,10 @@ elif len(sys.argv)>=3 and sys.argv[1]=='droplast':
     r=update.run_droplast(sys.argv[2])
     sys.exit(r)
 
+elif len(sys.argv)>=3 and sys.argv[1]=='compact':
+    r=update.run_compact(sys.argv[2])
+    sys.exit(r)
+
 elif len(sys.argv)>=3 and sys.argv[1]=='calcqts':
     qtsfn=None
     if len(sys.argv)>3:
@@ -80,5 +84,6 @@ else:
 %ZZ% update <prfx> <[optional] number of days>
 %ZZ% initial <prfx> <origfn> <enddate> <diff location> <state> {[optional] RoundTime=<true|false> AllowMissingUsers=<true|false> SourcePrfx=<replication url base (default https://planet.openstreetmap.org/replication/day/)> MergeOscFiles=<true|false>}
 %ZZ% droplast <prfx>
+%ZZ% compact <prfx>
 %ZZ% calcqts <prfx> {[optional] qtsfn=<default prfx[:-4]+'-qts.pbf'}
 """.replace("%ZZ%", sys.argv[0]))
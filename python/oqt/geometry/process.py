@@ -33,7 +33,7 @@ import time,sys,re, gzip
 from . import style as geometrystyle, minzoomvalues
 
 
-def read_blocks(prfx, box_in, lastdate=None, objflags=None, numchan=4):
+def read_blocks(prfx, box_in, lastdate=None, objflags=None, numchan=4, cache=None):
     
     tiles=[]
     result = addto(tiles)
@@ -42,7 +42,7 @@ def read_blocks(prfx, box_in, lastdate=None, objflags=None, numchan=4):
     if objflags is None:
         objflags=pbfformat.ReadBlockFlags()
     
-    pbfformat.read_blocks_merge_primitive(fns, result, locs, numchan=numchan, objflags=objflags)
+    pbfformat.read_blocks_merge_primitive(fns, result, locs, numchan=numchan, objflags=objflags, cache=cache)
     return tiles
 
 
@@ -84,7 +84,7 @@ def prep_geometry_params(prfx, box_in, style, lastdate, minzoom, numchan, minlen
         
     return params, style
 
-def process_geometry(prfx, box_in, stylefn=None, collect=True, outfn=None, lastdate=None,indexed=False,minzoom=None,nothread=False,mergetiles=False, maxtilelevel=None, groups=None, numchan=4,minlen=0,minarea=5):
+def process_geometry(prfx, box_in, stylefn=None, collect=True, outfn=None, lastdate=None,indexed=False,minzoom=None,nothread=False,mergetiles=False, maxtilelevel=None, groups=None, numchan=4,minlen=0,minarea=5,copyprefix=None,copyjsonb=False,tilesout=None,tileszooms=(0,14),tilesdirectory=False,simplify=False,cache=None):
     tiles={} if mergetiles else []
     
     
@@ -102,6 +102,21 @@ def process_geometry(prfx, box_in, stylefn=None, collect=True, outfn=None, lastd
     if outfn:
         params.outfn=outfn
     params.indexed=indexed
+    params.simplify=simplify
+    if not cache is None:
+        params.block_cache=cache
+    
+    if copyprefix:
+        params.postgiscopy.prefix=copyprefix
+        params.postgiscopy.jsonb_tags=copyjsonb
+        with open(copyprefix+'tables.sql','w') as sqlf:
+            for tab in (_geometry.PostgisCopyTable.Point, _geometry.PostgisCopyTable.Line, _geometry.PostgisCopyTable.Polygon):
+                sqlf.write(_geometry.postgiscopy_table_sql(params.postgiscopy, tab))
+    
+    if tilesout:
+        params.vectortiles.outfn=tilesout
+        params.vectortiles.min_zoom, params.vectortiles.max_zoom = tileszooms
+        params.vectortiles.directory=tilesdirectory
     
     
     if mergetiles and collect:
@@ -116,7 +131,7 @@ def process_geometry(prfx, box_in, stylefn=None, collect=True, outfn=None, lastd
     
     
     
-    if len(params.locs) > 2500 and outfn is not None:
+    if len(params.locs) > 2500 and (outfn is not None or copyprefix is not None or tilesout is not None):
         collect=False
         
     callback = None
@@ -25,9 +25,10 @@ from oqt import utils
 
 from . import _pbfformat
 from ._pbfformat import get_header_block, read_primitive_block, read_minimal_block
-from ._pbfformat import ReadBlockFlags, calc_idset_filter, ReadBlocksIter
+from ._pbfformat import ReadBlockFlags, ReadFields, calc_idset_filter, ReadBlocksIter
 from ._pbfformat import read_blocks_primitive, read_blocks_minimal, read_blocks_merge_primitive
-from ._pbfformat import WritePbfFile
+from ._pbfformat import WritePbfFile, BlockCache, TileStore
+from ._pbfformat import IdTileIndex, open_idtile_index, write_idtile_index
 
 from .filelocs import prep_poly,  get_locs, get_locs_single, Poly, read_poly_file
 
@@ -77,6 +78,9 @@ class ReadBlocksCaller:
 
     def num_tiles(self):
         return self.rbc.num_tiles()
+    
+    def set_block_cache(self, cache):
+        self.rbc.set_block_cache(cache)
         
     def calc_idset(self, bbox=None, poly=None):
         if bbox is None:
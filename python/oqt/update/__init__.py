@@ -23,5 +23,5 @@
 from __future__ import print_function
 
 from . import _update, misc, xmlchange
-from .misc import run_droplast, run_initial, run_update
+from .misc import run_droplast, run_initial, run_update, run_compact
 from .xmlchange import read_timestamp
@@ -23,7 +23,7 @@
 from __future__ import print_function
 from . import _update, xmlchange
 from oqt import pbfformat, utils
-import json, csv, time, sys, subprocess, os
+import json, csv, time, sys, subprocess, os, shutil
 
 try:
     from urllib import urlopen as urllib_urlopen
@@ -66,7 +66,27 @@ class timer:
         return "\n".join(res)
 
 
-def find_change(src_filenames, prfx, infiles, startdate, enddate, outfn, use_alt=False,allow_missing_users=False):
+def get_idtilestore(path, prfx, infiles, numchan=4):
+    if os.path.exists(path):
+        store = _update.open_idtilestore(path)
+        if store.last_file == infiles[-1]:
+            return store
+        print("idtilestore at %s is at %s, not %s: rebuild" % (path, store.last_file, infiles[-1]))
+        del store
+        shutil.rmtree(path)
+    return _update.build_idtilestore(path, prfx, infiles, numchan)
+
+
+def write_filelist(prfx, files):
+    #write to a temporary file and rename, so that readers never see a
+    #partly written list
+    tmpfn = prfx+'filelist.json.tmp'
+    with open(tmpfn,'w') as tf:
+        json.dump(files, tf)
+    os.replace(tmpfn, prfx+'filelist.json')
+
+
+def find_change(src_filenames, prfx, infiles, startdate, enddate, outfn, use_alt=False,allow_missing_users=False,idtilestore=None,index_filter=False):
     print("call find_change",
         "%d src files: %s%s" % (len(src_filenames),src_filenames[0],(" => %s" % src_filenames[-1] if len(src_filenames)>1 else '')),
         repr(prfx),
@@ -80,9 +100,11 @@ def find_change(src_filenames, prfx, infiles, startdate, enddate, outfn, use_alt
         _update.read_xml_change_file_em(src,True,objs,allow_missing_users)
     tm("read xml")
     
-    aoe = _update.add_orig_elements_altxx if use_alt else _update.add_orig_elements
-    
-    orig_allocs,qts,tree = aoe(objs,prfx, infiles)
+    if idtilestore is not None and idtilestore.last_file == infiles[-1]:
+        orig_allocs,qts,tree = _update.add_orig_elements_idtilestore(objs, prfx, infiles, idtilestore)
+    else:
+        aoe = _update.add_orig_elements_altxx if use_alt else _update.add_orig_elements
+        orig_allocs,qts,tree = aoe(objs,prfx, infiles)
     tm("find orig")
     _update.calc_change_qts(objs,qts)
     tm("calc qts")
@@ -99,11 +121,17 @@ def find_change(src_filenames, prfx, infiles, startdate, enddate, outfn, use_alt
     out.write(tiles)
     print("calling out.finish()")
     ln,nt = out.finish()
-    del tiles, out
     tm("write pbfc")
+    if idtilestore is not None and idtilestore.last_file == infiles[-1]:
+        idtilestore.add(tiles, outfn)
+        tm("update idtilestore")
+    del tiles, out
     print("calling _change.write_index_file")
     _update.write_index_file(prfx+outfn)
     tm("write index")
+    if index_filter:
+        _update.write_index_filter_file(prfx+outfn)
+        tm("write index filter")
     print("done")
 
     print(tm)
@@ -202,7 +230,7 @@ def run_initial(prfx, orig_fn, end_date, diffs_location, initial_state, **kw):
     json.dump(settings, open(prfx+'settings.json','w'))
     nt = _update.write_index_file(prfx+orig_fn)
     filelist = [{'Filename': orig_fn, 'EndDate': end_date, 'NumTiles':nt, 'State': initial_state}]
-    json.dump(filelist, open(prfx+'filelist.json','w'))
+    write_filelist(prfx, filelist)
 
 def split_available(diffsLocation, available, merge_osc_files, max_osc_size=100*1024*1024):
     if not merge_osc_files:
@@ -240,6 +268,7 @@ def run_update(prfx, nd=None, check_new_diffs=True):
     diffsLocation = settings['DiffsLocation']
     allow_missing_users=settings['AllowMissingUsers'] if 'AllowMissingUsers' in settings else False
     merge_osc_files = settings['MergeOscFiles'] if 'MergeOscFiles' in settings else False
+    index_filter = settings['IndexFilter'] if 'IndexFilter' in settings else False
     
     
     diffs, tms = check_diffslocation(diffsLocation, settings['InitialState'],settings['SourcePrfx'] if check_new_diffs else None)
@@ -260,23 +289,30 @@ def run_update(prfx, nd=None, check_new_diffs=True):
     else:
         print("update %d osc: %d %s => %d %s" % (len(available),available[0][0], available[0][-1],available[-1][0], available[-1][-1]))
 
+    idtilestore=None
+    if 'IdTileStore' in settings:
+        idtilestore = get_idtilestore(prfx+settings['IdTileStore'], prfx, [f['Filename'] for f in files])
+
     for src, state, enddate in split_available(diffsLocation, available, merge_osc_files):
         
         infiles = [f['Filename'] for f in files]
         outfn  = make_filename(enddate, settings['RoundTime'])
 
         startdate = xmlchange.read_timestamp(files[-1]['EndDate'])
-        tm, ln, nt = find_change(src, prfx, infiles, startdate, enddate, outfn,allow_missing_users=allow_missing_users)
+        tm, ln, nt = find_change(src, prfx, infiles, startdate, enddate, outfn,allow_missing_users=allow_missing_users,idtilestore=idtilestore,index_filter=index_filter)
         tms.append((state, tm))
         files.append({'State':state, 'NumTiles': nt, 'EndDate': datestr(enddate), 'Filename':outfn})
 
 
     
-    json.dump(files, open(prfx+'filelist.json','w'))
+    write_filelist(prfx, files)
     if len(tms)>1:
         for a,b in tms:
             print("%10s: %5.1fs" % (a,b))
         print("%10s: %5.1fs" % ('TOTAL',sum(b for a,b in tms)))
+    
+    if 'CompactFanouts' in settings:
+        run_compact(prfx)
         
 
 def run_droplast(prfx):
@@ -286,7 +322,100 @@ def run_droplast(prfx):
     
     print('drop', last)
     os.remove(prfx+last['Filename'])
+
+    #the idtilestore will be rebuilt by the next run_update
+    try:
+        settings = json.load(open(prfx+'settings.json'))
+        if 'IdTileStore' in settings and os.path.exists(prfx+settings['IdTileStore']):
+            shutil.rmtree(prfx+settings['IdTileStore'])
+    except IOError:
+        pass
     
-    json.dump(files, open(prfx+'filelist.json','w'))
+    write_filelist(prfx, files)
+
+
+def plan_compaction(prfx, files, fanouts, max_size=None):
+    """Find runs of change files to merge. Files start at tier 0; each run of
+    fanouts[t] consecutive tier t files becomes one tier t+1 file. A run is
+    also closed early, if it has at least two files, when adding the next file
+    would take it over max_size bytes. The original file (files[0]) is never
+    included. Returns a list of (first, last, tier) index ranges."""
+    result = []
+    curr = []
+    curr_tier, curr_size = None, 0
+    for i,f in enumerate(files[1:],1):
+        tier = f.get('Tier',0)
+        size = os.stat(prfx+f['Filename']).st_size
+        if curr and tier!=curr_tier:
+            curr, curr_size = [], 0
+        elif curr and max_size is not None and curr_size+size > max_size:
+            if len(curr)>1:
+                result.append((curr[0],curr[-1],curr_tier))
+            curr, curr_size = [], 0
+        if tier >= len(fanouts):
+            continue
+        curr.append(i)
+        curr_tier = tier
+        curr_size += size
+        if len(curr)==fanouts[tier]:
+            result.append((curr[0],curr[-1],curr_tier))
+            curr, curr_size = [], 0
+    return result
+
+
+def compacted_filename(first, last):
+    return first[:-5].split('_')[0]+'_'+last[:-5].split('_')[-1]+'.pbfc'
+
+
+def remove_change_file(prfx, fn):
+    for f in (fn, fn+'-index.pbf', fn+'-filter.pbf'):
+        if os.path.exists(prfx+f):
+            os.remove(prfx+f)
+
+
+def run_compact(prfx, fanouts=None, max_size=None, numchan=4):
+    """Merge runs of accumulated change files into consolidated change files
+    with the same tiles, following plan_compaction. The tiers default to
+    settings 'CompactFanouts' (e.g. [7,4] for weekly then monthly files) and
+    'CompactMaxSize'. Each merged file replaces its run in filelist.json, which
+    is rewritten before the old files are removed."""
+    settings = json.load(open(prfx+'settings.json'))
+    if fanouts is None:
+        fanouts = settings.get('CompactFanouts', [7,4])
+    if max_size is None:
+        max_size = settings.get('CompactMaxSize', None)
+    index_filter = settings.get('IndexFilter', False)
+
+    files = json.load(open(prfx+'filelist.json'))
+    tm = timer()
+    while True:
+        plan = plan_compaction(prfx, files, fanouts, max_size)
+        if not plan:
+            break
+
+        for first, last, tier in reversed(plan):
+            fls = [f['Filename'] for f in files[first:last+1]]
+            outfn = compacted_filename(fls[0], fls[-1])
+            print("merge %d tier %d files %s => %s as %s" % (len(fls), tier, fls[0], fls[-1], outfn))
+            nt, ln = _update.merge_change_files(prfx, fls, prfx+outfn, numchan)
+            _update.write_index_file(prfx+outfn)
+            if index_filter:
+                _update.write_index_filter_file(prfx+outfn)
+            tm("merge %s" % outfn)
+
+            entry = dict(files[last])
+            entry.update({'Filename': outfn, 'NumTiles': nt, 'Tier': tier+1})
+            files[first:last+1] = [entry]
+            write_filelist(prfx, files)
+
+            if 'IdTileStore' in settings and os.path.exists(prfx+settings['IdTileStore']):
+                store = _update.open_idtilestore(prfx+settings['IdTileStore'])
+                if store.last_file == fls[-1]:
+                    store.set_last_file(outfn)
+
+            for fn in fls:
+                remove_change_file(prfx, fn)
+
+    print(tm)
     
     
@@ -26,6 +26,7 @@ from ._utils import bbox_empty, bbox_planet, get_logger
 from ._utils import LonLat, point_in_poly, segment_intersects, line_intersects, line_box_intersects
 from ._utils import compress, decompress, compress_gzip, decompress_gzip
 from ._utils import checkstats, file_size
+from ._utils import telemetry_enable, telemetry_disable, telemetry_reset, telemetry_report, telemetry_trace, write_telemetry_report, write_telemetry_trace
 from ._utils import PbfTag, PbfValue, PbfData, read_all_pbf_tags, pack_pbf_tags, read_packed_delta, read_packed_int, write_packed_delta, write_packed_int, zig_zag, un_zig_zag
 
 from .misc import *
@@ -33,8 +34,9 @@ from .misc import *
 from . import _utils
 import oqt.elements
 
-import time,calendar
+import time,calendar,json
 get_date=lambda t: calendar.timegm(time.strptime(t,"%Y-%m-%dT%H:%M:%S"))
+get_telemetry_report=lambda: json.loads(telemetry_report())
 
 bbox = _utils.bbox
 bbox.__repr__=lambda b: "bbox(% 10d, % 10d, % 10d, % 10d)" % (b.minx,b.miny,b.maxx,b.maxy)
@@ -32,6 +32,7 @@
 #include "oqt/geometry/elements/simplepolygon.hpp"
 #include "oqt/geometry/elements/complicatedpolygon.hpp"
 #include "oqt/geometry/elements/waywithnodes.hpp"
+#include "oqt/geometry/simplify.hpp"
 
 #include <cmath> 
 using namespace oqt;
@@ -191,7 +192,7 @@ void geometry_defs(py::module& m) {
         .def_property_readonly("Bounds", &BaseGeometry::Bounds)
         .def_property_readonly("MinZoom", &BaseGeometry::MinZoom)
         .def("SetMinZoom", &BaseGeometry::SetMinZoom)
-        .def("Wkb", [](BaseGeometry& p,  bool transform, bool srid) { return py::bytes(p.Wkb(transform,srid)); }, py::arg("transform")=true, py::arg("srid")=true)
+        .def("Wkb", [](BaseGeometry& p,  bool transform, bool srid, int64 zoom) { return py::bytes(p.Wkb(transform,srid,zoom)); }, py::arg("transform")=true, py::arg("srid")=true, py::arg("zoom")=-1)
         .def("pack_extras", &BaseGeometry::pack_extras)
     ;
     
@@ -213,6 +214,8 @@ void geometry_defs(py::module& m) {
         .def_property_readonly("ZOrder", &geometry::Linestring::ZOrder)
         .def_property_readonly("Layer", &geometry::Linestring::Layer)
         .def_property_readonly("Length", &geometry::Linestring::Length)
+        .def_property_readonly("VertexZooms", &geometry::Linestring::VertexZooms)
+        .def("CalcVertexZooms", &geometry::Linestring::CalcVertexZooms)
         
     ;
 
@@ -224,6 +227,8 @@ void geometry_defs(py::module& m) {
         .def_property_readonly("ZOrder", &geometry::SimplePolygon::ZOrder)
         .def_property_readonly("Layer", &geometry::SimplePolygon::Layer)
         .def_property_readonly("Reversed", &geometry::SimplePolygon::Reversed)
+        .def_property_readonly("VertexZooms", &geometry::SimplePolygon::VertexZooms)
+        .def("CalcVertexZooms", &geometry::SimplePolygon::CalcVertexZooms)
         
     ;
 
@@ -236,6 +241,8 @@ void geometry_defs(py::module& m) {
         .def_property_readonly("Parts", &geometry::ComplicatedPolygon::Parts)
         .def_property_readonly("ZOrder", &geometry::ComplicatedPolygon::ZOrder)
         .def_property_readonly("Layer", &geometry::ComplicatedPolygon::Layer)
+        .def("CalcVertexZooms", &geometry::ComplicatedPolygon::CalcVertexZooms)
+        .def("SimplifiedParts", &geometry::ComplicatedPolygon::SimplifiedParts, py::arg("zoom"))
         
     ;
 
@@ -359,7 +366,23 @@ void geometry_defs(py::module& m) {
         .def("areaminzoom", &findminzoom_onetag::areaminzoom)
     ;*/
 
-    m.def("make_geometries", &geometry::make_geometries, py::arg("feature_keys"), py::arg("polygon_tags"), py::arg("other_tags"), py::arg("drop_keys"), py::arg("all_other_tags"), py::arg("all_objs"), py::arg("bbox"), py::arg("block"), py::arg("max_min_zoom_level")=0);
+    m.def("make_geometries", static_cast<PrimitiveBlockPtr(*)(
+            const std::set<std::string>&, const std::map<std::string, geometry::PolygonTag>&,
+            const std::set<std::string>&, const std::set<std::string>&, bool, bool, const bbox&,
+            PrimitiveBlockPtr, std::function<bool(ElementPtr)>)>(&geometry::make_geometries),
+        py::arg("feature_keys"), py::arg("polygon_tags"), py::arg("other_tags"), py::arg("drop_keys"), py::arg("all_other_tags"), py::arg("all_objs"), py::arg("bbox"), py::arg("block"), py::arg("max_min_zoom_level")=0);
+    
+    m.def("calc_vertex_zooms", &geometry::calc_vertex_zooms, py::arg("lonlats"), py::arg("is_ring"));
+    m.def("simplify_lonlats", &geometry::simplify_lonlats, py::arg("lonlats"), py::arg("vertex_zooms"), py::arg("zoom"));
+    m.def("simplify_geometries", &geometry::simplify_geometries, py::arg("block"));
+    
+    py::class_<geometry::TagRules, std::shared_ptr<geometry::TagRules>>(m, "TagRules")
+        .def(py::init<const std::set<std::string>&, const std::map<std::string, geometry::PolygonTag>&, const std::set<std::string>&, const std::set<std::string>&, bool, bool>(),
+            py::arg("feature_keys"), py::arg("polygon_tags"), py::arg("other_tags"), py::arg("drop_keys"), py::arg("all_other_tags"), py::arg("all_objs"))
+        .def("filter_tags", &geometry::TagRules::filter_tags, py::arg("tags"))
+        .def("check_polygon_tags", &geometry::TagRules::check_polygon_tags, py::arg("tags"))
+        .def("calc_zorder", &geometry::TagRules::calc_zorder, py::arg("tags"))
+    ;
     
     m.def("filter_tags", &geometry::filter_tags, py::arg("feature_keys"), py::arg("other_tags"), py::arg("drop_keys"), py::arg("all_other_tags"), py::arg("all_objs"), py::arg("tags"));
     m.def("check_polygon_tags", &geometry::check_polygon_tags, py::arg("polygon_tags"), py::arg("tags"));
@@ -378,6 +401,42 @@ void geometry_defs(py::module& m) {
     m.def("convert_packed_tags_to_json", &geometry::convert_packed_tags_to_json);
 
 
+    py::enum_<geometry::PostgisCopyTable>(m, "PostgisCopyTable")
+        .value("Point", geometry::PostgisCopyTable::Point)
+        .value("Line", geometry::PostgisCopyTable::Line)
+        .value("Polygon", geometry::PostgisCopyTable::Polygon)
+    ;
+    
+    py::class_<geometry::PostgisCopyParameters>(m, "PostgisCopyParameters")
+        .def(py::init<>())
+        .def_readwrite("prefix", &geometry::PostgisCopyParameters::prefix)
+        .def_readwrite("table_prefix", &geometry::PostgisCopyParameters::table_prefix)
+        .def_readwrite("transform", &geometry::PostgisCopyParameters::transform)
+        .def_readwrite("jsonb_tags", &geometry::PostgisCopyParameters::jsonb_tags)
+    ;
+    
+    m.def("postgiscopy_table_name", &geometry::postgiscopy_table_name);
+    m.def("postgiscopy_filename", &geometry::postgiscopy_filename);
+    m.def("postgiscopy_table_sql", &geometry::postgiscopy_table_sql);
+    m.def("validate_postgiscopy_file", [](const std::string& fn, geometry::PostgisCopyTable table, bool jsonb_tags) {
+        py::gil_scoped_release r;
+        return geometry::validate_postgiscopy_file(fn, table, jsonb_tags);
+    });
+    
+    py::class_<geometry::VectorTileParameters>(m, "VectorTileParameters")
+        .def(py::init<>())
+        .def_readwrite("outfn", &geometry::VectorTileParameters::outfn)
+        .def_readwrite("directory", &geometry::VectorTileParameters::directory)
+        .def_readwrite("min_zoom", &geometry::VectorTileParameters::min_zoom)
+        .def_readwrite("max_zoom", &geometry::VectorTileParameters::max_zoom)
+        .def_readwrite("extent", &geometry::VectorTileParameters::extent)
+        .def_readwrite("buffer", &geometry::VectorTileParameters::buffer)
+    ;
+    
+    m.def("read_vectortile", [](const std::string& fn, int64 x, int64 y, int64 z) {
+        return py::bytes(geometry::read_vectortile(fn, x, y, z));
+    });
+    
     py::class_<geometry::GeometryParameters>(m, "GeometryParameters")
         .def(py::init<>())
         .def_readwrite("filenames", &geometry::GeometryParameters::filenames)
@@ -407,6 +466,10 @@ void geometry_defs(py::module& m) {
             
         .def_readwrite("groups", &geometry::GeometryParameters::groups)
         .def_readwrite("max_min_zoom_level", &geometry::GeometryParameters::max_min_zoom_level)
+        .def_readwrite("simplify", &geometry::GeometryParameters::simplify)
+        .def_readwrite("postgiscopy", &geometry::GeometryParameters::postgiscopy)
+        .def_readwrite("vectortiles", &geometry::GeometryParameters::vectortiles)
+        .def_readwrite("block_cache", &geometry::GeometryParameters::block_cache)
         //.def_readwrite("csvblock_callback", &geometry_parameters::csvblock_callback)
     ;
     
@@ -455,6 +518,7 @@ void geometry_defs(py::module& m) {
         .def("add_tile", &geometry::LonLatStore::add_tile)
         .def("finish", &geometry::LonLatStore::finish)
         .def("get_lonlats", &geometry::LonLatStore::get_lonlats)
+        .def("get_lonlats_block", &geometry::LonLatStore::get_lonlats_block)
     ;
 
     m.def("make_lonlatstore", &geometry::make_lonlatstore);
@@ -38,6 +38,26 @@
 
 namespace py = pybind11;
 
+namespace pybind11 { namespace detail {
+//interned tag keys appear as str
+template <> struct type_caster<oqt::Symbol> {
+    public:
+        PYBIND11_TYPE_CASTER(oqt::Symbol, _("str"));
+        
+        bool load(handle src, bool convert) {
+            make_caster<std::string> str_caster;
+            if (!str_caster.load(src, convert)) {
+                return false;
+            }
+            value = oqt::Symbol(cast_op<std::string&>(str_caster));
+            return true;
+        }
+        
+        static handle cast(const oqt::Symbol& src, return_value_policy policy, handle parent) {
+            return make_caster<std::string>::cast(src.str(), policy, parent);
+        }
+};
+}}
 
 
 
@@ -24,12 +24,14 @@
 
 #include "oqt/pbfformat/fileblock.hpp"
 #include "oqt/pbfformat/idset.hpp"
+#include "oqt/pbfformat/idtileindex.hpp"
 #include "oqt/pbfformat/objsidset.hpp"
 #include "oqt/pbfformat/readblock.hpp"
 #include "oqt/pbfformat/readblockscaller.hpp"
 #include "oqt/pbfformat/readfileblocks.hpp"
 #include "oqt/pbfformat/readfileparallel.hpp"
 #include "oqt/pbfformat/readminimal.hpp"
+#include "oqt/pbfformat/tilestore.hpp"
 #include "oqt/pbfformat/writeblock.hpp"
 #include "oqt/pbfformat/writepbffile.hpp"
 
@@ -38,19 +40,51 @@
 
 using namespace oqt;
 
+/*! Objects read through a BlockCache are shared with every later reader,
+ * so they are copied before being returned to python, where they can be
+ * changed with SetTags, SetQuadtree etc. */
+std::vector<ElementPtr> copy_objects(const std::vector<ElementPtr>& objs) {
+    std::vector<ElementPtr> result;
+    result.reserve(objs.size());
+    for (const auto& o: objs) {
+        result.push_back(o->copy());
+    }
+    return result;
+}
+
+PrimitiveBlockPtr copy_objects(PrimitiveBlockPtr bl) {
+    if (bl) {
+        bl->Objects() = copy_objects(bl->Objects());
+    }
+    return bl;
+}
+
+std::vector<PrimitiveBlockPtr> copy_objects(std::vector<PrimitiveBlockPtr> bls) {
+    for (auto& bl: bls) {
+        copy_objects(bl);
+    }
+    return bls;
+}
+
+//minimal blocks hold their objects by value, so are already copies
+minimal::BlockPtr copy_objects(minimal::BlockPtr bl) { return bl; }
+
 template <class BlockType>
 size_t read_blocks_merge_py(
     std::vector<std::string> filenames,
     std::function<bool(std::vector<std::shared_ptr<BlockType>>)> callback,
     src_locs_map locs, size_t numchan, size_t numblocks,
     IdSetPtr filter, ReadBlockFlags objflags,
-    size_t buffer) {
+    size_t buffer, BlockCachePtr cache) {
 
 
     py::gil_scoped_release r;
     auto cb = std::make_shared<collect_blocks<BlockType>>(wrap_callback(callback),numblocks);
     std::function<void(std::shared_ptr<BlockType>)> cbf = [cb](std::shared_ptr<BlockType> bl) { cb->call(bl); };
-    read_blocks_merge(filenames, cbf, locs, numchan, filter, objflags,buffer);
+    if (cache) {
+        cbf = [cb](std::shared_ptr<BlockType> bl) { cb->call(copy_objects(bl)); };
+    }
+    read_blocks_merge(filenames, cbf, locs, numchan, filter, objflags,buffer,cache);
     return cb->total();
 }
 
@@ -111,7 +145,11 @@ size_t read_blocks_caller_read_primitive(
     
     py::gil_scoped_release r;
     auto cb = std::make_shared<collect_blocks<PrimitiveBlock>>(wrap_callback(callback),numblocks);
-    auto cbf = multi_threaded_callback<PrimitiveBlock>::make([cb](PrimitiveBlockPtr bl) { cb->call(bl); },numchan);
+    primitiveblock_callback call = [cb](PrimitiveBlockPtr bl) { cb->call(bl); };
+    if (rbc->block_cache()) {
+        call = [cb](PrimitiveBlockPtr bl) { cb->call(copy_objects(bl)); };
+    }
+    auto cbf = multi_threaded_callback<PrimitiveBlock>::make(call,numchan);
     rbc->read_primitive(cbf, flags, filter);
     return cb->total();
     
@@ -314,8 +352,8 @@ ReadBlockFlags make_readblockflags(
 
 
 
-PrimitiveBlockPtr read_primitive_block_py(int64 idx, py::bytes data, bool change) {
-    return read_primitive_block(idx,data,change,ReadBlockFlags::Empty,nullptr,geometry::read_geometry);
+PrimitiveBlockPtr read_primitive_block_py(int64 idx, py::bytes data, bool change, ReadFieldsPtr fields) {
+    return read_primitive_block(idx,data,change,ReadBlockFlags::Empty,nullptr,geometry::read_geometry,fields);
 }
 
 class WritePbfFile {
@@ -450,9 +488,26 @@ void pbfformat_defs(py::module& m) {
     ;
 
     
-    m.def("read_primitive_block", &read_primitive_block_py, py::arg("index"), py::arg("data"), py::arg("change"));
-    m.def("read_primitive_block_new", [](size_t idx, const std::string& d, bool c) { return read_primitive_block_new(idx,d,c,ReadBlockFlags::Empty,nullptr,geometry::read_geometry); },
-        py::arg("index"), py::arg("data"), py::arg("change"));
+    py::class_<ReadFields, ReadFieldsPtr>(m, "ReadFields")
+        .def(py::init<>())
+        .def_readwrite("coords", &ReadFields::coords)
+        .def_readwrite("refs", &ReadFields::refs)
+        .def_readwrite("members", &ReadFields::members)
+        .def_readwrite("roles", &ReadFields::roles)
+        .def_readwrite("quadtree", &ReadFields::quadtree)
+        .def_readwrite("version", &ReadFields::version)
+        .def_readwrite("timestamp", &ReadFields::timestamp)
+        .def_readwrite("changeset", &ReadFields::changeset)
+        .def_readwrite("user_id", &ReadFields::user_id)
+        .def_readwrite("user", &ReadFields::user)
+        .def_readwrite("visible", &ReadFields::visible)
+        .def_readwrite("tags", &ReadFields::tags)
+        .def_readwrite("tag_keys", &ReadFields::tag_keys)
+    ;
+    
+    m.def("read_primitive_block", &read_primitive_block_py, py::arg("index"), py::arg("data"), py::arg("change"), py::arg("fields")=ReadFieldsPtr());
+    m.def("read_primitive_block_new", [](size_t idx, const std::string& d, bool c, ReadFieldsPtr fields) { return read_primitive_block_new(idx,d,c,ReadBlockFlags::Empty,nullptr,geometry::read_geometry,fields); },
+        py::arg("index"), py::arg("data"), py::arg("change"), py::arg("fields")=ReadFieldsPtr());
 
     
     
@@ -483,6 +538,76 @@ void pbfformat_defs(py::module& m) {
     
     py::class_<ReadBlocksCaller, std::shared_ptr<ReadBlocksCaller>>(m, "ReadBlocksCaller")
         .def("num_tiles", &ReadBlocksCaller::num_tiles)
+        .def("set_block_cache", &ReadBlocksCaller::set_block_cache)
+    ;
+    
+    py::class_<BlockCacheStats>(m, "BlockCacheStats")
+        .def_readonly("hits", &BlockCacheStats::hits)
+        .def_readonly("misses", &BlockCacheStats::misses)
+        .def_readonly("evictions", &BlockCacheStats::evictions)
+        .def_readonly("num_blocks", &BlockCacheStats::num_blocks)
+        .def_readonly("bytes", &BlockCacheStats::bytes)
+        .def_readonly("max_bytes", &BlockCacheStats::max_bytes)
+    ;
+    
+    py::class_<BlockCache, BlockCachePtr>(m, "BlockCache")
+        .def(py::init<size_t>(), py::arg("max_bytes")=size_t(1)<<30)
+        .def("stats", &BlockCache::stats)
+        .def("clear", &BlockCache::clear)
+    ;
+    
+    py::class_<IdTileIndex, std::shared_ptr<IdTileIndex>>(m, "IdTileIndex")
+        .def_property_readonly("num_tiles", &IdTileIndex::num_tiles)
+        .def_property_readonly("num_entries", &IdTileIndex::num_entries)
+        .def("tile_quadtree", &IdTileIndex::tile_quadtree)
+        .def("find", [](const IdTileIndex& idx, ElementType ty, const std::vector<int64>& ids) {
+                py::gil_scoped_release r;
+                return idx.find(ty, ids);
+            }, py::arg("type"), py::arg("ids"))
+        .def("find_tiles", [](const IdTileIndex& idx, ElementType ty, const std::vector<int64>& ids) {
+                py::gil_scoped_release r;
+                return idx.find_tiles(ty, ids);
+            }, py::arg("type"), py::arg("ids"))
+    ;
+    m.def("open_idtile_index", &open_idtile_index);
+    m.def("write_idtile_index", [](const std::string& fn, size_t numchan, const std::string& outfn) {
+            py::gil_scoped_release r;
+            return write_idtile_index(fn, numchan, outfn);
+        }, py::arg("fn"), py::arg("numchan")=4, py::arg("outfn")="");
+    
+    py::class_<TileStore, TileStorePtr>(m, "TileStore")
+        .def(py::init([](const std::string& prfx, size_t numchan, size_t cache_size) {
+                py::gil_scoped_release r;
+                return make_tilestore(prfx, numchan, cache_size);
+            }), py::arg("prfx"), py::arg("numchan")=4, py::arg("cache_size")=size_t(1)<<30)
+        .def_property_readonly("filenames", &TileStore::filenames)
+        .def_property_readonly("enddates", &TileStore::enddates)
+        .def_property_readonly("box", &TileStore::box)
+        .def_property_readonly("cache", &TileStore::cache)
+        .def("num_tiles", &TileStore::num_tiles)
+        .def("tiles", &TileStore::tiles, py::arg("box"), py::arg("poly")=std::vector<LonLat>())
+        .def("query", [](const TileStore& ts, const bbox& box, const std::vector<LonLat>& poly, int64 enddate, ReadBlockFlags objflags) {
+                py::gil_scoped_release r;
+                return copy_objects(ts.query(box, poly, enddate, objflags));
+            }, py::arg("box"), py::arg("poly")=std::vector<LonLat>(), py::arg("enddate")=0, py::arg("objflags")=ReadBlockFlags::Empty)
+        .def("read_tiles", [](const TileStore& ts, const std::vector<int64>& qts, int64 enddate, ReadBlockFlags objflags) {
+                py::gil_scoped_release r;
+                return copy_objects(ts.read_tiles(qts, enddate, objflags));
+            }, py::arg("qts"), py::arg("enddate")=0, py::arg("objflags")=ReadBlockFlags::Empty)
+        .def("get_objects", [](const TileStore& ts, ElementType ty, const std::vector<int64>& ids, int64 enddate, const std::vector<int64>& qts) {
+                py::gil_scoped_release r;
+                return copy_objects(ts.get_objects(ty, ids, enddate, qts));
+            }, py::arg("type"), py::arg("ids"), py::arg("enddate")=0, py::arg("qts"))
+        .def("find_objects", [](const TileStore& ts, ElementType ty, const std::vector<int64>& ids, int64 enddate) {
+                py::gil_scoped_release r;
+                return copy_objects(ts.find_objects(ty, ids, enddate));
+            }, py::arg("type"), py::arg("ids"), py::arg("enddate")=0)
+        .def("scan_objects", [](const TileStore& ts, ElementType ty, const std::vector<int64>& ids, int64 enddate) {
+                py::gil_scoped_release r;
+                return ts.scan_objects(ty, ids, enddate);
+            }, py::arg("type"), py::arg("ids"), py::arg("enddate")=0)
+        .def_property("id_index", &TileStore::id_index, &TileStore::set_id_index)
+        .def_property("id_store", &TileStore::id_store, &TileStore::set_id_store)
     ;
     
     m.def("read_blocks_caller_read_primitive", &read_blocks_caller_read_primitive);
@@ -513,12 +638,12 @@ void pbfformat_defs(py::module& m) {
    m.def("read_blocks_merge_primitive", &read_blocks_merge_py<PrimitiveBlock>,
         py::arg("filenames"), py::arg("callback"), py::arg("locs"),
         py::arg("numchan")=4,py::arg("numblocks")=32,
-        py::arg("filter")=nullptr, py::arg("objflags")=ReadBlockFlags::Empty, py::arg("buffer")=0);
+        py::arg("filter")=nullptr, py::arg("objflags")=ReadBlockFlags::Empty, py::arg("buffer")=0, py::arg("cache")=nullptr);
     
    m.def("read_blocks_merge_minimal", &read_blocks_merge_py<minimal::Block>,
         py::arg("filenames"), py::arg("callback"), py::arg("locs"),
         py::arg("numchan")=4,py::arg("numblocks")=32,
-        py::arg("filter")=nullptr, py::arg("objflags")=ReadBlockFlags::Empty, py::arg("buffer")=0);
+        py::arg("filter")=nullptr, py::arg("objflags")=ReadBlockFlags::Empty, py::arg("buffer")=0, py::arg("cache")=nullptr);
     
    
    m.def("read_blocks_tempobjs", &read_blocks_tempobjs);
@@ -30,10 +30,10 @@ using namespace oqt;
 
 
 std::shared_ptr<QtTree> find_groups_copy_py(std::shared_ptr<QtTree> tree, 
-        int64 target, int64 minsize) {
+        int64 target, int64 minsize, size_t numchan) {
     if (!tree) { throw std::domain_error("no tree!"); }
     py::gil_scoped_release release;
-    return find_groups_copy(tree, target, minsize);
+    return find_groups_copy(tree, target, minsize, numchan);
 }
     
 
@@ -160,7 +160,7 @@ void sorting_defs(py::module& m) {
     m.def("make_tree_empty",&make_tree_empty);
     m.def("make_qts_tree_maxlevel", &make_qts_tree_maxlevel_py, py::arg("filename"), py::arg("numchan")=4, py::arg("maxlevel")=17);
     m.def("tree_rollup", &tree_rollup_py, py::arg("tree"), py::arg("minsize"));
-    m.def("find_groups_copy", &find_groups_copy_py, py::arg("tree"), py::arg("targetsize"), py::arg("minsize"));
+    m.def("find_groups_copy", &find_groups_copy_py, py::arg("tree"), py::arg("targetsize"), py::arg("minsize"), py::arg("numchan")=4);
     m.def("tree_round_copy", &tree_round_copy_py, py::arg("tree"), py::arg("minsize"));
 
     py::class_<QtTree::Item>(m,"QtTreeItem")
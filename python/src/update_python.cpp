@@ -24,6 +24,10 @@
 #include "oqt/pbfformat/objsidset.hpp"
 
 #include "oqt/update/update.hpp"
+#include "oqt/update/idtilestore.hpp"
+#include "oqt/update/compactchanges.hpp"
+#include "oqt/update/indexfilter.hpp"
+#include "oqt/update/updateqts.hpp"
 #include "oqt/update/xmlchange.hpp"
 #include "gzstream.hpp"
 
@@ -73,6 +77,12 @@ void read_xml_change_file_em_py(std::string fn, bool isgzip, element_map& em, bo
     return read_xml_change_file_em(&f,em.u, allow_missing_users);
 }
 
+void read_xml_change_files_em_py(const std::vector<std::string>& fns, element_map& em, size_t numchan, bool allow_missing_users) {
+    if (!em.u) { em.u=std::make_shared<typeid_element_map>(); }
+    py::gil_scoped_release r;
+    add_change_objects(em.u, read_xml_change_files_parallel(fns, numchan, allow_missing_users));
+}
+
 std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtTree>>
     add_orig_elements_py(element_map& em, const std::string& prfx, std::vector<std::string> fls) {
     py::gil_scoped_release r;
@@ -105,20 +115,49 @@ void calc_change_qts_py(element_map& em, std::shared_ptr<QtStore> qts) {
     calc_change_qts(em.u, qts);
 }
 
-std::pair<int64,int64> find_change_all_py(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn) {
+std::pair<int64,int64> find_change_all_py(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn, size_t numchan, const std::string& idtilestore) {
 
     py::gil_scoped_release r;
-    return find_change_all(src_filenames,prfx,fls,st,et,outfn);
+    return find_change_all(src_filenames,prfx,fls,st,et,outfn,numchan,idtilestore);
 }
-size_t write_index_file_py(const std::string& fn, size_t numchan, const std::string& outfn) {
+size_t write_index_file_py(const std::string& fn, size_t numchan, const std::string& outfn, bool idtile) {
     py::gil_scoped_release r;
-    return write_index_file(fn,numchan,outfn);
+    return write_index_file(fn,numchan,outfn,idtile);
 }
 
 std::set<int64> check_index_file_py(const std::string& idxfn, HeaderPtr head, size_t numchan, IdSetPtr ids) {
     py::gil_scoped_release r;
     return check_index_file(idxfn,head,numchan,ids);
 }
+size_t write_index_filter_file_py(const std::string& fn, size_t numchan, size_t range_bits) {
+    py::gil_scoped_release r;
+    return write_index_filter_file(fn,numchan,range_bits);
+}
+
+std::set<int64> check_index_py(const std::string& fn, HeaderPtr head, size_t numchan, IdSetPtr ids) {
+    py::gil_scoped_release r;
+    return check_index(fn,head,numchan,ids);
+}
+
+size_t update_qts_py(const std::string& origfn, const std::string& qtsfn, const std::vector<std::string>& changes, const std::string& outfn, size_t numchan, double buffer, size_t max_depth) {
+    py::gil_scoped_release r;
+    return run_update_qts(origfn,qtsfn,changes,outfn,numchan,buffer,max_depth);
+}
+std::pair<int64,int64> merge_change_files_py(const std::string& prfx, const std::vector<std::string>& fls, const std::string& outfn, size_t numchan) {
+    py::gil_scoped_release r;
+    return merge_change_files(prfx,fls,outfn,numchan);
+}
+std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtTree>>
+    add_orig_elements_idtilestore_py(element_map& em, const std::string& prfx, std::vector<std::string> fls, std::shared_ptr<IdTileStore> store) {
+    py::gil_scoped_release r;
+    return add_orig_elements_idtilestore(em.u,prfx,fls,store);
+}
+
+std::shared_ptr<IdTileStore> build_idtilestore_py(const std::string& path, const std::string& prfx, const std::vector<std::string>& fls, size_t numchan) {
+    py::gil_scoped_release r;
+    return build_idtilestore(path,prfx,fls,numchan);
+}
+
 PYBIND11_DECLARE_HOLDER_TYPE(XX, std::shared_ptr<XX>);
 void update_defs(py::module& m) {
     
@@ -169,6 +208,7 @@ void update_defs(py::module& m) {
         read_xml_change_em(d,em.u,allow_missing_users);
     });
     m.def("read_xml_change_file_em", &read_xml_change_file_em_py);
+    m.def("read_xml_change_files_em", &read_xml_change_files_em_py, py::arg("fns"), py::arg("em"), py::arg("numchan")=4, py::arg("allow_missing_users")=true);
 
     
     m.def("add_orig_elements", &add_orig_elements_py);
@@ -178,17 +218,49 @@ void update_defs(py::module& m) {
     m.def("find_change_tiles", &find_change_tiles_py);
     m.def("calc_change_qts", &calc_change_qts_py);
 
-    m.def("find_change_all", &find_change_all_py);
+    m.def("find_change_all", &find_change_all_py, py::arg("src_filenames"), py::arg("prfx"), py::arg("fls"), py::arg("st"), py::arg("et"), py::arg("outfn"), py::arg("numchan")=4, py::arg("idtilestore")="");
 
     m.def("check_index_file", &check_index_file_py);
-    m.def("write_index_file", &write_index_file_py, py::arg("fn"), py::arg("numchan")=4, py::arg("outfn")="");
+    m.def("write_index_file", &write_index_file_py, py::arg("fn"), py::arg("numchan")=4, py::arg("outfn")="", py::arg("idtile")=false);
+    m.def("write_index_filter_file", &write_index_filter_file_py, py::arg("fn"), py::arg("numchan")=4, py::arg("range_bits")=8);
+    m.def("check_index", &check_index_py);
     
     m.def("read_file_blocks", [](const std::string& fn, std::vector<int64> locs, size_t numchan,size_t index_offset, bool change, ReadBlockFlags objflags, IdSetPtr ids   ) {
         py::gil_scoped_release r;
         return read_file_blocks(fn,locs,numchan,index_offset,change,objflags,ids);
     });
     
+    m.def("update_qts", &update_qts_py, py::arg("origfn"), py::arg("qtsfn"), py::arg("changes"), py::arg("outfn"),
+        py::arg("numchan")=4, py::arg("buffer")=0.05, py::arg("max_depth")=17);
+    
     m.def("make_idset", [](element_map &em) { return make_idset(em.u);  });
+
+    py::class_<IdTileStore, std::shared_ptr<IdTileStore>>(m, "IdTileStore")
+        .def_property_readonly("last_file", &IdTileStore::last_file)
+        .def_property_readonly("num_runs", &IdTileStore::num_runs)
+        .def_property_readonly("num_entries", &IdTileStore::num_entries)
+        .def("find", [](const IdTileStore& s, const std::vector<int64>& ids) {
+            std::vector<std::tuple<int64,int64,int64>> res;
+            for (const auto& e: s.find(ids)) {
+                res.push_back(std::make_tuple(e.id, e.quadtree, e.tile));
+            }
+            return res;
+        })
+        .def("add", [](IdTileStore& s, const std::vector<PrimitiveBlockPtr>& tiles, const std::string& fn) {
+            py::gil_scoped_release r;
+            s.add(find_idtile_entries(tiles), fn);
+        })
+        .def("compact", [](IdTileStore& s) {
+            py::gil_scoped_release r;
+            s.compact();
+        })
+        .def("set_last_file", &IdTileStore::set_last_file)
+    ;
+    m.def("open_idtilestore", &open_idtilestore);
+    m.def("build_idtilestore", &build_idtilestore_py, py::arg("path"), py::arg("prfx"), py::arg("fls"), py::arg("numchan")=4);
+    m.def("add_orig_elements_idtilestore", &add_orig_elements_idtilestore_py);
+
+    m.def("merge_change_files", &merge_change_files_py, py::arg("prfx"), py::arg("fls"), py::arg("outfn"), py::arg("numchan")=4);
 }
 
 #ifdef INDIVIDUAL_MODULES
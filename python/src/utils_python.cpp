@@ -30,6 +30,7 @@
 #include "oqt/utils/geometry.hpp"
 #include "oqt/utils/logger.hpp"
 #include "oqt/utils/operatingsystem.hpp"
+#include "oqt/utils/telemetry.hpp"
 
 #include "oqt/utils/pbf/varint.hpp"
 #include "oqt/utils/pbf/protobuf.hpp"
@@ -122,6 +123,15 @@ void utils_defs(py::module& m) {
     // include/oqt/utils/operatingsystem.hpp
     m.def("checkstats", &checkstats);
     m.def("file_size", &file_size);
+    
+    // include/oqt/utils/telemetry.hpp
+    m.def("telemetry_enable", [](bool trace) { Telemetry::Get().enable(trace); }, py::arg("trace")=false);
+    m.def("telemetry_disable", []() { Telemetry::Get().disable(); });
+    m.def("telemetry_reset", []() { Telemetry::Get().reset(); });
+    m.def("telemetry_report", []() { return Telemetry::Get().report_json(); });
+    m.def("telemetry_trace", []() { return Telemetry::Get().trace_json(); });
+    m.def("write_telemetry_report", [](const std::string& fn) { Telemetry::Get().write_report(fn); });
+    m.def("write_telemetry_trace", [](const std::string& fn) { Telemetry::Get().write_trace(fn); });
 
 
 
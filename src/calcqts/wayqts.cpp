@@ -219,10 +219,12 @@ class AddLocationsToWayNodes {
             while (block && (block->size()==0)) {
                 block = next_block();
             }
+            pos=0;
             if (!block) {
-                throw std::domain_error("no way nodes???");
+                //no ways in this range (as in files with small way ids)
+                w=-1; n=-1;
+                return;
             }
-            pos=0;
             w= block->way_at(0); n=block->node_at(0);
             
             curr = make_waynodelocationblock(block->key(), block->size());
@@ -242,7 +244,7 @@ class AddLocationsToWayNodes {
                 expand_all(nullptr);
                 return;
             }
-            if (mb->nodes.empty()) { return; }
+            if (mb->nodes.empty() || !curr) { return; }
             
             if ((mb->index % 100) == 0) {
                 int64 now=getmemval(pid);
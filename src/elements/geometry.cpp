@@ -41,7 +41,7 @@ uint64 GeometryPacked::InternalId() const { return internalid; }
 
 ElementType GeometryPacked::OriginalType() const { return ElementType::Unknown; }
 bbox GeometryPacked::Bounds() const { return bbox{1,1,0,0}; }
-std::string GeometryPacked::Wkb(bool transform, bool srid) const { throw std::domain_error("not implemented"); }
+std::string GeometryPacked::Wkb(bool transform, bool srid, int64 zoom) const { throw std::domain_error("not implemented"); }
 
 std::list<PbfTag> GeometryPacked::pack_extras() const { return geom_messages; }
 
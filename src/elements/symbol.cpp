@@ -0,0 +1,104 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/elements/symbol.hpp"
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace oqt {
+
+class SymbolTable {
+    public:
+        SymbolTable() {
+            entries.push_back(Symbol::Entry{"", 0});
+            lookup[std::string_view(entries.back().str)] = &entries.back();
+        }
+        
+        const Symbol::Entry* empty() const { return &entries.front(); }
+        
+        const Symbol::Entry* find_or_insert(std::string_view s) {
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex);
+                auto it = lookup.find(s);
+                if (it!=lookup.end()) {
+                    return it->second;
+                }
+            }
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            auto it = lookup.find(s);
+            if (it!=lookup.end()) {
+                return it->second;
+            }
+            //std::deque::push_back does not move existing entries, so
+            //the string_view keys and the Entry pointers remain valid
+            entries.push_back(Symbol::Entry{std::string(s), (uint32_t) entries.size()});
+            lookup[std::string_view(entries.back().str)] = &entries.back();
+            return &entries.back();
+        }
+        
+        size_t size() {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            return entries.size();
+        }
+        
+    private:
+        std::shared_mutex mutex;
+        std::deque<Symbol::Entry> entries;
+        std::unordered_map<std::string_view, const Symbol::Entry*> lookup;
+};
+
+SymbolTable& symbol_table() {
+    static SymbolTable table;
+    return table;
+}
+
+const Symbol::Entry* intern_symbol(std::string_view s) {
+    auto& table = symbol_table();
+    if (s.empty()) {
+        return table.empty();
+    }
+    
+    //each thread keeps a small direct mapped cache of recent symbols, so
+    //that most lookups do not need to take the table's lock
+    thread_local std::array<const Symbol::Entry*, 4096> recent{};
+    auto& slot = recent[std::hash<std::string_view>()(s) & 4095];
+    if (slot && (std::string_view(slot->str)==s)) {
+        return slot;
+    }
+    slot = table.find_or_insert(s);
+    return slot;
+}
+
+Symbol::Symbol() : entry(symbol_table().empty()) {}
+Symbol::Symbol(const std::string& s) : entry(intern_symbol(s)) {}
+Symbol::Symbol(const char* s) : entry(intern_symbol(s)) {}
+
+size_t symbol_table_size() {
+    return symbol_table().size();
+}
+
+}
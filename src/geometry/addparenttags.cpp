@@ -36,9 +36,16 @@ PrimitiveBlockPtr finish_tags(int64 qt, pending_objs_map& pending) {
     pb->SetQuadtree(qt);
     for (auto& po : pending) {
         if (!po.second.second.empty()) {
-
+            
+            //the node may be shared with a BlockCache, so is copied
+            //before adding tags
+            bool copied=false;
             for (auto& tt: po.second.second) {
                 if (!tt.second.empty()) {
+                    if (!copied) {
+                        po.second.first = po.second.first->copy();
+                        copied=true;
+                    }
                     po.second.first->AddTag(tt.first,tt.second);
                 }
             }
@@ -33,113 +33,175 @@
 #include <map>
 #include <unordered_map>
 #include <algorithm>
+#include <limits>
 
 namespace oqt {
 namespace geometry {
 
-//typedef std::map<int64,LonLat> loctile;
-typedef std::pair<int64,LonLat> llp;
-typedef std::vector<llp> loctile;
+/*! Node locations for one tile, held in a flat open addressing hash
+ * table. Tables are not changed once built, so can be shared between
+ * threads. */
+class LonLatTile {
+    public:
+        LonLatTile(PrimitiveBlockPtr block) : qt(block->Quadtree()), count(0), mask(0) {
+            size_t nn=0;
+            for (auto& o : block->Objects()) {
+                if (o->Type()==ElementType::Node) { nn++; }
+            }
+            if (nn==0) { return; }
+
+            size_t cap=16;
+            while (cap < 2*nn) { cap*=2; }
+            mask = cap-1;
+            slots.resize(cap, std::make_pair(empty_key, LonLat{0,0}));
 
-LonLat get_ll(const std::map<int64,std::shared_ptr<loctile>>& tiles, int64 n) {
-    for (auto jt=tiles.rbegin(); jt!= tiles.rend(); ++jt) {
-        const auto& tile = *jt;
-        
-        if (tile.second->empty()) {
-            continue;
+            for (auto& o : block->Objects()) {
+                if (o->Type()==ElementType::Node) {
+                    auto n = std::dynamic_pointer_cast<Node>(o);
+                    insert(o->Id(), LonLat{n->Lon(),n->Lat()});
+                }
+            }
         }
-        
-        /*auto it=tile.second->find(n);
-        if (it!=tile.second->end()) {
-            return it->second;
-        }*/
-        
-        auto it = std::lower_bound(tile.second->begin(),tile.second->end(),std::make_pair(n,LonLat{0,0}),[](const llp& l, const llp& r)->bool { return l.first<r.first; });
-        if (it < tile.second->end()) {
-            if (it->first==n) {
-                return it->second;
+
+        int64 Quadtree() const { return qt; }
+        bool empty() const { return count==0; }
+
+        const LonLat* find(int64 ref) const {
+            if (count==0) { return nullptr; }
+            for (size_t i=slot(ref); ; i=(i+1)&mask) {
+                const auto& s = slots[i];
+                if (s.first==ref) { return &s.second; }
+                if (s.first==empty_key) { return nullptr; }
             }
+            return nullptr;
         }
+
+    private:
+        static constexpr int64 empty_key = std::numeric_limits<int64>::min();
+        int64 qt;
+        size_t count;
+        size_t mask;
+        std::vector<std::pair<int64,LonLat>> slots;
+
+        size_t slot(int64 ref) const {
+            uint64 h = ((uint64) ref) * 0x9E3779B97F4A7C15ull;
+            return (h ^ (h>>29)) & mask;
+        }
+
+        void insert(int64 ref, const LonLat& ll) {
+            for (size_t i=slot(ref); ; i=(i+1)&mask) {
+                auto& s = slots[i];
+                if (s.first==empty_key) {
+                    s = std::make_pair(ref, ll);
+                    count++;
+                    return;
+                }
+                if (s.first==ref) {
+                    s.second = ll;
+                    return;
+                }
+            }
+        }
+};
+
+typedef std::vector<std::shared_ptr<const LonLatTile>> lonlattile_chain;
+
+/*! Find the locations of \param refs, looking in the deepest tile in \param
+ * chain first. Each tile is searched for all the remaining refs in turn. */
+void find_lonlats(const lonlattile_chain& chain, const std::vector<int64>& refs, std::vector<LonLat>& result) {
+    result.resize(refs.size());
+    std::vector<size_t> missing(refs.size());
+    for (size_t i=0; i < refs.size(); i++) { missing[i]=i; }
+
+    for (auto jt=chain.rbegin(); jt!=chain.rend() && !missing.empty(); ++jt) {
+        const auto& tile = **jt;
+        size_t nm=0;
+        for (size_t i: missing) {
+            auto ll = tile.find(refs[i]);
+            if (ll) {
+                result[i] = *ll;
+            } else {
+                missing[nm++] = i;
+            }
+        }
+        missing.resize(nm);
     }
-    throw std::range_error("ref not present");
-    return LonLat{0,0};
-}
-std::vector<LonLat> get_lonlats(const std::map<int64,std::shared_ptr<loctile>>& tiles, std::shared_ptr<Way> way) {
-            
-    std::vector<LonLat> res;
-    res.reserve(way->Refs().size());
-    for (auto& r : way->Refs()) {
-        res.push_back(get_ll(tiles, r));
+    if (!missing.empty()) {
+        throw std::range_error("ref not present");
     }
-    return res;
 }
 
-void populate_tile(loctile& lls, PrimitiveBlockPtr block) {
-            
-    lls.reserve(block->size());
+
+std::vector<std::vector<LonLat>> get_lonlats_block(const lonlattile_chain& chain, PrimitiveBlockPtr block) {
+    std::vector<int64> refs;
     for (auto& o : block->Objects()) {
-        if (o->Type()==ElementType::Node) {
-            auto n = std::dynamic_pointer_cast<Node>(o);
-            //lls.insert(std::make_pair(o->Id(), LonLat{n->Lon(),n->Lat()}));
-            lls.push_back(std::make_pair(o->Id(), LonLat{n->Lon(),n->Lat()}));
+        if (o->Type()==ElementType::Way) {
+            const auto& rr = std::dynamic_pointer_cast<Way>(o)->Refs();
+            refs.insert(refs.end(), rr.begin(), rr.end());
         }
     }
-    if (!lls.empty()) {
-        std::sort(lls.begin(),lls.end(),[](const llp& l, const llp& r)->bool { return l.first<r.first; });
+    std::vector<LonLat> lls;
+    find_lonlats(chain, refs, lls);
+
+    std::vector<std::vector<LonLat>> result;
+    auto it = lls.begin();
+    for (auto& o : block->Objects()) {
+        if (o->Type()==ElementType::Way) {
+            size_t nr = std::dynamic_pointer_cast<Way>(o)->Refs().size();
+            result.push_back(std::vector<LonLat>(it, it+nr));
+            it += nr;
+        }
     }
-    
+    return result;
 }
 
 
+
 class LonLatStoreImpl : public LonLatStore {
-    
-        
-        
-    
     public:
         LonLatStoreImpl() {}
         virtual ~LonLatStoreImpl() {}
-        
-        
-                
-        void add_populated_tile(int64 qt, std::shared_ptr<loctile> lls) {
-            for (auto it=tiles.cbegin(); it!=tiles.cend(); ) {
-                if (quadtree::common(qt, it->first) != it->first) {
-                    it=tiles.erase(it);
-                } else {
-                    it++;
-                }
-            }
 
-            
-            if (!lls->empty()) {
-                tiles[qt] = lls;
-            }
-        }
-        
         virtual void add_tile(PrimitiveBlockPtr block) {
             if (!block) {
                 Logger::Message() << "add_tile empty block??"; 
             }
-            auto lls = std::make_shared<loctile>();
-            populate_tile(*lls, block);
-            add_populated_tile(block->Quadtree(), lls);
-        }
+            int64 qt = block->Quadtree();
 
+            //tiles arrive in quadtree order, so the active tiles are a
+            //chain of ancestors, and those no longer needed are at the end
+            while (!chain.empty() && (quadtree::common(qt, chain.back()->Quadtree()) != chain.back()->Quadtree())) {
+                chain.pop_back();
+            }
 
-            
+            auto tile = std::make_shared<LonLatTile>(block);
+            if (!tile->empty()) {
+                if (!chain.empty() && (chain.back()->Quadtree()==qt)) {
+                    chain.back() = tile;
+                } else {
+                    chain.push_back(tile);
+                }
+            }
+        }
 
         virtual std::vector<LonLat> get_lonlats(std::shared_ptr<Way> way) {
-            return oqt::geometry::get_lonlats(tiles, way);           
+            std::vector<LonLat> res;
+            find_lonlats(chain, way->Refs(), res);
+            return res;
+        }
+
+        virtual std::vector<std::vector<LonLat>> get_lonlats_block(PrimitiveBlockPtr block) {
+            return oqt::geometry::get_lonlats_block(chain, block);
         }
-        
+
         virtual void finish() {
-            tiles.clear();
-            std::map<int64,std::shared_ptr<loctile>> o;
-            tiles.swap(o);
+            lonlattile_chain o;
+            chain.swap(o);
         }
+
+        const lonlattile_chain& Chain() const { return chain; }
     private:
-        std::map<int64,std::shared_ptr<loctile>> tiles;
+        lonlattile_chain chain;
 };
 
 std::shared_ptr<LonLatStore> make_lonlatstore() {
@@ -147,17 +209,11 @@ std::shared_ptr<LonLatStore> make_lonlatstore() {
 }
 
 
-//PrimitiveBlockPtr add_waynodes(const std::map<int64,std::shared_ptr<loctile>>& tiles, PrimitiveBlockPtr in_bl) {
-PrimitiveBlockPtr add_waynodes(std::shared_ptr<LonLatStore> lls, PrimitiveBlockPtr in_bl) {
-    if (!in_bl) { 
-        Logger::Message() << "add_waynodes empty block??";         
-        return in_bl;
-    }
-    
+PrimitiveBlockPtr add_waynodes_lonlats(PrimitiveBlockPtr in_bl, const std::vector<std::vector<LonLat>>& lonlats) {
     auto out_bl = std::make_shared<PrimitiveBlock>(in_bl->Index(), in_bl->size());
     out_bl->CopyMetadata(in_bl);
-    
-    
+
+    auto it = lonlats.begin();
     for (auto& o : in_bl->Objects()) {
         if (o->Type()==ElementType::Node) {
             if (!o->Tags().empty()) {
@@ -165,8 +221,9 @@ PrimitiveBlockPtr add_waynodes(std::shared_ptr<LonLatStore> lls, PrimitiveBlockP
             }
         } else if (o->Type()==ElementType::Way) {
             auto w = std::dynamic_pointer_cast<Way>(o);
-            auto wwn = std::make_shared<WayWithNodes>(w, lls->get_lonlats(w));
+            auto wwn = std::make_shared<WayWithNodes>(w, *it);
             out_bl->add(wwn);
+            ++it;
         } else {
             out_bl->add(o);
         }
@@ -174,6 +231,15 @@ PrimitiveBlockPtr add_waynodes(std::shared_ptr<LonLatStore> lls, PrimitiveBlockP
     return out_bl;
 }
 
+//PrimitiveBlockPtr add_waynodes(const std::map<int64,std::shared_ptr<loctile>>& tiles, PrimitiveBlockPtr in_bl) {
+PrimitiveBlockPtr add_waynodes(std::shared_ptr<LonLatStore> lls, PrimitiveBlockPtr in_bl) {
+    if (!in_bl) { 
+        Logger::Message() << "add_waynodes empty block??";         
+        return in_bl;
+    }
+    return add_waynodes_lonlats(in_bl, lls->get_lonlats_block(in_bl));
+}
+
 block_callback make_addwaynodes_cb(block_callback cb) {
     auto lls = make_lonlatstore();
     return [lls,cb](PrimitiveBlockPtr bl) {
@@ -187,45 +253,52 @@ block_callback make_addwaynodes_cb(block_callback cb) {
     };
 }
 
-/*
-struct loctile_pb {
-    std::map<int64,std::shared_ptr<loctile>> tiles;
-    PrimitiveBlockPtr pb;
-};*/
+struct WayNodesTask {
+    PrimitiveBlockPtr block;
+    lonlattile_chain chain;
+};
 
-block_callback make_waynodes_cb_split(block_callback cb) {
-    Logger::Message() << "splitting add waynodes doesn't help";
-    return make_addwaynodes_cb(cb);
-    
-    /*
-    auto lls = std::make_shared<LonLatStoreImpl>();
-    auto second=threaded_callback<loctile_pb>::make(
-        [cb](std::shared_ptr<loctile_pb> bl) {
-            if (!bl) {
-                
-                cb(nullptr);
-                return;
+block_callback make_addwaynodes_cb_parallel(block_callback cb, size_t numchan) {
+    if (numchan<=1) {
+        return make_addwaynodes_cb(cb);
+    }
+
+    auto out = multi_threaded_callback<PrimitiveBlock>::make(cb, numchan);
+    std::vector<std::function<void(std::shared_ptr<WayNodesTask>)>> workers;
+    for (auto o: out) {
+        workers.push_back(threaded_callback<WayNodesTask>::make(
+            [o](std::shared_ptr<WayNodesTask> task) {
+                if (!task) {
+                    o(nullptr);
+                    return;
+                }
+                o(add_waynodes_lonlats(task->block, get_lonlats_block(task->chain, task->block)));
             }
-            
-            cb(add_waynodes(bl->tiles, bl->pb));
-        }
-     );
-    
-    return [lls,second](PrimitiveBlockPtr bl) {
+        ));
+    }
+
+    //each block is passed, with the chain of tiles it needs, to the
+    //workers in turn, and read back from out in the same order
+    auto lls = std::make_shared<LonLatStoreImpl>();
+    auto next = std::make_shared<size_t>(0);
+    return [lls, workers, next](PrimitiveBlockPtr bl) {
         if (!bl) {
             lls->finish();
-            second(nullptr);
+            for (auto& w: workers) {
+                w(nullptr);
+            }
             return;
         }
         lls->add_tile(bl);
-        
-        auto ltp = std::make_shared<loctile_pb>();
-        ltp->pb = bl;
-        ltp->tiles=lls->get_tiles();
-        
-        second(ltp);
+        auto task = std::make_shared<WayNodesTask>();
+        task->block = bl;
+        task->chain = lls->Chain();
+        workers[(*next)++ % workers.size()](task);
     };
-    */
+}
+
+block_callback make_waynodes_cb_split(block_callback cb) {
+    return make_addwaynodes_cb_parallel(cb, 2);
 }
 
 }}
@@ -115,13 +115,48 @@ double ComplicatedPolygon::Area() const {
     return a;
 }
 //int64 ComplicatedPolygon::Part() const { return part; }
+void ComplicatedPolygon::CalcVertexZooms() {
+    for (auto& part: parts) {
+        calc_ring_vertex_zooms(part.outer);
+        for (auto& inner: part.inners) {
+            calc_ring_vertex_zooms(inner);
+        }
+    }
+}
+
+std::vector<PolygonPart> ComplicatedPolygon::SimplifiedParts(int64 zoom) const {
+    std::vector<PolygonPart> result;
+    for (const auto& part: parts) {
+        Ring outer = simplify_ring(part.outer, zoom);
+        if (ringpart_numpoints(outer) < 4) {
+            continue;
+        }
+        PolygonPart sp(part.index, outer, {}, part.area);
+        for (const auto& inner: part.inners) {
+            Ring ii = simplify_ring(inner, zoom);
+            if (ringpart_numpoints(ii) >= 4) {
+                sp.inners.push_back(ii);
+            }
+        }
+        result.push_back(sp);
+    }
+    return result;
+}
+
 ElementPtr ComplicatedPolygon::copy() { return std::make_shared<ComplicatedPolygon>(
     Id(),Quadtree(),Info(),Tags(),parts/*,outers,inners*/,zorder,layer,/*area,*/bounds,MinZoom()); }
 
 bbox ComplicatedPolygon::Bounds() const { return bounds; }
 
 
-std::string ComplicatedPolygon::Wkb(bool transform, bool srid) const {
+std::string ComplicatedPolygon::Wkb(bool transform, bool srid, int64 zoom) const {
+    if (zoom>=0) {
+        return polygon_parts_wkb(SimplifiedParts(zoom), transform, srid);
+    }
+    return polygon_parts_wkb(parts, transform, srid);
+}
+
+std::string polygon_parts_wkb(const std::vector<PolygonPart>& parts, bool transform, bool srid) {
     if (parts.size()==0) {
         return make_multi_wkb(7, {}, transform, srid);
     }
@@ -21,6 +21,7 @@
  *****************************************************************************/
 
 #include "oqt/geometry/elements/linestring.hpp"
+#include "oqt/geometry/simplify.hpp"
 
 #include "oqt/pbfformat/readblock.hpp"
 
@@ -55,15 +56,38 @@ const std::vector<LonLat>& Linestring::LonLats() const { return lonlats; }
 double Linestring::Length() const { return length; }
 std::optional<int64> Linestring::ZOrder() const { return zorder; }
 std::optional<int64> Linestring::Layer() const { return layer; }
-ElementPtr Linestring::copy() { return std::make_shared<Linestring>(//*this); }
-    Id(),Quadtree(),Info(),Tags(),refs,lonlats,zorder,layer,length,bounds,MinZoom()); }
+ElementPtr Linestring::copy() {
+    auto result = std::make_shared<Linestring>(//*this); }
+        Id(),Quadtree(),Info(),Tags(),refs,lonlats,zorder,layer,length,bounds,MinZoom());
+    result->SetVertexZooms(vertex_zooms);
+    return result;
+}
+
+const std::vector<uint8_t>& Linestring::VertexZooms() const { return vertex_zooms; }
+void Linestring::SetVertexZooms(const std::vector<uint8_t>& vertex_zooms_) {
+    if (!vertex_zooms_.empty() && (vertex_zooms_.size()!=lonlats.size())) {
+        throw std::domain_error("Linestring::SetVertexZooms: wrong number of values");
+    }
+    vertex_zooms = vertex_zooms_;
+}
+void Linestring::CalcVertexZooms() {
+    bool is_ring = (refs.size()>3) && (refs.front()==refs.back());
+    vertex_zooms = calc_vertex_zooms(lonlats, is_ring);
+}
 
 bbox Linestring::Bounds() const { return bounds; }
 
        
-std::string Linestring::Wkb(bool transform, bool srid) const {
-
-    std::string res((srid?13:9)+16*lonlats.size(),'\0');
+std::string Linestring::Wkb(bool transform, bool srid, int64 zoom) const {
+    
+    std::vector<LonLat> simplified;
+    const std::vector<LonLat>* ll = &lonlats;
+    if ((zoom>=0) && !vertex_zooms.empty()) {
+        simplified = simplify_lonlats(lonlats, vertex_zooms, zoom);
+        ll = &simplified;
+    }
+    
+    std::string res((srid?13:9)+16*ll->size(),'\0');
     //res[0]='\1';
     res[4]='\2';
     size_t pos=5;
@@ -71,7 +95,7 @@ std::string Linestring::Wkb(bool transform, bool srid) const {
         res[1]=' ';
         pos = write_uint32(res,pos,epsg_code(transform));
     }
-    write_ring(res,pos,lonlats, transform);
+    write_ring(res,pos,*ll, transform);
     return res;
 }
 
@@ -83,6 +107,9 @@ std::list<PbfTag> Linestring::pack_extras() const {
     extras.push_back(PbfTag{13,0,write_packed_delta_func<LonLat>(lonlats,[](const LonLat& l)->int64 { return l.lon; })}); //lons
     extras.push_back(PbfTag{14,0,write_packed_delta_func<LonLat>(lonlats,[](const LonLat& l)->int64 { return l.lat; })}); //lats
     extras.push_back(PbfTag{15,zig_zag(to_int(length*100)),""});
+    if (!vertex_zooms.empty()) {
+        extras.push_back(PbfTag{26,0,write_packed_int_func<uint8_t>(vertex_zooms,[](const uint8_t& z)->uint64 { return z; })});
+    }
     if (MinZoom()) {
         extras.push_back(PbfTag{22,uint64(*MinZoom()),""});
     }
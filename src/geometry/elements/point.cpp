@@ -60,7 +60,7 @@ bbox Point::Bounds() const { return bbox{lon,lat,lon,lat}; }
     
     
     
-std::string Point::Wkb(bool transform, bool srid) const {
+std::string Point::Wkb(bool transform, bool srid, int64 zoom) const {
     std::string res(srid ? 25 : 21,'\0');
     res[4]='\1';
     size_t pos=5;
@@ -21,6 +21,7 @@
  *****************************************************************************/
 
 #include "oqt/geometry/elements/ring.hpp"
+#include "oqt/geometry/simplify.hpp"
 
 #include "oqt/pbfformat/readblock.hpp"
 
@@ -107,6 +108,32 @@ size_t write_ring(std::string& data, size_t pos, const std::vector<LonLat>& lonl
     return pos;
 }
 
+void calc_ring_vertex_zooms(Ring& ring) {
+    for (auto& rp: ring.parts) {
+        bool is_ring = (rp.refs.size()>3) && (rp.refs.front()==rp.refs.back());
+        rp.vertex_zooms = calc_vertex_zooms(rp.lonlats, is_ring);
+    }
+}
+
+Ring simplify_ring(const Ring& ring, int64 zoom) {
+    Ring result;
+    for (const auto& rp: ring.parts) {
+        if ((zoom<0) || (rp.vertex_zooms.size()!=rp.lonlats.size()) || (rp.refs.size()!=rp.lonlats.size())) {
+            result.parts.push_back(rp);
+            continue;
+        }
+        Ring::Part sp{rp.orig_id,{},{},rp.reversed,{}};
+        for (size_t i=0; i < rp.lonlats.size(); i++) {
+            if (rp.vertex_zooms[i] <= zoom) {
+                sp.refs.push_back(rp.refs[i]);
+                sp.lonlats.push_back(rp.lonlats[i]);
+            }
+        }
+        result.parts.push_back(sp);
+    }
+    return result;
+}
+
 std::string pack_ringpart(const Ring::Part& rp) {
     std::string refsp = write_packed_delta(rp.refs);
     std::string lonsp = write_packed_delta_func<LonLat>(rp.lonlats, [](const LonLat& l) { return l.lon; });
@@ -120,6 +147,11 @@ std::string pack_ringpart(const Ring::Part& rp) {
     if (rp.reversed) {
         pos = write_pbf_value(res,pos,5,1);
     }
+    if (!rp.vertex_zooms.empty()) {
+        std::string zoomsp = write_packed_int_func<uint8_t>(rp.vertex_zooms, [](const uint8_t& z)->uint64 { return z; });
+        res.resize(pos+10+zoomsp.size());
+        pos = write_pbf_data(res,pos,6,zoomsp);
+    }
     res.resize(pos);
     return res;
 }
@@ -165,6 +197,11 @@ Ring::Part unpack_ringpart(const std::string& data) {
         if (tag.tag==3) { read_lonlats_lons(res.lonlats, tag.data); }
         if (tag.tag==4) { read_lonlats_lats(res.lonlats, tag.data); }
         if (tag.tag==5) { res.reversed=(tag.value==1); }
+        if (tag.tag==6) {
+            for (auto z: read_packed_int(tag.data)) {
+                res.vertex_zooms.push_back(z);
+            }
+        }
 
     }
     return res;
@@ -21,6 +21,7 @@
  *****************************************************************************/
 
 #include "oqt/geometry/elements/simplepolygon.hpp"
+#include "oqt/geometry/simplify.hpp"
 
 #include "oqt/pbfformat/readblock.hpp"
 
@@ -69,15 +70,38 @@ std::optional<int64> SimplePolygon::ZOrder() const { return zorder; }
 std::optional<int64> SimplePolygon::Layer() const { return layer; }
 double SimplePolygon::Area() const { return area; }
 
-ElementPtr SimplePolygon::copy() { return std::make_shared<SimplePolygon>(//*this); }
-    Id(),Quadtree(),Info(),Tags(),refs,lonlats,zorder,layer,area,bounds,MinZoom(),reversed); }
+ElementPtr SimplePolygon::copy() {
+    auto result = std::make_shared<SimplePolygon>(//*this); }
+        Id(),Quadtree(),Info(),Tags(),refs,lonlats,zorder,layer,area,bounds,MinZoom(),reversed);
+    result->SetVertexZooms(vertex_zooms);
+    return result;
+}
 
-bbox SimplePolygon::Bounds() const { return bounds; }
+const std::vector<uint8_t>& SimplePolygon::VertexZooms() const { return vertex_zooms; }
+void SimplePolygon::SetVertexZooms(const std::vector<uint8_t>& vertex_zooms_) {
+    if (!vertex_zooms_.empty() && (vertex_zooms_.size()!=lonlats.size())) {
+        throw std::domain_error("SimplePolygon::SetVertexZooms: wrong number of values");
+    }
+    vertex_zooms = vertex_zooms_;
+}
+void SimplePolygon::CalcVertexZooms() {
+    vertex_zooms = calc_vertex_zooms(lonlats, true);
+}
 
+bbox SimplePolygon::Bounds() const { return bounds; }
 
-std::string SimplePolygon::Wkb(bool transform, bool srid) const {
 
-    std::string res((srid?17:13)+16*lonlats.size(),'\0');
+std::string SimplePolygon::Wkb(bool transform, bool srid, int64 zoom) const {
+    
+    std::vector<LonLat> ll;
+    if ((zoom>=0) && !vertex_zooms.empty()) {
+        ll = simplify_lonlats(lonlats, vertex_zooms, zoom);
+    } else if (reversed) {
+        ll = lonlats;
+    }
+    const std::vector<LonLat>& out = ll.empty() ? lonlats : ll;
+    
+    std::string res((srid?17:13)+16*out.size(),'\0');
     //res[0]='\1';
     res[4]='\3';
     size_t pos=5;
@@ -87,11 +111,10 @@ std::string SimplePolygon::Wkb(bool transform, bool srid) const {
     }
     pos=write_uint32(res,pos, 1);
     if (reversed) {
-        std::vector<LonLat> ll = lonlats;
         std::reverse(ll.begin(),ll.end());
         write_ring(res, pos,ll, transform);
     } else {
-        write_ring(res, pos,lonlats, transform);
+        write_ring(res, pos,out, transform);
     }
     return res;
 }
@@ -105,6 +128,9 @@ std::list<PbfTag> SimplePolygon::pack_extras() const {
     extras.push_back(PbfTag{13,0,write_packed_delta_func<LonLat>(lonlats,[](const LonLat& l)->int64 { return l.lon; })}); //lons
     extras.push_back(PbfTag{14,0,write_packed_delta_func<LonLat>(lonlats,[](const LonLat& l)->int64 { return l.lat; })}); //lats
     extras.push_back(PbfTag{16,zig_zag(to_int(area*100)),""});
+    if (!vertex_zooms.empty()) {
+        extras.push_back(PbfTag{26,0,write_packed_int_func<uint8_t>(vertex_zooms,[](const uint8_t& z)->uint64 { return z; })});
+    }
     
     if (MinZoom()) {
         extras.push_back(PbfTag{22,uint64(*MinZoom()),""});
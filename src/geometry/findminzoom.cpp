@@ -27,6 +27,8 @@
 #include "oqt/geometry/elements/simplepolygon.hpp"
 #include "oqt/geometry/elements/complicatedpolygon.hpp"
 #include <map>
+#include <unordered_map>
+#include <array>
 
 namespace oqt {
 namespace geometry {
@@ -51,6 +53,10 @@ class FindMinZoomOneTag : public FindMinZoom {
     public:
         typedef std::map<std::tuple<int64,std::string,std::string>,std::pair<int64,int64>> tagmap;
         
+        //for each value of a key, the tagmap entries for object types 0, 1 and 2
+        typedef std::array<tagmap::iterator,3> type_entries;
+        typedef std::unordered_map<std::string, type_entries> value_entries;
+        
         FindMinZoomOneTag(const tag_spec& spec, double ml_, double ma_) :
             minlen(ml_), minarea(ma_) {
             
@@ -58,7 +64,20 @@ class FindMinZoomOneTag : public FindMinZoom {
                 int64 a,d; std::string b,c;
                 std::tie(a,b,c,d) = t;
                 tm.insert(std::make_pair(std::make_tuple(a,b,c),std::make_pair(d,0)));
-                keys.insert(b);
+            }
+            
+            //compile the spec into a key -> value -> type lookup, so that
+            //each tag needs two hash lookups rather than a search of tm
+            //with the whole (type, key, value) tuple
+            for (auto it=tm.begin(); it!=tm.end(); ++it) {
+                int64 ty = std::get<0>(it->first);
+                auto& ve = keys[std::get<1>(it->first)];
+                if ((ty<0) || (ty>2)) { continue; }
+                auto vt = ve.find(std::get<2>(it->first));
+                if (vt==ve.end()) {
+                    vt = ve.emplace(std::get<2>(it->first), type_entries{tm.end(),tm.end(),tm.end()}).first;
+                }
+                vt->second[ty] = it;
             }
         }
         
@@ -73,20 +92,24 @@ class FindMinZoomOneTag : public FindMinZoom {
             return *mz <= min_max_zoom_level;
         }
         
-        void check_tag(tagmap::iterator& curr_it, int64 ty, const Tag& t) {
+        tagmap::iterator find_entry(const value_entries& ve, int64 ty, const std::string& val) {
+            auto vt = ve.find(val);
+            if (vt==ve.end()) {
+                return tm.end();
+            }
+            return vt->second[ty];
+        }
+        
+        void check_tag(tagmap::iterator& curr_it, int64 ty, const value_entries& ve, const Tag& t) {
         
-            auto it = tm.find(std::make_tuple(ty,t.key,t.val));
+            auto it = find_entry(ve, ty, t.val);
+            if (it==tm.end()) {
+                it = find_entry(ve, ty, "*");
+            }
             if (it!=tm.end()) {
                 if ((curr_it==tm.end()) || (it->second.first < curr_it->second.first)) {
                     curr_it=it;
                 }
-            } else {
-                it = tm.find(std::make_tuple(ty,t.key,"*"));
-                if (it!=tm.end()) {
-                    if ((curr_it==tm.end()) || (it->second.first < curr_it->second.first)) {
-                        curr_it=it;
-                    }
-                }
             }
         }
         
@@ -109,12 +132,13 @@ class FindMinZoomOneTag : public FindMinZoom {
             auto curr_it = tm.end();
             
             for (const auto& t: ele->Tags()) {
-                if (keys.count(t.key)>0) {
+                auto kt = keys.find(t.key);
+                if (kt!=keys.end()) {
                     if (ty==3) {
-                        check_tag(curr_it, 1,t);                        
-                        check_tag(curr_it, 2,t);
+                        check_tag(curr_it, 1, kt->second, t);
+                        check_tag(curr_it, 2, kt->second, t);
                     } else {
-                        check_tag(curr_it, ty,t);
+                        check_tag(curr_it, ty, kt->second, t);
                     }
                 }
             }
@@ -165,7 +189,7 @@ class FindMinZoomOneTag : public FindMinZoom {
         tagmap tm;
         double minlen;
         double minarea;
-        std::set<std::string> keys;
+        std::unordered_map<std::string, value_entries> keys;
 };
 
 
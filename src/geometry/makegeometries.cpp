@@ -27,6 +27,7 @@
 #include "oqt/geometry/elements/simplepolygon.hpp"
 #include "oqt/geometry/elements/complicatedpolygon.hpp"
 #include "oqt/geometry/elements/waywithnodes.hpp"
+#include "oqt/geometry/simplify.hpp"
 #include <algorithm>
 
 namespace oqt {
@@ -34,86 +35,91 @@ namespace geometry {
 
 
 
+typedef std::tuple<std::string,std::string,int64> zorder_value;
+
+const std::vector<zorder_value>& zorder_values() {
+    static const std::vector<zorder_value> values = {
+        {"highway", "motorway", 380},
+        {"highway", "trunk", 370},
+        {"highway", "primary", 360},
+        {"highway", "secondary", 350},
+        {"highway", "tertiary", 340},
+        {"highway", "residential", 330},
+        {"highway", "unclassified", 330},
+        {"highway", "road", 330},
+        {"highway", "living_street", 320},
+        {"highway", "pedestrian", 310},
+        {"highway", "raceway", 300},
+        {"highway", "motorway_link", 240},
+        {"highway", "trunk_link", 230},
+        {"highway", "primary_link", 220},
+        {"highway", "secondary_link", 210},
+        {"highway", "tertiary_link", 200},
+        {"highway", "service", 150},
+        {"highway", "track", 110},
+        {"highway", "path", 100},
+        {"highway", "footway", 100},
+        {"highway", "bridleway", 100},
+        {"highway", "cycleway", 100},
+        {"highway", "steps", 90},
+        {"highway", "platform", 90},
+        {"construction", "motorway", 33},
+        {"construction", "trunk", 33},
+        {"construction", "primary", 33},
+        {"construction", "secondary", 33},
+        {"construction", "tertiary", 33},
+        {"construction", "residential", 33},
+        {"construction", "unclassified", 33},
+        {"construction", "road", 33},
+        {"construction", "living_street", 32},
+        {"construction", "pedestrian", 31},
+        {"construction", "raceway", 30},
+        {"construction", "motorway_link", 24},
+        {"construction", "trunk_link", 23},
+        {"construction", "primary_link", 2},
+        {"construction", "secondary_link", 21},
+        {"construction", "tertiary_link", 20},
+        {"construction", "service", 15},
+        {"construction", "track", 11},
+        {"construction", "path", 10},
+        {"construction", "footway", 10},
+        {"construction", "bridleway", 10},
+        {"construction", "cycleway", 10},
+        {"construction", "steps", 9},
+        {"construction", "platform", 9},
+        {"railway", "rail", 440},
+        {"railway", "subway", 420},
+        {"railway", "narrow_gauge", 420},
+        {"railway", "light_rail", 420},
+        {"railway", "funicular", 420},
+        {"railway", "preserved", 420},
+        {"railway", "monorail", 420},
+        {"railway", "miniature", 420},
+        {"railway", "turntable", 420},
+        {"railway", "tram", 410},
+        {"railway", "disused", 400},
+        {"railway", "construction", 400},
+        {"railway", "platform", 90},
+        {"aeroway", "runway", 60},
+        {"aeroway", "taxiway", 50}
+    };
+    return values;
+}
+
 std::optional<int64> get_zorder_value(const Tag& t) {
-    if (t.key == "highway") {
-        if (t.val == "motorway") { return 380; }
-        if (t.val == "trunk") {return 370;}
-        if (t.val == "primary") {return 360;}
-        if (t.val == "secondary") { return 350;}
-        if (t.val == "tertiary") { return 340;}
-        if (t.val == "residential") { return 330;}
-        if (t.val == "unclassified") { return 330;}
-        if (t.val == "road") { return 330;}
-        if (t.val == "living_street") { return 320;}
-        if (t.val == "pedestrian") { return 310;}
-        if (t.val == "raceway") { return 300;}
-        if (t.val == "motorway_link") { return 240;}
-        if (t.val == "trunk_link") { return 230;}
-        if (t.val == "primary_link") { return 220;}
-        if (t.val == "secondary_link") { return 210;}
-        if (t.val == "tertiary_link") { return 200;}
-        if (t.val == "service") { return 150;}
-        if (t.val == "track") { return 110;}
-        if (t.val == "path") { return 100;}
-        if (t.val == "footway") { return 100;}
-        if (t.val == "bridleway") { return 100;}
-        if (t.val == "cycleway") { return 100;}
-        if (t.val == "steps") { return 90;}
-        if (t.val == "platform") { return 90;}
-        //if (t.val == "construction") { return 10;}
-        return std::optional<int64>();
-    }
-    if (t.key == "construction") {
-        if (t.val == "motorway") { return 33; }
-        if (t.val == "trunk") {return 33;}
-        if (t.val == "primary") {return 33;}
-        if (t.val == "secondary") { return 33;}
-        if (t.val == "tertiary") { return 33;}
-        if (t.val == "residential") { return 33;}
-        if (t.val == "unclassified") { return 33;}
-        if (t.val == "road") { return 33;}
-        if (t.val == "living_street") { return 32;}
-        if (t.val == "pedestrian") { return 31;}
-        if (t.val == "raceway") { return 30;}
-        if (t.val == "motorway_link") { return 24;}
-        if (t.val == "trunk_link") { return 23;}
-        if (t.val == "primary_link") { return 2;}
-        if (t.val == "secondary_link") { return 21;}
-        if (t.val == "tertiary_link") { return 20;}
-        if (t.val == "service") { return 15;}
-        if (t.val == "track") { return 11;}
-        if (t.val == "path") { return 10;}
-        if (t.val == "footway") { return 10;}
-        if (t.val == "bridleway") { return 10;}
-        if (t.val == "cycleway") { return 10;}
-        if (t.val == "steps") { return 9;}
-        if (t.val == "platform") { return 9;}
-        return std::optional<int64>();
-    }
-    
-    if (t.key=="railway") {
-        if (t.val == "rail") { return 440; }
-        if (t.val == "subway") { return 420; }
-        if (t.val == "narrow_gauge") { return 420; }
-        if (t.val == "light_rail") { return 420; }
-        if (t.val == "funicular") { return 420; }
-        if (t.val == "preserved") { return 420; }
-        if (t.val == "monorail") { return 420; }
-        if (t.val == "miniature") { return 420; }
-        if (t.val == "turntable") { return 420; }
-        if (t.val == "tram") { return 410; }
-        if (t.val == "disused") { return 400; }
-        if (t.val == "construction") { return 400; }
-        if (t.val == "platform") { return 90; }
-        return std::optional<int64>();
-    }
+    static const std::map<std::pair<std::string,std::string>,int64> lookup = []() {
+        std::map<std::pair<std::string,std::string>,int64> result;
+        for (const auto& zv: zorder_values()) {
+            result[std::make_pair(std::get<0>(zv),std::get<1>(zv))] = std::get<2>(zv);
+        }
+        return result;
+    }();
     
-    if (t.key=="aeroway") {
-        if (t.val == "runway") { return 60; }
-        if (t.val == "taxiway") { return 50; }
+    auto it = lookup.find(std::make_pair(t.key, t.val));
+    if (it==lookup.end()) {
         return std::optional<int64>();
     }
-    return std::optional<int64>();
+    return it->second;
 }
 
 
@@ -225,6 +231,118 @@ bool check_polygon_tags(const std::map<std::string, PolygonTag>& polygon_tags, c
       
 
 
+TagRules::TagRules(
+    const std::set<std::string>& feature_keys,
+    const std::map<std::string, PolygonTag>& polygon_tags,
+    const std::set<std::string>& other_keys,
+    const std::set<std::string>& drop_keys_,
+    bool all_other_keys_,
+    bool all_objs_)
+    : drop_keys(drop_keys_), all_other_keys(all_other_keys_), all_objs(all_objs_) {
+    
+    for (const auto& k: feature_keys) {
+        keys[k].feature=true;
+    }
+    for (const auto& k: other_keys) {
+        keys[k].other=true;
+    }
+    for (const auto& pt: polygon_tags) {
+        auto& kr = keys[pt.first];
+        kr.polygon = true;
+        kr.polygon_type = pt.second.type;
+        kr.polygon_values.insert(pt.second.values.begin(), pt.second.values.end());
+    }
+    for (const auto& zv: zorder_values()) {
+        keys[std::get<0>(zv)].zorder[std::get<1>(zv)] = std::get<2>(zv);
+    }
+    keys["layer"].layer=true;
+    
+    for (auto& kr: keys) {
+        kr.second.drop = is_drop_key(drop_keys, kr.first);
+    }
+}
+
+const TagRules::KeyRule* TagRules::find_key(const std::string& key) const {
+    auto it = keys.find(key);
+    if (it==keys.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+std::tuple<bool, std::vector<Tag>, std::optional<int64>> TagRules::filter_tags(const std::vector<Tag>& in_tags) const {
+    bool has_feature=false;
+    std::vector<Tag> out_tags;
+    std::optional<int64> layer;
+        
+    if (in_tags.empty()) {
+        return std::make_tuple(has_feature, out_tags, layer);
+    }
+    
+    for (const auto& tg: in_tags) {
+        const KeyRule* kr = find_key(tg.key);
+        
+        if (kr && kr->feature) {
+            has_feature=true;
+            out_tags.push_back(tg);
+        } else if (all_other_keys || (kr && kr->other)) {
+            //keys not in the table still have to be checked for a
+            //dropped prefix, e.g. "name:"
+            if (!(kr ? kr->drop : is_drop_key(drop_keys, tg.key))) {
+                out_tags.push_back(tg);
+            }
+        }
+        if (kr && kr->layer) {
+            try {
+                layer = std::stoll(tg.val);
+            } catch (...) {
+                //pass
+            }
+        }
+    }
+    if (all_objs && (!out_tags.empty())) {
+        has_feature=true;
+    }
+    return std::make_tuple(has_feature, out_tags, layer);
+}
+
+bool TagRules::check_polygon_tags(const std::vector<Tag>& tags) const {
+    for (const auto& tg: tags) {
+        const KeyRule* kr = find_key(tg.key);
+        if (!kr || !kr->polygon) {
+            continue;
+        }
+        if (kr->polygon_type == PolygonTag::Type::All) {
+            return true;
+        } else if (kr->polygon_type == PolygonTag::Type::Include) {
+            if (kr->polygon_values.count(tg.val)>0) {
+                return true;
+            }
+        } else if (kr->polygon_type == PolygonTag::Type::Exclude) {
+            if (kr->polygon_values.count(tg.val)==0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::optional<int64> TagRules::calc_zorder(const std::vector<Tag>& tags) const {
+    std::optional<int64> result;
+    for (const auto& tg: tags) {
+        const KeyRule* kr = find_key(tg.key);
+        if (!kr || kr->zorder.empty()) {
+            continue;
+        }
+        auto it = kr->zorder.find(tg.val);
+        if ((it!=kr->zorder.end()) && (it->second > result)) {
+            result = it->second;
+        }
+    }
+    return result;
+}
+
+
 PrimitiveBlockPtr make_geometries(
     const std::set<std::string>& feature_keys,
     const std::map<std::string, PolygonTag>& polygon_tags,
@@ -235,6 +353,16 @@ PrimitiveBlockPtr make_geometries(
     const bbox& box,
     PrimitiveBlockPtr in,
     std::function<bool(ElementPtr)> check_feat) {
+    
+    TagRules rules(feature_keys, polygon_tags, other_keys, drop_keys, all_other_keys, all_objs);
+    return make_geometries(rules, box, in, check_feat);
+}
+
+PrimitiveBlockPtr make_geometries(
+    const TagRules& rules,
+    const bbox& box,
+    PrimitiveBlockPtr in,
+    std::function<bool(ElementPtr)> check_feat) {
         
     if (!in) { return in; }
     if (in->Objects().empty()) { return in; }
@@ -251,7 +379,7 @@ PrimitiveBlockPtr make_geometries(
         if (obj->Type()==ElementType::Node) {
             
             bool passes; std::vector<Tag> tags; std::optional<int64> layer;
-            std::tie(passes, tags, layer) = filter_tags(feature_keys, other_keys, drop_keys, all_other_keys, all_objs, obj->Tags());
+            std::tie(passes, tags, layer) = rules.filter_tags(obj->Tags());
             if (passes) {
                 auto n = std::dynamic_pointer_cast<Node>(obj);
                 if (contains_point(box, n->Lon(),n->Lat())) {
@@ -261,7 +389,7 @@ PrimitiveBlockPtr make_geometries(
         } else if (obj->Type() == ElementType::WayWithNodes) {
             
             bool passes; std::vector<Tag> tags; std::optional<int64> layer;
-            std::tie(passes, tags, layer) = filter_tags(feature_keys, other_keys, drop_keys, all_other_keys, all_objs, obj->Tags());
+            std::tie(passes, tags, layer) = rules.filter_tags(obj->Tags());
             
             if (passes) {
                 auto w = std::dynamic_pointer_cast<WayWithNodes>(obj);
@@ -272,8 +400,8 @@ PrimitiveBlockPtr make_geometries(
                 if (!overlaps(box, w->Bounds())) {
                     continue;
                 }
-                bool is_poly = (w->IsRing() && check_polygon_tags(polygon_tags, tags));
-                std::optional<int64> z_order = calc_zorder(tags);
+                bool is_poly = (w->IsRing() && rules.check_polygon_tags(tags));
+                std::optional<int64> z_order = rules.calc_zorder(tags);
                 if (is_poly) {
                     result->add(std::make_shared<SimplePolygon>(w, tags,z_order,layer,std::optional<int64>()));
                 } else {
@@ -348,13 +476,12 @@ class GeometryProcess : public BlockHandler {
             const bbox& box_,
             bool recalc_,
             std::shared_ptr<FindMinZoom> fmz_,
-            int64 max_min_zoom_level_)
+            int64 max_min_zoom_level_,
+            bool simplify_)
             
             
-            :feature_keys(feature_keys_), polygon_tags(polygon_tags_),
-            other_keys(other_keys_), drop_keys(drop_keys_),
-            all_other_keys(all_other_keys_), all_objs(all_objs_),
-            box(box_), recalc(recalc_), fmz(fmz_), max_min_zoom_level(max_min_zoom_level_) {}
+            : rules(feature_keys_, polygon_tags_, other_keys_, drop_keys_, all_other_keys_, all_objs_),
+            box(box_), recalc(recalc_), fmz(fmz_), max_min_zoom_level(max_min_zoom_level_), simplify(simplify_) {}
             
 
         virtual primblock_vec process(primblock_ptr bl) {
@@ -362,7 +489,7 @@ class GeometryProcess : public BlockHandler {
             if (max_min_zoom_level>0) {
                 check_feat = [this](ElementPtr e) { return this->fmz->check_feature(e, this->max_min_zoom_level); };
             }
-            auto res = make_geometries(feature_keys, polygon_tags, other_keys, drop_keys, all_other_keys, all_objs, box, bl, check_feat);
+            auto res = make_geometries(rules, box, bl, check_feat);
             
             if (recalc) {
                 recalculate_quadtree(res, 18, fmz ? 0 : 0.05);
@@ -370,22 +497,21 @@ class GeometryProcess : public BlockHandler {
             if (fmz) {
                 calculate_minzoom(res, fmz,max_min_zoom_level);
             }
+            if (simplify) {
+                simplify_geometries(res);
+            }
             return primblock_vec(1, res);
         }
         virtual ~GeometryProcess() {}
     
     
     private:
-        std::set<std::string> feature_keys;
-        std::map<std::string, PolygonTag> polygon_tags;
-        std::set<std::string> other_keys;
-        std::set<std::string> drop_keys;
-        bool all_other_keys;
-        bool all_objs;
+        TagRules rules;
         bbox box;
         bool recalc;
         std::shared_ptr<FindMinZoom> fmz;
         int64 max_min_zoom_level;
+        bool simplify;
 };
 
 
@@ -399,9 +525,10 @@ std::shared_ptr<BlockHandler> make_geometryprocess(
     const bbox& box,
     bool recalc,
     std::shared_ptr<FindMinZoom> fmz,
-    int64 max_min_zoom_level){
+    int64 max_min_zoom_level,
+    bool simplify){
         
-    return std::make_shared<GeometryProcess>(feature_keys, polygon_tags, other_keys, drop_keys, all_other_keys, all_objs, box, recalc, fmz, max_min_zoom_level);
+    return std::make_shared<GeometryProcess>(feature_keys, polygon_tags, other_keys, drop_keys, all_other_keys, all_objs, box, recalc, fmz, max_min_zoom_level, simplify);
     
 }
 
@@ -28,7 +28,14 @@
 #include "oqt/geometry/elements/complicatedpolygon.hpp"
 #include "oqt/geometry/elements/waywithnodes.hpp"
 #include "oqt/utils/logger.hpp"
+#include "oqt/utils/threadedcallback.hpp"
+#include "oqt/utils/multithreadedcallback.hpp"
+#include "oqt/utils/timing.hpp"
+#include "oqt/utils/string.hpp"
 #include <deque>
+#include <unordered_map>
+#include <cmath>
+#include <limits>
 namespace oqt {
 namespace geometry {
 
@@ -48,27 +55,18 @@ bool is_ring(std::shared_ptr<WayWithNodes> w) {
 
 
 
-template <class T>
-int64 first_point(const T& r) {
-    const Ring::Part& r0 = r.front();
-    if (r0.reversed) {
-        return r0.refs.back();
-    }
-    return r0.refs.front();
-}
-
-template <class T>
-int64 last_point(const T& r) {
-    const Ring::Part& r1 = r.back();
-    if (r1.reversed) {
-        return r1.refs.front();
-    }
-    return r1.refs.back();
-}
+//! One way in a ring being assembled: the way data is not copied until the
+//! finished ring is converted into a Ring
+struct RingPartRef {
+    std::shared_ptr<WayWithNodes> way;
+    bool reversed;
 
+    int64 first_point() const { return reversed ? way->Refs().back() : way->Refs().front(); }
+    int64 last_point() const { return reversed ? way->Refs().front() : way->Refs().back(); }
+};
 
-Ring::Part make_ringpart(std::shared_ptr<WayWithNodes> w, bool d) {
-    return Ring::Part{w->Id(),w->Refs(),w->LonLats(), d};
+Ring::Part make_ringpart(const RingPartRef& p) {
+    return Ring::Part{p.way->Id(),p.way->Refs(),p.way->LonLats(), p.reversed};
 }
 
 std::ostream& ringstr(std::ostream& strm, const Ring& ring) {
@@ -90,99 +88,149 @@ std::ostream& tagstr(std::ostream& strm, const tagvector& tgs) {
     }
     return strm;
 }
-typedef std::pair<bool,std::deque<Ring::Part>> tempring;
-typedef std::vector<tempring> tempringvec;
+struct TempRing {
+    std::deque<RingPartRef> parts;
+    bool closed;
 
-void add_to_rings(tempringvec& rings, std::shared_ptr<WayWithNodes> w) {
-    if (is_ring(w)) {
-        rings.push_back(std::make_pair(true,std::deque<Ring::Part>{make_ringpart(w,false)}));
-        return;
-    }
-    if (!rings.empty()) {
-        int64 a=w->Refs().front();
-        int64 b=w->Refs().back();
-
-        for (auto& r: rings) {
-            if (r.first) {
-                //skip
-            } else if (a == last_point(r.second)) {
-                r.second.push_back(make_ringpart(w,false));
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
-            } else if (b == last_point(r.second)) {
-                r.second.push_back(make_ringpart(w, true));
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
-            } else if (a==first_point(r.second)) {
-                r.second.push_front(make_ringpart(w,true));
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
-            } else if (b==first_point(r.second)) {
-                r.second.push_front(make_ringpart(w,false));
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
+    int64 first_point() const { return parts.front().first_point(); }
+    int64 last_point() const { return parts.back().last_point(); }
+};
+
+/*! Open ends of the rings being assembled, from node ref to ring index,
+ * so that matching rings are found without scanning all the rings. Where
+ * several rings end at the same node the earliest is used. */
+class RingEnds {
+    public:
+        size_t find(int64 p, size_t notfound) const {
+            size_t result=notfound;
+            auto rr = ends.equal_range(p);
+            for (auto it=rr.first; it!=rr.second; ++it) {
+                if (it->second<result) {
+                    result=it->second;
+                }
             }
+            return result;
         }
-    }
-    rings.push_back(std::make_pair(false,std::deque<Ring::Part>{make_ringpart(w,false)}));
-}
 
-void extend_rings(tempringvec& rings, const tempring& rp) {
-    int64 a=first_point(rp.second);
-    int64 b=last_point(rp.second);
+        void add(const TempRing& r, size_t idx) {
+            if (!r.closed) {
+                ends.emplace(r.first_point(), idx);
+                ends.emplace(r.last_point(), idx);
+            }
+        }
 
-    if (a==b) {
-        rings.push_back(rp);
-        return;
-    }
-    if (!rings.empty()) {
-
-        for (auto& r: rings) {
-            if (r.first) {
-                //skip
-            } else if (a == last_point(r.second)) {
-                for (size_t i = 0; i < rp.second.size(); i++) {
-                    r.second.push_back(rp.second[i]);
-                }
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
-            } else if (b == last_point(r.second)) {
-                for (size_t i = 0; i < rp.second.size(); i++) {
-                    auto q = rp.second[rp.second.size()-1-i];
-                    q.reversed = !q.reversed;
-                    r.second.push_back(q);
-                }
-                r.first= first_point(r.second)==last_point(r.second);
-                return;
-            } else if (a==first_point(r.second)) {
-                for (size_t i = 0; i < rp.second.size(); i++) {
-                    auto q = rp.second[i];
-                    q.reversed = !q.reversed;
-                    r.second.push_front(q);
+        void remove(const TempRing& r, size_t idx) {
+            remove_point(r.first_point(), idx);
+            remove_point(r.last_point(), idx);
+        }
+
+    private:
+        std::unordered_multimap<int64,size_t> ends;
+
+        void remove_point(int64 p, size_t idx) {
+            auto rr = ends.equal_range(p);
+            for (auto it=rr.first; it!=rr.second; ++it) {
+                if (it->second==idx) {
+                    ends.erase(it);
+                    return;
                 }
-                r.first= first_point(r.second)==last_point(r.second);
+            }
+        }
+};
+
+/*! Assembles ways into rings: each way is added to the first ring it
+ * continues, then rings are joined to the first earlier ring they continue
+ * until no more can be joined. */
+class RingAssembler {
+    public:
+        void add(std::shared_ptr<WayWithNodes> w) {
+            if (is_ring(w)) {
+                rings.push_back(TempRing{std::deque<RingPartRef>{RingPartRef{w,false}}, true});
                 return;
-            } else if (b==first_point(r.second)) {
-                for (size_t i = 0; i < rp.second.size(); i++) {
-                    auto q = rp.second[rp.second.size()-1-i];
-                    r.second.push_front(q);
-                }
-                r.first= first_point(r.second)==last_point(r.second);
+            }
+            int64 a=w->Refs().front();
+            int64 b=w->Refs().back();
+
+            size_t idx = std::min(ends.find(a, rings.size()), ends.find(b, rings.size()));
+            if (idx==rings.size()) {
+                rings.push_back(TempRing{std::deque<RingPartRef>{RingPartRef{w,false}}, false});
+                ends.add(rings.back(), idx);
                 return;
             }
+
+            auto& r = rings[idx];
+            ends.remove(r, idx);
+            if (a == r.last_point()) {
+                r.parts.push_back(RingPartRef{w,false});
+            } else if (b == r.last_point()) {
+                r.parts.push_back(RingPartRef{w,true});
+            } else if (a == r.first_point()) {
+                r.parts.push_front(RingPartRef{w,true});
+            } else {
+                r.parts.push_front(RingPartRef{w,false});
+            }
+            r.closed = r.first_point()==r.last_point();
+            ends.add(r, idx);
         }
-    }
-    rings.push_back(rp);
-}
 
-std::vector<std::pair<bool,std::deque<Ring::Part>>> merge_rings(const std::vector<std::pair<bool,std::deque<Ring::Part>>>& in) {
+        std::vector<TempRing>& finish() {
+            size_t rl = rings.size();
+            merge_rings();
+            while (rl != rings.size()) {
+                rl = rings.size();
+                merge_rings();
+            }
+            return rings;
+        }
 
-    std::vector<std::pair<bool,std::deque<Ring::Part>>> rings;
-    for (auto r : in) {
-        extend_rings(rings, r);
-    }
-    return rings;
-}
+    private:
+        std::vector<TempRing> rings;
+        RingEnds ends;
+
+        void merge_rings() {
+            std::vector<TempRing> result;
+            result.reserve(rings.size());
+            RingEnds result_ends;
+
+            for (auto& rp: rings) {
+                int64 a=rp.first_point();
+                int64 b=rp.last_point();
+
+                size_t idx = result.size();
+                if (a!=b) {
+                    idx = std::min(result_ends.find(a, result.size()), result_ends.find(b, result.size()));
+                }
+                if (idx==result.size()) {
+                    result.push_back(std::move(rp));
+                    result_ends.add(result.back(), idx);
+                    continue;
+                }
+
+                auto& r = result[idx];
+                result_ends.remove(r, idx);
+                if (a == r.last_point()) {
+                    for (auto it=rp.parts.begin(); it!=rp.parts.end(); ++it) {
+                        r.parts.push_back(*it);
+                    }
+                } else if (b == r.last_point()) {
+                    for (auto it=rp.parts.rbegin(); it!=rp.parts.rend(); ++it) {
+                        r.parts.push_back(RingPartRef{it->way, !it->reversed});
+                    }
+                } else if (a == r.first_point()) {
+                    for (auto it=rp.parts.begin(); it!=rp.parts.end(); ++it) {
+                        r.parts.push_front(RingPartRef{it->way, !it->reversed});
+                    }
+                } else {
+                    for (auto it=rp.parts.rbegin(); it!=rp.parts.rend(); ++it) {
+                        r.parts.push_front(*it);
+                    }
+                }
+                r.closed = r.first_point()==r.last_point();
+                result_ends.add(r, idx);
+            }
+            rings.swap(result);
+        }
+};
 
 
 bool is_ring(const Ring& ring) {
@@ -191,57 +239,161 @@ bool is_ring(const Ring& ring) {
 }
 
 std::pair<std::vector<Ring>,std::vector<std::pair<bool,Ring>>> make_rings(const std::vector<std::pair<bool,std::shared_ptr<WayWithNodes>>>& ways, bool is_inner, const bbox& box) {
-    std::vector<std::pair<bool,std::deque<Ring::Part>>> rings;
+    RingAssembler assembler;
     for (auto w : ways) {
         if (w.first==is_inner) {
-            add_to_rings(rings, w.second);
+            assembler.add(w.second);
         }
-        
-    }
-    size_t rl = rings.size();
-    rings = merge_rings(rings);
-    while (rl!= rings.size()) {
-        rl = rings.size();
-        rings = merge_rings(rings);
     }
 
-
     std::vector<Ring> result;
     std::vector<std::pair<bool,Ring>> passes;
-    for (auto& r: rings) {
+    for (auto& r: assembler.finish()) {
+        Ring rng;
+        rng.parts.reserve(r.parts.size());
         bbox ringbox;
-        for (auto p : r.second) {
-            for (auto ll : p.lonlats) {
+        for (const auto& p : r.parts) {
+            for (const auto& ll : p.way->LonLats()) {
                 expand_point(ringbox, ll.lon,ll.lat);
             }
+            rng.parts.push_back(make_ringpart(p));
         }
-        if (r.first) {
+        if (r.closed) {
             if (overlaps(box, ringbox)) {
-                auto rng = Ring{std::vector<Ring::Part>(r.second.begin(),r.second.end())};
                 if (!is_ring(rng)) {
-                    passes.push_back(std::make_pair(true, rng));
+                    passes.push_back(std::make_pair(true, std::move(rng)));
                 } else {
-                    result.push_back(rng);
+                    result.push_back(std::move(rng));
                 }
-                
             } else {
-                passes.push_back(std::make_pair(true,Ring{std::vector<Ring::Part>(r.second.begin(),r.second.end())}));
+                passes.push_back(std::make_pair(true,std::move(rng)));
             }
         } else {
-            passes.push_back(std::make_pair(false,Ring{std::vector<Ring::Part>(r.second.begin(),r.second.end())}));
+            passes.push_back(std::make_pair(false,std::move(rng)));
         }
     }
     return std::make_pair(result,passes);
 }
 
-bool ring_contains(const std::vector<LonLat>& outer, const std::vector<LonLat>& inner) {
-    for (auto ll : inner) {
-        if (!point_in_poly(outer,ll)) {
-            return false;
+/*! Point in polygon test for a ring, with the edges sorted into bands of
+ * latitude so that each test only looks at the edges crossing its band.
+ * Each edge is tested exactly as in point_in_poly. */
+class RingIndex {
+    public:
+        RingIndex(const std::vector<LonLat>& verts_) : verts(verts_) {
+            for (const auto& ll: verts) {
+                expand_point(box, ll.lon, ll.lat);
+            }
+            if (verts.size()<3) { return; }
+
+            size_t nb = std::max<size_t>(1, std::sqrt(verts.size()));
+            band_height = std::max<int64>(1, (box.maxy-box.miny) / (int64) nb + 1);
+            bands.resize(nb+1);
+
+            size_t j = verts.size()-1;
+            for (size_t i=0; i < verts.size(); i++) {
+                int64 lo = std::min(verts[i].lat, verts[j].lat);
+                int64 hi = std::max(verts[i].lat, verts[j].lat);
+                if (lo!=hi) {
+                    for (size_t b=band(lo); b <= band(hi); b++) {
+                        bands[b].push_back(i);
+                    }
+                }
+                j = i;
+            }
+        }
+
+        const bbox& Bounds() const { return box; }
+
+        bool contains(const LonLat& test) const {
+            if (bands.empty() || (test.lat < box.miny) || (test.lat > box.maxy)) {
+                return false;
+            }
+            bool c = false;
+            double testlon = test.lon, testlat = test.lat;
+            for (size_t i: bands[band(test.lat)]) {
+                size_t j = (i==0) ? verts.size()-1 : i-1;
+                double loni = verts[i].lon, lati = verts[i].lat;
+                double lonj = verts[j].lon, latj = verts[j].lat;
+
+                if ( ((lati>testlat)!=(latj>testlat)) &&
+                    (testlon < (lonj - loni) * (testlat- lati) / (latj  - lati) + loni)) {
+                    c = !c;
+                }
+            }
+            return c;
         }
-    }
-    return true;
-}
+
+        bool contains(const std::vector<LonLat>& inner) const {
+            for (const auto& ll : inner) {
+                if (!contains(ll)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        const std::vector<LonLat>& verts;
+        bbox box;
+        int64 band_height;
+        std::vector<std::vector<size_t>> bands;
+
+        size_t band(int64 lat) const {
+            return (lat - box.miny) / band_height;
+        }
+};
+
+/*! Grid over the bounds of the outer rings, so that the outers which may
+ * contain an inner ring are found without testing every outer. */
+class OuterRingGrid {
+    public:
+        OuterRingGrid(const std::vector<RingIndex>& outers_) : outers(outers_), size(0), cellw(1), cellh(1) {
+            for (const auto& o: outers) {
+                bbox_expand(box, o.Bounds());
+            }
+            if (outers.empty()) { return; }
+            size = std::max<size_t>(1, std::sqrt(outers.size()));
+            cellw = std::max<int64>(1, (box.maxx-box.minx) / (int64) size + 1);
+            cellh = std::max<int64>(1, (box.maxy-box.miny) / (int64) size + 1);
+            cells.resize(size*size);
+            for (size_t i=0; i < outers.size(); i++) {
+                const auto& b = outers[i].Bounds();
+                for (size_t x=cellx(b.minx); x <= cellx(b.maxx); x++) {
+                    for (size_t y=celly(b.miny); y <= celly(b.maxy); y++) {
+                        cells[x*size+y].push_back(i);
+                    }
+                }
+            }
+        }
+
+        //! Index of the first outer containing \param inner, or outers.size()
+        size_t find(const std::vector<LonLat>& inner) const {
+            if (inner.empty() || cells.empty()) { return outers.size(); }
+            bbox ib;
+            for (const auto& ll: inner) {
+                expand_point(ib, ll.lon, ll.lat);
+            }
+            if (!bbox_contains(box, ib)) { return outers.size(); }
+
+            for (size_t i: cells[cellx(inner[0].lon)*size+celly(inner[0].lat)]) {
+                if (bbox_contains(outers[i].Bounds(), ib) && outers[i].contains(inner)) {
+                    return i;
+                }
+            }
+            return outers.size();
+        }
+
+    private:
+        const std::vector<RingIndex>& outers;
+        bbox box;
+        size_t size;
+        int64 cellw, cellh;
+        std::vector<std::vector<size_t>> cells;
+
+        size_t cellx(int64 x) const { return std::min<size_t>(size-1, (x-box.minx) / cellw); }
+        size_t celly(int64 y) const { return std::min<size_t>(size-1, (y-box.miny) / cellh); }
+};
 
 
     
@@ -259,7 +411,35 @@ bool check_parts(const std::pair<std::vector<LonLat>,std::vector<Ring>>& part) {
 
 
 
-class MakeMultiPolygons : public BlockHandler {
+/*! Relations ready to be finished, with their member ways. Each input
+ * block gives one or more tasks, the last of which holds the block. */
+struct MultiPolygonTask {
+    struct Item {
+        int64 tile_quadtree;
+        std::shared_ptr<Relation> rel;
+        std::vector<std::pair<bool,std::shared_ptr<WayWithNodes>>> ways;
+
+        std::shared_ptr<ComplicatedPolygon> result;
+        std::optional<mperror> error;
+    };
+
+    std::vector<Item> items;
+    primblock_ptr block;
+    bool finish_batch;
+};
+typedef std::shared_ptr<MultiPolygonTask> mptask_ptr;
+
+void run_multipolygon_task(const GeometryTagsParams& params, const bbox& box, mptask_ptr task) {
+    for (auto& it: task->items) {
+        std::tie(it.result, it.error) = process_multipolygon(params, box, it.rel, it.ways);
+    }
+}
+
+/*! Collects the multipolygon relations and their member ways. Once all the
+ * tiles which may contain a relation's members have been passed, the
+ * relation is handed on in a MultiPolygonTask. This is the only serial
+ * step: the tasks can be run in parallel. */
+class CollectMultiPolygons {
     struct pendingrel {
         int64 tile_quadtree;
         std::shared_ptr<Relation> rel;
@@ -268,57 +448,29 @@ class MakeMultiPolygons : public BlockHandler {
     struct pendingway {
         int64 tile_quadtree;
         std::shared_ptr<WayWithNodes> wy;
-        //std::set<int64> rels;
         int rels;
-        //std::set<std::string> finished_tags;
     };
 
     std::map<int64,pendingrel> pendingrels;
     std::map<int64,pendingway> pendingways;
-    
-    std::function<void(mperrorvec&)> errors_callback;
-    mperrorvec errors;
-    
-    GeometryTagsParams params;
-    
-    bbox box;
+
     int64 maxqt;
-    int compcount;
     bool boundary, multipolygon;
-    int64 max_number_errors;
-    //std::string extra_tags_key;
     bool allow_empty_role;
+    size_t max_task_ways;
     public:
-        MakeMultiPolygons(
-            std::function<void(mperrorvec&)> errors_callback_,
-            const GeometryTagsParams& params_,
-            const bbox& box_,
-            bool boundary_,
-            bool multipolygon_,
-            int64 max_number_errors_) : 
-                errors_callback(errors_callback_),
-                params(params_),
-                box(box_), maxqt(-1),
-                compcount(0), boundary(boundary_),
-                multipolygon(multipolygon_),
-                max_number_errors(max_number_errors_)
-            {
-                
-                
-                allow_empty_role=true;
-            }
+        CollectMultiPolygons(bool boundary_, bool multipolygon_, size_t max_task_ways_) :
+            maxqt(-1), boundary(boundary_), multipolygon(multipolygon_),
+            allow_empty_role(true), max_task_ways(max_task_ways_) {}
 
-        virtual primblock_vec process(primblock_ptr in) {
+        void process(primblock_ptr in, std::function<void(mptask_ptr)> callback) {
 
-            
-            primblock_vec res;
+            auto task = std::make_shared<MultiPolygonTask>();
             if (in->Quadtree() > maxqt) {
-                res = check_finished(in->Quadtree());
+                check_finished(in->Quadtree(), task, callback);
                 maxqt = in->Quadtree();
             }
 
-            
-
             std::vector<ElementPtr> tempobjs;
             tempobjs.reserve(in->size());
             for (auto o : in->Objects()) {
@@ -339,13 +491,11 @@ class MakeMultiPolygons : public BlockHandler {
                         pendingrels[o->Id()] = pendingrel{in->Quadtree(),r};
                     }
                 } else {
-                    
-                    
                     tempobjs.push_back(o);
                 }
 
             }
-            
+
             for (auto& o: tempobjs) {
                 if ((o->Type()==ElementType::WayWithNodes) && (pendingways.count(o->Id())>0)) {
                     pendingways[o->Id()].tile_quadtree=in->Quadtree();
@@ -353,80 +503,51 @@ class MakeMultiPolygons : public BlockHandler {
 
                 }
             }
-        
-        
+
             in->Objects().swap(tempobjs);
-            res.push_back(in);
-            return res;
+            task->block = in;
+            task->finish_batch = true;
+            callback(task);
         }
-        virtual ~MakeMultiPolygons() {}
 
-        virtual primblock_vec finish() {
-            auto ff = check_finished(-1);
-            errors_callback(errors);
-            return ff;
+        void finish(std::function<void(mptask_ptr)> callback) {
+            auto task = std::make_shared<MultiPolygonTask>();
+            check_finished(-1, task, callback);
+            task->finish_batch = true;
+            callback(task);
         }
-    private:
-        primblock_vec check_finished(int64 qt) {
-           
-
-            std::map<int64,primblock_ptr> finished;
-            size_t cc=0;
 
+    private:
+        void check_finished(int64 qt, mptask_ptr& task, std::function<void(mptask_ptr)> callback) {
+            size_t num_ways=0;
             for (auto it=pendingrels.cbegin(); it!=pendingrels.cend(); /*no ince*/) {
                 int64 tq=it->second.tile_quadtree;
-                if (finished.count(tq)==0) {
-                    finished[tq]=std::make_shared<PrimitiveBlock>(0,0);
-                }
-                
+
                 if ((qt<0) || (quadtree::common(tq,qt)!=tq)) {
-                    
-                    cc += finish_relation(it->second, finished);
+                    if (num_ways >= max_task_ways) {
+                        task->finish_batch = false;
+                        callback(task);
+                        task = std::make_shared<MultiPolygonTask>();
+                        num_ways = 0;
+                    }
+                    task->items.push_back(finish_relation(it->second));
+                    num_ways += task->items.back().ways.size();
                     it=pendingrels.erase(it);
-
-
                 } else {
                     it++;
                 }
             }
 
-
             if (qt<0) {
                 if (!pendingways.empty()) {
                     Logger::Message() << "at null, have " << pendingways.size() << " remaining";
                 }
-
             }
-            
-            
-            size_t mm=0;
-            primblock_vec result;
-            for (const auto& ff: finished) {
-                ff.second->SetQuadtree(ff.first);
-                if (ff.second->size()>0) {
-                    result.push_back(ff.second);
-                    mm+=ff.second->size();
-                }
-            }
-            
-            
-            return result;
         }
 
+        MultiPolygonTask::Item finish_relation(const pendingrel& pr) {
+            MultiPolygonTask::Item item{pr.tile_quadtree, pr.rel, collect_ways(pr.rel), nullptr, std::optional<mperror>()};
 
-
-        size_t finish_relation(const pendingrel& pr, std::map<int64,primblock_ptr>& finished) {
-            auto tq=pr.tile_quadtree;
-            size_t cc=0;
-            
-            auto r=pr.rel;
-            //bool is_bp = get_tag(r,"type")=="boundary";
-            
-            auto ways = collect_ways(r);
-            
-            
-            auto res = process_multipolygon(params, box, r, ways);
-            
             for (auto& m: pr.rel->Members()) {
                 if (m.type==ElementType::Way) {
                     auto jt = pendingways.find(m.ref);
@@ -435,29 +556,13 @@ class MakeMultiPolygons : public BlockHandler {
                     } else {
                         jt->second.rels--;
                         if (jt->second.rels==0) {
-                            
                             pendingways.erase(jt);
-                            cc++;
                         }
                     }
-
-
-
-                }
-            }
-            
-            if (res.first) {
-                finished[tq]->add(res.first);
-            }
-            if (res.second) {
-                errors.count+=1;
-                if ((int64) errors.errors.size() < max_number_errors) {
-                    errors.errors.push_back(*res.second);
                 }
             }
-            return cc;
+            return item;
         }
-            
 
         std::vector<std::pair<bool,std::shared_ptr<WayWithNodes>>> collect_ways(std::shared_ptr<Relation> rel) {
             std::vector<std::pair<bool,std::shared_ptr<WayWithNodes>>> ways;
@@ -476,10 +581,99 @@ class MakeMultiPolygons : public BlockHandler {
 
             return ways;
         }
-        
+};
 
-        
+/*! Puts the finished multipolygons from each batch of tasks into a block
+ * for each tile, followed by the input block. Tasks must be added in the
+ * order they were produced by CollectMultiPolygons. */
+class AssembleMultiPolygons {
+    public:
+        AssembleMultiPolygons(int64 max_number_errors_) : max_number_errors(max_number_errors_) {}
+
+        primblock_vec add(mptask_ptr task) {
+            for (auto& it: task->items) {
+                auto& bl = finished[it.tile_quadtree];
+                if (!bl) {
+                    bl = std::make_shared<PrimitiveBlock>(0,0);
+                }
+                if (it.result) {
+                    bl->add(it.result);
+                }
+                if (it.error) {
+                    errors.count+=1;
+                    if ((int64) errors.errors.size() < max_number_errors) {
+                        errors.errors.push_back(*it.error);
+                    }
+                }
+            }
+            primblock_vec result;
+            if (!task->finish_batch) {
+                return result;
+            }
+
+            for (const auto& ff: finished) {
+                ff.second->SetQuadtree(ff.first);
+                if (ff.second->size()>0) {
+                    result.push_back(ff.second);
+                }
+            }
+            finished.clear();
+            if (task->block) {
+                result.push_back(task->block);
+            }
+            return result;
+        }
+
+        mperrorvec& Errors() { return errors; }
 
+    private:
+        int64 max_number_errors;
+        std::map<int64,primblock_ptr> finished;
+        mperrorvec errors;
+};
+
+
+class MakeMultiPolygons : public BlockHandler {
+    std::function<void(mperrorvec&)> errors_callback;
+    GeometryTagsParams params;
+    bbox box;
+    CollectMultiPolygons collect;
+    AssembleMultiPolygons assemble;
+
+    public:
+        MakeMultiPolygons(
+            std::function<void(mperrorvec&)> errors_callback_,
+            const GeometryTagsParams& params_,
+            const bbox& box_,
+            bool boundary_,
+            bool multipolygon_,
+            int64 max_number_errors_) : 
+                errors_callback(errors_callback_),
+                params(params_),
+                box(box_),
+                collect(boundary_, multipolygon_, std::numeric_limits<size_t>::max()),
+                assemble(max_number_errors_) {}
+
+        virtual primblock_vec process(primblock_ptr in) {
+            primblock_vec res;
+            collect.process(in, [this, &res](mptask_ptr task) { run(task, res); });
+            return res;
+        }
+        virtual ~MakeMultiPolygons() {}
+
+        virtual primblock_vec finish() {
+            primblock_vec res;
+            collect.finish([this, &res](mptask_ptr task) { run(task, res); });
+            errors_callback(assemble.Errors());
+            return res;
+        }
+    private:
+        void run(mptask_ptr task, primblock_vec& res) {
+            run_multipolygon_task(params, box, task);
+            for (auto bl: assemble.add(task)) {
+                res.push_back(bl);
+            }
+        }
 };
 
 std::pair<std::shared_ptr<ComplicatedPolygon>, std::optional<mperror>> process_multipolygon(
@@ -544,16 +738,18 @@ std::pair<std::shared_ptr<ComplicatedPolygon>, std::optional<mperror>> process_m
                 
             }
             if (!inners.empty()) {
+                std::vector<RingIndex> outer_index;
+                outer_index.reserve(parts.size());
+                for (const auto& pp: parts) {
+                    outer_index.emplace_back(pp.second.first);
+                }
+                OuterRingGrid grid(outer_index);
+
                 for (const auto& r : inners) {
-                    bool added=false;
-                    auto ll = ringpart_lonlats(r);
-                    for (auto& pp : parts) {
-                        if (!added && ring_contains(pp.second.first, ll)) {
-                            pp.second.second.push_back(r);
-                            added=true;
-                        }
-                    }
-                    if (!added) {
+                    size_t i = grid.find(ringpart_lonlats(r));
+                    if (i < outers.size()) {
+                        parts[i].second.push_back(r);
+                    } else {
                         if (!err.empty()) { err+=", "; }
                         err += "orphan inner";
                     }
@@ -626,5 +822,100 @@ std::shared_ptr<BlockHandler> make_multipolygons(
     return std::make_shared<MakeMultiPolygons>(add_error,params, box,boundary,multipolygon,max_number_errors);
 }
 
+struct MultiPolygonTimes {
+    MultiPolygonTimes(size_t numchan) : wait(0), collect(0), assemble(0), callback(0), tasks(numchan, 0) {}
+    
+    void report() const {
+        double t=0;
+        for (auto& x: tasks) { t += x; }
+        Logger::Message() << "MultiPolygons: wait=" << TmStr{wait,7,1} << ", exec=" << TmStr{collect,7,1}
+            << ", tasks=" << TmStr{t,7,1} << ", assemble=" << TmStr{assemble,7,1} << ", call cb=" << TmStr{callback,7,1};
+    }
+    
+    double wait, collect, assemble, callback;
+    std::vector<double> tasks;
+    TimeSingle collect_ts, assemble_ts;
+};
+
+std::function<void(primblock_ptr)> make_multipolygons_callback(
+    std::function<void(primblock_ptr)> callback,
+    std::function<void(mperrorvec&)> add_error,
+    const std::set<std::string>& feature_keys,  
+    const std::set<std::string>& other_keys,
+    const std::set<std::string>& drop_keys,
+    bool all_other_keys,
+    bool all_objs,
+    const bbox& box,
+    bool boundary, bool multipolygon, int64 max_number_errors,
+    size_t numchan) {
+
+    GeometryTagsParams params;
+    params.feature_keys=feature_keys;
+    params.other_keys=other_keys;
+    params.drop_keys=drop_keys;
+    params.all_other_keys=all_other_keys;
+    params.all_objs=all_objs;
+
+    if (numchan==0) { numchan=1; }
+
+    //the stages run on different threads, so each keeps its own times.
+    //They are reported by the output thread once every worker has finished
+    auto times = std::make_shared<MultiPolygonTimes>(numchan);
+
+    auto assemble = std::make_shared<AssembleMultiPolygons>(max_number_errors);
+    auto output = multi_threaded_callback<MultiPolygonTask>::make(
+        [assemble, callback, add_error, times](mptask_ptr task) {
+            times->assemble_ts.reset();
+            if (!task) {
+                add_error(assemble->Errors());
+                callback(nullptr);
+                times->callback += times->assemble_ts.since_reset();
+                times->report();
+                return;
+            }
+            auto bls = assemble->add(task);
+            times->assemble += times->assemble_ts.since_reset();
+            for (auto bl: bls) {
+                callback(bl);
+            }
+            times->callback += times->assemble_ts.since_reset();
+        }, numchan);
+
+    std::vector<std::function<void(mptask_ptr)>> workers;
+    for (size_t i=0; i < output.size(); i++) {
+        auto out = output[i];
+        workers.push_back(threaded_callback<MultiPolygonTask>::make(
+            [out, params, box, times, i](mptask_ptr task) {
+                if (task) {
+                    TimeSingle ts;
+                    run_multipolygon_task(params, box, task);
+                    times->tasks[i] += ts.since();
+                }
+                out(task);
+            }));
+    }
+
+    //tasks are passed to the workers in turn, and read back from output
+    //in the same order
+    auto collect = std::make_shared<CollectMultiPolygons>(boundary, multipolygon, 1000);
+    auto next = std::make_shared<size_t>(0);
+    return [collect, workers, next, times](primblock_ptr bl) {
+        times->wait += times->collect_ts.since_reset();
+        auto send = [&workers, &next](mptask_ptr task) {
+            workers[(*next)++ % workers.size()](task);
+        };
+        if (!bl) {
+            collect->finish(send);
+            times->collect += times->collect_ts.since_reset();
+            for (auto& w: workers) {
+                w(nullptr);
+            }
+            return;
+        }
+        collect->process(bl, send);
+        times->collect += times->collect_ts.since_reset();
+    };
+}
+
 
 }}
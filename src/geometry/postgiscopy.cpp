@@ -0,0 +1,642 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/geometry/postgiscopy.hpp"
+#include "oqt/geometry/utils.hpp"
+#include "oqt/geometry/elements/point.hpp"
+#include "oqt/geometry/elements/linestring.hpp"
+#include "oqt/geometry/elements/simplepolygon.hpp"
+#include "oqt/geometry/elements/complicatedpolygon.hpp"
+
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/pbf/fixedint.hpp"
+#include "oqt/utils/multithreadedcallback.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+namespace oqt {
+namespace geometry {
+
+enum class CopyColumnType {
+    Int8,
+    Float8,
+    Tags,
+    Geometry
+};
+
+struct CopyColumn {
+    std::string name;
+    CopyColumnType type;
+};
+
+const std::vector<CopyColumn>& table_columns(PostgisCopyTable table) {
+    static const std::vector<CopyColumn> point_columns{
+        {"osm_id", CopyColumnType::Int8}, {"quadtree", CopyColumnType::Int8},
+        {"tags", CopyColumnType::Tags}, {"layer", CopyColumnType::Int8},
+        {"minzoom", CopyColumnType::Int8}, {"way", CopyColumnType::Geometry}};
+    static const std::vector<CopyColumn> line_columns{
+        {"osm_id", CopyColumnType::Int8}, {"quadtree", CopyColumnType::Int8},
+        {"tags", CopyColumnType::Tags}, {"layer", CopyColumnType::Int8},
+        {"z_order", CopyColumnType::Int8}, {"minzoom", CopyColumnType::Int8},
+        {"length", CopyColumnType::Float8}, {"way", CopyColumnType::Geometry}};
+    static const std::vector<CopyColumn> polygon_columns{
+        {"osm_id", CopyColumnType::Int8}, {"quadtree", CopyColumnType::Int8},
+        {"tags", CopyColumnType::Tags}, {"layer", CopyColumnType::Int8},
+        {"z_order", CopyColumnType::Int8}, {"minzoom", CopyColumnType::Int8},
+        {"way_area", CopyColumnType::Float8}, {"way", CopyColumnType::Geometry}};
+    
+    switch (table) {
+        case PostgisCopyTable::Point: return point_columns;
+        case PostgisCopyTable::Line: return line_columns;
+        case PostgisCopyTable::Polygon: return polygon_columns;
+    }
+    throw std::domain_error("unknown table");
+}
+
+std::string postgiscopy_table_name(PostgisCopyTable table) {
+    switch (table) {
+        case PostgisCopyTable::Point: return "point";
+        case PostgisCopyTable::Line: return "line";
+        case PostgisCopyTable::Polygon: return "polygon";
+    }
+    throw std::domain_error("unknown table");
+}
+
+std::string postgiscopy_filename(const PostgisCopyParameters& params, PostgisCopyTable table) {
+    return params.prefix + postgiscopy_table_name(table) + ".copy";
+}
+
+std::string postgiscopy_table_sql(const PostgisCopyParameters& params, PostgisCopyTable table) {
+    std::string name = params.table_prefix + postgiscopy_table_name(table);
+    std::string geomtype = table==PostgisCopyTable::Point ? "Point" : (table==PostgisCopyTable::Line ? "LineString" : "Geometry");
+    
+    std::stringstream create, copy;
+    create << "CREATE TABLE " << name << " (";
+    copy << "COPY " << name << " (";
+    bool isf=true;
+    for (const auto& col: table_columns(table)) {
+        if (!isf) { create << ", "; copy << ", "; }
+        create << col.name << " ";
+        switch (col.type) {
+            case CopyColumnType::Int8: create << "bigint"; break;
+            case CopyColumnType::Float8: create << "float8"; break;
+            case CopyColumnType::Tags: create << (params.jsonb_tags ? "jsonb" : "hstore"); break;
+            case CopyColumnType::Geometry: create << "geometry(" << geomtype << ", " << epsg_code(params.transform) << ")"; break;
+        }
+        copy << col.name;
+        isf=false;
+    }
+    create << ");\n";
+    copy << ") FROM STDIN WITH (FORMAT binary);\n";
+    return create.str() + copy.str();
+}
+
+const std::string copy_signature("PGCOPY\n\377\r\n\0", 11);
+
+size_t extend(std::string& data, size_t len) {
+    size_t pos = data.size();
+    data.resize(pos+len);
+    return pos;
+}
+
+void write_copy_header(std::string& data) {
+    size_t pos = extend(data, 19);
+    std::copy(copy_signature.begin(), copy_signature.end(), data.begin()+pos);
+    pos = write_int32(data, pos+11, 0); //flags
+    write_int32(data, pos, 0); //header extension length
+}
+
+void write_copy_trailer(std::string& data) {
+    write_int16(data, extend(data, 2), -1);
+}
+
+void write_row_start(std::string& data, size_t numfields) {
+    write_int16(data, extend(data, 2), numfields);
+}
+
+void write_null_field(std::string& data) {
+    write_int32(data, extend(data, 4), -1);
+}
+
+void write_int8_field(std::string& data, int64 v) {
+    size_t pos = extend(data, 12);
+    pos = write_int32(data, pos, 8);
+    write_int64(data, pos, v);
+}
+
+void write_int8_field(std::string& data, std::optional<int64> v) {
+    if (!v) {
+        write_null_field(data);
+    } else {
+        write_int8_field(data, *v);
+    }
+}
+
+void write_float8_field(std::string& data, double v) {
+    size_t pos = extend(data, 12);
+    pos = write_int32(data, pos, 8);
+    write_double(data, pos, v);
+}
+
+size_t write_bytes(std::string& data, size_t pos, const std::string& v) {
+    std::copy(v.begin(), v.end(), data.begin()+pos);
+    return pos+v.size();
+}
+
+//same layout as pack_hstoretags_binary, written in place
+void write_hstore_field(std::string& data, const tagvector& tags) {
+    size_t len = 4 + tags.size()*8;
+    for (const auto& tg: tags) {
+        len += tg.key.size() + tg.val.size();
+    }
+    size_t pos = extend(data, 4+len);
+    pos = write_int32(data, pos, len);
+    pos = write_int32(data, pos, tags.size());
+    for (const auto& tg: tags) {
+        pos = write_int32(data, pos, tg.key.size());
+        pos = write_bytes(data, pos, tg.key);
+        pos = write_int32(data, pos, tg.val.size());
+        pos = write_bytes(data, pos, tg.val);
+    }
+}
+
+void write_jsonb_field(std::string& data, const tagvector& tags) {
+    std::string js = pack_jsontags_picojson(tags);
+    size_t pos = extend(data, 5+js.size());
+    pos = write_int32(data, pos, 1+js.size());
+    data[pos] = 1; //jsonb binary format version
+    write_bytes(data, pos+1, js);
+}
+
+void write_tags_field(std::string& data, const tagvector& tags, bool jsonb_tags) {
+    if (jsonb_tags) {
+        write_jsonb_field(data, tags);
+    } else {
+        write_hstore_field(data, tags);
+    }
+}
+
+//geometries are written as big endian ewkb, with the srid on the outermost geometry only
+size_t write_wkb_header(std::string& data, size_t pos, uint32_t type, bool transform, bool srid) {
+    data[pos] = '\0';
+    if (srid) {
+        pos = write_uint32(data, pos+1, type | 0x20000000);
+        return write_uint32(data, pos, epsg_code(transform));
+    }
+    return write_uint32(data, pos+1, type);
+}
+
+size_t start_geometry_field(std::string& data, size_t len) {
+    size_t pos = extend(data, 4+len);
+    return write_int32(data, pos, len);
+}
+
+void write_point_geometry(std::string& data, const oqt::LonLat& ll, bool transform) {
+    size_t pos = start_geometry_field(data, 25);
+    pos = write_wkb_header(data, pos, 1, transform, true);
+    write_point(data, pos, ll, transform);
+}
+
+void write_linestring_geometry(std::string& data, const std::vector<LonLat>& lonlats, bool transform) {
+    size_t pos = start_geometry_field(data, 13+16*lonlats.size());
+    pos = write_wkb_header(data, pos, 2, transform, true);
+    write_ring(data, pos, lonlats, transform);
+}
+
+void write_simplepolygon_geometry(std::string& data, const std::vector<LonLat>& lonlats, bool reversed, bool transform) {
+    size_t pos = start_geometry_field(data, 17+16*lonlats.size());
+    pos = write_wkb_header(data, pos, 3, transform, true);
+    pos = write_uint32(data, pos, 1);
+    if (!reversed) {
+        write_ring(data, pos, lonlats, transform);
+        return;
+    }
+    pos = write_uint32(data, pos, lonlats.size());
+    for (auto it=lonlats.rbegin(); it!=lonlats.rend(); ++it) {
+        pos = write_point(data, pos, *it, transform);
+    }
+}
+
+struct PolygonPartLengths {
+    size_t outer;
+    std::vector<size_t> inners;
+    size_t wkb_size;
+};
+
+PolygonPartLengths polygon_part_lengths(const PolygonPart& part) {
+    PolygonPartLengths result;
+    result.outer = ringpart_numpoints(part.outer);
+    result.wkb_size = 9 + 4 + 16*result.outer;
+    for (const auto& inner: part.inners) {
+        size_t l = ringpart_numpoints(inner);
+        result.inners.push_back(l);
+        result.wkb_size += 4 + 16*l;
+    }
+    return result;
+}
+
+size_t write_polygon_part(std::string& data, size_t pos, const PolygonPart& part, const PolygonPartLengths& lens, bool transform, bool srid) {
+    pos = write_wkb_header(data, pos, 3, transform, srid);
+    pos = write_uint32(data, pos, 1+part.inners.size());
+    pos = write_ringpart_ring(data, pos, part.outer, lens.outer, transform);
+    for (size_t i=0; i < part.inners.size(); i++) {
+        pos = write_ringpart_ring(data, pos, part.inners[i], lens.inners[i], transform);
+    }
+    return pos;
+}
+
+void write_complicatedpolygon_geometry(std::string& data, const std::vector<PolygonPart>& parts, bool transform) {
+    if (parts.empty()) {
+        size_t pos = start_geometry_field(data, 13);
+        pos = write_wkb_header(data, pos, 7, transform, true);
+        write_uint32(data, pos, 0);
+        return;
+    }
+    
+    std::vector<PolygonPartLengths> lens;
+    lens.reserve(parts.size());
+    for (const auto& part: parts) {
+        lens.push_back(polygon_part_lengths(part));
+    }
+    
+    if (parts.size()==1) {
+        size_t pos = start_geometry_field(data, lens[0].wkb_size+4);
+        write_polygon_part(data, pos, parts[0], lens[0], transform, true);
+        return;
+    }
+    
+    size_t len = 13;
+    for (const auto& l: lens) { len += l.wkb_size; }
+    
+    size_t pos = start_geometry_field(data, len);
+    pos = write_wkb_header(data, pos, 6, transform, true);
+    pos = write_uint32(data, pos, parts.size());
+    for (size_t i=0; i < parts.size(); i++) {
+        pos = write_polygon_part(data, pos, parts[i], lens[i], transform, false);
+    }
+}
+
+void write_common_fields(std::string& data, PostgisCopyTable table, int64 osm_id, ElementPtr ele, std::optional<int64> layer, bool jsonb_tags) {
+    write_row_start(data, table_columns(table).size());
+    write_int8_field(data, osm_id);
+    write_int8_field(data, ele->Quadtree());
+    write_tags_field(data, ele->Tags(), jsonb_tags);
+    write_int8_field(data, layer);
+}
+
+size_t write_postgiscopy_block(std::vector<std::string>& tables, PrimitiveBlockPtr block, bool transform, bool jsonb_tags) {
+    if (tables.size()!=3) {
+        tables.resize(3);
+    }
+    std::string& points = tables[(size_t) PostgisCopyTable::Point];
+    std::string& lines = tables[(size_t) PostgisCopyTable::Line];
+    std::string& polygons = tables[(size_t) PostgisCopyTable::Polygon];
+    
+    size_t count=0;
+    for (auto ele: block->Objects()) {
+        auto geom = std::dynamic_pointer_cast<BaseGeometry>(ele);
+        if (!geom) { continue; }
+        if (geom->OriginalType()==ElementType::Unknown) {
+            //read from a packed geometry file
+            geom = std::dynamic_pointer_cast<BaseGeometry>(unpack_geometry_element(geom));
+        }
+        
+        if (geom->Type()==ElementType::Point) {
+            auto pt = std::dynamic_pointer_cast<Point>(geom);
+            write_common_fields(points, PostgisCopyTable::Point, pt->Id(), pt, pt->Layer(), jsonb_tags);
+            write_int8_field(points, pt->MinZoom());
+            write_point_geometry(points, pt->LonLat(), transform);
+            count++;
+            
+        } else if (geom->Type()==ElementType::Linestring) {
+            auto ln = std::dynamic_pointer_cast<Linestring>(geom);
+            write_common_fields(lines, PostgisCopyTable::Line, ln->Id(), ln, ln->Layer(), jsonb_tags);
+            write_int8_field(lines, ln->ZOrder());
+            write_int8_field(lines, ln->MinZoom());
+            write_float8_field(lines, ln->Length());
+            write_linestring_geometry(lines, ln->LonLats(), transform);
+            count++;
+            
+        } else if (geom->Type()==ElementType::SimplePolygon) {
+            auto py = std::dynamic_pointer_cast<SimplePolygon>(geom);
+            write_common_fields(polygons, PostgisCopyTable::Polygon, py->Id(), py, py->Layer(), jsonb_tags);
+            write_int8_field(polygons, py->ZOrder());
+            write_int8_field(polygons, py->MinZoom());
+            write_float8_field(polygons, py->Area());
+            write_simplepolygon_geometry(polygons, py->LonLats(), py->Reversed(), transform);
+            count++;
+            
+        } else if (geom->Type()==ElementType::ComplicatedPolygon) {
+            //relation ids are negated, as they may clash with way ids
+            auto py = std::dynamic_pointer_cast<ComplicatedPolygon>(geom);
+            write_common_fields(polygons, PostgisCopyTable::Polygon, -py->Id(), py, py->Layer(), jsonb_tags);
+            write_int8_field(polygons, py->ZOrder());
+            write_int8_field(polygons, py->MinZoom());
+            write_float8_field(polygons, py->Area());
+            write_complicatedpolygon_geometry(polygons, py->Parts(), transform);
+            count++;
+        }
+    }
+    return count;
+}
+
+struct PostgisCopyBlock {
+    int64 index;
+    std::vector<std::string> tables;
+    size_t num_rows;
+};
+
+class PostgisCopyWriter {
+    public:
+        PostgisCopyWriter(const PostgisCopyParameters& params) : files(3), num_rows(0), num_blocks(0) {
+            
+            std::string head;
+            write_copy_header(head);
+            for (size_t i=0; i < 3; i++) {
+                std::string fn = postgiscopy_filename(params, (PostgisCopyTable) i);
+                files[i].open(fn, std::ios::out | std::ios::binary | std::ios::trunc);
+                if (!files[i].good()) {
+                    throw std::domain_error("can't open "+fn);
+                }
+                files[i].write(head.data(), head.size());
+            }
+        }
+        
+        void call(std::shared_ptr<PostgisCopyBlock> bl) {
+            if (!bl) {
+                finish();
+                return;
+            }
+            for (size_t i=0; i < 3; i++) {
+                const auto& d = bl->tables[i];
+                if (!d.empty()) {
+                    files[i].write(d.data(), d.size());
+                }
+            }
+            num_rows += bl->num_rows;
+            num_blocks++;
+        }
+        
+    private:
+        void finish() {
+            std::string trailer;
+            write_copy_trailer(trailer);
+            for (auto& f: files) {
+                f.write(trailer.data(), trailer.size());
+                f.close();
+            }
+            Logger::Message() << "PostgisCopyWriter wrote " << num_rows << " rows from " << num_blocks << " blocks";
+        }
+        
+        std::vector<std::ofstream> files;
+        size_t num_rows;
+        size_t num_blocks;
+};
+
+std::vector<block_callback> make_postgiscopy_callbacks(
+    std::vector<block_callback> callbacks,
+    const PostgisCopyParameters& params, size_t numchan) {
+    
+    if (!callbacks.empty() && (callbacks.size()!=numchan)) {
+        throw std::domain_error("make_postgiscopy_callbacks: wrong number of callbacks");
+    }
+    
+    auto writer = std::make_shared<PostgisCopyWriter>(params);
+    auto write_split = multi_threaded_callback<PostgisCopyBlock>::make(
+        [writer](std::shared_ptr<PostgisCopyBlock> bl) { writer->call(bl); }, numchan);
+    
+    bool transform = params.transform;
+    bool jsonb_tags = params.jsonb_tags;
+    
+    std::vector<block_callback> result(numchan);
+    for (size_t i=0; i < numchan; i++) {
+        auto write_i = write_split[i];
+        block_callback cb;
+        if (!callbacks.empty()) { cb = callbacks[i]; }
+        
+        result[i] = [write_i, cb, transform, jsonb_tags](PrimitiveBlockPtr bl) {
+            if (cb) {
+                cb(bl);
+            }
+            if (!bl) {
+                write_i(nullptr);
+                return;
+            }
+            auto out = std::make_shared<PostgisCopyBlock>();
+            out->index = bl->Index();
+            out->tables.resize(3);
+            out->num_rows = write_postgiscopy_block(out->tables, bl, transform, jsonb_tags);
+            write_i(out);
+        };
+    }
+    return result;
+}
+
+
+class CopyFileReader {
+    public:
+        CopyFileReader(const std::string& fn) : file(fn, std::ios::in | std::ios::binary), pos(0) {
+            if (!file.good()) {
+                throw std::domain_error("can't open "+fn);
+            }
+        }
+        
+        void read(std::string& out, size_t len) {
+            out.resize(len);
+            if (len==0) { return; }
+            file.read(&out[0], len);
+            if ((size_t) file.gcount()!=len) {
+                fail("unexpected end of file");
+            }
+            pos += len;
+        }
+        
+        int64 read_int(size_t len) {
+            read(buf, len);
+            return read_int_at(buf, 0, len);
+        }
+        
+        static int64 read_int_at(const std::string& data, size_t p, size_t len) {
+            uint64 v=0;
+            for (size_t i=0; i < len; i++) {
+                v = (v<<8) | ((unsigned char) data[p+i]);
+            }
+            if (len==2) { return (int16_t) v; }
+            if (len==4) { return (int32_t) v; }
+            return (int64) v;
+        }
+        
+        bool at_end() {
+            return file.peek()==std::char_traits<char>::eof();
+        }
+        
+        [[noreturn]] void fail(const std::string& msg) {
+            std::stringstream ss;
+            ss << msg << " at " << pos;
+            throw std::domain_error(ss.str());
+        }
+        
+    private:
+        std::ifstream file;
+        std::string buf;
+        size_t pos;
+};
+
+void check_hstore(CopyFileReader& reader, const std::string& data) {
+    if (data.size()<4) { reader.fail("hstore value too short"); }
+    int64 n = CopyFileReader::read_int_at(data, 0, 4);
+    if (n<0) { reader.fail("hstore negative count"); }
+    size_t p=4;
+    for (int64 i=0; i < 2*n; i++) {
+        if (p+4 > data.size()) { reader.fail("hstore value truncated"); }
+        int64 l = CopyFileReader::read_int_at(data, p, 4);
+        p += 4;
+        if (l==-1 && (i%2)==1) { continue; } //null value
+        if (l<0 || (p+l) > data.size()) { reader.fail("hstore bad string length"); }
+        p += l;
+    }
+    if (p!=data.size()) { reader.fail("hstore trailing data"); }
+}
+
+size_t check_ewkb(CopyFileReader& reader, const std::string& data, size_t p, PostgisCopyTable table, bool outer) {
+    if (p+5 > data.size()) { reader.fail("ewkb truncated"); }
+    if (data[p]!='\0') { reader.fail("ewkb not big endian"); }
+    uint32_t ty = CopyFileReader::read_int_at(data, p+1, 4);
+    p += 5;
+    if (outer != ((ty & 0x20000000)!=0)) {
+        reader.fail(outer ? "ewkb missing srid" : "ewkb srid on inner geometry");
+    }
+    if (outer) {
+        p += 4;
+    }
+    ty &= ~0x20000000;
+    
+    if (outer) {
+        bool ok = (table==PostgisCopyTable::Point && ty==1)
+            || (table==PostgisCopyTable::Line && ty==2)
+            || (table==PostgisCopyTable::Polygon && (ty==3 || ty==6 || ty==7));
+        if (!ok) { reader.fail("unexpected geometry type "+std::to_string(ty)); }
+    }
+    
+    auto check_count = [&reader, &data](size_t p, size_t sz) {
+        if (p+4 > data.size()) { reader.fail("ewkb truncated"); }
+        size_t n = CopyFileReader::read_int_at(data, p, 4);
+        if (p+4+n*sz > data.size()) { reader.fail("ewkb truncated"); }
+        return n;
+    };
+    
+    if (ty==1) {
+        p += 16;
+    } else if (ty==2) {
+        size_t n = check_count(p, 16);
+        if (n<2) { reader.fail("linestring with fewer than two points"); }
+        p += 4 + 16*n;
+    } else if (ty==3) {
+        size_t nr = check_count(p, 4);
+        p += 4;
+        for (size_t i=0; i < nr; i++) {
+            size_t n = check_count(p, 16);
+            if (n<4) { reader.fail("polygon ring with fewer than four points"); }
+            if (data.compare(p+4, 16, data, p+4+16*(n-1), 16)!=0) {
+                reader.fail("polygon ring not closed");
+            }
+            p += 4 + 16*n;
+        }
+    } else if (ty==6 || ty==7) {
+        if (!outer) { reader.fail("nested collection"); }
+        size_t n = check_count(p, 0);
+        if (ty==7 && n!=0) { reader.fail("non-empty geometry collection"); }
+        p += 4;
+        for (size_t i=0; i < n; i++) {
+            if (p+5 > data.size() || CopyFileReader::read_int_at(data, p+1, 4)!=3) {
+                reader.fail("multipolygon member not a polygon");
+            }
+            p = check_ewkb(reader, data, p, table, false);
+        }
+    } else {
+        reader.fail("unexpected geometry type "+std::to_string(ty));
+    }
+    if (p > data.size()) { reader.fail("ewkb truncated"); }
+    return p;
+}
+
+int64 validate_postgiscopy_file(const std::string& filename, PostgisCopyTable table, bool jsonb_tags) {
+    
+    const auto& columns = table_columns(table);
+    
+    CopyFileReader reader(filename);
+    std::string field;
+    
+    reader.read(field, 11);
+    if (field!=copy_signature) { reader.fail("bad signature"); }
+    if (reader.read_int(4)!=0) { reader.fail("unexpected flags"); }
+    int64 extlen = reader.read_int(4);
+    if (extlen<0) { reader.fail("bad header extension length"); }
+    reader.read(field, extlen);
+    
+    int64 num_rows=0;
+    while (true) {
+        int64 nf = reader.read_int(2);
+        if (nf==-1) { break; }
+        if (nf != (int64) columns.size()) {
+            reader.fail("row "+std::to_string(num_rows)+" has "+std::to_string(nf)+" fields, expected "+std::to_string(columns.size()));
+        }
+        for (const auto& col: columns) {
+            int64 len = reader.read_int(4);
+            if (len==-1) {
+                if (col.type!=CopyColumnType::Int8) { reader.fail("unexpected null "+col.name); }
+                continue;
+            }
+            if (len<0) { reader.fail("bad field length"); }
+            reader.read(field, len);
+            
+            switch (col.type) {
+                case CopyColumnType::Int8:
+                case CopyColumnType::Float8:
+                    if (len!=8) { reader.fail("bad length for "+col.name); }
+                    break;
+                case CopyColumnType::Tags:
+                    if (jsonb_tags) {
+                        if (len<3 || field[0]!=1 || field[1]!='{' || field[len-1]!='}') {
+                            reader.fail("bad jsonb tags");
+                        }
+                    } else {
+                        check_hstore(reader, field);
+                    }
+                    break;
+                case CopyColumnType::Geometry:
+                    if (check_ewkb(reader, field, 0, table, true)!=field.size()) {
+                        reader.fail("ewkb trailing data");
+                    }
+                    break;
+            }
+        }
+        num_rows++;
+    }
+    if (!reader.at_end()) { reader.fail("data after trailer"); }
+    return num_rows;
+}
+
+}
+}
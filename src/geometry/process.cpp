@@ -138,9 +138,10 @@ block_callback process_geometry_blocks(
        
         makegeoms[i]  =threaded_callback<PrimitiveBlock>::make(
             BlockhandlerCallbackTime::make("MakeGeometries["+std::to_string(i)+"]",
-                make_geometryprocess(params.feature_keys, params.polygon_tags, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.recalcqts,params.findmz,params.max_min_zoom_level),
+                make_geometryprocess(params.feature_keys, params.polygon_tags, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.recalcqts,params.findmz,params.max_min_zoom_level,params.simplify),
                 finalcb
-            )
+            ),
+            "MakeGeometries"
         );
         
         
@@ -158,10 +159,10 @@ block_callback process_geometry_blocks(
        
         
         make_mps = threaded_callback<PrimitiveBlock>::make(
-            BlockhandlerCallbackTime::make("MultiPolygons", //blockhandler_callback(
-                make_multipolygons(errors_callback,params.feature_keys, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.add_boundary_polygons, params.add_multipolygons,params.max_number_errors),
-                makegeoms_split
-            )
+            make_multipolygons_callback(makegeoms_split, errors_callback,
+                params.feature_keys, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.add_boundary_polygons, params.add_multipolygons,params.max_number_errors,
+                params.numchan),
+            "MultiPolygons"
         );
     }
             
@@ -174,7 +175,8 @@ block_callback process_geometry_blocks(
             BlockhandlerCallbackTime::make("HandleRelations",
                 make_handlerelations(params.relation_tag_spec),
                 make_mps
-            )
+            ),
+            "HandleRelations"
         );
     }
     
@@ -184,11 +186,12 @@ block_callback process_geometry_blocks(
             BlockhandlerCallbackTime::make("AddParentTags", //blockhandler_callback(
                 make_addparenttags(params.parent_tag_spec),
                 reltags
-            )
+            ),
+            "AddParentTags"
         );
     }
     
-    return threaded_callback<PrimitiveBlock>::make(make_addwaynodes_cb(apt));
+    return threaded_callback<PrimitiveBlock>::make(make_addwaynodes_cb_parallel(apt, params.numchan), "AddWayNodes");
         
 
     
@@ -206,7 +209,7 @@ block_callback process_geometry_blocks_nothread(
     
     
     auto make_geom = BlockhandlerCallbackTime::make("GeometryProcess",
-        make_geometryprocess(params.feature_keys, params.polygon_tags, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.recalcqts,params.findmz,params.max_min_zoom_level),
+        make_geometryprocess(params.feature_keys, params.polygon_tags, params.other_keys, params.drop_keys, params.all_other_keys,params.all_objs,params.box,params.recalcqts,params.findmz,params.max_min_zoom_level,params.simplify),
         
         final_callback
     );
@@ -273,12 +276,13 @@ std::vector<block_callback> pack_and_write_callback(
     write_file_callback write = make_pbffilewriter_filelocs_callback(filename,head);
     
     //auto write_split = threaded_callback<std::pair<int64,std::string>>::make(write, numchan);
-    auto write_split = multi_threaded_callback<std::pair<int64,std::string>>::make(write, numchan);
+    auto write_split = multi_threaded_callback<std::pair<int64,std::string>>::make(write, numchan, "write blocks");
+    auto compress_split = make_compress_callbacks(write_split, "OSMData", -1);
     
     std::vector<block_callback> pack(numchan);
     
     for (size_t i=0; i < numchan; i++) {
-        auto write_i = write_split[i];
+        auto write_i = compress_split[i];
         block_callback cb;
         if (!callbacks.empty()) { cb = callbacks[i]; }
         pack[i] = //threaded_callback<primitiveblock>::make(
@@ -292,8 +296,7 @@ std::vector<block_callback> pack_and_write_callback(
                     return;
                 } else {
                     auto data = pack_primitive_block(bl, writeqts, false, writeinfos, writerefs);
-                    auto packed = prepare_file_block("OSMData", data);
-                    write_i(std::make_shared<keystring>(bl->Quadtree(),packed));
+                    write_i(std::make_shared<keystring>(bl->Quadtree(),data));
                 }
             };
         //);
@@ -395,12 +398,17 @@ mperrorvec process_geometry(const GeometryParameters& params, block_callback wra
         
     }
     
-    
+    if (params.postgiscopy.prefix!="") {
+        writer = make_postgiscopy_callbacks(writer, params.postgiscopy, params.numchan);
+    }
+    if (params.vectortiles.outfn!="") {
+        writer = make_vectortile_callbacks(writer, params.vectortiles, params.numchan);
+    }
     
     auto addwns = process_geometry_blocks(writer, params, [&errors_res](mperrorvec& ee) { errors_res = ee; });
     
     
-    read_blocks_merge(params.filenames, addwns, params.locs, params.numchan, nullptr, ReadBlockFlags::Empty, 1<<14);
+    read_blocks_merge(params.filenames, addwns, params.locs, params.numchan, nullptr, ReadBlockFlags::Empty, 1<<14, params.block_cache);
       
     
     return errors_res;
@@ -421,12 +429,12 @@ mperrorvec process_geometry_sortblocks(const GeometryParameters& params, block_c
   
     auto addwns = process_geometry_blocks(sb_callbacks, params, [&errors_res](mperrorvec& ee) { errors_res.errors.swap(ee.errors); errors_res.count=ee.count; });
     
-    read_blocks_merge(params.filenames, addwns, params.locs, params.numchan, nullptr, ReadBlockFlags::Empty, 1<<14);
+    read_blocks_merge(params.filenames, addwns, params.locs, params.numchan, nullptr, ReadBlockFlags::Empty, 1<<14, params.block_cache);
     
     
     sb->finish();
     
-    if ((params.outfn!="") && (!cb)) {
+    if ((params.outfn!="") && (!cb) && (params.postgiscopy.prefix=="") && (params.vectortiles.outfn=="")) {
         auto head = std::make_shared<Header>();
         head->SetBBox(params.box);
     
@@ -452,6 +460,12 @@ mperrorvec process_geometry_sortblocks(const GeometryParameters& params, block_c
             writer = pack_and_write_callback(writer, params.outfn, params.indexed, params.box, params.numchan, true, true, true);
             
         }
+        if (params.postgiscopy.prefix!="") {
+            writer = make_postgiscopy_callbacks(writer, params.postgiscopy, params.numchan);
+        }
+        if (params.vectortiles.outfn!="") {
+            writer = make_vectortile_callbacks(writer, params.vectortiles, params.numchan);
+        }
         sb->read_blocks(split_callback<PrimitiveBlock>::make(writer), true);
     
     }
@@ -474,11 +488,21 @@ mperrorvec process_geometry_nothread(const GeometryParameters& params, block_cal
     if (params.outfn!="") {
         writer = pack_and_write_callback_nothread(writer, params.outfn, params.indexed, params.box, true, true, true);
     }
+    if (params.postgiscopy.prefix!="") {
+        std::vector<block_callback> cbs;
+        if (writer) { cbs.push_back(writer); }
+        writer = make_postgiscopy_callbacks(cbs, params.postgiscopy, 1)[0];
+    }
+    if (params.vectortiles.outfn!="") {
+        std::vector<block_callback> cbs;
+        if (writer) { cbs.push_back(writer); }
+        writer = make_vectortile_callbacks(cbs, params.vectortiles, 1)[0];
+    }
     
     
     block_callback addwns = process_geometry_blocks_nothread(writer, params, [&errors_res](mperrorvec& ee) { errors_res.errors.swap(ee.errors); errors_res.count=ee.count; });
     
-    read_blocks_merge_nothread(params.filenames, addwns, params.locs, nullptr, ReadBlockFlags::Empty);
+    read_blocks_merge_nothread(params.filenames, addwns, params.locs, nullptr, ReadBlockFlags::Empty, params.block_cache);
       
     
     return errors_res;
@@ -0,0 +1,148 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/geometry/simplify.hpp"
+#include "oqt/geometry/elements/linestring.hpp"
+#include "oqt/geometry/elements/simplepolygon.hpp"
+#include "oqt/geometry/elements/complicatedpolygon.hpp"
+
+#include "oqt/utils/geometry.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace oqt {
+namespace geometry {
+
+double simplify_tolerance(int64 zoom) {
+    return 2*earth_width / 256.0 / ((double) (((int64) 1) << zoom));
+}
+
+double segment_distance(const XY& p, const XY& a, const XY& b) {
+    double dx = b.x-a.x, dy = b.y-a.y;
+    double ln = dx*dx + dy*dy;
+    double t = 0;
+    if (ln > 0) {
+        t = ((p.x-a.x)*dx + (p.y-a.y)*dy) / ln;
+        t = std::max(0.0, std::min(1.0, t));
+    }
+    double ex = a.x + t*dx - p.x, ey = a.y + t*dy - p.y;
+    return std::sqrt(ex*ex + ey*ey);
+}
+
+uint8_t significance_zoom(double sig) {
+    for (int64 z=0; z <= 30; z++) {
+        if (sig > simplify_tolerance(z)) {
+            return z;
+        }
+    }
+    return vertex_zoom_never;
+}
+
+std::vector<uint8_t> calc_vertex_zooms(const std::vector<LonLat>& lonlats, bool is_ring) {
+    size_t n = lonlats.size();
+    if (n < 3) {
+        return std::vector<uint8_t>(n, 0);
+    }
+    
+    std::vector<XY> xy;
+    xy.reserve(n);
+    for (const auto& ll: lonlats) {
+        xy.push_back(forward_transform(ll.lon, std::max((int64) -850511287, std::min((int64) 850511287, ll.lat))));
+    }
+    
+    //the significance of each vertex is its distance from the segment it
+    //splits, capped by the significance of that segment's own split vertex
+    double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> sig(n, 0);
+    sig[0] = inf;
+    sig[n-1] = inf;
+    
+    std::vector<std::tuple<size_t,size_t,double>> stack{{0, n-1, inf}};
+    while (!stack.empty()) {
+        size_t i, j; double parent;
+        std::tie(i, j, parent) = stack.back();
+        stack.pop_back();
+        if (j <= i+1) { continue; }
+        
+        size_t k = i+1;
+        double d = -1;
+        for (size_t m=i+1; m < j; m++) {
+            double dm = segment_distance(xy[m], xy[i], xy[j]);
+            if (dm > d) { d=dm; k=m; }
+        }
+        sig[k] = std::min(d, parent);
+        stack.push_back(std::make_tuple(i, k, sig[k]));
+        stack.push_back(std::make_tuple(k, j, sig[k]));
+    }
+    
+    if (is_ring && n >= 4) {
+        size_t a=1, b=2;
+        if (sig[b] > sig[a]) { std::swap(a, b); }
+        for (size_t m=3; m < n-1; m++) {
+            if (sig[m] > sig[a]) { b=a; a=m; }
+            else if (sig[m] > sig[b]) { b=m; }
+        }
+        sig[a] = inf;
+        sig[b] = inf;
+    }
+    
+    std::vector<uint8_t> result(n);
+    for (size_t m=0; m < n; m++) {
+        result[m] = std::isinf(sig[m]) ? 0 : significance_zoom(sig[m]);
+    }
+    return result;
+}
+
+std::vector<LonLat> simplify_lonlats(const std::vector<LonLat>& lonlats, const std::vector<uint8_t>& vertex_zooms, int64 zoom) {
+    if ((zoom < 0) || (vertex_zooms.size()!=lonlats.size())) {
+        return lonlats;
+    }
+    std::vector<LonLat> result;
+    for (size_t i=0; i < lonlats.size(); i++) {
+        if (vertex_zooms[i] <= zoom) {
+            result.push_back(lonlats[i]);
+        }
+    }
+    return result;
+}
+
+size_t simplify_geometries(PrimitiveBlockPtr block) {
+    if (!block) { return 0; }
+    size_t count=0;
+    for (auto ele: block->Objects()) {
+        if (ele->Type()==ElementType::Linestring) {
+            auto ln = std::dynamic_pointer_cast<Linestring>(ele);
+            if (ln) { ln->CalcVertexZooms(); count++; }
+        } else if (ele->Type()==ElementType::SimplePolygon) {
+            auto py = std::dynamic_pointer_cast<SimplePolygon>(ele);
+            if (py) { py->CalcVertexZooms(); count++; }
+        } else if (ele->Type()==ElementType::ComplicatedPolygon) {
+            auto py = std::dynamic_pointer_cast<ComplicatedPolygon>(ele);
+            if (py) { py->CalcVertexZooms(); count++; }
+        }
+    }
+    return count;
+}
+
+}
+}
@@ -267,6 +267,7 @@ ElementPtr readGeometry_int(ElementType ty, int64 id, ElementInfo inf, const std
         int64 minzoom=-1;
         int64 zorder=0; int64 layer=0; double length=0, area=0;
         bool rev=false;
+        std::vector<uint8_t> vertex_zooms;
 
         for (const auto& t : pbftags) {
             if (t.tag==8) { rfs = read_packed_delta(t.data);}
@@ -278,15 +279,24 @@ ElementPtr readGeometry_int(ElementType ty, int64 id, ElementInfo inf, const std
             if (t.tag==22) { minzoom = (int64) t.value; }
             if (t.tag==23) { rev = t.value==1; }
             if (t.tag==24) { layer=un_zig_zag(t.value); }
+            if (t.tag==26) {
+                for (auto z: read_packed_int(t.data)) {
+                    vertex_zooms.push_back(z);
+                }
+            }
             //if (t.tag==20) { bounds=unpack_bounds(t.data); }
         }
         bbox bounds;
         expand_bbox(bounds,lonlats);
 
         if (ty==ElementType::Linestring) {
-            return std::make_shared<Linestring>(id,qt,inf,tgs,rfs, lonlats, zorder, layer,length,bounds,minzoom);
+            auto ln = std::make_shared<Linestring>(id,qt,inf,tgs,rfs, lonlats, zorder, layer,length,bounds,minzoom);
+            ln->SetVertexZooms(vertex_zooms);
+            return ln;
         } else if (ty==ElementType::SimplePolygon) {
-            return std::make_shared<SimplePolygon>(id,qt,inf,tgs,rfs, lonlats, zorder, layer,area,bounds,minzoom,rev);
+            auto py = std::make_shared<SimplePolygon>(id,qt,inf,tgs,rfs, lonlats, zorder, layer,area,bounds,minzoom,rev);
+            py->SetVertexZooms(vertex_zooms);
+            return py;
         }
     } else if ((ty==ElementType::ComplicatedPolygon)) {
         int64 minzoom=-1;
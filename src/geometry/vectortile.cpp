@@ -0,0 +1,995 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/geometry/vectortile.hpp"
+#include "oqt/geometry/elements/point.hpp"
+#include "oqt/geometry/elements/linestring.hpp"
+#include "oqt/geometry/elements/simplepolygon.hpp"
+#include "oqt/geometry/elements/complicatedpolygon.hpp"
+
+#include "oqt/elements/header.hpp"
+#include "oqt/elements/quadtree.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+
+#include "oqt/utils/geometry.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/threadedcallback.hpp"
+#include "oqt/utils/pbf/fixedint.hpp"
+#include "oqt/utils/pbf/protobuf.hpp"
+
+#include <experimental/filesystem>
+#include <fstream>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+namespace oqt {
+namespace geometry {
+
+typedef std::vector<XY> xy_line;
+
+struct TileBox {
+    double minx, miny, maxx, maxy;
+};
+
+double tile_size(int64 z) {
+    return 2*earth_width / (((int64) 1)<<z);
+}
+
+TileBox tile_box(int64 x, int64 y, int64 z, double buffer_frac) {
+    double sz = tile_size(z);
+    double b = sz*buffer_frac;
+    return TileBox{
+        -earth_width + x*sz - b, earth_width - (y+1)*sz - b,
+        -earth_width + (x+1)*sz + b, earth_width - y*sz + b};
+}
+
+TileBox line_box(const xy_line& line) {
+    TileBox r{line[0].x, line[0].y, line[0].x, line[0].y};
+    for (const auto& p: line) {
+        r.minx = std::min(r.minx, p.x); r.maxx = std::max(r.maxx, p.x);
+        r.miny = std::min(r.miny, p.y); r.maxy = std::max(r.maxy, p.y);
+    }
+    return r;
+}
+
+bool box_within(const TileBox& inner, const TileBox& outer) {
+    return inner.minx >= outer.minx && inner.maxx <= outer.maxx && inner.miny >= outer.miny && inner.maxy <= outer.maxy;
+}
+bool box_disjoint(const TileBox& l, const TileBox& r) {
+    return l.maxx < r.minx || l.minx > r.maxx || l.maxy < r.miny || l.miny > r.maxy;
+}
+
+//! geometry projected to spherical mercator
+struct MercatorGeometry {
+    ElementType type;
+    std::vector<xy_line> lines; //the single point, or the linestring parts
+    std::vector<std::vector<xy_line>> polygons; //outer ring followed by inner rings
+    
+    bool empty() const { return lines.empty() && polygons.empty(); }
+};
+
+const int64 max_mercator_lat = 850511287;
+
+XY project(const LonLat& ll) {
+    return forward_transform(ll.lon, std::max(-max_mercator_lat, std::min(max_mercator_lat, ll.lat)));
+}
+
+xy_line project_line(const std::vector<LonLat>& lonlats) {
+    xy_line result;
+    result.reserve(lonlats.size());
+    for (const auto& ll: lonlats) {
+        result.push_back(project(ll));
+    }
+    return result;
+}
+
+bool project_geometry(std::shared_ptr<BaseGeometry> geom, MercatorGeometry& result) {
+    result.type = geom->Type();
+    if (geom->Type()==ElementType::Point) {
+        result.lines.push_back({project(std::dynamic_pointer_cast<Point>(geom)->LonLat())});
+    } else if (geom->Type()==ElementType::Linestring) {
+        result.lines.push_back(project_line(std::dynamic_pointer_cast<Linestring>(geom)->LonLats()));
+    } else if (geom->Type()==ElementType::SimplePolygon) {
+        result.polygons.push_back({project_line(std::dynamic_pointer_cast<SimplePolygon>(geom)->LonLats())});
+    } else if (geom->Type()==ElementType::ComplicatedPolygon) {
+        for (const auto& part: std::dynamic_pointer_cast<ComplicatedPolygon>(geom)->Parts()) {
+            std::vector<xy_line> poly;
+            poly.push_back(project_line(ringpart_lonlats(part.outer)));
+            for (const auto& inner: part.inners) {
+                poly.push_back(project_line(ringpart_lonlats(inner)));
+            }
+            result.polygons.push_back(poly);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+TileBox geometry_box(const MercatorGeometry& geom) {
+    TileBox r{0,0,0,0};
+    bool first=true;
+    auto add = [&r, &first](const xy_line& line) {
+        if (line.empty()) { return; }
+        TileBox b = line_box(line);
+        if (first) { r = b; first=false; return; }
+        r.minx = std::min(r.minx, b.minx); r.maxx = std::max(r.maxx, b.maxx);
+        r.miny = std::min(r.miny, b.miny); r.maxy = std::max(r.maxy, b.maxy);
+    };
+    for (const auto& l: geom.lines) { add(l); }
+    for (const auto& p: geom.polygons) { add(p[0]); }
+    return r;
+}
+
+//Liang-Barsky: returns false if the segment misses the box, else the parameters of the clipped segment
+bool clip_segment(const XY& a, const XY& b, const TileBox& box, double& t0, double& t1) {
+    double dx = b.x-a.x, dy = b.y-a.y;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {a.x-box.minx, box.maxx-a.x, a.y-box.miny, box.maxy-a.y};
+    t0=0; t1=1;
+    for (size_t i=0; i < 4; i++) {
+        if (p[i]==0) {
+            if (q[i]<0) { return false; }
+            continue;
+        }
+        double r = q[i]/p[i];
+        if (p[i]<0) {
+            if (r>t1) { return false; }
+            if (r>t0) { t0=r; }
+        } else {
+            if (r<t0) { return false; }
+            if (r<t1) { t1=r; }
+        }
+    }
+    return true;
+}
+
+XY interpolate(const XY& a, const XY& b, double t) {
+    return XY(a.x + t*(b.x-a.x), a.y + t*(b.y-a.y));
+}
+
+void clip_line(std::vector<xy_line>& result, const xy_line& line, const TileBox& box) {
+    if (line.size()<2) { return; }
+    TileBox lb = line_box(line);
+    if (box_disjoint(lb, box)) { return; }
+    if (box_within(lb, box)) {
+        result.push_back(line);
+        return;
+    }
+    
+    xy_line curr;
+    auto flush = [&result, &curr]() {
+        if (curr.size()>=2) { result.push_back(curr); }
+        curr.clear();
+    };
+    for (size_t i=1; i < line.size(); i++) {
+        double t0, t1;
+        if (!clip_segment(line[i-1], line[i], box, t0, t1)) {
+            flush();
+            continue;
+        }
+        if (t0>0) {
+            flush();
+            curr.push_back(interpolate(line[i-1], line[i], t0));
+        } else if (curr.empty()) {
+            curr.push_back(line[i-1]);
+        }
+        if (t1<1) {
+            curr.push_back(interpolate(line[i-1], line[i], t1));
+            flush();
+        } else {
+            curr.push_back(line[i]);
+        }
+    }
+    flush();
+}
+
+bool inside_edge(const XY& p, const TileBox& box, size_t edge) {
+    switch (edge) {
+        case 0: return p.x >= box.minx;
+        case 1: return p.x <= box.maxx;
+        case 2: return p.y >= box.miny;
+    }
+    return p.y <= box.maxy;
+}
+
+XY intersect_edge(const XY& a, const XY& b, const TileBox& box, size_t edge) {
+    if (edge<2) {
+        double x = edge==0 ? box.minx : box.maxx;
+        return XY(x, a.y + (b.y-a.y)*(x-a.x)/(b.x-a.x));
+    }
+    double y = edge==2 ? box.miny : box.maxy;
+    return XY(a.x + (b.x-a.x)*(y-a.y)/(b.y-a.y), y);
+}
+
+//Sutherland-Hodgman: returns an empty ring if nothing is left
+xy_line clip_ring(const xy_line& ring, const TileBox& box) {
+    if (ring.size()<4) { return {}; }
+    TileBox rb = line_box(ring);
+    if (box_disjoint(rb, box)) { return {}; }
+    if (box_within(rb, box)) { return ring; }
+    
+    xy_line out(ring.begin(), ring.end()-1);
+    for (size_t edge=0; edge < 4; edge++) {
+        xy_line in;
+        in.swap(out);
+        if (in.empty()) { break; }
+        XY prev = in.back();
+        bool prev_in = inside_edge(prev, box, edge);
+        for (const auto& curr: in) {
+            bool curr_in = inside_edge(curr, box, edge);
+            if (curr_in != prev_in) {
+                out.push_back(intersect_edge(prev, curr, box, edge));
+            }
+            if (curr_in) {
+                out.push_back(curr);
+            }
+            prev = curr;
+            prev_in = curr_in;
+        }
+    }
+    if (out.size()<3) { return {}; }
+    out.push_back(out.front());
+    return out;
+}
+
+MercatorGeometry clip_geometry(const MercatorGeometry& geom, const TileBox& box) {
+    MercatorGeometry result;
+    result.type = geom.type;
+    if (geom.type==ElementType::Point) {
+        const auto& p = geom.lines[0][0];
+        if (p.x >= box.minx && p.x <= box.maxx && p.y >= box.miny && p.y <= box.maxy) {
+            result.lines = geom.lines;
+        }
+        return result;
+    }
+    for (const auto& line: geom.lines) {
+        clip_line(result.lines, line, box);
+    }
+    for (const auto& poly: geom.polygons) {
+        auto outer = clip_ring(poly[0], box);
+        if (outer.empty()) { continue; }
+        std::vector<xy_line> clipped{outer};
+        for (size_t i=1; i < poly.size(); i++) {
+            auto inner = clip_ring(poly[i], box);
+            if (!inner.empty()) { clipped.push_back(inner); }
+        }
+        result.polygons.push_back(clipped);
+    }
+    return result;
+}
+
+//quantises geometries into tile coordinates, and writes the mvt geometry commands
+class CommandEncoder {
+    public:
+        CommandEncoder(int64 x, int64 y, int64 z, int64 extent) : cx(0), cy(0) {
+            double sz = tile_size(z);
+            minx = -earth_width + x*sz;
+            maxy = earth_width - y*sz;
+            scale = extent / sz;
+        }
+        
+        void add_point(const XY& p) {
+            command(1, 1);
+            move(quantise(p));
+        }
+        
+        bool add_line(const xy_line& line) {
+            auto pts = quantise_line(line);
+            if (pts.size()<2) { return false; }
+            command(1, 1);
+            move(pts[0]);
+            command(2, pts.size()-1);
+            for (size_t i=1; i < pts.size(); i++) {
+                move(pts[i]);
+            }
+            return true;
+        }
+        
+        bool add_ring(const xy_line& ring, bool outer) {
+            auto pts = quantise_line(ring);
+            if (pts.size()>1 && pts.front()==pts.back()) {
+                pts.pop_back();
+            }
+            if (pts.size()<3) { return false; }
+            
+            //mvt exterior rings have positive area in tile coordinates (with y pointing down)
+            int64 area=0;
+            for (size_t i=0; i < pts.size(); i++) {
+                const auto& a = pts[i];
+                const auto& b = pts[(i+1)%pts.size()];
+                area += a.first*b.second - b.first*a.second;
+            }
+            if (area==0) { return false; }
+            if ((area>0) != outer) {
+                std::reverse(pts.begin(), pts.end());
+            }
+            
+            command(1, 1);
+            move(pts[0]);
+            command(2, pts.size()-1);
+            for (size_t i=1; i < pts.size(); i++) {
+                move(pts[i]);
+            }
+            command(7, 1);
+            return true;
+        }
+        
+        std::vector<uint32_t> commands;
+        
+    private:
+        typedef std::pair<int64,int64> tile_xy;
+        
+        tile_xy quantise(const XY& p) {
+            return tile_xy(std::llround((p.x-minx)*scale), std::llround((maxy-p.y)*scale));
+        }
+        
+        std::vector<tile_xy> quantise_line(const xy_line& line) {
+            std::vector<tile_xy> result;
+            result.reserve(line.size());
+            for (const auto& p: line) {
+                auto q = quantise(p);
+                if (result.empty() || (q!=result.back())) {
+                    result.push_back(q);
+                }
+            }
+            return result;
+        }
+        
+        void command(uint32_t id, size_t count) {
+            commands.push_back((id & 7) | (count << 3));
+        }
+        void move(const tile_xy& p) {
+            commands.push_back(zig_zag(p.first-cx));
+            commands.push_back(zig_zag(p.second-cy));
+            cx = p.first;
+            cy = p.second;
+        }
+        
+        double minx, maxy, scale;
+        int64 cx, cy;
+};
+
+std::vector<uint32_t> encode_geometry(const MercatorGeometry& geom, int64 x, int64 y, int64 z, int64 extent) {
+    CommandEncoder enc(x, y, z, extent);
+    if (geom.type==ElementType::Point) {
+        enc.add_point(geom.lines[0][0]);
+    }
+    for (const auto& line: geom.lines) {
+        if (geom.type!=ElementType::Point) {
+            enc.add_line(line);
+        }
+    }
+    for (const auto& poly: geom.polygons) {
+        if (enc.add_ring(poly[0], true)) {
+            for (size_t i=1; i < poly.size(); i++) {
+                enc.add_ring(poly[i], false);
+            }
+        }
+    }
+    return enc.commands;
+}
+
+
+struct TileFeature {
+    int64 order;
+    std::shared_ptr<BaseGeometry> geom;
+    std::vector<uint32_t> commands;
+};
+typedef std::map<int64, std::vector<TileFeature>> tile_features_map;
+
+void append_pbf_value(std::string& out, uint64 tag, uint64 value) {
+    size_t pos = out.size();
+    out.resize(pos + pbf_value_length(tag, value));
+    write_pbf_value(out, pos, tag, value);
+}
+
+void append_pbf_data(std::string& out, uint64 tag, const std::string& data) {
+    size_t pos = out.size();
+    out.resize(pos + pbf_data_length(tag, data.size()));
+    write_pbf_data(out, pos, tag, data);
+}
+
+class VectorTileLayer {
+    public:
+        VectorTileLayer(const std::string& name_) : name(name_) {}
+        
+        void add_feature(const TileFeature& feat) {
+            const auto& geom = feat.geom;
+            std::vector<uint64> tags;
+            for (const auto& tg: geom->Tags()) {
+                std::string v;
+                append_pbf_data(v, 1, tg.val);
+                add_property(tags, tg.key, v);
+            }
+            
+            uint64 geomtype = 3;
+            if (geom->Type()==ElementType::Point) {
+                geomtype = 1;
+                add_int_property(tags, "layer", std::dynamic_pointer_cast<Point>(geom)->Layer());
+            } else if (geom->Type()==ElementType::Linestring) {
+                geomtype = 2;
+                auto ln = std::dynamic_pointer_cast<Linestring>(geom);
+                add_int_property(tags, "layer", ln->Layer());
+                add_int_property(tags, "z_order", ln->ZOrder());
+                add_double_property(tags, "way_length", ln->Length());
+            } else if (geom->Type()==ElementType::SimplePolygon) {
+                auto py = std::dynamic_pointer_cast<SimplePolygon>(geom);
+                add_int_property(tags, "layer", py->Layer());
+                add_int_property(tags, "z_order", py->ZOrder());
+                add_double_property(tags, "way_area", py->Area());
+            } else if (geom->Type()==ElementType::ComplicatedPolygon) {
+                auto py = std::dynamic_pointer_cast<ComplicatedPolygon>(geom);
+                add_int_property(tags, "layer", py->Layer());
+                add_int_property(tags, "z_order", py->ZOrder());
+                add_double_property(tags, "way_area", py->Area());
+            }
+            
+            std::string ft;
+            append_pbf_value(ft, 1, geom->Id());
+            append_pbf_data(ft, 2, write_packed_int(tags));
+            append_pbf_value(ft, 3, geomtype);
+            append_pbf_data(ft, 4, write_packed_int_func<uint32_t>(feat.commands, [](const uint32_t& c) { return (uint64) c; }));
+            append_pbf_data(features, 2, ft);
+        }
+        
+        //adds the features of \param layer, an already packed layer
+        void add_packed_features(const std::string& layer) {
+            std::vector<std::string> layer_keys, layer_values, layer_features;
+            size_t pos=0;
+            for (auto tg=read_pbf_tag(layer, pos); tg.tag>0; tg=read_pbf_tag(layer, pos)) {
+                if (tg.tag==2) { layer_features.push_back(tg.data); }
+                else if (tg.tag==3) { layer_keys.push_back(tg.data); }
+                else if (tg.tag==4) { layer_values.push_back(tg.data); }
+            }
+            
+            for (const auto& f: layer_features) {
+                std::string ft;
+                size_t fpos=0;
+                for (auto tg=read_pbf_tag(f, fpos); tg.tag>0; tg=read_pbf_tag(f, fpos)) {
+                    if (tg.tag==2) {
+                        //the tags index into the layer's own keys and values
+                        auto old_tags = read_packed_int(tg.data);
+                        std::vector<uint64> tags;
+                        for (size_t i=0; (i+1) < old_tags.size(); i+=2) {
+                            add_property(tags, layer_keys.at(old_tags[i]), layer_values.at(old_tags[i+1]));
+                        }
+                        append_pbf_data(ft, 2, write_packed_int(tags));
+                    } else if (tg.tag==4) {
+                        append_pbf_data(ft, 4, tg.data);
+                    } else {
+                        append_pbf_value(ft, tg.tag, tg.value);
+                    }
+                }
+                append_pbf_data(features, 2, ft);
+            }
+        }
+        
+        const std::string& Name() const { return name; }
+        bool empty() const { return features.empty(); }
+        
+        std::string pack(int64 extent) const {
+            std::string out;
+            append_pbf_value(out, 15, 2);
+            append_pbf_data(out, 1, name);
+            out += features;
+            for (const auto& k: keys_list) {
+                append_pbf_data(out, 3, k);
+            }
+            for (const auto& v: values_list) {
+                append_pbf_data(out, 4, v);
+            }
+            append_pbf_value(out, 5, extent);
+            return out;
+        }
+        
+    private:
+        void add_property(std::vector<uint64>& tags, const std::string& key, const std::string& packed_value) {
+            auto kt = keys.find(key);
+            if (kt==keys.end()) {
+                kt = keys.insert(std::make_pair(key, keys_list.size())).first;
+                keys_list.push_back(key);
+            }
+            auto vt = values.find(packed_value);
+            if (vt==values.end()) {
+                vt = values.insert(std::make_pair(packed_value, values_list.size())).first;
+                values_list.push_back(packed_value);
+            }
+            tags.push_back(kt->second);
+            tags.push_back(vt->second);
+        }
+        
+        void add_int_property(std::vector<uint64>& tags, const std::string& key, std::optional<int64> val) {
+            if (!val) { return; }
+            std::string v;
+            append_pbf_value(v, 6, zig_zag(*val));
+            add_property(tags, key, v);
+        }
+        
+        void add_double_property(std::vector<uint64>& tags, const std::string& key, double val) {
+            std::string v(9, '\0');
+            v[0] = (3<<3) | 1; //double_value, fixed64
+            write_double_le(v, 1, val);
+            add_property(tags, key, v);
+        }
+        
+        std::string name;
+        std::string features;
+        std::map<std::string, uint64> keys;
+        std::vector<std::string> keys_list;
+        std::map<std::string, uint64> values;
+        std::vector<std::string> values_list;
+};
+
+size_t layer_index(ElementType ty) {
+    if (ty==ElementType::Point) { return 0; }
+    if (ty==ElementType::Linestring) { return 1; }
+    return 2;
+}
+
+//adds \param feats to the layers of \param tile, an already packed tile
+std::string merge_vectortile(const std::string& tile, const std::vector<const TileFeature*>& feats, int64 extent) {
+    std::vector<VectorTileLayer> layers{VectorTileLayer("point"), VectorTileLayer("line"), VectorTileLayer("polygon")};
+    
+    size_t pos=0;
+    for (auto tg=read_pbf_tag(tile, pos); tg.tag>0; tg=read_pbf_tag(tile, pos)) {
+        if (tg.tag!=3) { continue; }
+        size_t lpos=0;
+        for (auto lt=read_pbf_tag(tg.data, lpos); lt.tag>0; lt=read_pbf_tag(tg.data, lpos)) {
+            if (lt.tag!=1) { continue; }
+            for (auto& l: layers) {
+                if (l.Name()==lt.data) {
+                    l.add_packed_features(tg.data);
+                }
+            }
+            break;
+        }
+    }
+    
+    for (const auto& f: feats) {
+        layers[layer_index(f->geom->Type())].add_feature(*f);
+    }
+    std::string out;
+    for (const auto& l: layers) {
+        if (!l.empty()) {
+            append_pbf_data(out, 3, l.pack(extent));
+        }
+    }
+    return out;
+}
+
+std::string pack_vectortile(const std::vector<const TileFeature*>& feats, int64 extent) {
+    return merge_vectortile("", feats, extent);
+}
+
+std::string pack_vectortile(std::vector<TileFeature>& features, const std::string& tile, int64 extent) {
+    std::vector<const TileFeature*> feats;
+    for (const auto& f: features) {
+        feats.push_back(&f);
+    }
+    std::sort(feats.begin(), feats.end(), [](const TileFeature* l, const TileFeature* r) { return l->order < r->order; });
+    return merge_vectortile(tile, feats, extent);
+}
+
+
+class VectorTileWriter {
+    public:
+        VectorTileWriter(const VectorTileParameters& params_) : params(params_), num_tiles(0), num_bytes(0) {
+            if (!params.directory) {
+                auto head = std::make_shared<Header>();
+                head->SetBBox(bbox{-1800000000,-900000000,1800000000,900000000});
+                out = make_pbffilewriter_indexed(params.outfn, head);
+            }
+        }
+        
+        /*! Features for tiles which may already have been written. These
+         * are added to the written tiles once all the tiles have been
+         * passed to call. */
+        void set_late(tile_features_map&& late_) {
+            late.swap(late_);
+        }
+        
+        void call(keystring_ptr tile) {
+            if (!tile) {
+                if (out) {
+                    out->finish();
+                }
+                if (!late.empty()) {
+                    if (params.directory) {
+                        merge_late_directory();
+                    } else {
+                        merge_late_archive();
+                    }
+                }
+                Logger::Message() << "VectorTileWriter wrote " << num_tiles << " tiles, " << num_bytes << " bytes";
+                return;
+            }
+            num_tiles++;
+            num_bytes += tile->second.size();
+            if (out) {
+                out->writeBlock(tile->first, tile->second);
+                return;
+            }
+            
+            std::ofstream outf(tile_filename(tile->first, true), std::ios::out | std::ios::binary | std::ios::trunc);
+            outf.write(tile->second.data(), tile->second.size());
+        }
+        
+    private:
+        std::string tile_filename(int64 qt, bool create) {
+            namespace fs = std::experimental::filesystem;
+            auto t = quadtree::tuple(qt);
+            fs::path dir = fs::path(params.outfn) / std::to_string(std::get<2>(t)) / std::to_string(std::get<0>(t));
+            if (create) {
+                fs::create_directories(dir);
+            }
+            return (dir / (std::to_string(std::get<1>(t))+".pbf")).string();
+        }
+        
+        void merge_late_directory() {
+            for (auto& t: late) {
+                auto fn = tile_filename(t.first, true);
+                std::string tile;
+                std::ifstream inf(fn, std::ios::in | std::ios::binary);
+                if (inf.good()) {
+                    tile.assign(std::istreambuf_iterator<char>(inf), std::istreambuf_iterator<char>());
+                } else {
+                    num_tiles++;
+                }
+                inf.close();
+                
+                auto data = pack_vectortile(t.second, tile, params.extent);
+                num_bytes += data.size() - tile.size();
+                std::ofstream outf(fn, std::ios::out | std::ios::binary | std::ios::trunc);
+                outf.write(data.data(), data.size());
+            }
+        }
+        
+        //rewrites the archive, merging the late features into its tiles
+        void merge_late_archive() {
+            std::string unmerged = params.outfn+"-unmerged";
+            std::rename(params.outfn.c_str(), unmerged.c_str());
+            auto head = get_header_block(unmerged);
+            
+            auto merged_head = std::make_shared<Header>();
+            merged_head->SetBBox(bbox{-1800000000,-900000000,1800000000,900000000});
+            auto merged = make_pbffilewriter_indexed(params.outfn, merged_head);
+            
+            auto write_late = [this, &merged](tile_features_map::iterator it, const std::string& tile) {
+                auto data = prepare_file_block("VectorTile", pack_vectortile(it->second, tile, params.extent));
+                merged->writeBlock(it->first, data);
+                return data.size();
+            };
+            
+            std::ifstream infile(unmerged, std::ios::in | std::ios::binary);
+            auto it = late.begin();
+            num_tiles=0;
+            num_bytes=0;
+            for (const auto& ii: head->Index()) {
+                int64 qt = std::get<0>(ii);
+                for ( ; (it!=late.end()) && (it->first < qt); ++it) {
+                    num_bytes += write_late(it, "");
+                    num_tiles++;
+                }
+                
+                infile.seekg(std::get<1>(ii));
+                auto fb = read_file_block(0, infile);
+                if (!fb || (fb->blocktype!="VectorTile")) {
+                    throw std::domain_error("VectorTileWriter: expected a VectorTile block");
+                }
+                if ((it!=late.end()) && (it->first==qt)) {
+                    num_bytes += write_late(it, fb->get_data());
+                    ++it;
+                } else {
+                    //copy the tile without decompressing it
+                    auto data = prepare_file_block_compressed("VectorTile", fb->data, fb->compressed ? fb->uncompressed_size : 0);
+                    merged->writeBlock(qt, data);
+                    num_bytes += data.size();
+                }
+                num_tiles++;
+            }
+            for ( ; it!=late.end(); ++it) {
+                num_bytes += write_late(it, "");
+                num_tiles++;
+            }
+            infile.close();
+            merged->finish();
+            std::remove(unmerged.c_str());
+        }
+        
+        VectorTileParameters params;
+        std::shared_ptr<PbfFileWriter> out;
+        tile_features_map late;
+        size_t num_tiles;
+        size_t num_bytes;
+};
+
+
+//the deepest quadtree tile, and the buffer around each tile (as a
+//fraction of its size) within which the objects in its block lie
+const int64 max_quadtree_depth = 24;
+const double block_buffer = 0.05;
+
+/*! The largest key of any block which can have features in tile \param
+ * x, \param y, \param z (plus \param buffer_frac). Keys at each depth
+ * are largest at the bottom right corner of the area covered, and each
+ * block's objects lie within its tile plus block_buffer. */
+int64 tile_last_block(int64 x, int64 y, int64 z, double buffer_frac) {
+    double nz = (double) (((int64) 1)<<z);
+    double ex = (x + 1 + buffer_frac) / nz;
+    double ey = (y + 1 + buffer_frac) / nz;
+    
+    int64 result = 0;
+    for (int64 d=0; d <= max_quadtree_depth; d++) {
+        int64 nd = ((int64) 1)<<d;
+        int64 bx = std::min(nd-1, (int64) std::floor(ex*nd + block_buffer));
+        int64 by = std::min(nd-1, (int64) std::floor(ey*nd + block_buffer));
+        result = std::max(result, quadtree::from_tuple(bx, by, d));
+    }
+    return result;
+}
+
+struct HeldTile {
+    int64 last_block;
+    std::vector<TileFeature> features;
+};
+
+class VectorTileBuilder {
+    public:
+        VectorTileBuilder(const VectorTileParameters& params_, size_t numchan_) :
+            params(params_), numchan(numchan_), block_counts(numchan_, 0),
+            last_keys(numchan_, -1), finished(numchan_, false),
+            written_upto(-1), num_written(0), max_held(0), num_late(0) {
+            
+            if ((params.min_zoom<0) || (params.max_zoom>max_quadtree_depth) || (params.min_zoom>params.max_zoom)) {
+                throw std::domain_error("VectorTileBuilder: bad zoom range (max_zoom can be at most "+std::to_string(max_quadtree_depth)+")");
+            }
+            buffer_frac = ((double) params.buffer) / params.extent;
+            
+            writer = std::make_shared<VectorTileWriter>(params);
+            write = threaded_callback<keystring>::make(
+                [this](keystring_ptr t) { writer->call(t); }, numchan, "write vector tiles");
+        }
+        
+        void call(size_t i, PrimitiveBlockPtr bl) {
+            if (!bl) {
+                write_tiles(finish_channel(i));
+                write(nullptr);
+                return;
+            }
+            
+            int64 block_order = (block_counts[i]*numchan + i) << 24;
+            block_counts[i]++;
+            
+            tile_features_map clipped;
+            for (size_t j=0; j < bl->size(); j++) {
+                auto geom = std::dynamic_pointer_cast<BaseGeometry>(bl->at(j));
+                if (!geom) { continue; }
+                if (geom->OriginalType()==ElementType::Unknown) {
+                    geom = std::dynamic_pointer_cast<BaseGeometry>(unpack_geometry_element(geom));
+                }
+                add_feature(clipped, block_order + j, geom);
+            }
+            
+            write_tiles(add_block(i, bl->Quadtree(), clipped));
+        }
+        
+    private:
+        /*! Adds the features clipped from a block with key \param qt to
+         * the held tiles, then takes those tiles which no block still to
+         * come can add to. The blocks passed to each channel are in
+         * quadtree order, except for the multipolygons of each tile, which
+         * follow the tile's children: features for tiles already taken
+         * are kept apart, and added to the written tiles at the end. */
+        std::vector<std::pair<int64,std::vector<TileFeature>>> add_block(size_t i, int64 qt, tile_features_map& clipped) {
+            std::lock_guard<std::mutex> lock(mutex);
+            
+            for (auto& t: clipped) {
+                auto it = held.find(t.first);
+                if (it==held.end()) {
+                    auto xyz = quadtree::tuple(t.first);
+                    int64 last = tile_last_block(std::get<0>(xyz), std::get<1>(xyz), std::get<2>(xyz), buffer_frac);
+                    if (last < written_upto) {
+                        num_late += t.second.size();
+                        auto& ff = late[t.first];
+                        std::move(t.second.begin(), t.second.end(), std::back_inserter(ff));
+                        continue;
+                    }
+                    it = held.emplace(t.first, HeldTile{last, {}}).first;
+                    by_last_block.insert(std::make_pair(last, t.first));
+                }
+                auto& ff = it->second.features;
+                std::move(t.second.begin(), t.second.end(), std::back_inserter(ff));
+            }
+            max_held = std::max(max_held, held.size());
+            
+            last_keys[i] = std::max(last_keys[i], qt);
+            return take_tiles();
+        }
+        
+        std::vector<std::pair<int64,std::vector<TileFeature>>> finish_channel(size_t i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished[i]=true;
+            auto result = take_tiles();
+            if (std::find(finished.begin(), finished.end(), false)==finished.end()) {
+                Logger::Message() << "VectorTileBuilder: encoded " << num_written << " tiles, at most " << max_held << " held at once, "
+                    << num_late << " features added to " << late.size() << " tiles at the end";
+                writer->set_late(std::move(late));
+            }
+            return result;
+        }
+        
+        /*! Takes the held tiles whose last block is before the last block
+         * passed to every unfinished channel, in quadtree order. */
+        std::vector<std::pair<int64,std::vector<TileFeature>>> take_tiles() {
+            int64 done = std::numeric_limits<int64>::max();
+            for (size_t j=0; j < numchan; j++) {
+                if (!finished[j]) {
+                    done = std::min(done, last_keys[j]);
+                }
+            }
+            
+            std::vector<std::pair<int64,std::vector<TileFeature>>> result;
+            if (done <= written_upto) {
+                return result;
+            }
+            
+            while (!by_last_block.empty() && (by_last_block.begin()->first < done)) {
+                auto it = held.find(by_last_block.begin()->second);
+                result.push_back(std::make_pair(it->first, std::move(it->second.features)));
+                held.erase(it);
+                by_last_block.erase(by_last_block.begin());
+            }
+            written_upto = done;
+            num_written += result.size();
+            std::sort(result.begin(), result.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+            return result;
+        }
+        
+        void write_tiles(std::vector<std::pair<int64,std::vector<TileFeature>>> tt) {
+            for (auto& t: tt) {
+                write(std::make_shared<keystring>(t.first, encode_tile(t.second)));
+                std::vector<TileFeature>().swap(t.second);
+            }
+        }
+        
+        void add_feature(tile_features_map& result, int64 order, std::shared_ptr<BaseGeometry> geom) {
+            
+            int64 zmin = std::max(params.min_zoom, geom->MinZoom().value_or(params.max_zoom));
+            if (zmin > params.max_zoom) { return; }
+            
+            MercatorGeometry merc;
+            if (!project_geometry(geom, merc) || merc.empty()) { return; }
+            
+            //the tiles at zmin covered by the feature: each is then split
+            //into its children until max_zoom is reached
+            TileBox bx = geometry_box(merc);
+            double sz = tile_size(zmin);
+            double b = sz*buffer_frac;
+            int64 nt = ((int64) 1)<<zmin;
+            auto tile_coord = [sz, nt](double v) { return std::max((int64) 0, std::min(nt-1, (int64) std::floor(v/sz))); };
+            
+            int64 minx = tile_coord(bx.minx - b + earth_width), maxx = tile_coord(bx.maxx + b + earth_width);
+            int64 miny = tile_coord(earth_width - bx.maxy - b), maxy = tile_coord(earth_width - bx.miny + b);
+            
+            for (int64 x=minx; x <= maxx; x++) {
+                for (int64 y=miny; y <= maxy; y++) {
+                    add_tile(result, order, geom, merc, x, y, zmin);
+                }
+            }
+        }
+        
+        void add_tile(tile_features_map& result, int64 order, std::shared_ptr<BaseGeometry> geom, const MercatorGeometry& merc, int64 x, int64 y, int64 z) {
+            
+            auto clipped = clip_geometry(merc, tile_box(x, y, z, buffer_frac));
+            if (clipped.empty()) { return; }
+            
+            auto commands = encode_geometry(clipped, x, y, z, params.extent);
+            if (!commands.empty()) {
+                result[quadtree::from_tuple(x,y,z)].push_back(TileFeature{order, geom, std::move(commands)});
+            }
+            
+            if (z < params.max_zoom) {
+                for (int64 c=0; c < 4; c++) {
+                    add_tile(result, order, geom, clipped, 2*x + (c&1), 2*y + (c>>1), z+1);
+                }
+            }
+        }
+        
+        std::string encode_tile(std::vector<TileFeature>& features) {
+            std::string data = pack_vectortile(features, "", params.extent);
+            if (params.directory) {
+                return data;
+            }
+            return prepare_file_block("VectorTile", data);
+        }
+        
+        VectorTileParameters params;
+        size_t numchan;
+        double buffer_frac;
+        std::vector<int64> block_counts;
+        std::shared_ptr<VectorTileWriter> writer;
+        write_file_callback write;
+        
+        std::mutex mutex;
+        std::map<int64, HeldTile> held;
+        std::multimap<int64, int64> by_last_block;
+        tile_features_map late;
+        std::vector<int64> last_keys;
+        std::vector<bool> finished;
+        int64 written_upto;
+        size_t num_written;
+        size_t max_held;
+        size_t num_late;
+};
+
+
+std::vector<block_callback> make_vectortile_callbacks(
+    std::vector<block_callback> callbacks,
+    const VectorTileParameters& params, size_t numchan) {
+    
+    if (!callbacks.empty() && (callbacks.size()!=numchan)) {
+        throw std::domain_error("make_vectortile_callbacks: wrong number of callbacks");
+    }
+    
+    auto builder = std::make_shared<VectorTileBuilder>(params, numchan);
+    
+    std::vector<block_callback> result(numchan);
+    for (size_t i=0; i < numchan; i++) {
+        block_callback cb;
+        if (!callbacks.empty()) { cb = callbacks[i]; }
+        
+        result[i] = [builder, cb, i](PrimitiveBlockPtr bl) {
+            if (cb) {
+                cb(bl);
+            }
+            builder->call(i, bl);
+        };
+    }
+    return result;
+}
+
+
+std::string read_vectortile(const std::string& filename, int64 x, int64 y, int64 z) {
+    
+    int64 qt = quadtree::from_tuple(x, y, z);
+    auto head = get_header_block(filename);
+    for (const auto& ii: head->Index()) {
+        if (std::get<0>(ii)!=qt) { continue; }
+        
+        std::ifstream infile(filename, std::ios::in | std::ios::binary);
+        infile.seekg(std::get<1>(ii));
+        auto fb = read_file_block(0, infile);
+        if (!fb || (fb->blocktype!="VectorTile")) {
+            throw std::domain_error("read_vectortile: expected a VectorTile block");
+        }
+        return fb->get_data();
+    }
+    return "";
+}
+
+}
+}
@@ -0,0 +1,163 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/pbfformat/blockcache.hpp"
+#include "oqt/elements/node.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/elements/relation.hpp"
+#include "oqt/elements/geometry.hpp"
+
+namespace oqt {
+
+namespace blockcache_detail {
+
+//heap memory of \param s: short strings are held inline
+size_t string_size(const std::string& s) {
+    return (s.size() < sizeof(std::string)) ? 0 : s.capacity()+1;
+}
+
+//shared_ptr control block and allocation overhead
+const size_t object_overhead = 48;
+
+size_t element_size(const Element& ele) {
+    size_t sz = object_overhead + string_size(ele.Info().user);
+    sz += ele.Tags().capacity()*sizeof(Tag);
+    for (const auto& t: ele.Tags()) {
+        sz += string_size(t.val);
+    }
+    
+    switch (ele.Type()) {
+        case ElementType::Node: return sz + sizeof(Node);
+        case ElementType::Way: {
+            const auto& refs = static_cast<const Way&>(ele).Refs();
+            return sz + sizeof(Way) + refs.capacity()*sizeof(int64);
+        }
+        case ElementType::Relation: {
+            const auto& mems = static_cast<const Relation&>(ele).Members();
+            sz += sizeof(Relation) + mems.capacity()*sizeof(Member);
+            for (const auto& m: mems) {
+                sz += string_size(m.role);
+            }
+            return sz;
+        }
+        default: break;
+    }
+    
+    auto geom = dynamic_cast<const BaseGeometry*>(&ele);
+    if (!geom) {
+        //not read from pbf files
+        return sz + sizeof(Way);
+    }
+    //packed coordinates are delta encoded varints, usually two or three
+    //bytes for each of the eight byte values held once decoded
+    sz += sizeof(GeometryPacked);
+    for (const auto& t: geom->pack_extras()) {
+        sz += sizeof(PbfTag) + 4*t.data.size();
+    }
+    return sz;
+}
+}
+
+size_t estimate_block_size(const PrimitiveBlock& block) {
+    size_t sz = sizeof(PrimitiveBlock) + block.size()*sizeof(ElementPtr);
+    for (size_t i=0; i < block.size(); i++) {
+        sz += blockcache_detail::element_size(*block.at(i));
+    }
+    return sz;
+}
+
+size_t estimate_block_size(const minimal::Block& block) {
+    size_t sz = sizeof(minimal::Block);
+    sz += block.nodes.capacity()*sizeof(minimal::Node);
+    sz += block.ways.capacity()*sizeof(minimal::Way);
+    sz += block.relations.capacity()*sizeof(minimal::Relation);
+    sz += block.geometries.capacity()*sizeof(minimal::Geometry);
+    for (const auto& w: block.ways) {
+        sz += blockcache_detail::string_size(w.refs_data);
+    }
+    for (const auto& r: block.relations) {
+        sz += blockcache_detail::string_size(r.tys_data) + blockcache_detail::string_size(r.refs_data);
+    }
+    return sz;
+}
+
+std::shared_ptr<void> BlockCache::get_internal(const key_type& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it==index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->block;
+}
+
+void BlockCache::put_internal(const key_type& key, IdSetPtr filter, std::shared_ptr<void> block, size_t size) {
+    if (size > max_bytes) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it!=index.end()) {
+        //another thread has read the same tile
+        bytes -= it->second->size;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    
+    entries.push_front(Entry{key, block, filter, size});
+    index[key] = entries.begin();
+    bytes += size;
+    
+    while (bytes > max_bytes) {
+        auto& last = entries.back();
+        bytes -= last.size;
+        index.erase(last.key);
+        entries.pop_back();
+        evictions++;
+    }
+}
+
+void BlockCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    entries.clear();
+    bytes=0;
+}
+
+BlockCacheStats BlockCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return BlockCacheStats{hits, misses, evictions, entries.size(), bytes, max_bytes};
+}
+
+std::string block_cache_fileset(const std::vector<std::string>& filenames) {
+    std::string result;
+    for (const auto& fn: filenames) {
+        result += fn;
+        result += '\n';
+    }
+    return result;
+}
+
+}
@@ -26,6 +26,7 @@
 #include "oqt/utils/pbf/protobuf.hpp"
 #include "oqt/utils/compress.hpp"
 #include "oqt/utils/logger.hpp"
+#include "oqt/utils/telemetry.hpp"
 #include <fstream>
 namespace oqt {
     
@@ -56,12 +57,17 @@ std::pair<size_t, bool> read_bytes_into(std::istream& infile, std::string& dest,
 
 
 
+int64 telemetry_item_bytes(const FileBlock& fb) {
+    return fb.data.size();
+}
+
 std::string FileBlock::get_data() {
     return decompress(data,uncompressed_size);
 };
 
 
 std::shared_ptr<FileBlock> read_file_block(int64 index, std::istream& infile) {
+    StageTimer timer(Telemetry::Get().stage("read file block", false));
     int64 fpos = infile.tellg();
     
     uint32_t size;
@@ -107,6 +113,7 @@ std::shared_ptr<FileBlock> read_file_block(int64 index, std::istream& infile) {
 
     
     r = std::move(read_bytes(infile, block_size));
+    timer.add_bytes(4+size+block_size);
     
     pos=0;
     tag = std::move(read_pbf_tag(r.first, pos));
@@ -140,15 +147,17 @@ std::shared_ptr<FileBlock> read_file_block(int64 index, std::istream& infile) {
     
 std::string prepare_file_block(const std::string& head, const std::string& data, int compress_level) {
     
-    
-    std::string comp;
-    if (compress_level != 0) {
-        comp = std::move(compress(data,compress_level));
+    if ((compress_level != 0) && (!data.empty())) {
+        return prepare_file_block_compressed(head, compress(data,compress_level), data.size());
     }
+    return prepare_file_block_compressed(head, data, 0);
+}
+
+std::string prepare_file_block_compressed(const std::string& head, const std::string& data, size_t uncompressed_size) {
     
     size_t data_blob_len = 0;
-    if (compress_level != 0) {
-        data_blob_len = pbf_value_length(2, uint64(data.size())) + pbf_data_length(3, comp.size());
+    if (uncompressed_size != 0) {
+        data_blob_len = pbf_value_length(2, uint64(uncompressed_size)) + pbf_data_length(3, data.size());
     } else {
         data_blob_len = pbf_data_length(1, data.size());
     }    
@@ -167,9 +176,9 @@ std::string prepare_file_block(const std::string& head, const std::string& data,
     
     if (pos != (4+head_blob_len)) { throw std::domain_error("wtf"); }
     
-    if (compress_level != 0) {
-        pos = write_pbf_value(output, pos, 2, uint64(data.size()));
-        pos = write_pbf_data(output, pos, 3, comp);
+    if (uncompressed_size != 0) {
+        pos = write_pbf_value(output, pos, 2, uint64(uncompressed_size));
+        pos = write_pbf_data(output, pos, 3, data);
     } else {
         pos = write_pbf_data(output, pos, 1, data);
     }
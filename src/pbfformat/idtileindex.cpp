@@ -0,0 +1,501 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/pbfformat/idtileindex.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/utils/pbf/varint.hpp"
+#include "oqt/utils/compress.hpp"
+#include "oqt/utils/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace oqt {
+namespace idtileindexdetail {
+
+const char index_magic[] = "OQTIDTX1";
+const size_t chunk_entries = 4096;
+
+//! as Element::InternalId
+uint64 make_key(ElementType ty, int64 id) {
+    return (((uint64) ty)<<61) | (uint64) id;
+}
+
+struct FileHeader {
+    char magic[8];
+    uint64 num_tiles;
+    uint64 num_entries;
+    uint64 num_chunks;
+};
+
+struct ChunkInfo {
+    uint64 first_id;
+    uint64 offset;
+    uint32_t count;
+    uint32_t size;
+    uint32_t raw_size;
+    uint32_t unused;
+};
+
+std::string pack_chunk(const std::pair<uint64,uint32_t>* begin, const std::pair<uint64,uint32_t>* end) {
+    size_t count = end-begin;
+    std::string raw(count*20+20, 0);
+    size_t pos=0;
+    
+    uint64 prev_id = begin->first;
+    for (auto it=begin; it!=end; ++it) {
+        pos = write_varint(raw, pos, it->first - prev_id);
+        prev_id = it->first;
+    }
+    
+    int64 prev_tile=0;
+    for (auto it=begin; it!=end; ) {
+        auto run_end = it;
+        while ((run_end!=end) && (run_end->second==it->second)) { ++run_end; }
+        pos = write_varint(raw, pos, zig_zag((int64) it->second - prev_tile));
+        pos = write_varint(raw, pos, run_end-it);
+        prev_tile = it->second;
+        it = run_end;
+    }
+    raw.resize(pos);
+    return raw;
+}
+
+void unpack_chunk(const std::string& raw, const ChunkInfo& info, std::vector<uint64>& ids, std::vector<uint32_t>& tiles) {
+    ids.resize(info.count);
+    tiles.resize(info.count);
+    
+    size_t pos=0;
+    uint64 id = info.first_id;
+    for (size_t i=0; i < info.count; i++) {
+        id += read_varint(raw, pos);
+        ids[i] = id;
+    }
+    
+    int64 tile=0;
+    size_t i=0;
+    while (i < info.count) {
+        tile += un_zig_zag(read_varint(raw, pos));
+        size_t len = read_varint(raw, pos);
+        if ((len==0) || (i+len > info.count)) {
+            throw std::domain_error("corrupt idtile index chunk");
+        }
+        std::fill(tiles.begin()+i, tiles.begin()+i+len, (uint32_t) tile);
+        i+=len;
+    }
+}
+
+class IdTileIndexImpl : public IdTileIndex {
+    public:
+        IdTileIndexImpl(const std::string& fn) : data(nullptr), length(0) {
+            int fd = open(fn.c_str(), O_RDONLY);
+            if (fd<0) {
+                throw std::domain_error("can't open "+fn);
+            }
+            struct stat st;
+            if (fstat(fd, &st)!=0) {
+                close(fd);
+                throw std::domain_error("can't stat "+fn);
+            }
+            length = st.st_size;
+            if (length < sizeof(FileHeader)) {
+                close(fd);
+                throw std::domain_error(fn+" is not an idtile index");
+            }
+            void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p==MAP_FAILED) {
+                throw std::domain_error("can't map "+fn);
+            }
+            data = static_cast<const char*>(p);
+            memcpy(&header, data, sizeof(FileHeader));
+            if ((memcmp(header.magic, index_magic, 8)!=0) || (chunks_offset() + header.num_chunks*sizeof(ChunkInfo) > length)) {
+                munmap(const_cast<char*>(data), length);
+                throw std::domain_error(fn+" is not an idtile index");
+            }
+        }
+        
+        virtual ~IdTileIndexImpl() {
+            munmap(const_cast<char*>(data), length);
+        }
+        
+        IdTileIndexImpl(const IdTileIndexImpl&) = delete;
+        IdTileIndexImpl& operator=(const IdTileIndexImpl&) = delete;
+        
+        virtual size_t num_tiles() const { return header.num_tiles; }
+        virtual size_t num_entries() const { return header.num_entries; }
+        virtual int64 tile_quadtree(size_t tile) const {
+            if (tile >= header.num_tiles) {
+                throw std::domain_error("tile "+std::to_string(tile)+" out of range");
+            }
+            int64 qt;
+            memcpy(&qt, data+sizeof(FileHeader)+tile*sizeof(int64), sizeof(int64));
+            return qt;
+        }
+        
+        virtual std::vector<std::pair<int64,int64>> find(ElementType ty, const std::vector<int64>& ids_in) const {
+            std::vector<int64> ids = ids_in;
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            
+            std::vector<std::pair<int64,int64>> result;
+            if (header.num_chunks==0) { return result; }
+            
+            const ChunkInfo* dir_begin = chunks();
+            const ChunkInfo* dir_end = dir_begin + header.num_chunks;
+            
+            //ids are sorted, so each chunk is unpacked at most once
+            const ChunkInfo* curr = nullptr;
+            std::vector<uint64> chunk_ids;
+            std::vector<uint32_t> chunk_tiles;
+            for (auto id: ids) {
+                uint64 key = make_key(ty, id);
+                auto it = std::upper_bound(dir_begin, dir_end, key,
+                    [](uint64 k, const ChunkInfo& c) { return k < c.first_id; });
+                if (it==dir_begin) { continue; }
+                --it;
+                if (it!=curr) {
+                    if (it->offset + it->size > length) {
+                        throw std::domain_error("idtile index truncated");
+                    }
+                    std::string raw = decompress(std::string(data+it->offset, it->size), it->raw_size);
+                    unpack_chunk(raw, *it, chunk_ids, chunk_tiles);
+                    curr = it;
+                }
+                auto jt = std::lower_bound(chunk_ids.begin(), chunk_ids.end(), key);
+                if ((jt!=chunk_ids.end()) && (*jt==key)) {
+                    result.push_back(std::make_pair(id, tile_quadtree(chunk_tiles[jt-chunk_ids.begin()])));
+                }
+            }
+            return result;
+        }
+        
+        virtual std::vector<int64> find_tiles(ElementType ty, const std::vector<int64>& ids) const {
+            std::vector<int64> result;
+            for (const auto& f: find(ty, ids)) {
+                result.push_back(f.second);
+            }
+            std::sort(result.begin(), result.end());
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+            return result;
+        }
+        
+    private:
+        const char* data;
+        size_t length;
+        FileHeader header;
+        
+        size_t chunks_offset() const {
+            return sizeof(FileHeader) + header.num_tiles*sizeof(int64);
+        }
+        const ChunkInfo* chunks() const {
+            return reinterpret_cast<const ChunkInfo*>(data+chunks_offset());
+        }
+};
+
+/*! Writes the index file as the sorted entries are added: the chunk
+ * directory is written once all the chunks are. */
+class IndexFileWriter {
+    public:
+        IndexFileWriter(const std::string& fn_, const std::vector<int64>& qts, size_t num_entries_) :
+            fn(fn_), num_entries(num_entries_), count(0), last_key(0) {
+            
+            outfile.open(fn, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!outfile.good()) {
+                throw std::domain_error("can't write "+fn);
+            }
+            FileHeader header;
+            memcpy(header.magic, index_magic, 8);
+            header.num_tiles = qts.size();
+            header.num_entries = num_entries;
+            header.num_chunks = (num_entries+chunk_entries-1)/chunk_entries;
+            outfile.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+            outfile.write(reinterpret_cast<const char*>(qts.data()), qts.size()*sizeof(int64));
+            
+            chunks_pos = outfile.tellp();
+            offset = chunks_pos + header.num_chunks*sizeof(ChunkInfo);
+            outfile.seekp(offset);
+            chunks.reserve(header.num_chunks);
+            buffer.reserve(chunk_entries);
+        }
+        
+        void add(uint64 key, uint32_t tile) {
+            if ((count>0) && (key==last_key)) {
+                throw std::domain_error("object "+std::to_string(key)+" in more than one tile");
+            }
+            last_key=key;
+            count++;
+            buffer.push_back(std::make_pair(key, tile));
+            if (buffer.size()==chunk_entries) {
+                write_chunk();
+            }
+        }
+        
+        size_t finish() {
+            write_chunk();
+            if (count!=num_entries) {
+                throw std::domain_error("expected "+std::to_string(num_entries)+" entries, have "+std::to_string(count));
+            }
+            outfile.seekp(chunks_pos);
+            outfile.write(reinterpret_cast<const char*>(chunks.data()), chunks.size()*sizeof(ChunkInfo));
+            outfile.close();
+            if (!outfile.good()) {
+                throw std::domain_error("failed to write "+fn);
+            }
+            Logger::Message() << "written idtile index " << fn << ": " << count << " objects in " << chunks.size() << " chunks, " << offset << " bytes";
+            return count;
+        }
+        
+    private:
+        std::string fn;
+        std::ofstream outfile;
+        size_t num_entries, count;
+        uint64 last_key;
+        size_t chunks_pos, offset;
+        std::vector<ChunkInfo> chunks;
+        std::vector<std::pair<uint64,uint32_t>> buffer;
+        
+        void write_chunk() {
+            if (buffer.empty()) { return; }
+            std::string raw = pack_chunk(buffer.data(), buffer.data()+buffer.size());
+            std::string packed = compress(raw);
+            chunks.push_back(ChunkInfo{buffer.front().first, offset, (uint32_t) buffer.size(), (uint32_t) packed.size(), (uint32_t) raw.size(), 0});
+            outfile.write(packed.data(), packed.size());
+            offset += packed.size();
+            buffer.clear();
+        }
+};
+
+/*! A run is a sequence of chunks, each preceded by its ChunkInfo, as
+ * written by write_run. */
+size_t write_run(const std::string& fn, std::vector<std::pair<uint64,uint32_t>>& entries) {
+    std::sort(entries.begin(), entries.end());
+    std::ofstream outfile(fn, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!outfile.good()) {
+        throw std::domain_error("can't write "+fn);
+    }
+    for (size_t i=0; i < entries.size(); i+=chunk_entries) {
+        size_t j = std::min(i+chunk_entries, entries.size());
+        std::string raw = pack_chunk(entries.data()+i, entries.data()+j);
+        std::string packed = compress(raw);
+        ChunkInfo info{entries[i].first, 0, (uint32_t) (j-i), (uint32_t) packed.size(), (uint32_t) raw.size(), 0};
+        outfile.write(reinterpret_cast<const char*>(&info), sizeof(ChunkInfo));
+        outfile.write(packed.data(), packed.size());
+    }
+    outfile.close();
+    if (!outfile.good()) {
+        throw std::domain_error("failed to write "+fn);
+    }
+    return entries.size();
+}
+
+//! Reads the entries of a run in order, one chunk at a time
+class RunReader {
+    public:
+        RunReader(const std::string& fn) : infile(fn, std::ios::in | std::ios::binary), pos(0) {
+            if (!infile.good()) {
+                throw std::domain_error("can't open "+fn);
+            }
+        }
+        
+        //! Moves to the next entry, returning false at the end of the run
+        bool next() {
+            pos++;
+            if (pos < ids.size()) {
+                return true;
+            }
+            ChunkInfo info;
+            if (!infile.read(reinterpret_cast<char*>(&info), sizeof(ChunkInfo))) {
+                return false;
+            }
+            std::string packed(info.size, 0);
+            if (!infile.read(&packed[0], info.size)) {
+                throw std::domain_error("idtile index run truncated");
+            }
+            unpack_chunk(decompress(packed, info.raw_size), info, ids, tiles);
+            pos=0;
+            return !ids.empty();
+        }
+        
+        uint64 key() const { return ids[pos]; }
+        uint32_t tile() const { return tiles[pos]; }
+        
+    private:
+        std::ifstream infile;
+        std::vector<uint64> ids;
+        std::vector<uint32_t> tiles;
+        size_t pos;
+};
+
+}
+
+std::shared_ptr<IdTileIndex> open_idtile_index(const std::string& fn) {
+    return std::make_shared<idtileindexdetail::IdTileIndexImpl>(fn);
+}
+
+IdTileIndexBuilder::IdTileIndexBuilder(const std::vector<int64>& qts_, const std::string& tempfn_, size_t spill_entries_) :
+    qts(qts_), tempfn(tempfn_), spill_entries(spill_entries_) {
+    
+    for (size_t i=0; i < qts.size(); i++) {
+        tile_numbers[qts[i]] = i;
+    }
+}
+
+uint32_t IdTileIndexBuilder::tile_number(int64 qt) {
+    auto it = tile_numbers.find(qt);
+    if (it==tile_numbers.end()) {
+        throw std::domain_error("tile "+quadtree::string(qt)+" not in index");
+    }
+    return it->second;
+}
+
+void IdTileIndexBuilder::add(PrimitiveBlockPtr block) {
+    uint32_t tile = tile_number(block->Quadtree());
+    std::vector<std::pair<uint64,uint32_t>> ee;
+    ee.reserve(block->size());
+    for (const auto& o: block->Objects()) {
+        if ((o->ChangeType()==changetype::Delete) || (o->ChangeType()==changetype::Remove)) { continue; }
+        ee.push_back(std::make_pair(o->InternalId(), tile));
+    }
+    add_entries(ee);
+}
+
+template <class T>
+void add_minimal_entries(std::vector<std::pair<uint64,uint32_t>>& ee, const std::vector<T>& objs, ElementType ty, uint32_t tile) {
+    for (const auto& o: objs) {
+        if ((o.changetype==(size_t) changetype::Delete) || (o.changetype==(size_t) changetype::Remove)) { continue; }
+        ee.push_back(std::make_pair(idtileindexdetail::make_key(ty, o.id), tile));
+    }
+}
+
+void IdTileIndexBuilder::add(minimal::BlockPtr block) {
+    uint32_t tile = tile_number(block->quadtree);
+    std::vector<std::pair<uint64,uint32_t>> ee;
+    ee.reserve(block->nodes.size()+block->ways.size()+block->relations.size());
+    add_minimal_entries(ee, block->nodes, ElementType::Node, tile);
+    add_minimal_entries(ee, block->ways, ElementType::Way, tile);
+    add_minimal_entries(ee, block->relations, ElementType::Relation, tile);
+    add_entries(ee);
+}
+
+void IdTileIndexBuilder::add_entries(const std::vector<std::pair<uint64,uint32_t>>& ee) {
+    std::vector<std::pair<uint64,uint32_t>> full;
+    std::string run_fn;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.insert(entries.end(), ee.begin(), ee.end());
+        if (entries.size() < spill_entries) {
+            return;
+        }
+        full.swap(entries);
+        run_fn = tempfn+"-run"+std::to_string(runs.size());
+        runs.push_back(std::make_pair(run_fn, full.size()));
+    }
+    //sort and write the run without holding up the other threads
+    idtileindexdetail::write_run(run_fn, full);
+}
+
+size_t IdTileIndexBuilder::finish(const std::string& fn) {
+    using namespace idtileindexdetail;
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    if (runs.empty()) {
+        std::sort(entries.begin(), entries.end());
+        IndexFileWriter writer(fn, qts, entries.size());
+        for (const auto& e: entries) {
+            writer.add(e.first, e.second);
+        }
+        std::vector<std::pair<uint64,uint32_t>>().swap(entries);
+        return writer.finish();
+    }
+    
+    if (!entries.empty()) {
+        auto run_fn = tempfn+"-run"+std::to_string(runs.size());
+        runs.push_back(std::make_pair(run_fn, write_run(run_fn, entries)));
+        std::vector<std::pair<uint64,uint32_t>>().swap(entries);
+    }
+    
+    size_t total=0;
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::priority_queue<std::pair<uint64,size_t>, std::vector<std::pair<uint64,size_t>>, std::greater<std::pair<uint64,size_t>>> heads;
+    for (const auto& r: runs) {
+        total += r.second;
+        readers.push_back(std::make_unique<RunReader>(r.first));
+        if (readers.back()->next()) {
+            heads.push(std::make_pair(readers.back()->key(), readers.size()-1));
+        }
+    }
+    Logger::Message() << "merge " << runs.size() << " idtile index runs, " << total << " objects";
+    
+    IndexFileWriter writer(fn, qts, total);
+    while (!heads.empty()) {
+        size_t i = heads.top().second;
+        heads.pop();
+        writer.add(readers[i]->key(), readers[i]->tile());
+        if (readers[i]->next()) {
+            heads.push(std::make_pair(readers[i]->key(), i));
+        }
+    }
+    size_t count = writer.finish();
+    
+    readers.clear();
+    for (const auto& r: runs) {
+        std::remove(r.first.c_str());
+    }
+    runs.clear();
+    return count;
+}
+
+size_t write_idtile_index(const std::string& fn, size_t numchan, const std::string& outfn_in) {
+    std::string outfn = outfn_in;
+    if (outfn=="") {
+        outfn = fn + "-idtile.idx";
+    }
+    
+    auto hh = get_header_block(fn);
+    if ((!hh) || hh->Index().empty()) {
+        throw std::domain_error("not an indexed pbf file: "+fn);
+    }
+    std::vector<int64> qts, locs;
+    for (const auto& l: hh->Index()) {
+        qts.push_back(std::get<0>(l));
+        locs.push_back(std::get<1>(l));
+    }
+    
+    IdTileIndexBuilder builder(qts, outfn);
+    auto cb = [&builder](minimal::BlockPtr bl) {
+        if (bl) { builder.add(bl); }
+    };
+    read_blocks_minimalblock(fn, cb, locs, numchan, ReadBlockFlags::SkipInfo | ReadBlockFlags::SkipGeometries);
+    return builder.finish(outfn);
+}
+
+}
@@ -41,7 +41,26 @@
 namespace oqt {
 
 
-ElementInfo readInfo(const std::string& data,const std::vector<std::string>& stringtable) {
+std::vector<bool> ReadFields::tag_key_mask(const std::vector<std::string>& stringtable) const {
+    if (tag_keys.empty()) { return {}; }
+    
+    std::vector<bool> mask(stringtable.size(), false);
+    for (size_t i=0; i < stringtable.size(); i++) {
+        mask[i] = tag_keys.count(stringtable[i])>0;
+    }
+    return mask;
+}
+
+const ReadFields& all_fields() {
+    static const ReadFields fields;
+    return fields;
+}
+
+bool keep_tag_key(const std::vector<bool>& key_mask, uint64 k) {
+    return key_mask.empty() || ((k < key_mask.size()) && key_mask[k]);
+}
+
+ElementInfo readInfo(const std::string& data, SymbolCache& symbols, const ReadFields& fields) {
 
     ElementInfo ans;
     size_t pos = 0;
@@ -50,12 +69,12 @@ ElementInfo readInfo(const std::string& data,const std::vector<std::string>& str
 
     PbfTag tag = read_pbf_tag(data,pos);
     for ( ; tag.tag>0; tag = read_pbf_tag(data,pos)) {
-        if      (tag.tag==1) { ans.version = int64(tag.value); }
-        else if (tag.tag==2) { ans.timestamp = int64(tag.value); }
-        else if (tag.tag==3) { ans.changeset = int64(tag.value); }
-        else if (tag.tag==4) { ans.user_id = int64(tag.value); }
-        else if (tag.tag==5) { ans.user = stringtable.at(tag.value); }
-        else if (tag.tag==6) { vv = tag.value!=0; }
+        if      ((tag.tag==1) && fields.version) { ans.version = int64(tag.value); }
+        else if ((tag.tag==2) && fields.timestamp) { ans.timestamp = int64(tag.value); }
+        else if ((tag.tag==3) && fields.changeset) { ans.changeset = int64(tag.value); }
+        else if ((tag.tag==4) && fields.user_id) { ans.user_id = int64(tag.value); }
+        else if ((tag.tag==5) && fields.user) { ans.user = symbols.string(tag.value); }
+        else if ((tag.tag==6) && fields.visible) { vv = tag.value!=0; }
 
     }
     ans.visible=vv;
@@ -66,21 +85,44 @@ ElementInfo readInfo(const std::string& data,const std::vector<std::string>& str
 
 std::vector<Tag> makeTags(
     const std::vector<uint64>& keys, const std::vector<uint64>& vals,
-    const std::vector<std::string>& stringtable) {
+    SymbolCache& symbols, const std::vector<bool>& key_mask) {
 
+    if (!key_mask.empty()) {
+        std::vector<Tag> ans;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keep_tag_key(key_mask, keys.at(i))) {
+                ans.push_back(Tag(symbols.symbol(keys.at(i)), symbols.string(vals.at(i))));
+            }
+        }
+        return ans;
+    }
+    
     std::vector<Tag> ans(keys.size());
     for (size_t i = 0; i < keys.size(); i++) {
-        ans[i].key=stringtable.at(keys.at(i));
-        ans[i].val=stringtable.at(vals.at(i));
+        ans[i].key=symbols.symbol(keys.at(i));
+        ans[i].val=symbols.string(vals.at(i));
     }
     return ans;
 
 
 }
 
+//type specific messages which have not been selected are not passed on
+bool keep_other_tag(ElementType ty, uint64 tg, const ReadFields& fields) {
+    if (ty==ElementType::Node) {
+        if ((tg==8) || (tg==9)) { return fields.coords; }
+    } else if (ty==ElementType::Way) {
+        if (tg==8) { return fields.refs; }
+    } else if (ty==ElementType::Relation) {
+        if (tg==8) { return fields.members && fields.roles; }
+        if ((tg==9) || (tg==10)) { return fields.members; }
+    }
+    return true;
+}
 
 std::tuple<int64,ElementInfo,std::vector<Tag>,int64,std::list<PbfTag> >
-    read_common(ElementType ty, const std::string& data, const std::vector<std::string>& stringtable, IdSetPtr ids) {
+    read_common_symbols(ElementType ty, const std::string& data, SymbolCache& symbols, IdSetPtr ids,
+        const ReadFields& fields, const std::vector<bool>& key_mask) {
 
 
     std::vector<uint64> keys,vals;
@@ -97,32 +139,42 @@ std::tuple<int64,ElementInfo,std::vector<Tag>,int64,std::list<PbfTag> >
             }
             std::get<0>(r)=id;
         } else if (tag.tag==2) {
-            keys = read_packed_int(tag.data);
+            if (fields.tags) { keys = read_packed_int(tag.data); }
         } else if (tag.tag==3) {
-            vals = read_packed_int(tag.data);
+            if (fields.tags) { vals = read_packed_int(tag.data); }
         } else if (tag.tag==4) {
-            std::get<1>(r) = readInfo(tag.data,stringtable);
+            if (fields.info()) { std::get<1>(r) = readInfo(tag.data,symbols,fields); }
         } else if (tag.tag==20) {
-            std::get<3>(r) = un_zig_zag(tag.value);
-        } else {
+            if (fields.quadtree) { std::get<3>(r) = un_zig_zag(tag.value); }
+        } else if (keep_other_tag(ty, tag.tag, fields)) {
             std::get<4>(r).push_back(tag);
         }
     }
 
-    std::get<2>(r) = makeTags(keys,vals,stringtable);
+    std::get<2>(r) = makeTags(keys,vals,symbols,key_mask);
     return r;
 }
 
+std::tuple<int64,ElementInfo,std::vector<Tag>,int64,std::list<PbfTag> >
+    read_common(ElementType ty, const std::string& data, const std::vector<std::string>& stringtable, IdSetPtr ids, ReadFieldsPtr fields) {
+    
+    SymbolCache symbols(stringtable, false);
+    if (fields) {
+        return read_common_symbols(ty, data, symbols, ids, *fields, fields->tag_key_mask(stringtable));
+    }
+    return read_common_symbols(ty, data, symbols, ids, all_fields(), {});
+}
+
 
 ElementPtr readNode(
-        const std::string& data, const std::vector<std::string>& stringtable,
-        changetype ct, IdSetPtr ids) {
+        const std::string& data, SymbolCache& symbols,
+        changetype ct, IdSetPtr ids, const ReadFields& fields, const std::vector<bool>& key_mask) {
     int64 id,qt;
     
     ElementInfo inf; std::vector<Tag> tags;
     std::list<PbfTag> rem;
 
-    std::tie(id,inf,tags,qt,rem) = read_common(ElementType::Node,data,stringtable,ids);
+    std::tie(id,inf,tags,qt,rem) = read_common_symbols(ElementType::Node,data,symbols,ids,fields,key_mask);
     if (id==0) { return ElementPtr(); }
 
     int64 lon=0,lat=0;
@@ -138,7 +190,7 @@ ElementPtr readNode(
 }
 
 std::tuple<std::vector<uint64>,std::vector<int64>,std::vector<int64>,std::vector<int64>,std::vector<int64>,std::vector<uint64> >
-    readDenseInfo(const std::string& data)
+    readDenseInfo(const std::string& data, const ReadFields& fields)
 {
     std::vector<int64> ts,cs,ui,us;
     std::vector<uint64> vs, vv;
@@ -147,12 +199,12 @@ std::tuple<std::vector<uint64>,std::vector<int64>,std::vector<int64>,std::vector
     size_t pos = 0;
     PbfTag tag = read_pbf_tag(data,pos);
     for ( ; tag.tag>0; tag = read_pbf_tag(data,pos)) {
-        if (tag.tag==1) { vs = read_packed_int(tag.data); }
-        if (tag.tag==2) { ts = read_packed_delta(tag.data); }
-        if (tag.tag==3) { cs = read_packed_delta(tag.data); }
-        if (tag.tag==4) { ui = read_packed_delta(tag.data); }
-        if (tag.tag==5) { us = read_packed_delta(tag.data); }
-        if (tag.tag==6) { vv = read_packed_int(tag.data); }
+        if ((tag.tag==1) && fields.version) { vs = read_packed_int(tag.data); }
+        if ((tag.tag==2) && fields.timestamp) { ts = read_packed_delta(tag.data); }
+        if ((tag.tag==3) && fields.changeset) { cs = read_packed_delta(tag.data); }
+        if ((tag.tag==4) && fields.user_id) { ui = read_packed_delta(tag.data); }
+        if ((tag.tag==5) && fields.user) { us = read_packed_delta(tag.data); }
+        if ((tag.tag==6) && fields.visible) { vv = read_packed_int(tag.data); }
     }
     return std::make_tuple(vs,ts,cs,ui,us,vv);
 }
@@ -166,15 +218,16 @@ bool has_an_id(IdSetPtr id_set, ElementType ty, const std::vector<int64>& ids) {
 }
 
 int readDenseNodes(
-        const std::string& data, const std::vector<std::string>& stringtable,
-        changetype ct, std::vector<ElementPtr >& objects, IdSetPtr id_set) {
+        const std::string& data, SymbolCache& symbols,
+        changetype ct, std::vector<ElementPtr >& objects, IdSetPtr id_set,
+        const ReadFields& fields, const std::vector<bool>& key_mask) {
 
     std::vector<int64> ids, lons, lats, qts;
     std::vector<uint64> kvs;
 
     std::vector<int64> ts,cs,ui,us;
     std::vector<uint64> vs,vv;
-
+    bool has_info=false;
 
     size_t pos = 0;
     PbfTag pbfTag = read_pbf_tag(data,pos);
@@ -185,11 +238,14 @@ int readDenseNodes(
                 return 0;
             }
         }
-        else if (pbfTag.tag==5) { std::tie(vs,ts,cs,ui,us,vv) = readDenseInfo(pbfTag.data); }
-        else if (pbfTag.tag==8) { lats = read_packed_delta(pbfTag.data); }
-        else if (pbfTag.tag==9) { lons = read_packed_delta(pbfTag.data); }
-        else if (pbfTag.tag==10) { kvs = read_packed_int(pbfTag.data); }
-        else if (pbfTag.tag==20) { qts = read_packed_delta(pbfTag.data); }
+        else if ((pbfTag.tag==5) && fields.info()) {
+            std::tie(vs,ts,cs,ui,us,vv) = readDenseInfo(pbfTag.data, fields);
+            has_info=true;
+        }
+        else if ((pbfTag.tag==8) && fields.coords) { lats = read_packed_delta(pbfTag.data); }
+        else if ((pbfTag.tag==9) && fields.coords) { lons = read_packed_delta(pbfTag.data); }
+        else if ((pbfTag.tag==10) && fields.tags) { kvs = read_packed_int(pbfTag.data); }
+        else if ((pbfTag.tag==20) && fields.quadtree) { qts = read_packed_delta(pbfTag.data); }
     }
 
     size_t tagi = 0;
@@ -199,27 +255,23 @@ int readDenseNodes(
         std::vector<Tag> tags;
         ElementInfo inf;
 
-        if (i<vs.size()) {
-            inf = ElementInfo(
-                vs.at(i),
-                ts.at(i),
-                cs.at(i),
-                ui.at(i),
-                stringtable.at(us.at(i)),
-                true
-            );
-            if (vv.size()>0) {
-                inf.visible = vv.at(i)!=0;
-            } 
+        if (has_info) {
+            if (i < vs.size()) { inf.version = vs.at(i); }
+            if (i < ts.size()) { inf.timestamp = ts.at(i); }
+            if (i < cs.size()) { inf.changeset = cs.at(i); }
+            if (i < ui.size()) { inf.user_id = ui.at(i); }
+            if (i < us.size()) { inf.user = symbols.string(us.at(i)); }
+            inf.visible = (i < vv.size()) ? (vv.at(i)!=0) : true;
         }
         if (tagi < kvs.size()) {
             
             while ((tagi < kvs.size()) && kvs.at(tagi)!=0) {
-                
-                tags.push_back(Tag(
-                    stringtable.at(kvs.at(tagi)),
-                    stringtable.at(kvs.at(tagi+1))
-                ));
+                if (keep_tag_key(key_mask, kvs.at(tagi))) {
+                    tags.push_back(Tag(
+                        symbols.symbol(kvs.at(tagi)),
+                        symbols.string(kvs.at(tagi+1))
+                    ));
+                }
                 tagi+=2;
             }
             tagi += 1;
@@ -247,14 +299,15 @@ int readDenseNodes(
     return pp;
 }
 
-ElementPtr readWay(const std::string& data, const std::vector<std::string>& stringtable, changetype ct, IdSetPtr ids) {
+ElementPtr readWay(const std::string& data, SymbolCache& symbols, changetype ct, IdSetPtr ids,
+        const ReadFields& fields, const std::vector<bool>& key_mask) {
 
     int64 id,qt;
 
     ElementInfo inf; std::vector<Tag> tags;
     std::list<PbfTag> rem;
 
-    std::tie(id,inf,tags,qt,rem) = read_common(ElementType::Way,data,stringtable,ids);
+    std::tie(id,inf,tags,qt,rem) = read_common_symbols(ElementType::Way,data,symbols,ids,fields,key_mask);
     if (id==0) { return ElementPtr(); }
 
     std::vector<int64> refs;
@@ -269,14 +322,14 @@ ElementPtr readWay(const std::string& data, const std::vector<std::string>& stri
 
 }
 
-ElementPtr readRelation(const std::string& data, const std::vector<std::string>& stringtable,
-        changetype ct, IdSetPtr ids) {
+ElementPtr readRelation(const std::string& data, SymbolCache& symbols,
+        changetype ct, IdSetPtr ids, const ReadFields& fields, const std::vector<bool>& key_mask) {
     int64 id,qt;
 
     ElementInfo inf; std::vector<Tag> tags;
     std::list<PbfTag> rem;
 
-    std::tie(id,inf,tags,qt,rem) = read_common(ElementType::Relation,data,stringtable,ids);
+    std::tie(id,inf,tags,qt,rem) = read_common_symbols(ElementType::Relation,data,symbols,ids,fields,key_mask);
     if (id==0) { return ElementPtr(); }
     std::vector<uint64> ty, rl;
     std::vector<int64> rf;
@@ -302,7 +355,7 @@ ElementPtr readRelation(const std::string& data, const std::vector<std::string>&
         }
         mems[i].ref = rf[i];
         if (i < rl.size()) {
-            mems[i].role = stringtable.at(rl[i]);
+            mems[i].role = symbols.string(rl[i]);
         }
     }
 
@@ -327,10 +380,10 @@ ElementPtr readGeometry_default(ElementType ty, const std::string& data, const s
 };
 
 void readPrimitiveGroupCommon(
-        const std::string& data, const std::vector<std::string>& stringtable,
+        const std::string& data, SymbolCache& symbols,
         std::vector<ElementPtr >& objects,
         changetype ct, ReadBlockFlags objflags, IdSetPtr ids,
-        read_geometry_func readGeometry) {
+        read_geometry_func readGeometry, const ReadFields& fields, const std::vector<bool>& key_mask) {
 
     
     if (!readGeometry) {
@@ -343,21 +396,21 @@ void readPrimitiveGroupCommon(
     for ( ; tag.tag>0; tag = read_pbf_tag(data,pos)) {
 
         if ((tag.tag==1) && (!has_flag(objflags, ReadBlockFlags::SkipNodes))) {
-            auto o = readNode(tag.data, stringtable,ct,ids);
+            auto o = readNode(tag.data, symbols,ct,ids,fields,key_mask);
             if (o) { objects.push_back(o); }
 
         } else if ((tag.tag==2) && (!has_flag(objflags, ReadBlockFlags::SkipNodes))) {
-            readDenseNodes(tag.data, stringtable, ct,objects,ids);
+            readDenseNodes(tag.data, symbols, ct,objects,ids,fields,key_mask);
         } else if ((tag.tag==3) && (!has_flag(objflags, ReadBlockFlags::SkipWays))) {
-            auto o = readWay(tag.data, stringtable,ct,ids);
+            auto o = readWay(tag.data, symbols,ct,ids,fields,key_mask);
             if (o) { objects.push_back(o); }
         } else if ((tag.tag==4) && (!has_flag(objflags, ReadBlockFlags::SkipRelations))) {
-            auto o = readRelation(tag.data, stringtable,ct,ids);
+            auto o = readRelation(tag.data, symbols,ct,ids,fields,key_mask);
             if (o) { objects.push_back(o); }
         } else if ((tag.tag>=20) && (!has_flag(objflags, ReadBlockFlags::SkipGeometries)) ) {
 
             ElementType ty = (ElementType) (tag.tag-17);
-            auto o = readGeometry(ty, tag.data, stringtable, ct);
+            auto o = readGeometry(ty, tag.data, symbols.string_table(), ct);
             if (o) { objects.push_back(o); }
         }
         
@@ -366,12 +419,13 @@ void readPrimitiveGroupCommon(
     return;
 }
 
-void readPrimitiveGroup(const std::string& data, const std::vector<std::string>& stringtable, std::vector<ElementPtr >& objects, bool change, ReadBlockFlags objflags, IdSetPtr ids,read_geometry_func readGeometry) {
+void readPrimitiveGroup(const std::string& data, SymbolCache& symbols, std::vector<ElementPtr >& objects, bool change, ReadBlockFlags objflags, IdSetPtr ids,read_geometry_func readGeometry,
+        const ReadFields& fields, const std::vector<bool>& key_mask) {
 
     
 
     if (!change) {
-        readPrimitiveGroupCommon(data,stringtable,objects,changetype::Normal,objflags,ids,readGeometry);
+        readPrimitiveGroupCommon(data,symbols,objects,changetype::Normal,objflags,ids,readGeometry,fields,key_mask);
         return;
     }
 
@@ -383,7 +437,7 @@ void readPrimitiveGroup(const std::string& data, const std::vector<std::string>&
     for ( ; tag.tag>0; tag = read_pbf_tag(data,pos)) {
         if (tag.tag==10) { ct=(changetype) tag.value; }
     }
-    readPrimitiveGroupCommon(data,stringtable,objects, ct,objflags,ids,readGeometry);
+    readPrimitiveGroupCommon(data,symbols,objects, ct,objflags,ids,readGeometry,fields,key_mask);
 }
 
 
@@ -462,9 +516,9 @@ std::tuple<int64,bool,int64> readBlockIdx(const std::string& data) {
 
 
 
-PrimitiveBlockPtr read_primitive_block(int64 idx, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry) {
+PrimitiveBlockPtr read_primitive_block(int64 idx, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry, ReadFieldsPtr fields) {
     if (has_flag(objflags, ReadBlockFlags::UseAlternative)) {
-        return read_primitive_block_new(idx,data,change,objflags,ids,readGeometry);
+        return read_primitive_block_new(idx,data,change,objflags,ids,readGeometry,fields);
     }
 
     std::vector<std::string> stringtable;
@@ -498,8 +552,14 @@ PrimitiveBlockPtr read_primitive_block(int64 idx, const std::string& data, bool
 
     
 
+    SymbolCache symbols(stringtable);
+    std::vector<bool> key_mask;
+    if (fields && fields->tags) {
+        key_mask = fields->tag_key_mask(stringtable);
+    }
     for (size_t i=0; i < blocks.size(); i++) {
-        readPrimitiveGroup(blocks[i], stringtable, primblock->Objects(),change, objflags,ids, readGeometry);
+        readPrimitiveGroup(blocks[i], symbols, primblock->Objects(),change, objflags,ids, readGeometry,
+            fields ? *fields : all_fields(), key_mask);
     }
 
 
@@ -51,9 +51,33 @@ struct block_data {
     bool skip_ways;
     bool skip_relations;
     bool skip_geometries;
-    bool skip_strings;
-    bool skip_info;
+    ReadFields fields;
     
+    //tag_keys resolved against stringtable, empty if all tags are kept
+    std::vector<bool> key_mask;
+    
+    //tag keys are interned once per block
+    mutable std::vector<std::optional<Symbol>> symbols;
+    
+    Symbol symbol(uint64 idx) const {
+        if (symbols.size()!=stringtable.size()) {
+            symbols.resize(stringtable.size());
+        }
+        auto& sym = symbols.at(idx);
+        if (!sym) {
+            sym = Symbol(stringtable[idx]);
+        }
+        return *sym;
+    }
+    
+    bool keep_key(uint64 idx) const {
+        return key_mask.empty() || ((idx < key_mask.size()) && key_mask[idx]);
+    }
+    
+    //fields which are not selected are given tag 0, so they are skipped by read_pbf_messages
+    static uint64 field(bool selected, uint64 tg) {
+        return selected ? tg : 0;
+    }
 };
 
 bool check_id(const block_data& data, ElementType ty, int64 id) {
@@ -97,15 +121,57 @@ struct geometry_data {
 };
     
 
+class tag_reader {
+    public:
+        tag_reader(std::vector<Tag>& tags_, const block_data& block_) : tags(tags_), block(block_) {}
+        
+        handle_pbf_packed_int keys() {
+            if (!block.fields.tags) { return handle_pbf_packed_int{0, nullptr, nullptr}; }
+            if (block.key_mask.empty()) {
+                return handle_pbf_packed_int{2,
+                    [this](size_t s) { if (s>tags.size()) { tags.resize(s); } },
+                    [this](size_t i, uint64 v) { tags[i].key=block.symbol(v); }
+                };
+            }
+            return handle_pbf_packed_int{2, nullptr, [this](size_t, uint64 v) { key_idx.push_back(v); }};
+        }
+        
+        handle_pbf_packed_int vals() {
+            if (!block.fields.tags) { return handle_pbf_packed_int{0, nullptr, nullptr}; }
+            if (block.key_mask.empty()) {
+                return handle_pbf_packed_int{3,
+                    [this](size_t s) { if (s>tags.size()) { tags.resize(s); } },
+                    [this](size_t i, uint64 v) { tags[i].val=block.stringtable.at(v); }
+                };
+            }
+            return handle_pbf_packed_int{3, nullptr, [this](size_t, uint64 v) { val_idx.push_back(v); }};
+        }
+        
+        //when filtering by key only the values of kept tags are copied
+        void finish() {
+            for (size_t i=0; (i < key_idx.size()) && (i < val_idx.size()); i++) {
+                if (block.keep_key(key_idx[i])) {
+                    tags.push_back(Tag(block.symbol(key_idx[i]), block.stringtable.at(val_idx[i])));
+                }
+            }
+        }
+    private:
+        std::vector<Tag>& tags;
+        const block_data& block;
+        std::vector<uint64> key_idx;
+        std::vector<uint64> val_idx;
+};
+
 void read_info(ElementInfo& info, const block_data& block, const std::string& data, size_t pos, size_t lim) {
 
+    const auto& f = block.fields;
     read_pbf_messages(data,pos,lim,
-        handle_pbf_value{1, [&info](uint64 vl) { info.version = vl; }},
-        handle_pbf_value{2, [&info](uint64 vl) { info.timestamp = vl; }},
-        handle_pbf_value{3, [&info](uint64 vl) { info.changeset = vl; }},
-        handle_pbf_value{4, [&info](uint64 vl) { info.user_id = vl; }},
-        handle_pbf_value{block.skip_strings ? 0ull: 5, [&info,&block](uint64 vl) { info.user = block.stringtable.at(vl); }},
-        handle_pbf_value{6, [&info](uint64 vl) { info.visible = vl==1; }}
+        handle_pbf_value{block.field(f.version, 1), [&info](uint64 vl) { info.version = vl; }},
+        handle_pbf_value{block.field(f.timestamp, 2), [&info](uint64 vl) { info.timestamp = vl; }},
+        handle_pbf_value{block.field(f.changeset, 3), [&info](uint64 vl) { info.changeset = vl; }},
+        handle_pbf_value{block.field(f.user_id, 4), [&info](uint64 vl) { info.user_id = vl; }},
+        handle_pbf_value{block.field(f.user, 5), [&info,&block](uint64 vl) { info.user = block.stringtable.at(vl); }},
+        handle_pbf_value{block.field(f.visible, 6), [&info](uint64 vl) { info.visible = vl==1; }}
     );
     
 }
@@ -114,22 +180,18 @@ void read_info(ElementInfo& info, const block_data& block, const std::string& da
 ElementPtr read_node(const std::string& data, size_t pos, size_t lim, const block_data& block, changetype c) {
     
     node_data nd{0,0,{0,0,0,0,"",false},{},0,0};
+    tag_reader tags(nd.tags, block);
     
     read_pbf_messages(data, pos, lim, 
         handle_pbf_value{1, [&nd](uint64 v) { nd.id=v; }},
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 2,
-                [&nd](size_t s) { if (s>nd.tags.size()) { nd.tags.resize(s); } },
-                [&nd,&block](size_t i, uint64 v) { nd.tags[i].key=block.stringtable.at(v); }
-        },
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 3,
-                [&nd](size_t s) { if (s>nd.tags.size()) { nd.tags.resize(s); } },
-                [&nd,&block](size_t i, uint64 v) { nd.tags[i].val=block.stringtable.at(v); }
-        },
-        handle_pbf_data{block.skip_info ? 0ull: 4,[&nd,&block](const std::string& d, size_t p, size_t l) { read_info(nd.info, block, d, p, l); }},
-        handle_pbf_value{8, [&nd](uint64 v) { nd.lat=un_zig_zag(v); }},
-        handle_pbf_value{9, [&nd](uint64 v) { nd.lon=un_zig_zag(v); }},
-        handle_pbf_value{20, [&nd](uint64 v) { nd.qt=un_zig_zag(v); }}
+        tags.keys(),
+        tags.vals(),
+        handle_pbf_data{block.field(block.fields.info(), 4),[&nd,&block](const std::string& d, size_t p, size_t l) { read_info(nd.info, block, d, p, l); }},
+        handle_pbf_value{block.field(block.fields.coords, 8), [&nd](uint64 v) { nd.lat=un_zig_zag(v); }},
+        handle_pbf_value{block.field(block.fields.coords, 9), [&nd](uint64 v) { nd.lon=un_zig_zag(v); }},
+        handle_pbf_value{block.field(block.fields.quadtree, 20), [&nd](uint64 v) { nd.qt=un_zig_zag(v); }}
     );
+    tags.finish();
     if (nd.id==0) { return nullptr; }
     if (!check_id(block,ElementType::Node,nd.id)) { return nullptr; }
 
@@ -138,7 +200,7 @@ ElementPtr read_node(const std::string& data, size_t pos, size_t lim, const bloc
     
 class dense_node_tags {
     public:
-        dense_node_tags(std::vector<node_data>& nds_, const block_data& block_) : nds(nds_), block(block_), node_idx(0), tag_idx(0) {}
+        dense_node_tags(std::vector<node_data>& nds_, const block_data& block_) : nds(nds_), block(block_), node_idx(0), tag_idx(0), keep(false) {}
         
         void call(size_t i, uint64 v) {
             if (v==0) {
@@ -146,9 +208,12 @@ class dense_node_tags {
                 tag_idx=0;
             } else {
                 if ((tag_idx%2)==0) {
-                    nds[node_idx].tags.push_back(Tag(block.stringtable.at(v),""));
-                } else {
-                    nds[node_idx].tags[tag_idx/2].val = block.stringtable.at(v);
+                    keep = block.keep_key(v);
+                    if (keep) {
+                        nds[node_idx].tags.push_back(Tag(block.symbol(v),""));
+                    }
+                } else if (keep) {
+                    nds[node_idx].tags.back().val = block.stringtable.at(v);
                 }
                 tag_idx++;
             }
@@ -158,6 +223,7 @@ class dense_node_tags {
         const block_data& block;
         size_t node_idx;
         size_t tag_idx;
+        bool keep;
 };
             
 void read_dense_info(std::vector<node_data>& nds, const block_data& block, const std::string& data, size_t pos, size_t lim) {
@@ -167,13 +233,14 @@ void read_dense_info(std::vector<node_data>& nds, const block_data& block, const
         if (sz != nds.size()) { throw std::domain_error("unexpected dense info length"); }
     };
         
+    const auto& f = block.fields;
     read_pbf_messages(data,pos,lim,
-        handle_pbf_packed_int{1, check_size, [&nds](size_t i, uint64 vl) { nds[i].info.version = vl; }},
-        handle_pbf_packed_int_delta{2, check_size, [&nds](size_t i, int64 vl) { nds[i].info.timestamp = vl; }},
-        handle_pbf_packed_int_delta{3, check_size, [&nds](size_t i, int64 vl) { nds[i].info.changeset = vl; }},
-        handle_pbf_packed_int_delta{4, check_size, [&nds](size_t i, int64 vl) { nds[i].info.user_id = vl; }},
-        handle_pbf_packed_int_delta{block.skip_strings ? 0ull: 5, check_size, [&nds,&block](size_t i, int64 vl) { nds[i].info.user = block.stringtable.at(vl); }},
-        handle_pbf_packed_int{6, check_size, [&nds](size_t i, uint64 vl) { nds[i].info.visible = vl==1; }}
+        handle_pbf_packed_int{block.field(f.version, 1), check_size, [&nds](size_t i, uint64 vl) { nds[i].info.version = vl; }},
+        handle_pbf_packed_int_delta{block.field(f.timestamp, 2), check_size, [&nds](size_t i, int64 vl) { nds[i].info.timestamp = vl; }},
+        handle_pbf_packed_int_delta{block.field(f.changeset, 3), check_size, [&nds](size_t i, int64 vl) { nds[i].info.changeset = vl; }},
+        handle_pbf_packed_int_delta{block.field(f.user_id, 4), check_size, [&nds](size_t i, int64 vl) { nds[i].info.user_id = vl; }},
+        handle_pbf_packed_int_delta{block.field(f.user, 5), check_size, [&nds,&block](size_t i, int64 vl) { nds[i].info.user = block.stringtable.at(vl); }},
+        handle_pbf_packed_int{block.field(f.visible, 6), check_size, [&nds](size_t i, uint64 vl) { nds[i].info.visible = vl==1; }}
     );
     
 }
@@ -188,18 +255,18 @@ void read_dense(std::vector<ElementPtr>& objects, const std::string& data, size_
             [&nds](size_t sz) { nds.resize(sz); },
             [&nds](size_t i, int64 v) { nds[i].id=v; }
         },
-        handle_pbf_data{block.skip_info ? 0ull: 5, [&nds,&block](const std::string& d, size_t p, size_t l) { read_dense_info(nds,block,d,p,l); }},
-        handle_pbf_packed_int_delta{8,
+        handle_pbf_data{block.field(block.fields.info(), 5), [&nds,&block](const std::string& d, size_t p, size_t l) { read_dense_info(nds,block,d,p,l); }},
+        handle_pbf_packed_int_delta{block.field(block.fields.coords, 8),
             [&nds](size_t sz) { if (sz!=nds.size()) { throw std::domain_error("unexpected size of dense lons"); } },
             [&nds](size_t i, int64 v) { nds[i].lat=v; }
         },
-        handle_pbf_packed_int_delta{9,
+        handle_pbf_packed_int_delta{block.field(block.fields.coords, 9),
             [&nds](size_t sz) { if (sz!=nds.size()) { throw std::domain_error("unexpected size of dense lats"); } },
             [&nds](size_t i, int64 v) { nds[i].lon=v; }
         },
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 10, nullptr, [&dnt](size_t i, int64 v) { dnt.call(i,v); }},
+        handle_pbf_packed_int{block.field(block.fields.tags, 10), nullptr, [&dnt](size_t i, int64 v) { dnt.call(i,v); }},
         
-        handle_pbf_packed_int_delta{20,
+        handle_pbf_packed_int_delta{block.field(block.fields.quadtree, 20),
             [&nds](size_t sz) { if (sz!=nds.size()) { throw std::domain_error("unexpected size of dense quadtree"); } },
             [&nds](size_t i, int64 v) { nds[i].qt=v; }
         }
@@ -220,24 +287,20 @@ void read_dense(std::vector<ElementPtr>& objects, const std::string& data, size_
 
 ElementPtr read_way(const std::string& data, size_t pos, size_t lim, const block_data& block, changetype c) { 
     way_data wy{0,0,{0,0,0,0,"",false},{},{}};
+    tag_reader tags(wy.tags, block);
     
     read_pbf_messages(data, pos, lim, 
         handle_pbf_value{1, [&wy](uint64 v) { wy.id=v; }},
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 2,
-                [&wy](size_t s) { if (s>wy.tags.size()) { wy.tags.resize(s); } },
-                [&wy,&block](size_t i, uint64 v) { wy.tags[i].key=block.stringtable.at(v); }
-        },
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 3,
-                [&wy](size_t s) { if (s>wy.tags.size()) { wy.tags.resize(s); } },
-                [&wy,&block](size_t i, uint64 v) { wy.tags[i].val=block.stringtable.at(v); }
-        },
-        handle_pbf_data{block.skip_info ? 0ull: 4, [&wy,&block](const std::string& d, size_t p, size_t l) { read_info(wy.info, block, d, p, l); }},
-        handle_pbf_packed_int_delta{8,
+        tags.keys(),
+        tags.vals(),
+        handle_pbf_data{block.field(block.fields.info(), 4), [&wy,&block](const std::string& d, size_t p, size_t l) { read_info(wy.info, block, d, p, l); }},
+        handle_pbf_packed_int_delta{block.field(block.fields.refs, 8),
                 [&wy](size_t sz) { wy.refs.resize(sz); },
                 [&wy](size_t i, int64 v) { wy.refs[i]=v; }
         },
-        handle_pbf_value{20, [&wy](uint64 v) { wy.qt=un_zig_zag(v); }}
+        handle_pbf_value{block.field(block.fields.quadtree, 20), [&wy](uint64 v) { wy.qt=un_zig_zag(v); }}
     );
+    tags.finish();
     if (wy.id==0) { return nullptr; }
     if (!check_id(block,ElementType::Way,wy.id)) { return nullptr; }
     return std::make_shared<Way>(c, wy.id, wy.qt, wy.info, wy.tags, wy.refs);
@@ -246,35 +309,30 @@ ElementPtr read_way(const std::string& data, size_t pos, size_t lim, const block
 
 ElementPtr read_relation(const std::string& data, size_t pos, size_t lim, const block_data& block, changetype c) {
     relation_data rl{0,0,{0,0,0,0,"",false},{},{}};
-    
+    tag_reader tags(rl.tags, block);
     
     read_pbf_messages(data, pos, lim, 
         handle_pbf_value{1, [&rl](uint64 v) { rl.id=v; }},
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 2,
-                [&rl](size_t s) { if (s>rl.tags.size()) { rl.tags.resize(s); } },
-                [&rl,&block](size_t i, uint64 v) { rl.tags[i].key=block.stringtable.at(v); }
-        },
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 3,
-                [&rl](size_t s) { if (s>rl.tags.size()) { rl.tags.resize(s); } },
-                [&rl,&block](size_t i, uint64 v) { rl.tags[i].val=block.stringtable.at(v); }
-        },
-        handle_pbf_data{block.skip_info ? 0ull: 4, [&rl,&block](const std::string& d, size_t p, size_t l) { read_info(rl.info, block, d, p, l); }},
+        tags.keys(),
+        tags.vals(),
+        handle_pbf_data{block.field(block.fields.info(), 4), [&rl,&block](const std::string& d, size_t p, size_t l) { read_info(rl.info, block, d, p, l); }},
         
-        handle_pbf_packed_int{block.skip_strings ? 0ull: 8,
+        handle_pbf_packed_int{block.field(block.fields.members && block.fields.roles, 8),
                 [&rl](size_t sz) { if (sz>rl.members.size()) { rl.members.resize(sz); } },
                 [&rl,&block](size_t i, int64 v) { rl.members[i].role=block.stringtable.at(v); }
         },
-        handle_pbf_packed_int_delta{9,
+        handle_pbf_packed_int_delta{block.field(block.fields.members, 9),
                 [&rl](size_t sz) { if (sz>rl.members.size()) { rl.members.resize(sz);  }},
                 [&rl](size_t i, int64 v) { rl.members[i].ref=v; }
         },
-        handle_pbf_packed_int{10,
+        handle_pbf_packed_int{block.field(block.fields.members, 10),
                 [&rl](size_t sz) { if (sz>rl.members.size()) { rl.members.resize(sz); } },
                 [&rl](size_t i, int64 v) { rl.members[i].type=(ElementType) v; }
         },
         
-        handle_pbf_value{20, [&rl](uint64 v) { rl.qt=un_zig_zag(v); }}
+        handle_pbf_value{block.field(block.fields.quadtree, 20), [&rl](uint64 v) { rl.qt=un_zig_zag(v); }}
     );
+    tags.finish();
     if (rl.id==0) { return nullptr; }
     if (!check_id(block,ElementType::Relation,rl.id)) { return nullptr; }
     return std::make_shared<Relation>(c, rl.id, rl.qt, rl.info, rl.tags, rl.members);
@@ -356,19 +414,35 @@ using oqt::readblock_detail::read_string_table;
 using oqt::readblock_detail::read_quadtree;
 using oqt::readblock_detail::read_primitive_group;
 
-void read_primitive_block_new_into(PrimitiveBlockPtr primblock, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry) {
+void read_primitive_block_new_into(PrimitiveBlockPtr primblock, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry, ReadFieldsPtr fields) {
     block_data block{{},change,ids,readGeometry,
         has_flag(objflags,ReadBlockFlags::SkipNodes),
         has_flag(objflags,ReadBlockFlags::SkipWays),
         has_flag(objflags,ReadBlockFlags::SkipRelations),
         has_flag(objflags,ReadBlockFlags::SkipGeometries),
-        has_flag(objflags,ReadBlockFlags::SkipStrings),
-        has_flag(objflags,ReadBlockFlags::SkipInfo)};
-   
-   
+        fields ? *fields : ReadFields()};
+    
+    bool skip_strings = has_flag(objflags,ReadBlockFlags::SkipStrings);
+    if (skip_strings) {
+        block.fields.tags=false;
+        block.fields.user=false;
+        block.fields.roles=false;
+    }
+    if (has_flag(objflags,ReadBlockFlags::SkipInfo)) {
+        block.fields.version=false;
+        block.fields.timestamp=false;
+        block.fields.changeset=false;
+        block.fields.user_id=false;
+        block.fields.user=false;
+        block.fields.visible=false;
+    }
+    
+    //the string table is only needed for the selected fields and for geometries
+    bool read_strings = (!skip_strings) && (block.fields.strings() || (block.readGeometry && !block.skip_geometries));
+    
     std::vector<std::pair<size_t,size_t>> group_poses;
     read_pbf_messages(data, 0, data.size(),
-        handle_pbf_data{block.skip_strings ? 0ull : 1, [&block](const std::string& d, size_t p, size_t l) { read_string_table(block.stringtable, d, p, l); }},
+        handle_pbf_data{block.field(read_strings, 1), [&block](const std::string& d, size_t p, size_t l) { read_string_table(block.stringtable, d, p, l); }},
         handle_pbf_data{2, [&group_poses](const std::string&, size_t p, size_t l) { group_poses.push_back(std::make_pair(p,l)); }},
         handle_pbf_data{31,[&primblock](const std::string& d, size_t p, size_t l) { primblock->SetQuadtree(read_quadtree(d,p,l)); }},
         handle_pbf_value{32, [&primblock](uint64 vl) { primblock->SetQuadtree(un_zig_zag(vl)); }},
@@ -376,18 +450,22 @@ void read_primitive_block_new_into(PrimitiveBlockPtr primblock, const std::strin
         handle_pbf_value{34, [&primblock](uint64 vl) { primblock->SetEndDate(vl); }}
     );
     
+    if (block.fields.tags) {
+        block.key_mask = block.fields.tag_key_mask(block.stringtable);
+    }
+    
     for (const auto& pl: group_poses) {
         read_primitive_group(primblock->Objects(), block, data, pl.first, pl.second);
     }
 }
     
 
-PrimitiveBlockPtr read_primitive_block_new(int64 idx, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry) {
+PrimitiveBlockPtr read_primitive_block_new(int64 idx, const std::string& data, bool change, ReadBlockFlags objflags, IdSetPtr ids, read_geometry_func readGeometry, ReadFieldsPtr fields) {
     
     
     auto primblock = std::make_shared<PrimitiveBlock>(idx,(change || ids || (objflags!=ReadBlockFlags::Empty)) ? 0: 8000);
     
-    read_primitive_block_new_into(primblock, data,change,objflags,ids,readGeometry);
+    read_primitive_block_new_into(primblock, data,change,objflags,ids,readGeometry,fields);
     return primblock;
 }
 }
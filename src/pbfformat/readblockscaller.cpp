@@ -35,7 +35,7 @@
 #include "oqt/pbfformat/readfileblocks.hpp"
         
 namespace oqt {
-std::pair<std::vector<std::string>,int64> read_filenames(const std::string& prfx, int64 enddate) {
+std::vector<std::pair<std::string,int64>> read_filelist(const std::string& prfx) {
     std::ifstream filelist(prfx+"filelist.json", std::ios::in);
     if (!filelist.good()) {
         throw std::domain_error("?? "+prfx+"filelist.json");
@@ -55,9 +55,7 @@ std::pair<std::vector<std::string>,int64> read_filenames(const std::string& prfx
     auto varr = v.get<picojson::array>();
     Logger::Message() << "filelist: " << varr.size() << "entries";
 
-    std::vector<std::string> result;
-    int64 last_date=0;
-    
+    std::vector<std::pair<std::string,int64>> result;
     for (auto& vlv : varr) {
 
         auto vl = vlv.get<picojson::object>();
@@ -66,16 +64,26 @@ std::pair<std::vector<std::string>,int64> read_filenames(const std::string& prfx
         if (vl_date==0) {
             throw std::domain_error("can't parse "+vl_date_in);
         }
-        if ((enddate>0) && (vl_date > enddate)) {
-            Logger::Message() << "skip entry for " << vl_date_in << "(" << vl_date << ">" << enddate;
+        result.push_back(std::make_pair(prfx+vl["Filename"].get<std::string>(), vl_date));
+    }
+    return result;
+}
+
+std::pair<std::vector<std::string>,int64> read_filenames(const std::string& prfx, int64 enddate) {
+    
+    std::vector<std::string> result;
+    int64 last_date=0;
+    
+    for (const auto& fl: read_filelist(prfx)) {
+        if ((enddate>0) && (fl.second > enddate)) {
+            Logger::Message() << "skip entry for " << date_str(fl.second) << "(" << fl.second << ">" << enddate;
             continue;
         }
         
-        std::string fn = prfx+vl["Filename"].get<std::string>();
-        if (vl_date>last_date) {
-            last_date=vl_date;
+        if (fl.second>last_date) {
+            last_date=fl.second;
         }
-        result.push_back(fn);
+        result.push_back(fl.first);
     }
     
     return std::make_pair(result, last_date);
@@ -97,6 +105,7 @@ class ReadBlocksSingle : public ReadBlocksCaller {
                                 
                                 
                                     locs.push_back(std::get<1>(l));
+                                    keyed_locs[std::get<0>(l)].push_back(std::make_pair(0, std::get<1>(l)));
                                 }
                             }
                         }
@@ -129,10 +138,24 @@ class ReadBlocksSingle : public ReadBlocksCaller {
         }
         
         
+        //keyed_locs is only filled when locs are taken from the file's tile index
+        bool can_read_blobs() { return !keyed_locs.empty(); }
+        
+        void read_blobs(std::vector<keyedblob_callback> cbs) {
+            if (keyed_locs.empty()) {
+                throw std::domain_error("can't read blobs from "+fn+" without a tile index");
+            }
+            read_some_split_locs_parallel_callback({fn}, cbs, keyed_locs);
+        }
+        
         size_t num_tiles() { return locs.size(); }
+        
+        void set_block_cache(BlockCachePtr) {}
+        BlockCachePtr block_cache() { return nullptr; }
     private:
         std::string fn;
         std::vector<int64> locs;
+        src_locs_map keyed_locs;
 };
         
 class ReadBlocksMerged : public ReadBlocksCaller {
@@ -176,30 +199,55 @@ class ReadBlocksMerged : public ReadBlocksCaller {
         
         void read_primitive(std::vector<primitiveblock_callback> cbs, ReadBlockFlags flags, IdSetPtr filter) {
             
-            read_blocks_split_merge<PrimitiveBlock>(filenames, cbs, locs, filter, flags, buffer);
+            read_blocks_split_merge<PrimitiveBlock>(filenames, cbs, locs, filter, flags, buffer, cache);
+            log_cache_stats();
         }
         void read_minimal(std::vector<minimalblock_callback> cbs, ReadBlockFlags flags, IdSetPtr filter)  {
-            read_blocks_split_merge<minimal::Block>(filenames, cbs, locs, filter, flags, buffer);
+            read_blocks_split_merge<minimal::Block>(filenames, cbs, locs, filter, flags, buffer, cache);
+            log_cache_stats();
         }
         
         void read_primitive_nothread(primitiveblock_callback cb, ReadBlockFlags flags, IdSetPtr filter) {
-            read_blocks_merge_nothread<PrimitiveBlock>(filenames, cb, locs, filter, flags);
+            read_blocks_merge_nothread<PrimitiveBlock>(filenames, cb, locs, filter, flags, cache);
+            log_cache_stats();
         }
         
         void read_minimal_nothread(minimalblock_callback cb, ReadBlockFlags flags, IdSetPtr filter) {
-            read_blocks_merge_nothread<minimal::Block>(filenames, cb, locs, filter, flags);
+            read_blocks_merge_nothread<minimal::Block>(filenames, cb, locs, filter, flags, cache);
+            log_cache_stats();
+        }
+        
+        bool can_read_blobs() { return true; }
+        
+        void read_blobs(std::vector<keyedblob_callback> cbs) {
+            if (buffer==0) {
+                read_some_split_locs_parallel_callback(filenames, cbs, locs);
+            } else {
+                read_some_split_buffered_keyed_callback_all(filenames, cbs, locs, buffer);
+            }
         }
         
         int64 actual_enddate() { return enddate; }
         bbox actual_filter_box() { return filter_box; }
         size_t num_tiles() { return locs.size(); }
         
+        void set_block_cache(BlockCachePtr cache_) { cache=cache_; }
+        BlockCachePtr block_cache() { return cache; }
+        
     private:
         std::vector<std::string> filenames;
         src_locs_map locs;
         int64 enddate;
         bbox filter_box;
         size_t buffer;
+        BlockCachePtr cache;
+        
+        void log_cache_stats() {
+            if (!cache) { return; }
+            auto st = cache->stats();
+            Logger::Message() << "block cache: " << st.hits << " hits, " << st.misses << " misses, "
+                << st.evictions << " evicted, " << st.num_blocks << " blocks [" << (st.bytes>>20) << "mb]";
+        }
 };
         
 std::shared_ptr<ReadBlocksCaller> make_read_blocks_caller(
@@ -28,12 +28,12 @@ namespace oqt {
     
 PrimitiveBlockPtr read_as_primitiveblock(
     std::shared_ptr<FileBlock> bl,
-    IdSetPtr filter, bool isc, ReadBlockFlags objflags) {
+    IdSetPtr filter, bool isc, ReadBlockFlags objflags, ReadFieldsPtr fields) {
     
     
     if ((bl->blocktype=="OSMData")) {
         std::string dd = bl->get_data();
-        auto r = read_primitive_block(bl->idx, dd, isc, objflags, filter, nullptr);
+        auto r = read_primitive_block(bl->idx, dd, isc, objflags, filter, nullptr, fields);
         r->SetFilePosition(bl->file_position);
         r->SetFileProgress(bl->file_progress);
         
@@ -39,6 +39,13 @@
 
 namespace oqt {
 
+int64 telemetry_item_bytes(const KeyedBlob& kb) {
+    int64 r=0;
+    for (const auto& b: kb.blobs) {
+        r += b.first.size();
+    }
+    return r;
+}
 
 void read_some_split_locs_parallel_callback(
     const std::vector<std::string>& filenames,
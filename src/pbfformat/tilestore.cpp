@@ -0,0 +1,242 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/pbfformat/tilestore.hpp"
+#include "oqt/pbfformat/readblockscaller.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/update/idtilestore.hpp"
+#include "oqt/utils/string.hpp"
+#include "oqt/utils/logger.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+namespace oqt {
+
+TileStore::TileStore(const std::string& prfx, size_t numchan_, size_t cache_size) : numchan(numchan_), cache_(std::make_shared<BlockCache>(cache_size)) {
+    
+    if (ends_with(prfx, ".pbf")) {
+        filenames_.push_back(prfx);
+        enddates_.push_back(0);
+    } else {
+        for (const auto& fl: read_filelist(prfx)) {
+            filenames_.push_back(fl.first);
+            enddates_.push_back(fl.second);
+        }
+    }
+    if (filenames_.empty()) { throw std::domain_error("no filenames!"); }
+    
+    for (size_t file_idx=0; file_idx < filenames_.size(); file_idx++) {
+        const auto& fn = filenames_.at(file_idx);
+        auto head = get_header_block(fn);
+        if (!head) { throw std::domain_error("file "+fn+" has no header"); }
+        if (head->Index().empty()) { throw std::domain_error("file "+fn+" has no tile index"); }
+        
+        if (file_idx==0) {
+            box_ = head->BBox();
+        }
+        for (const auto& l : head->Index()) {
+            if ((file_idx==0) || (locs.count(std::get<0>(l))>0)) {
+                locs[std::get<0>(l)].push_back(std::make_pair(file_idx, std::get<1>(l)));
+            }
+        }
+    }
+    if (std::ifstream(filenames_[0]+"-idtile.idx").good()) {
+        id_index_ = open_idtile_index(filenames_[0]+"-idtile.idx");
+        if (id_index_->num_tiles() != locs.size()) {
+            throw std::domain_error(filenames_[0]+"-idtile.idx doesn't match "+filenames_[0]);
+        }
+    }
+    Logger::Message() << "TileStore " << prfx << ": " << filenames_.size() << " files, " << locs.size() << " tiles" << (id_index_ ? ", with idtile index" : "");
+}
+
+std::pair<size_t,std::string> TileStore::find_files(int64 enddate) const {
+    size_t nf=1;
+    while ((nf < filenames_.size()) && ((enddate==0) || (enddates_[nf] <= enddate))) {
+        nf++;
+    }
+    return std::make_pair(nf, block_cache_fileset(std::vector<std::string>(filenames_.begin(), filenames_.begin()+nf)));
+}
+
+std::vector<int64> TileStore::tiles(const bbox& box, const std::vector<LonLat>& poly) const {
+    std::vector<int64> result;
+    for (const auto& l: locs) {
+        if (overlaps_quadtree(box, l.first)) {
+            if (poly.empty() || polygon_box_intersects(poly, quadtree::bbox(l.first, 0.05))) {
+                result.push_back(l.first);
+            }
+        }
+    }
+    return result;
+}
+
+std::vector<PrimitiveBlockPtr> TileStore::query(const bbox& box, const std::vector<LonLat>& poly, int64 enddate, ReadBlockFlags objflags) const {
+    return read_tiles(tiles(box, poly), enddate, objflags);
+}
+
+//the cached tiles are shared, so return a copy of the list of objects
+PrimitiveBlockPtr copy_tile(PrimitiveBlockPtr block) {
+    auto result = std::make_shared<PrimitiveBlock>(block->Index(), 0);
+    result->CopyMetadata(block);
+    result->Objects() = block->Objects();
+    return result;
+}
+
+std::vector<PrimitiveBlockPtr> TileStore::read_tiles(const std::vector<int64>& qts, int64 enddate, ReadBlockFlags objflags) const {
+    return read_tiles_cached(qts, enddate, objflags, true);
+}
+
+std::vector<PrimitiveBlockPtr> TileStore::read_tiles_cached(const std::vector<int64>& qts, int64 enddate, ReadBlockFlags objflags, bool use_cache) const {
+    size_t nf; std::string fileset;
+    std::tie(nf, fileset) = find_files(enddate);
+    
+    std::map<int64,PrimitiveBlockPtr> result;
+    src_locs_map missing;
+    for (auto qt: qts) {
+        auto it = locs.find(qt);
+        if (it==locs.end()) {
+            throw std::domain_error("no tile "+quadtree::string(qt));
+        }
+        auto bl = use_cache ? cache_->get<PrimitiveBlock>(fileset, qt, objflags, nullptr) : PrimitiveBlockPtr();
+        if (bl) {
+            result[qt] = copy_tile(bl);
+            continue;
+        }
+        auto& mm = missing[qt];
+        for (const auto& l: it->second) {
+            if (l.first < nf) {
+                mm.push_back(l);
+            }
+        }
+    }
+    
+    if (!missing.empty()) {
+        std::mutex mutex;
+        auto cache = cache_;
+        auto cb = [&result, &mutex, cache, fileset, objflags, use_cache](std::shared_ptr<KeyedBlob> kb) {
+            if (!kb) { return; }
+            auto bl = readpbffile_detail::merge_keyedblob<PrimitiveBlock>(kb, objflags, nullptr);
+            if (use_cache) {
+                cache->put<PrimitiveBlock>(fileset, kb->key, objflags, nullptr, bl);
+                bl = copy_tile(bl);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            result[kb->key] = bl;
+        };
+        
+        std::vector<keyedblob_callback> cbs;
+        size_t nc = std::min(numchan, missing.size());
+        if (nc==0) {
+            cbs.push_back(cb);
+        } else {
+            for (size_t i=0; i < nc; i++) {
+                cbs.push_back(threaded_callback<KeyedBlob>::make(cb));
+            }
+        }
+        read_some_split_locs_parallel_callback(filenames_, cbs, missing);
+    }
+    
+    std::vector<PrimitiveBlockPtr> out;
+    out.reserve(result.size());
+    for (auto& r: result) {
+        out.push_back(r.second);
+    }
+    return out;
+}
+
+std::vector<ElementPtr> TileStore::get_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate, const std::vector<int64>& qts) const {
+    if (qts.empty()) {
+        throw std::domain_error("TileStore::get_objects: no tiles given (use scan_objects to search every tile)");
+    }
+    return search_tiles(ty, ids, enddate, qts, true);
+}
+
+std::vector<ElementPtr> TileStore::scan_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate) const {
+    std::vector<int64> qts;
+    for (const auto& l: locs) {
+        qts.push_back(l.first);
+    }
+    return search_tiles(ty, ids, enddate, qts, false);
+}
+
+std::vector<ElementPtr> TileStore::search_tiles(ElementType ty, const std::vector<int64>& ids_in, int64 enddate, std::vector<int64> qts, bool use_cache) const {
+    std::vector<int64> ids = ids_in;
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    
+    std::sort(qts.begin(), qts.end());
+    qts.erase(std::unique(qts.begin(), qts.end()), qts.end());
+    
+    std::vector<ElementPtr> result;
+    //read a few tiles at a time, so that the whole file is not held in memory
+    size_t step = std::max<size_t>(numchan, 1)*16;
+    for (size_t i=0; (i < qts.size()) && (result.size() < ids.size()); i+=step) {
+        std::vector<int64> qq(qts.begin()+i, qts.begin()+std::min(i+step, qts.size()));
+        for (const auto& bl: read_tiles_cached(qq, enddate, ReadBlockFlags::Empty, use_cache)) {
+            for (const auto& o: bl->Objects()) {
+                if ((o->Type()==ty) && (o->ChangeType()!=changetype::Delete) && (o->ChangeType()!=changetype::Remove)) {
+                    if (std::binary_search(ids.begin(), ids.end(), o->Id())) {
+                        result.push_back(o);
+                    }
+                }
+            }
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const ElementPtr& l, const ElementPtr& r) { return l->Id() < r->Id(); });
+    return result;
+}
+
+std::vector<ElementPtr> TileStore::find_objects(ElementType ty, const std::vector<int64>& ids, int64 enddate) const {
+    std::vector<int64> qts;
+    size_t nf = find_files(enddate).first;
+    if (id_store_ && (nf==filenames_.size()) && ends_with(filenames_.back(), id_store_->last_file())) {
+        std::vector<int64> keys;
+        for (auto id: ids) {
+            keys.push_back((((int64) ty)<<61) | id);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for (const auto& e: id_store_->find(keys)) {
+            qts.push_back(e.tile);
+        }
+    } else if (id_index_ && (nf==1)) {
+        qts = id_index_->find_tiles(ty, ids);
+    } else if (id_index_) {
+        //the index gives the tiles in the first file: objects moved to
+        //another tile by a change file would be missed
+        throw std::domain_error("TileStore::find_objects: no IdTileStore for the change files (use scan_objects to search every tile)");
+    } else {
+        throw std::domain_error("TileStore::find_objects: no id index (use scan_objects to search every tile)");
+    }
+    if (qts.empty()) {
+        return {};
+    }
+    return search_tiles(ty, ids, enddate, qts, true);
+}
+
+TileStorePtr make_tilestore(const std::string& prfx, size_t numchan, size_t cache_size) {
+    return std::make_shared<TileStore>(prfx, numchan, cache_size);
+}
+
+}
@@ -29,6 +29,8 @@
 #include <map>
 #include <algorithm>
 #include <iterator>
+#include <string_view>
+#include <memory>
 #include "oqt/elements/node.hpp"
 #include "oqt/elements/way.hpp"
 #include "oqt/elements/relation.hpp"
@@ -41,225 +43,571 @@ namespace oqt {
 namespace writeblock_detail {
 
 
-uint64 getString(std::map<std::string,uint64>& stringtable, const std::string& str) {
-    auto it=stringtable.find(str);
-    if (it!=stringtable.end()) {
-        return it->second;
-    }
-    uint64 a=stringtable.size();
-    stringtable[str]=a;
-    return a;
-}
-
-std::string packObject(
-    std::map<std::string,uint64>& stringtable,
-    ElementPtr obj,
-    bool includeQts,bool includeInfos,bool includeRefs) {
+/*! Builds the string table for a block. Each string is counted as it is
+ * added, and the table is then sorted by frequency so that the most
+ * common strings get the smallest (one byte) indices. Strings are held in
+ * an open addressing hash table of string_views into the objects being
+ * packed. Interned tag keys are first
+ * looked up by address, so each distinct symbol is only hashed as a
+ * string once per block.
+ *
+ * Every string added is also recorded in order, so later passes over the
+ * same objects can read the indices back with next() without hashing. */
+class StringTableBuilder {
+    public:
+        StringTableBuilder() : cursor(0), num_symbols(0), table(1024, -1), symbol_table(1024, std::make_pair(nullptr,0)) {}
         
-    std::list<PbfTag> msgs;
-
-    msgs.push_back(PbfTag{1,uint64(obj->Id())});
-
-    std::vector<uint64> kk,vv;
-    
-    for (const auto& tg: obj->Tags()) {
-        kk.push_back(getString(stringtable, tg.key));
-    }
-    for (const auto& tg: obj->Tags()) {
-        vv.push_back(getString(stringtable, tg.val));
-    }
-    std::list<PbfTag> infmsgs;
-    if (includeInfos) {
-        
-        infmsgs.push_back(PbfTag{1,uint64(obj->Info().version),""});
-        infmsgs.push_back(PbfTag{2,uint64(obj->Info().timestamp),""});
-        infmsgs.push_back(PbfTag{3,uint64(obj->Info().changeset),""});
-        infmsgs.push_back(PbfTag{4,uint64(obj->Info().user_id),""});
-        infmsgs.push_back(PbfTag{5,getString(stringtable,obj->Info().user),""});
-        /*if (!obj->Info().visible) {
-            infmsgs.push_back(PbfTag{6,0,""});
-        }*/
-    }
-    
-    if ((!kk.empty()) && (!vv.empty())) {
-        if (kk.size()!=vv.size()) {
-            throw std::domain_error("tags wrong");
+        void add(const std::string& str) {
+            occurrences.push_back(find_or_add(str));
         }
         
-        msgs.push_back(PbfTag{2,0,write_packed_int(kk)});
-        msgs.push_back(PbfTag{3,0,write_packed_int(vv)});
-    }
-    if (!infmsgs.empty() && includeInfos) {
-        msgs.push_back(PbfTag{4,0,pack_pbf_tags(infmsgs)});
-    }
-    
-    if (obj->Type()==ElementType::Node) {
-        auto nd = std::dynamic_pointer_cast<Node>(obj);
-        msgs.push_back(PbfTag{8,zig_zag(nd->Lat()),""});
-        msgs.push_back(PbfTag{9,zig_zag(nd->Lon()),""});
-    } else if (obj->Type()==ElementType::Way) {
-        auto wy = std::dynamic_pointer_cast<Way>(obj);
-        msgs.push_back(PbfTag{8, 0, write_packed_delta(wy->Refs())});
-    } else if (obj->Type()==ElementType::Relation) {
-        auto rl = std::dynamic_pointer_cast<Relation>(obj);
-        if (!rl->Members().empty()) {
-            msgs.push_back(PbfTag{8,0,write_packed_int_func<Member>(rl->Members(), [&stringtable](const Member& m) { return getString(stringtable, m.role); })});
-            msgs.push_back(PbfTag{9,0,write_packed_delta_func<Member>(rl->Members(), [](const Member& m) { return m.ref; })});
-            msgs.push_back(PbfTag{10,0,write_packed_int_func<Member>(rl->Members(), [](const Member& m) { return (uint64) m.type; })});
+        void add(const Symbol& sym) {
+            const void* key = sym.c_str();
+            size_t mask = symbol_table.size()-1;
+            size_t h = std::hash<const void*>()(key) & mask;
+            while (symbol_table[h].first) {
+                if (symbol_table[h].first==key) {
+                    occurrences.push_back(symbol_table[h].second);
+                    return;
+                }
+                h = (h+1) & mask;
+            }
+            uint32_t slot = find_or_add(sym.str());
+            symbol_table[h] = std::make_pair(key, slot);
+            num_symbols++;
+            if (2*num_symbols > symbol_table.size()) {
+                grow_symbols();
+            }
+            occurrences.push_back(slot);
         }
         
-    } else {
-        auto geom = std::dynamic_pointer_cast<BaseGeometry>(obj);
-        if (!geom) {
-            throw std::domain_error("unexpected type ??"+std::to_string(uint64(obj->Type())));
+        void finish() {
+            sorted.resize(strings.size());
+            for (size_t i=0; i < sorted.size(); i++) {
+                sorted[i]=i;
+            }
+            std::stable_sort(sorted.begin(), sorted.end(), [this](uint32_t l, uint32_t r) { return counts[l] > counts[r]; });
+            
+            //index 0 is left as an empty string: it marks the end of each
+            //node's tags in a DenseNodes message
+            indices.resize(strings.size());
+            for (size_t i=0; i < sorted.size(); i++) {
+                indices[sorted[i]] = i+1;
+            }
         }
-        for (const auto& m: geom->pack_extras()) {
-            msgs.push_back(m);
+        
+        void rewind() { cursor=0; }
+        uint64 next() { return indices[occurrences.at(cursor++)]; }
+        void skip(size_t n) { cursor+=n; }
+        size_t position() const { return cursor; }
+        
+        size_t packed_length() const {
+            size_t l = pbf_data_length(1,0);
+            for (const auto& s: strings) {
+                l += pbf_data_length(1, s.size());
+            }
+            return l;
         }
-    }
         
-
-    if (includeQts && (obj->Quadtree()>=0)) {
-        msgs.push_back(PbfTag{20,zig_zag(obj->Quadtree())});
-    }
-
-    sort_pbf_tags(msgs);
-    
-    return pack_pbf_tags(msgs);
-}
-
-template <class Iter>
-std::string packDenseNodes(
-    std::map<std::string,uint64>& stringtable,
-    Iter beg, Iter end, size_t nobj,bool includeQts,bool includeInfos) {
-
-    //size_t nobj = (end-beg);
-    std::vector<int64> ids, qts, ts, cs, ui, us, lons,lats;
-    std::vector<uint64> vs, /*iv,*/ kvs;
-
-    ids.reserve(nobj);
-    if (includeQts) {
-        qts.reserve(nobj);
-    }
-    if (includeInfos) {
-        ts.reserve(nobj);
-        ui.reserve(nobj);
-        us.reserve(nobj);
-        vs.reserve(nobj);
-        //iv.reserve(nobj);
-    }
-    lons.reserve(nobj);
-    lats.reserve(nobj);
-
-    
-    kvs.reserve(nobj*5);
-    
-    for (auto it=beg; it!=end; ++it) {
-        auto obj = std::dynamic_pointer_cast<Node>(*it);        
+        size_t write(std::string& out, size_t pos) const {
+            pos = write_pbf_data_header(out, pos, 1, 0);
+            for (auto i: sorted) {
+                const auto& s = strings[i];
+                pos = write_pbf_data_header(out, pos, 1, s.size());
+                std::copy(s.begin(), s.end(), out.begin()+pos);
+                pos += s.size();
+            }
+            return pos;
+        }
         
-        ids.push_back(obj->Id());
-        if (includeQts) {
-            qts.push_back(obj->Quadtree());
+    private:
+        uint32_t find_or_add(std::string_view str) {
+            size_t mask = table.size()-1;
+            size_t h = std::hash<std::string_view>()(str) & mask;
+            while (table[h]>=0) {
+                if (strings[table[h]]==str) {
+                    counts[table[h]]++;
+                    return table[h];
+                }
+                h = (h+1) & mask;
+            }
+            uint32_t slot = strings.size();
+            table[h] = slot;
+            strings.push_back(str);
+            counts.push_back(1);
+            if (2*strings.size() > table.size()) {
+                grow();
+            }
+            return slot;
         }
-
         
-        for (const auto& tg: obj->Tags()) {
-            getString(stringtable, tg.key);
+        void grow() {
+            std::vector<int64> new_table(table.size()*2, -1);
+            size_t mask = new_table.size()-1;
+            for (size_t i=0; i < strings.size(); i++) {
+                size_t h = std::hash<std::string_view>()(strings[i]) & mask;
+                while (new_table[h]>=0) {
+                    h = (h+1) & mask;
+                }
+                new_table[h] = i;
+            }
+            table.swap(new_table);
         }
-        for (const auto& tg: obj->Tags()) {
-            kvs.push_back(getString(stringtable, tg.key));
-            kvs.push_back(getString(stringtable, tg.val));
+        
+        void grow_symbols() {
+            std::vector<std::pair<const void*,uint32_t>> new_table(symbol_table.size()*2, std::make_pair(nullptr,0));
+            size_t mask = new_table.size()-1;
+            for (const auto& e: symbol_table) {
+                if (!e.first) { continue; }
+                size_t h = std::hash<const void*>()(e.first) & mask;
+                while (new_table[h].first) {
+                    h = (h+1) & mask;
+                }
+                new_table[h] = e;
+            }
+            symbol_table.swap(new_table);
         }
-        kvs.push_back(0);
         
+        std::vector<std::string_view> strings;
+        std::vector<uint64> counts;
+        std::vector<uint32_t> sorted;
+        std::vector<uint64> indices;
+        std::vector<uint32_t> occurrences;
+        size_t cursor;
+        size_t num_symbols;
         
-        if (includeInfos) {
-            vs.push_back(obj->Info().version);
-            ts.push_back(obj->Info().timestamp);
-            cs.push_back(obj->Info().changeset);
-            ui.push_back(obj->Info().user_id);
-            us.push_back(getString(stringtable, obj->Info().user));
-            //iv.push_back(obj->Info().user_id ? 1 : 0);
+        std::vector<int64> table;
+        std::vector<std::pair<const void*,uint32_t>> symbol_table;
+};
+
+
+/*! Packs a PrimitiveBlock in three passes over its objects: the first
+ * counts the strings, the second finds the length of each message, and
+ * the third writes the messages straight into a single preallocated
+ * output string. The DenseNodes groups and geometry messages made in the
+ * second pass are kept for the third. */
+class BlockPacker {
+    public:
+        BlockPacker(PrimitiveBlockPtr block_, bool includeQts_, bool change_, bool includeInfos_)
+            : block(block_), includeQts(includeQts_), change(change_), includeInfos(includeInfos_) {}
+        
+        std::string pack() {
+            find_groups();
+            
+            for (const auto& g: groups) {
+                for (size_t i=g.begin; i < g.end; i++) {
+                    add_strings(objects()[i], g.dense);
+                }
+            }
+            strings.finish();
+            
+            size_t strings_len = strings.packed_length();
+            size_t total = pbf_data_length(1, strings_len);
+            strings.rewind();
+            for (auto& g: groups) {
+                group_length(g);
+                total += pbf_data_length(2, g.length);
+            }
+            total += block_fields_length();
+            
+            std::string out(total, '\0');
+            size_t pos = write_pbf_data_header(out, 0, 1, strings_len);
+            pos = strings.write(out, pos);
+            strings.rewind();
+            for (auto& g: groups) {
+                pos = write_pbf_data_header(out, pos, 2, g.length);
+                pos = write_group(out, pos, g);
+            }
+            pos = write_block_fields(out, pos);
+            if (pos!=total) {
+                throw std::domain_error("pack_primitive_block: wrote "+std::to_string(pos)+" bytes, expected "+std::to_string(total));
+            }
+            return out;
         }
         
-        lons.push_back(obj->Lon());
-        lats.push_back(obj->Lat());
+    private:
+        struct DenseNodes {
+            std::vector<int64> ids, qts, ts, cs, ui, us, lons, lats;
+            std::vector<uint64> vs, kvs;
+            bool write_info;
+            bool write_qts;
+            size_t info_length;
+            size_t length;
+        };
         
-    }
-    std::list<PbfTag> msgs;
-
-    msgs.push_back(PbfTag{1,0,write_packed_delta(ids)});
-    
-    if (includeInfos && (!vs.empty())) {
-        std::list<PbfTag> infmsgs;
-        infmsgs.push_back(PbfTag{1,0,write_packed_int(vs)});
-        infmsgs.push_back(PbfTag{2,0,write_packed_delta(ts)});
-        infmsgs.push_back(PbfTag{3,0,write_packed_delta(cs)});
-        infmsgs.push_back(PbfTag{4,0,write_packed_delta(ui)});
-        infmsgs.push_back(PbfTag{5,0,write_packed_delta(us)});
-        /*if (size_t(std::count(iv.begin(),iv.end(),1))!=iv.size()) {
-            infmsgs.push_back(PbfTag{6,0,write_packed_int(iv)});
-        }*/        
-        msgs.push_back(PbfTag{5,0,pack_pbf_tags(infmsgs)});
-    }
-
-    msgs.push_back(PbfTag{8,0,write_packed_delta(lats)});
-    msgs.push_back(PbfTag{9,0,write_packed_delta(lons)});
-    msgs.push_back(PbfTag{10,0,write_packed_int(kvs)});
-    if (includeQts && (size_t(std::count(qts.begin(),qts.end(),-1))!=qts.size())) {
-        msgs.push_back(PbfTag{20,0,write_packed_delta(qts)});
-    }
-
-    return pack_pbf_tags(msgs);
-}
-
-
-
-template <class Iter>
-std::string packPrimitiveGroup(
-    std::map<std::string,uint64>& stringtable,
-    Iter beg, Iter end,size_t nobj,changetype ct,
-    bool includeQts, bool includeInfos, bool includeRefs) {
-
-    std::list<PbfTag> msgs;
-
-    if ((*beg)->Type()==ElementType::Node) {
-        msgs.push_back(PbfTag{2,0,packDenseNodes(stringtable,beg,end,nobj,includeQts,includeInfos)});
-    } else {
-        for (auto it=beg; it != end; ++it) {
-            if ((*beg)->Type()==ElementType::Node) {
-                msgs.push_back(PbfTag{1,0,packObject(stringtable,*it,includeQts,includeInfos,includeRefs)});
-            } else if ((*beg)->Type()==ElementType::Way) {
-                msgs.push_back(PbfTag{3,0,packObject(stringtable,*it,includeQts,includeInfos,includeRefs)});
-            } else if ((*beg)->Type()==ElementType::Relation) {
-                msgs.push_back(PbfTag{4,0,packObject(stringtable,*it,includeQts,includeInfos,includeRefs)});
+        struct Group {
+            size_t begin, end;
+            changetype ct;
+            bool dense;
+            size_t length;
+            std::vector<size_t> lengths;
+            std::map<size_t,std::string> geometries;
+            std::unique_ptr<DenseNodes> dense_nodes;
+            size_t num_strings;
+        };
+        
+        struct ObjectFields {
+            std::vector<uint64> keys, vals, roles, types;
+            std::vector<int64> refs;
+            uint64 user;
+        };
+        
+        const std::vector<ElementPtr>& objects() { return block->Objects(); }
+        
+        void find_groups() {
+            auto& objs = objects();
+            size_t i=0;
+            while (i < objs.size()) {
+                size_t j=i+1;
+                while ((j < objs.size()) && (objs[i]->Type()==objs[j]->Type()) && ((!change) || (objs[i]->ChangeType()==objs[j]->ChangeType()))) {
+                    j++;
+                }
+                Group g;
+                g.begin=i; g.end=j;
+                g.ct = change ? objs[i]->ChangeType() : changetype::Normal;
+                g.dense = objs[i]->Type()==ElementType::Node;
+                g.length=0; g.num_strings=0;
+                groups.push_back(std::move(g));
+                i=j;
+            }
+        }
+        
+        //the strings of each object, in the order they are read by read_fields and DenseNodes
+        void add_strings(ElementPtr obj, bool dense) {
+            if (dense) {
+                for (const auto& tg: obj->Tags()) {
+                    strings.add(tg.key);
+                    strings.add(tg.val);
+                }
             } else {
-                ElementType ty = (*beg)->Type();
-                msgs.push_back(PbfTag{uint64(ty)+17,0,packObject(stringtable,*it,includeQts,includeInfos,includeRefs)});
+                for (const auto& tg: obj->Tags()) {
+                    strings.add(tg.key);
+                }
+                for (const auto& tg: obj->Tags()) {
+                    strings.add(tg.val);
+                }
+            }
+            if (includeInfos) {
+                strings.add(obj->Info().user);
+            }
+            if (obj->Type()==ElementType::Relation) {
+                for (const auto& m: std::dynamic_pointer_cast<Relation>(obj)->Members()) {
+                    strings.add(m.role);
+                }
             }
         }
-    }
-    if (ct!=changetype::Normal) {
-        msgs.push_back(PbfTag{10,uint64(ct),""});
-    }
-
-    return pack_pbf_tags(msgs);
-}
-
-
+        
+        void read_fields(ElementPtr obj, ObjectFields& fields) {
+            fields.keys.clear(); fields.vals.clear(); fields.roles.clear();
+            fields.types.clear(); fields.refs.clear();
+            
+            for (size_t i=0; i < obj->Tags().size(); i++) {
+                fields.keys.push_back(strings.next());
+            }
+            for (size_t i=0; i < obj->Tags().size(); i++) {
+                fields.vals.push_back(strings.next());
+            }
+            if (includeInfos) {
+                fields.user = strings.next();
+            }
+            if (obj->Type()==ElementType::Relation) {
+                for (const auto& m: std::dynamic_pointer_cast<Relation>(obj)->Members()) {
+                    fields.roles.push_back(strings.next());
+                    fields.refs.push_back(m.ref);
+                    fields.types.push_back((uint64) m.type);
+                }
+            }
+        }
+        
+        size_t info_length(const ElementInfo& info, uint64 user) {
+            return pbf_value_length(1, uint64(info.version))
+                + pbf_value_length(2, uint64(info.timestamp))
+                + pbf_value_length(3, uint64(info.changeset))
+                + pbf_value_length(4, uint64(info.user_id))
+                + pbf_value_length(5, user);
+        }
+        
+        size_t write_info(std::string& out, size_t pos, const ElementInfo& info, uint64 user) {
+            pos = write_pbf_value(out, pos, 1, uint64(info.version));
+            pos = write_pbf_value(out, pos, 2, uint64(info.timestamp));
+            pos = write_pbf_value(out, pos, 3, uint64(info.changeset));
+            pos = write_pbf_value(out, pos, 4, uint64(info.user_id));
+            pos = write_pbf_value(out, pos, 5, user);
+            return pos;
+        }
+        
+        uint64 object_tag(ElementType ty) {
+            if (ty==ElementType::Node) { return 1; }
+            if (ty==ElementType::Way) { return 3; }
+            if (ty==ElementType::Relation) { return 4; }
+            return uint64(ty)+17;
+        }
+        
+        size_t object_length(ElementPtr obj, const ObjectFields& fields) {
+            size_t len = pbf_value_length(1, uint64(obj->Id()));
+            if (!fields.keys.empty()) {
+                len += pbf_data_length(2, packed_int_length(fields.keys));
+                len += pbf_data_length(3, packed_int_length(fields.vals));
+            }
+            if (includeInfos) {
+                len += pbf_data_length(4, info_length(obj->Info(), fields.user));
+            }
+            if (obj->Type()==ElementType::Node) {
+                auto nd = std::dynamic_pointer_cast<Node>(obj);
+                len += pbf_value_length(8, zig_zag(nd->Lat()));
+                len += pbf_value_length(9, zig_zag(nd->Lon()));
+            } else if (obj->Type()==ElementType::Way) {
+                size_t rl = packed_delta_length(std::dynamic_pointer_cast<Way>(obj)->Refs(), 0);
+                len += (rl>0) ? pbf_data_length(8, rl) : pbf_value_length(8, 0);
+            } else if (!fields.refs.empty()) {
+                len += pbf_data_length(8, packed_int_length(fields.roles));
+                len += pbf_data_length(9, packed_delta_length(fields.refs, 0));
+                len += pbf_data_length(10, packed_int_length(fields.types));
+            }
+            if (includeQts && (obj->Quadtree()>=0)) {
+                len += pbf_value_length(20, zig_zag(obj->Quadtree()));
+            }
+            return len;
+        }
+        
+        size_t write_object(std::string& out, size_t pos, ElementPtr obj, const ObjectFields& fields) {
+            pos = write_pbf_value(out, pos, 1, uint64(obj->Id()));
+            if (!fields.keys.empty()) {
+                pos = write_pbf_data_header(out, pos, 2, packed_int_length(fields.keys));
+                pos = write_packed_int_in_place(out, pos, fields.keys);
+                pos = write_pbf_data_header(out, pos, 3, packed_int_length(fields.vals));
+                pos = write_packed_int_in_place(out, pos, fields.vals);
+            }
+            if (includeInfos) {
+                pos = write_pbf_data_header(out, pos, 4, info_length(obj->Info(), fields.user));
+                pos = write_info(out, pos, obj->Info(), fields.user);
+            }
+            if (obj->Type()==ElementType::Node) {
+                auto nd = std::dynamic_pointer_cast<Node>(obj);
+                pos = write_pbf_value(out, pos, 8, zig_zag(nd->Lat()));
+                pos = write_pbf_value(out, pos, 9, zig_zag(nd->Lon()));
+            } else if (obj->Type()==ElementType::Way) {
+                const auto& refs = std::dynamic_pointer_cast<Way>(obj)->Refs();
+                size_t rl = packed_delta_length(refs, 0);
+                if (rl>0) {
+                    pos = write_pbf_data_header(out, pos, 8, rl);
+                    pos = write_packed_delta_in_place(out, pos, refs, 0);
+                } else {
+                    pos = write_pbf_value(out, pos, 8, 0);
+                }
+            } else if (!fields.refs.empty()) {
+                pos = write_pbf_data_header(out, pos, 8, packed_int_length(fields.roles));
+                pos = write_packed_int_in_place(out, pos, fields.roles);
+                pos = write_pbf_data_header(out, pos, 9, packed_delta_length(fields.refs, 0));
+                pos = write_packed_delta_in_place(out, pos, fields.refs, 0);
+                pos = write_pbf_data_header(out, pos, 10, packed_int_length(fields.types));
+                pos = write_packed_int_in_place(out, pos, fields.types);
+            }
+            if (includeQts && (obj->Quadtree()>=0)) {
+                pos = write_pbf_value(out, pos, 20, zig_zag(obj->Quadtree()));
+            }
+            return pos;
+        }
+        
+        //geometries add their own extra fields, which are interleaved
+        //with the common fields: these are packed as a list of PbfTags
+        std::string pack_geometry(ElementPtr obj, const ObjectFields& fields) {
+            auto geom = std::dynamic_pointer_cast<BaseGeometry>(obj);
+            if (!geom) {
+                throw std::domain_error("unexpected type ??"+std::to_string(uint64(obj->Type())));
+            }
+            std::list<PbfTag> msgs;
+            msgs.push_back(PbfTag{1,uint64(obj->Id()),""});
+            if (!fields.keys.empty()) {
+                msgs.push_back(PbfTag{2,0,write_packed_int(fields.keys)});
+                msgs.push_back(PbfTag{3,0,write_packed_int(fields.vals)});
+            }
+            if (includeInfos) {
+                std::string info(info_length(obj->Info(), fields.user), '\0');
+                write_info(info, 0, obj->Info(), fields.user);
+                msgs.push_back(PbfTag{4,0,info});
+            }
+            for (const auto& m: geom->pack_extras()) {
+                msgs.push_back(m);
+            }
+            if (includeQts && (obj->Quadtree()>=0)) {
+                msgs.push_back(PbfTag{20,zig_zag(obj->Quadtree()),""});
+            }
+            sort_pbf_tags(msgs);
+            return pack_pbf_tags(msgs);
+        }
+        
+        std::unique_ptr<DenseNodes> make_dense_nodes(const Group& g) {
+            auto dn = std::make_unique<DenseNodes>();
+            size_t nobj = g.end-g.begin;
+            dn->ids.reserve(nobj); dn->lons.reserve(nobj); dn->lats.reserve(nobj);
+            if (includeQts) { dn->qts.reserve(nobj); }
+            if (includeInfos) {
+                dn->vs.reserve(nobj); dn->ts.reserve(nobj); dn->cs.reserve(nobj);
+                dn->ui.reserve(nobj); dn->us.reserve(nobj);
+            }
+            
+            for (size_t i=g.begin; i < g.end; i++) {
+                auto obj = std::dynamic_pointer_cast<Node>(objects()[i]);
+                dn->ids.push_back(obj->Id());
+                if (includeQts) {
+                    dn->qts.push_back(obj->Quadtree());
+                }
+                for (size_t j=0; j < obj->Tags().size(); j++) {
+                    dn->kvs.push_back(strings.next());
+                    dn->kvs.push_back(strings.next());
+                }
+                dn->kvs.push_back(0);
+                if (includeInfos) {
+                    dn->vs.push_back(obj->Info().version);
+                    dn->ts.push_back(obj->Info().timestamp);
+                    dn->cs.push_back(obj->Info().changeset);
+                    dn->ui.push_back(obj->Info().user_id);
+                    dn->us.push_back(strings.next());
+                }
+                dn->lons.push_back(obj->Lon());
+                dn->lats.push_back(obj->Lat());
+            }
+            
+            dn->length = pbf_data_length(1, packed_delta_length(dn->ids,0));
+            dn->write_info = includeInfos && (!dn->vs.empty());
+            dn->info_length=0;
+            if (dn->write_info) {
+                dn->info_length = pbf_data_length(1, packed_int_length(dn->vs))
+                    + pbf_data_length(2, packed_delta_length(dn->ts,0))
+                    + pbf_data_length(3, packed_delta_length(dn->cs,0))
+                    + pbf_data_length(4, packed_delta_length(dn->ui,0))
+                    + pbf_data_length(5, packed_delta_length(dn->us,0));
+                dn->length += pbf_data_length(5, dn->info_length);
+            }
+            dn->length += pbf_data_length(8, packed_delta_length(dn->lats,0));
+            dn->length += pbf_data_length(9, packed_delta_length(dn->lons,0));
+            dn->length += pbf_data_length(10, packed_int_length(dn->kvs));
+            dn->write_qts = includeQts && (size_t(std::count(dn->qts.begin(),dn->qts.end(),-1))!=dn->qts.size());
+            if (dn->write_qts) {
+                dn->length += pbf_data_length(20, packed_delta_length(dn->qts,0));
+            }
+            return dn;
+        }
+        
+        size_t write_delta_field(std::string& out, size_t pos, uint64 tag, const std::vector<int64>& vals) {
+            pos = write_pbf_data_header(out, pos, tag, packed_delta_length(vals,0));
+            return write_packed_delta_in_place(out, pos, vals, 0);
+        }
+        
+        size_t write_dense_nodes(std::string& out, size_t pos, const DenseNodes& dn) {
+            pos = write_delta_field(out, pos, 1, dn.ids);
+            if (dn.write_info) {
+                pos = write_pbf_data_header(out, pos, 5, dn.info_length);
+                pos = write_pbf_data_header(out, pos, 1, packed_int_length(dn.vs));
+                pos = write_packed_int_in_place(out, pos, dn.vs);
+                pos = write_delta_field(out, pos, 2, dn.ts);
+                pos = write_delta_field(out, pos, 3, dn.cs);
+                pos = write_delta_field(out, pos, 4, dn.ui);
+                pos = write_delta_field(out, pos, 5, dn.us);
+            }
+            pos = write_delta_field(out, pos, 8, dn.lats);
+            pos = write_delta_field(out, pos, 9, dn.lons);
+            pos = write_pbf_data_header(out, pos, 10, packed_int_length(dn.kvs));
+            pos = write_packed_int_in_place(out, pos, dn.kvs);
+            if (dn.write_qts) {
+                pos = write_delta_field(out, pos, 20, dn.qts);
+            }
+            return pos;
+        }
+        
+        void group_length(Group& g) {
+            size_t start = strings.position();
+            if (g.dense) {
+                g.dense_nodes = make_dense_nodes(g);
+                g.length = pbf_data_length(2, g.dense_nodes->length);
+            } else {
+                for (size_t i=g.begin; i < g.end; i++) {
+                    auto obj = objects()[i];
+                    read_fields(obj, fields);
+                    size_t l=0;
+                    if ((obj->Type()==ElementType::Node) || (obj->Type()==ElementType::Way) || (obj->Type()==ElementType::Relation)) {
+                        l = object_length(obj, fields);
+                    } else {
+                        auto& msg = g.geometries[i];
+                        msg = pack_geometry(obj, fields);
+                        l = msg.size();
+                    }
+                    g.lengths.push_back(l);
+                    g.length += pbf_data_length(object_tag(obj->Type()), l);
+                }
+            }
+            if (g.ct!=changetype::Normal) {
+                g.length += pbf_value_length(10, uint64(g.ct));
+            }
+            g.num_strings = strings.position()-start;
+        }
+        
+        size_t write_group(std::string& out, size_t pos, Group& g) {
+            if (g.dense) {
+                pos = write_pbf_data_header(out, pos, 2, g.dense_nodes->length);
+                pos = write_dense_nodes(out, pos, *g.dense_nodes);
+                g.dense_nodes.reset();
+                strings.skip(g.num_strings);
+            } else {
+                for (size_t i=g.begin; i < g.end; i++) {
+                    auto obj = objects()[i];
+                    pos = write_pbf_data_header(out, pos, object_tag(obj->Type()), g.lengths[i-g.begin]);
+                    auto it = g.geometries.find(i);
+                    if (it!=g.geometries.end()) {
+                        std::copy(it->second.begin(), it->second.end(), out.begin()+pos);
+                        pos += it->second.size();
+                        read_fields(obj, fields);
+                    } else {
+                        read_fields(obj, fields);
+                        pos = write_object(out, pos, obj, fields);
+                    }
+                }
+            }
+            if (g.ct!=changetype::Normal) {
+                pos = write_pbf_value(out, pos, 10, uint64(g.ct));
+            }
+            return pos;
+        }
+        
+        size_t block_fields_length() {
+            size_t len=0;
+            if (includeQts) {
+                if (block->Quadtree()>=0) {
+                    len += pbf_value_length(32, zig_zag(block->Quadtree()));
+                }
+                if (block->StartDate()>0) {
+                    len += pbf_value_length(33, uint64(block->StartDate()));
+                }
+                if (block->EndDate()>0) {
+                    len += pbf_value_length(34, uint64(block->EndDate()));
+                }
+            }
+            return len;
+        }
+        
+        size_t write_block_fields(std::string& out, size_t pos) {
+            if (includeQts) {
+                if (block->Quadtree()>=0) {
+                    pos = write_pbf_value(out, pos, 32, zig_zag(block->Quadtree()));
+                }
+                if (block->StartDate()>0) {
+                    pos = write_pbf_value(out, pos, 33, uint64(block->StartDate()));
+                }
+                if (block->EndDate()>0) {
+                    pos = write_pbf_value(out, pos, 34, uint64(block->EndDate()));
+                }
+            }
+            return pos;
+        }
+        
+        PrimitiveBlockPtr block;
+        bool includeQts, change, includeInfos;
+        StringTableBuilder strings;
+        std::vector<Group> groups;
+        ObjectFields fields;
+};
 
-std::string packStringTable(const std::map<std::string,uint64>& stringtable) {
-    std::vector<std::string> st(stringtable.size());
-    for (const auto& s: stringtable) {
-        st.at(s.second)=s.first;
-    }
-    st[0]="";
-    std::list<PbfTag> msgs;
-    for (const auto& s: st) {
-        msgs.push_back(PbfTag{1,0,s});
-    }
-    return pack_pbf_tags(msgs,true);
-}
 
 std::string packQuadtree(int64 qt) {
 
@@ -352,45 +700,8 @@ void write_filelocs_json(const block_index& index, const std::string& pbffilenam
 
 
 std::string pack_primitive_block(PrimitiveBlockPtr block, bool includeQts, bool change, bool includeInfo, bool includeRefs) {
-    
-    std::list<PbfTag> msgs;
-
-    std::map<std::string,uint64> stringtable;
-    stringtable["%%$6535ff"]=0;
-
-    if (block->size()>0) {
-        auto it=block->Objects().begin();
-        while (it < block->Objects().end()) {
-            
-            auto jt=it;
-            ++jt;
-            while ( jt!=block->Objects().end() && ((*it)->Type()==(*jt)->Type()) && ( (!change) || ((*it)->ChangeType()==(*jt)->ChangeType()))) {
-                ++jt;
-            }
-
-            msgs.push_back(PbfTag{2,0,writeblock_detail::packPrimitiveGroup(stringtable,it,jt,jt-it,change ? (*it)->ChangeType() : changetype::Normal, includeQts, includeInfo, includeRefs)});
-            it=jt;
-        }
-    }
-
-
-    msgs.push_front(PbfTag{1,0,writeblock_detail::packStringTable(stringtable)});
-
-    if (includeQts) {
-        if (block->Quadtree()>=0) {
-            msgs.push_back(PbfTag{32,zig_zag(block->Quadtree()),""});
-        }
-        if (block->StartDate()>0) {
-            msgs.push_back(PbfTag{33,uint64(block->StartDate()),""});
-        }
-        if (block->EndDate()>0) {
-            msgs.push_back(PbfTag{34,uint64(block->EndDate()),""});
-        }
-    }
-
-    return pack_pbf_tags(msgs);
-    
-    
+    writeblock_detail::BlockPacker packer(block, includeQts, change, includeInfo);
+    return packer.pack();
 }
 
 
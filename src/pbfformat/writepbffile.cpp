@@ -24,7 +24,10 @@
 #include "oqt/pbfformat/writeblock.hpp"
 #include "oqt/pbfformat/fileblock.hpp"
 #include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
 #include "oqt/utils/logger.hpp"
+#include "oqt/utils/threadedcallback.hpp"
+#include "oqt/utils/telemetry.hpp"
 
 
 #include <algorithm>
@@ -149,7 +152,8 @@ void rewrite_indexed_file(std::string filename, std::string tempfilename, Header
 class PbfFileWriterImpl : public PbfFileWriter {
     public:
         PbfFileWriterImpl(const std::string& filename_, HeaderPtr head, bool write_filelocs_)
-            : file(filename_, std::ios::out | std::ios::binary), filename(filename_), write_filelocs(write_filelocs_), pos(0) {
+            : file(filename_, std::ios::out | std::ios::binary), filename(filename_), write_filelocs(write_filelocs_), pos(0),
+              stats(Telemetry::Get().stage("write file")) {
             
             if (!file.good()) { throw std::domain_error("can't open"); }
             if (head) {
@@ -161,6 +165,7 @@ class PbfFileWriterImpl : public PbfFileWriter {
         }
         
         void writeBlock(int64 qt, const std::string& data) {
+            StageTimer timer(stats, data.size());
             index.push_back(std::make_tuple(qt, pos,data.size()));
             file.write(data.data(), data.size());
             pos += data.size();
@@ -168,6 +173,7 @@ class PbfFileWriterImpl : public PbfFileWriter {
         
         
         void writeBlockPart(int64 qt, const std::string& data, size_t srcpos, size_t len) {
+            StageTimer timer(stats, len);
             index.push_back(std::make_tuple(qt, pos, len));
             file.write(data.data()+srcpos, len);
             pos += len;
@@ -197,7 +203,7 @@ class PbfFileWriterImpl : public PbfFileWriter {
         bool write_filelocs;
         block_index index;
         int64 pos;
-        
+        StageStatsPtr stats;
         
 };
 
@@ -449,6 +455,54 @@ write_file_callback make_pbffilewriter_indexed_callback(
     
 }
 
+std::vector<write_file_callback> make_compress_callbacks(
+    std::vector<write_file_callback> callbacks,
+    const std::string& blocktype, int complevel) {
+    
+    std::vector<write_file_callback> result;
+    for (auto cb: callbacks) {
+        result.push_back(threaded_callback<keystring>::make(
+            [cb, blocktype, complevel](keystring_ptr p) {
+                if (!p) {
+                    cb(nullptr);
+                    return;
+                }
+                cb(std::make_shared<keystring>(p->first, prepare_file_block(blocktype, p->second, complevel)));
+            },
+            "compress blocks"
+        ));
+    }
+    return result;
+}
+
+std::vector<std::function<void(std::shared_ptr<KeyedBlob>)>> make_compress_blob_callbacks(
+    std::vector<write_file_callback> callbacks,
+    const std::string& blocktype, int complevel) {
+    
+    std::vector<std::function<void(std::shared_ptr<KeyedBlob>)>> result;
+    for (auto cb: callbacks) {
+        result.push_back(threaded_callback<KeyedBlob>::make(
+            [cb, blocktype, complevel](std::shared_ptr<KeyedBlob> kb) {
+                if (!kb) {
+                    cb(nullptr);
+                    return;
+                }
+                if (kb->blobs.empty()) {
+                    throw std::domain_error("no blob to write for "+std::to_string(kb->key));
+                }
+                const auto& bl = kb->blobs.front();
+                if (bl.second != 0) {
+                    cb(std::make_shared<keystring>(kb->key, prepare_file_block_compressed(blocktype, bl.first, bl.second)));
+                } else {
+                    cb(std::make_shared<keystring>(kb->key, prepare_file_block(blocktype, bl.first, complevel)));
+                }
+            },
+            "compress blocks"
+        ));
+    }
+    return result;
+}
+
 
 class PbfFileWriterIndexedInmem : public PbfFileWriter {
     public:
@@ -112,7 +112,7 @@ SplitBlocks::SplitBlocks(primitiveblock_callback callback_, size_t blocksplit_,
         detail->last=detail->ts.since();
         temps = std::make_shared<tempsvec>();
         
-        call_writetemps = threaded_callback<tempsvec>::make([this](std::shared_ptr<tempsvec> t) { detail->writetemps(t); });
+        call_writetemps = threaded_callback<tempsvec>::make([this](std::shared_ptr<tempsvec> t) { detail->writetemps(t); }, "write temps");
         detail->maxp=0;
 }
 
@@ -24,6 +24,8 @@
 #include "oqt/elements/block.hpp"
 #include "oqt/pbfformat/writeblock.hpp"
 #include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
 #include "oqt/pbfformat/writepbffile.hpp"
 #include "oqt/utils/threadedcallback.hpp"
 #include "oqt/utils/multithreadedcallback.hpp"
@@ -35,8 +37,8 @@ namespace oqt {
 
 class PackFinal {
     public:
-        PackFinal(write_file_callback cb_, int64 enddate_, bool writeqts_, size_t ii_, int complevel_) :
-            cb(cb_), enddate(enddate_), writeqts(writeqts_), ii(ii_), complevel(complevel_) {}//, nb(0),no(0),sort(0),pack(0),comp(0),writ(0) {}
+        PackFinal(write_file_callback cb_, int64 enddate_, bool writeqts_, size_t ii_, int complevel_, bool compress_) :
+            cb(cb_), enddate(enddate_), writeqts(writeqts_), ii(ii_), complevel(complevel_), compress(compress_) {}//, nb(0),no(0),sort(0),pack(0),comp(0),writ(0) {}
         
         void call(PrimitiveBlockPtr oo) {
             if (!oo) {
@@ -49,7 +51,7 @@ class PackFinal {
             }
             std::sort(oo->Objects().begin(), oo->Objects().end(), element_cmp);
             auto p = pack_primitive_block(oo, writeqts, false, true, true);
-            auto q = std::make_shared<keystring>(writeqts ? oo->Quadtree() : oo->Index(), prepare_file_block("OSMData", p,complevel));
+            auto q = std::make_shared<keystring>(writeqts ? oo->Quadtree() : oo->Index(), compress ? prepare_file_block("OSMData", p,complevel) : p);
             
             cb(q);
             
@@ -60,11 +62,13 @@ class PackFinal {
         bool writeqts;
         size_t ii;
         int complevel;
+        bool compress;
         
 };
 
-primitiveblock_callback make_pack_final(write_file_callback cb, int64 enddate, bool writeqts, size_t ii, int complevel) {
-    auto pfu = std::make_shared<PackFinal>(cb,enddate,writeqts,ii,complevel);
+//if compress is false, cb is passed the packed blocks uncompressed
+primitiveblock_callback make_pack_final(write_file_callback cb, int64 enddate, bool writeqts, size_t ii, int complevel, bool compress) {
+    auto pfu = std::make_shared<PackFinal>(cb,enddate,writeqts,ii,complevel,compress);
     return [pfu](PrimitiveBlockPtr oo) { pfu->call(oo); };
 }   
 
@@ -76,15 +80,16 @@ std::vector<primitiveblock_callback> make_final_packers(std::shared_ptr<PbfFileW
             if (p) {
                 write_file_obj->writeBlock(p->first,p->second);
             }
-    },numchan);
+    },numchan,"write blocks");
     
+    auto compressors = make_compress_callbacks(std::vector<write_file_callback>(numchan, writers), "OSMData", -1);
     
     std::vector<primitiveblock_callback> packers;
     for (size_t i=0; i < numchan; i++) {
-        auto cb=make_pack_final(writers, timestamp, writeqts, i, -1);
+        auto cb=make_pack_final(compressors.at(i), timestamp, writeqts, i, -1, false);
         
         if (asthread) {
-            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb));
+            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb, "pack final"));
         } else {
             packers.push_back(cb);
         }
@@ -94,15 +99,16 @@ std::vector<primitiveblock_callback> make_final_packers(std::shared_ptr<PbfFileW
 
 std::vector<primitiveblock_callback> make_final_packers_cb(std::function<void(keystring_ptr)> ks_cb, size_t numchan, int64 timestamp, bool writeqts, bool asthread) {
     
-    auto writers = threaded_callback<keystring>::make(ks_cb,numchan);
+    auto writers = threaded_callback<keystring>::make(ks_cb,numchan,"write blocks");
     
+    auto compressors = make_compress_callbacks(std::vector<write_file_callback>(numchan, writers), "OSMData", 1);
     
     std::vector<primitiveblock_callback> packers;
     for (size_t i=0; i < numchan; i++) {
-        auto cb=make_pack_final(writers, timestamp, writeqts, i,1);
+        auto cb=make_pack_final(compressors.at(i), timestamp, writeqts, i, 1, false);
         
         if (asthread) {
-            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb));
+            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb, "pack final"));
         } else {
             packers.push_back(cb);
         }
@@ -119,7 +125,7 @@ primitiveblock_callback make_final_packer_nothread(std::shared_ptr<PbfFileWriter
         }
     };
     
-    return make_pack_final(write, timestamp, writeqts, 0,-1);
+    return make_pack_final(write, timestamp, writeqts, 0,-1, true);
 }
 
 std::vector<primitiveblock_callback> make_final_packers_sync(std::shared_ptr<PbfFileWriter> write_file_obj, size_t numchan, int64 timestamp, bool writeqts, bool asthread) {
@@ -134,15 +140,18 @@ std::vector<primitiveblock_callback> make_final_packers_sync(std::shared_ptr<Pbf
             if (p) {
                 write_file_obj->writeBlock(p->first,p->second);
             }
-    },numchan);
+    },numchan,"write blocks");
     
+    //keeps blocks in order: each packer passes its blocks through a
+    //single compressor to the matching writer
+    auto compressors = make_compress_callbacks(writers, "OSMData", -1);
     
     std::vector<primitiveblock_callback> packers;
     for (size_t i=0; i < numchan; i++) {
-        auto cb=make_pack_final(writers.at(i), timestamp, writeqts, i,-1);
+        auto cb=make_pack_final(compressors.at(i), timestamp, writeqts, i, -1, false);
         
         if (asthread) {
-            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb));
+            packers.push_back(threaded_callback<PrimitiveBlock>::make(cb, "pack final"));
         } else {
             packers.push_back(cb);
         }
@@ -150,7 +159,68 @@ std::vector<primitiveblock_callback> make_final_packers_sync(std::shared_ptr<Pbf
     return packers;
 };
 
+class PackFinalPassthrough {
+    public:
+        PackFinalPassthrough(keyedblob_callback cb_, int64 enddate, size_t ii_) :
+            cb(cb_), ii(ii_), copied(0), merged(0) {
+            
+            //merged tiles are packed uncompressed, and compressed by cb
+            pack = make_pack_final([cb_](keystring_ptr p) {
+                if (!p) {
+                    cb_(nullptr);
+                    return;
+                }
+                auto kb = std::make_shared<KeyedBlob>();
+                kb->key = p->first;
+                kb->blobs.push_back(std::make_pair(std::move(p->second), 0));
+                cb_(kb);
+            }, enddate, true, ii_, -1, false);
+        }
+        
+        void call(std::shared_ptr<KeyedBlob> kb) {
+            if (!kb) {
+                Logger::Message() << "pack final passthrough[" << ii << "]: copied " << copied << ", merged " << merged << " tiles";
+                pack(nullptr);
+                return;
+            }
+            
+            if (kb->blobs.size()==1) {
+                cb(kb);
+                copied++;
+                return;
+            }
+            
+            pack(readpbffile_detail::merge_keyedblob<PrimitiveBlock>(kb, ReadBlockFlags::Empty, nullptr));
+            merged++;
+        }
+    private:
+        keyedblob_callback cb;
+        primitiveblock_callback pack;
+        size_t ii;
+        size_t copied, merged;
+};
 
+std::vector<keyedblob_callback> make_final_packers_passthrough(std::shared_ptr<PbfFileWriter> write_file_obj, size_t numchan, int64 timestamp) {
+    
+    auto writers = multi_threaded_callback<keystring>::make(
+        [write_file_obj](keystring_ptr p) {
+            if (p) {
+                write_file_obj->writeBlock(p->first,p->second);
+            }
+    },numchan,"write blocks");
+    
+    //copied tiles are only framed by the compressors, and pass through
+    //the same compressor as the packed tiles, so that each writer gets
+    //its tiles in order
+    auto compressors = make_compress_blob_callbacks(writers, "OSMData", -1);
+    
+    std::vector<keyedblob_callback> packers;
+    for (size_t i=0; i < numchan; i++) {
+        auto pp = std::make_shared<PackFinalPassthrough>(compressors.at(i), timestamp, i);
+        packers.push_back(threaded_callback<KeyedBlob>::make([pp](std::shared_ptr<KeyedBlob> kb) { pp->call(kb); }, "pack final passthrough"));
+    }
+    return packers;
+}
 
     
     
@@ -464,6 +464,16 @@ void run_mergechanges(
     auto outfile_header = std::make_shared<Header>();
     outfile_header->SetBBox(filter_box);
     auto outfile_writer = (sort_objs ? make_pbffilewriter(outfn, outfile_header) : make_pbffilewriter_filelocs(outfn,outfile_header));
+    
+    if ((!sort_objs) && (!filter_objs) && read_blocks_caller->can_read_blobs()) {
+        //tiles without any changes can be copied without decoding them
+        read_blocks_caller->read_blobs(make_final_packers_passthrough(outfile_writer, numchan, enddate));
+        Logger::Get().time("written blocks");
+        outfile_writer->finish();
+        Logger::Get().time("finished outfile");
+        return;
+    }
+    
     auto packers = make_final_packers_sync(outfile_writer, numchan, enddate, !sort_objs, true);
     
     auto read_data = [read_blocks_caller,filter,numchan,filter_objs](std::vector<primitiveblock_callback> addobjs) {
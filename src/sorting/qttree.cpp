@@ -32,6 +32,7 @@
 #include <algorithm>
 #include <set>
 #include <deque>
+#include <future>
 
 namespace oqt {
 std::string item_string(size_t i, const QtTree::Item& t) {
@@ -281,4 +282,79 @@ std::function<void(std::shared_ptr<count_map>)> make_addcountmaptree(std::shared
     
 }
     
+
+void add_qt_histogram(qt_histogram& hist, std::vector<int64>& qts) {
+    if (qts.empty()) { return; }
+    
+    std::sort(qts.begin(), qts.end());
+    qt_histogram counts;
+    for (auto q: qts) {
+        if (counts.empty() || (counts.back().first != q)) {
+            counts.push_back(std::make_pair(q, 1));
+        } else {
+            counts.back().second++;
+        }
+    }
+    qts.clear();
+    
+    if (hist.empty()) {
+        hist.swap(counts);
+    } else {
+        hist = merge_qt_histograms(hist, counts);
+    }
+}
+
+qt_histogram merge_qt_histograms(const qt_histogram& left, const qt_histogram& right) {
+    qt_histogram result;
+    result.reserve(std::max(left.size(), right.size()));
+    
+    auto l = left.begin();
+    auto r = right.begin();
+    while ((l != left.end()) && (r != right.end())) {
+        if (l->first < r->first) {
+            result.push_back(*l++);
+        } else if (r->first < l->first) {
+            result.push_back(*r++);
+        } else {
+            result.push_back(std::make_pair(l->first, l->second+r->second));
+            l++; r++;
+        }
+    }
+    result.insert(result.end(), l, left.end());
+    result.insert(result.end(), r, right.end());
+    return result;
+}
+
+qt_histogram reduce_qt_histograms(std::vector<qt_histogram> hists, size_t numchan) {
+    if (hists.empty()) { return qt_histogram(); }
+    if (numchan==0) { numchan=1; }
+    
+    while (hists.size()>1) {
+        std::vector<qt_histogram> next((hists.size()+1)/2);
+        for (size_t i=0; i < next.size(); i+=numchan) {
+            std::vector<std::future<void>> futs;
+            for (size_t j=i; (j < next.size()) && (j < i+numchan); j++) {
+                futs.push_back(std::async(std::launch::async, [&hists, &next, j]() {
+                    if ((2*j+1) < hists.size()) {
+                        next[j] = merge_qt_histograms(hists[2*j], hists[2*j+1]);
+                    } else {
+                        next[j].swap(hists[2*j]);
+                    }
+                }));
+            }
+            for (auto& f: futs) { f.get(); }
+        }
+        hists.swap(next);
+    }
+    return std::move(hists.front());
+}
+
+std::shared_ptr<QtTree> make_tree_histogram(const qt_histogram& hist) {
+    auto tree = make_tree_empty();
+    for (const auto& h: hist) {
+        tree->add(h.first, h.second);
+    }
+    return tree;
+}
+    
 }
@@ -31,69 +31,180 @@
 #include <iomanip>
 #include <algorithm>
 #include <set>
+#include <array>
+#include <atomic>
+#include <future>
 namespace oqt {
 
-std::pair<size_t,int64> clip_within_copy(std::shared_ptr<QtTree> tree, std::shared_ptr<QtTree> result, int64 min, int64 max, int64 absmin) {
-    size_t cc=0;
-    int64 sz=0;
+/*! The tiles of a QtTree in preorder (which is also quadtree order), as
+ * used by find_groups_copy. found is the total weight of the groups
+ * already found in each tile, including the tile itself. */
+struct FlatQtTree {
+    std::vector<int64> qts;
+    std::vector<int64> totals;
+    std::vector<int64> weights;
+    std::vector<size_t> parents;
+    std::vector<size_t> ends; //one past the last tile within this one
+    std::vector<std::array<size_t,4>> children;
+    std::vector<int64> found;
+    
+    size_t size() const { return qts.size(); }
+    
+    void add_found(size_t i, size_t stop, int64 w) {
+        found[i] += w;
+        while (i != stop) {
+            i = parents[i];
+            found[i] += w;
+        }
+    }
+};
 
+FlatQtTree make_flat_qttree(std::shared_ptr<QtTree> tree) {
+    FlatQtTree ft;
+    std::vector<size_t> pos(tree->size(), 0);
+    
     int64 qq=0;
-    size_t i=0;
-    while (i < tree->size() ) {
+    for (size_t i=0; i < tree->size(); i=tree->next(i,0)) {
         const QtTree::Item& t = tree->at(i);
-
         if (t.qt < qq) {
             throw std::domain_error("out of order");
         }
         qq=t.qt;
-        int64 t_total = t.total;
-        const QtTree::Item& result_tile = result->at(result->find(qq));
-        if (result_tile.qt == t.qt) {
-            t_total -= result_tile.total;
+        pos[i] = ft.size();
+        ft.qts.push_back(t.qt);
+        ft.totals.push_back(t.total);
+        ft.weights.push_back(t.weight);
+        ft.parents.push_back(i==0 ? 0 : pos[t.parent]);
+    }
+    
+    size_t n = ft.size();
+    ft.children.resize(n, {0,0,0,0});
+    ft.ends.resize(n);
+    ft.found.resize(n, 0);
+    for (size_t i=0; i < tree->size(); i=tree->next(i,0)) {
+        const QtTree::Item& t = tree->at(i);
+        for (size_t c=0; c < 4; c++) {
+            if (t.children[c]!=0) {
+                ft.children[pos[i]][c] = pos[t.children[c]];
+            }
         }
-        
-        
+    }
+    //tiles follow their parents, so sizes can be summed in reverse
+    std::vector<size_t> sizes(n, 1);
+    for (size_t i=n; i-- > 1; ) {
+        sizes[ft.parents[i]] += sizes[i];
+    }
+    for (size_t i=0; i < n; i++) {
+        ft.ends[i] = i + sizes[i];
+    }
+    return ft;
+}
 
-        if (t_total >= min) {
-            bool alls = true;
-            for (size_t ji=0; ji<4; ji++) {
-                size_t j = t.children[ji];
-                if (j>0) {
-                    const QtTree::Item& ct = tree->at(j);
-                    int64 ct_total = ct.total;
-                    if ((result_tile.qt == t.qt)&&(result_tile.children[ji]>0)) {
-                        
-                        ct_total -= result->at(result_tile.children[ji]).total;
-                    }                    
-                    
-                    if (ct_total > absmin) {
-                        alls=false;
-                        break;
-                    }
-                }
-            }
-            
+//! true if the tile \param i, less the groups found, should be a group
+bool clip_tile(const FlatQtTree& ft, size_t i, int64 min, int64 max, int64 absmin, int64& t_total) {
+    t_total = ft.totals[i] - ft.found[i];
+    if (t_total < min) {
+        return false;
+    }
+    bool alls = true;
+    for (auto j: ft.children[i]) {
+        if ((j>0) && ((ft.totals[j]-ft.found[j]) > absmin)) {
+            alls=false;
+            break;
+        }
+    }
+    return (ft.weights[i]!=0) && ((t_total==ft.weights[i]) || (t_total <= max) || alls);
+}
 
-            if ((t.weight!=0) && ((t_total==t.weight) || (t_total <= max) || alls)) {
-                
-                cc++;
-                sz+=t_total;
-                
-                result->add(qq, t_total);
+/*! As clip_within, for the tiles within \param root, adding each group
+ * found to \param groups. Only the found values within root are updated,
+ * so tiles in separate subtrees can be run at the same time. */
+int64 clip_within_flat(FlatQtTree& ft, size_t root, int64 min, int64 max, int64 absmin, std::vector<std::pair<size_t,int64>>& groups) {
+    int64 sz=0;
+    size_t i=root;
+    while (i < ft.ends[root]) {
+        int64 t_total=0;
+        if (clip_tile(ft, i, min, max, absmin, t_total)) {
+            groups.push_back(std::make_pair(i, t_total));
+            ft.add_found(i, root, t_total);
+            sz += t_total;
+            i = ft.ends[i];
+        } else if (t_total >= min) {
+            i++;
+        } else {
+            i = ft.ends[i];
+        }
+    }
+    return sz;
+}
 
-                i = tree->next(i,4);
-            } else {
-                i = tree->next(i,0);
+/*! One pass of find_groups_copy. The decision for each tile depends only
+ * on the groups found within it by earlier passes, so the tiles above
+ * split_level are checked first, and the subtrees below are then checked
+ * by \param numchan threads. */
+size_t clip_within_parallel(FlatQtTree& ft, int64 min, int64 max, int64 absmin, size_t numchan, std::vector<std::pair<size_t,int64>>& groups) {
+    
+    if (numchan<=1) {
+        size_t n = groups.size();
+        clip_within_flat(ft, 0, min, max, absmin, groups);
+        return groups.size()-n;
+    }
+    
+    const int64 split_level=6;
+    
+    size_t cc=0;
+    std::vector<size_t> roots;
+    size_t i=0;
+    while (i < ft.size()) {
+        if ((ft.qts[i]&31) >= split_level) {
+            if ((ft.totals[i]-ft.found[i]) >= min) {
+                roots.push_back(i);
             }
+            i = ft.ends[i];
+            continue;
+        }
+        int64 t_total=0;
+        if (clip_tile(ft, i, min, max, absmin, t_total)) {
+            groups.push_back(std::make_pair(i, t_total));
+            ft.add_found(i, 0, t_total);
+            cc++;
+            i = ft.ends[i];
+        } else if (t_total >= min) {
+            i++;
         } else {
-            i = tree->next(i,4);
+            i = ft.ends[i];
         }
-        
     }
-
-    return std::make_pair(cc,sz);
-}
     
+    std::vector<std::vector<std::pair<size_t,int64>>> root_groups(roots.size());
+    std::vector<int64> root_found(roots.size(), 0);
+    std::atomic<size_t> next_root(0);
+    
+    auto run = [&ft, &roots, &root_groups, &root_found, &next_root, min, max, absmin]() {
+        for (size_t r = next_root++; r < roots.size(); r = next_root++) {
+            root_found[r] = clip_within_flat(ft, roots[r], min, max, absmin, root_groups[r]);
+        }
+    };
+    if (roots.size() < 4*numchan) {
+        //not worth starting threads
+        run();
+    } else {
+        std::vector<std::future<void>> futs;
+        for (size_t j=0; j < numchan; j++) {
+            futs.push_back(std::async(std::launch::async, run));
+        }
+        for (auto& f: futs) { f.get(); }
+    }
+    
+    for (size_t r=0; r < roots.size(); r++) {
+        if (root_found[r] != 0) {
+            ft.add_found(ft.parents[roots[r]], 0, root_found[r]);
+        }
+        cc += root_groups[r].size();
+        groups.insert(groups.end(), root_groups[r].begin(), root_groups[r].end());
+    }
+    return cc;
+}
     
 
 std::pair<size_t,int64> clip_within(std::shared_ptr<QtTree> tree, std::set<size_t>& outs, int64 min, int64 max, int64 absmin) {
@@ -198,41 +309,43 @@ std::shared_ptr<QtTree> tree_round_copy(std::shared_ptr<QtTree> tree, int64 maxl
 }
 
 std::shared_ptr<QtTree> find_groups_copy(std::shared_ptr<QtTree> tree, int64 target, int64 minsize) {
+    return find_groups_copy(tree, target, minsize, 1);
+}
 
+std::shared_ptr<QtTree> find_groups_copy(std::shared_ptr<QtTree> tree, int64 target, int64 minsize, size_t numchan) {
 
+    auto ft = make_flat_qttree(tree);
 
-    int64 total = tree->at(0).total;
+    int64 total = ft.totals[0];
     double total_fac = 100.0 / (double) total;
 
-    auto result = make_tree_empty();
+    std::vector<std::pair<size_t,int64>> groups;
+    int64 root_weight=0;
     
     int64 min=target-50;
     int64 max=target+50;
-    while ((tree->at(0).total > result->at(0).total)) {
+    while (total > ft.found[0]) {
 
         while (true) {
-            const QtTree::Item& t0 = tree->at(0);
-
-            const QtTree::Item& r0 = result->at(0);
-            
-
-            if (t0.total == r0.total) {
+            int64 rem = total - ft.found[0];
+            if (rem == 0) {
                 break;
             }
-            if (((t0.total-r0.total) < max) || ( (t0.total-r0.total)==t0.weight)) {
-                result->add(0, (t0.total-r0.total));
+            if ((rem < max) || (rem==ft.weights[0])) {
+                groups.push_back(std::make_pair(0, rem));
+                ft.found[0] += rem;
+                root_weight += rem;
                 break;
             }
 
-            size_t cc; int64 sz;
-            std::tie(cc,sz) = clip_within_copy(tree,result,min,max,minsize);
+            size_t cc = clip_within_parallel(ft,min,max,minsize,numchan,groups);
             if (cc==0) {
                 break;
             }
         }
-        if (result->at(0).weight==0) {
-            int64 rem = tree->at(0).total-result->at(0).total;
-            Logger::Progress(100-rem*total_fac) << "min=" << min << ", max=" << max << " found=" << result->size() << " remaining " << rem
+        if (root_weight==0) {
+            int64 rem = total-ft.found[0];
+            Logger::Progress(100-rem*total_fac) << "min=" << min << ", max=" << max << " found=" << groups.size() << " remaining " << rem
                       << "[" << std::setw(5) << std::fixed << std::setprecision(1) << rem*total_fac << "%]]";
         }
 
@@ -244,6 +357,11 @@ std::shared_ptr<QtTree> find_groups_copy(std::shared_ptr<QtTree> tree, int64 tar
         }
     }
     
+    auto result = make_tree_empty();
+    for (const auto& g: groups) {
+        result->add(ft.qts[g.first], g.second);
+    }
+    
     size_t idx=1;
     size_t i=0;
     int64 qt=-1;
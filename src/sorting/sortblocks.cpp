@@ -53,6 +53,7 @@
 #include "oqt/pbfformat/readfileparallel.hpp"
 #include "oqt/pbfformat/readfileblocks.hpp"
 #include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/pbfformat/writeblock.hpp"
 #include "oqt/sorting/tempobjs.hpp"
 namespace oqt {
 class CollectQts { 
@@ -96,27 +97,62 @@ class CollectQts {
 
 
 
+//! Counts the quadtrees, rounded to maxlevel, read by one thread
+class CollectQtsHistogram {
+    public:
+        CollectQtsHistogram(qt_histogram& hist_, size_t maxlevel_) : hist(hist_), maxlevel(maxlevel_), lim(1<<22) {}
+        
+        void call(std::shared_ptr<quadtree_vector> cc) {
+            if (!cc) {
+                add_qt_histogram(hist, qts);
+                return;
+            }
+            for (const auto& q: cc->quadtrees) {
+                if (q>=0) {
+                    qts.push_back(quadtree::round(q, maxlevel));
+                }
+            }
+            if (qts.size()>lim) {
+                add_qt_histogram(hist, qts);
+                Logger::Progress(cc->file_progress) << "add qts: " << hist.size() << " distinct";
+            }
+        }
+        
+        static std::function<void(std::shared_ptr<quadtree_vector>)> make(qt_histogram& hist, size_t maxlevel) {
+            auto cq = std::make_shared<CollectQtsHistogram>(hist, maxlevel);
+            return [cq](std::shared_ptr<quadtree_vector> v) {
+                cq->call(v);
+            };
+        }
+    private:
+        qt_histogram& hist;
+        size_t maxlevel;
+        size_t lim;
+        std::vector<int64> qts;
+};
+
 std::shared_ptr<QtTree> make_qts_tree_maxlevel(const std::string& qtsfn, size_t numchan, size_t maxlevel) {
     
-    auto tree = make_tree_empty();
-    
     if (numchan==0) {
+        auto tree = make_tree_empty();
         auto add_qts=make_addcountmaptree(tree,maxlevel);
         auto addcount = CollectQts::make(add_qts);
         read_blocks_nothread_quadtree_vector(qtsfn, addcount, {}, ReadBlockFlags::Empty);
-    } else {
-        
+        return tree;
+    }
     
-        auto add_qts = multi_threaded_callback<count_map>::make(make_addcountmaptree(tree, maxlevel),numchan);
-        
-        std::vector<std::function<void(std::shared_ptr<quadtree_vector>)>> make_addcounts;
-        for (size_t i=0; i < numchan; i++) {
-            make_addcounts.push_back(CollectQts::make(add_qts[i]));
-        }
-        
-        read_blocks_split_quadtree_vector(qtsfn, make_addcounts, {}, ReadBlockFlags::Empty);
+    //each thread counts its own blocks: the counts are then merged
+    std::vector<qt_histogram> hists(numchan);
+    std::vector<std::function<void(std::shared_ptr<quadtree_vector>)>> make_addcounts;
+    for (size_t i=0; i < numchan; i++) {
+        make_addcounts.push_back(CollectQtsHistogram::make(hists[i], maxlevel));
     }
     
+    read_blocks_split_quadtree_vector(qtsfn, make_addcounts, {}, ReadBlockFlags::Empty);
+    
+    auto hist = reduce_qt_histograms(std::move(hists), numchan);
+    auto tree = make_tree_histogram(hist);
+    Logger::Message() << "make_qts_tree: " << hist.size() << " distinct qts, " << tree->size() << " tiles, total " << tree->at(0).total;
     return tree;
 };
            
@@ -165,7 +201,7 @@ class AddQuadtrees {
             
             for (size_t i=0; i < bl->size(); i++) {
                 
-                if (curr_idx == curr->ids.size()) { 
+                while (curr_idx == curr->ids.size()) { 
                     curr = next_qts_block();
                     curr_idx=0;
                     if (!curr) {
@@ -252,17 +288,232 @@ primitiveblock_callback add_quadtreesup_callback(std::vector<primitiveblock_call
 
 
 
-int run_sortblocks_inmem(const std::string& origfn, const std::string& qtsfn, const std::string& outfn,
-    int64 timestamp, size_t numchan, std::shared_ptr<QtTree> groups, bool fix_strs) {
+/*! Sorts objects into tiles for run_sortblocks_inmem. Each input block
+ * is passed to one of the shards, which adds its objects to its own
+ * bucket for each tile: find_tile only reads the groups tree, so the
+ * shards run concurrently. Packed tiles are written in the same order as
+ * the groups tree.
+ * 
+ * If \param pack_early is set, the weight of each tile must be exactly
+ * the number of objects which will be found in it, as for a tree from
+ * find_groups_copy. When a shard adds the last object for a tile, the
+ * buckets from all shards are merged and the tile is packed while the
+ * rest of the file is still being read. Otherwise (for trees given by the
+ * caller, whose weights may not be exact) all tiles are packed by
+ * finish. */
+class ShardedSortTiles {
+    public:
+        ShardedSortTiles(std::shared_ptr<QtTree> groups_, size_t numchan, int64 timestamp_, bool fix_strs_,
+            std::shared_ptr<PbfFileWriter> writer, bool pack_early_)
+            : groups(groups_), timestamp(timestamp_), fix_strs(fix_strs_), pack_early(pack_early_), num_tiles(0),
+              shards(numchan), num_packed(0) {
+            
+            for (size_t i=0; i < groups->size(); i++) {
+                num_tiles = std::max<size_t>(num_tiles, groups->at(i).idx);
+            }
+            remaining.reset(new std::atomic<int64>[num_tiles]);
+            tile_qts.resize(num_tiles);
+            std::vector<int64> weights(num_tiles);
+            for (size_t i=0; i < groups->size(); i++) {
+                const auto& t = groups->at(i);
+                if (t.idx>0) {
+                    tile_qts[t.idx-1] = t.qt;
+                    weights[t.idx-1] = t.weight;
+                }
+            }
+            for (size_t i=0; i < num_tiles; i++) {
+                remaining[i] = weights[i];
+            }
+            
+            for (auto& sh: shards) {
+                sh.buckets.resize(num_tiles);
+                sh.counts.resize(num_tiles);
+            }
+            
+            //unless packing early, finish passes on every tile, so the writer
+            //should not skip those with no weight
+            auto ordered = std::make_shared<OrderedTiles>(writer, tile_qts, pack_early ? weights : std::vector<int64>(num_tiles, 1));
+            write = threaded_callback<keystring>::make([ordered](keystring_ptr p) { ordered->call(p); }, numchan+1, "write blocks");
+            
+            for (size_t i=0; i < numchan; i++) {
+                auto write_ = write;
+                packers.push_back(threaded_callback<PrimitiveBlock>::make([write_](PrimitiveBlockPtr bl) {
+                    if (!bl) {
+                        write_(nullptr);
+                        return;
+                    }
+                    std::sort(bl->Objects().begin(), bl->Objects().end(), element_cmp);
+                    auto p = pack_primitive_block(bl, true, false, true, true);
+                    write_(std::make_shared<keystring>(bl->Index(), prepare_file_block("OSMData", p)));
+                }, "pack final"));
+            }
+        }
+        
+        std::vector<primitiveblock_callback> make_shard_callbacks() {
+            std::vector<primitiveblock_callback> result;
+            for (size_t i=0; i < shards.size(); i++) {
+                result.push_back(threaded_callback<PrimitiveBlock>::make([this, i](PrimitiveBlockPtr bl) { add(i, bl); }, "sort tiles"));
+            }
+            return result;
+        }
+        
+        /*! Pack the tiles not packed while reading, and finish the packers.
+         * Tiles with no objects are passed to the writer as empty, so that
+         * it does not wait for them. */
+        void finish() {
+            size_t num_packed_reading = num_packed;
+            size_t num_incomplete=0;
+            for (size_t t=0; t < num_tiles; t++) {
+                if (!pack_early || (remaining[t] > 0)) {
+                    size_t tot=0;
+                    for (auto& sh: shards) { tot += sh.buckets[t].size(); }
+                    if (tot>0) {
+                        pack_tile(num_incomplete % packers.size(), t);
+                        num_incomplete++;
+                    } else {
+                        write(std::make_shared<keystring>(t+1, ""));
+                    }
+                }
+            }
+            write(nullptr);
+            //the packers pass on nullptr to the writer one at a time
+            for (auto& p: packers) {
+                p(nullptr);
+            }
+            Logger::Message() << "sortblocks_inmem: packed " << num_packed_reading << " tiles while reading, "
+                << num_incomplete << " incomplete tiles at end";
+        }
+        
+    private:
+        struct Shard {
+            std::vector<std::vector<ElementPtr>> buckets;
+            std::vector<int64> counts;
+            std::vector<size_t> touched;
+        };
+        
+        class OrderedTiles {
+            public:
+                OrderedTiles(std::shared_ptr<PbfFileWriter> writer_, const std::vector<int64>& tile_qts_, const std::vector<int64>& weights_)
+                    : writer(writer_), tile_qts(tile_qts_), weights(weights_), next(0) {}
+                
+                void call(keystring_ptr p) {
+                    if (!p) {
+                        for (auto& pp: pending) {
+                            if (!pp.second.empty()) {
+                                writer->writeBlock(tile_qts[pp.first-1], pp.second);
+                            }
+                        }
+                        pending.clear();
+                        return;
+                    }
+                    pending[p->first] = std::move(p->second);
+                    
+                    while (next < weights.size()) {
+                        if (weights[next]==0) {
+                            next++;
+                            continue;
+                        }
+                        auto it = pending.find(next+1);
+                        if (it==pending.end()) {
+                            break;
+                        }
+                        if (!it->second.empty()) {
+                            //an empty block marks a tile with no objects
+                            writer->writeBlock(tile_qts[next], it->second);
+                        }
+                        pending.erase(it);
+                        next++;
+                    }
+                }
+            private:
+                std::shared_ptr<PbfFileWriter> writer;
+                std::vector<int64> tile_qts;
+                std::vector<int64> weights;
+                size_t next;
+                std::map<int64, std::string> pending;
+        };
+        
+        std::shared_ptr<QtTree> groups;
+        int64 timestamp;
+        bool fix_strs;
+        bool pack_early;
+        size_t num_tiles;
+        std::unique_ptr<std::atomic<int64>[]> remaining;
+        std::vector<int64> tile_qts;
+        std::vector<Shard> shards;
+        std::vector<primitiveblock_callback> packers;
+        write_file_callback write;
+        std::atomic<size_t> num_packed;
+        
+        void add(size_t si, PrimitiveBlockPtr bl) {
+            if (!bl) { return; }
+            
+            auto& sh = shards[si];
+            for (auto o: bl->Objects()) {
+                auto tl = groups->find_tile(o->Quadtree());
+                if (tl.idx==0) {
+                    throw std::domain_error("no tile for "+quadtree::string(o->Quadtree()));
+                }
+                size_t t = tl.idx-1;
+                
+                if (fix_strs) {
+                    fix_tags(*o);
+                    if (o->Type()==ElementType::Relation) {
+                        auto rel = std::dynamic_pointer_cast<Relation>(o);
+                        fix_members(*rel);
+                    }
+                }
+                
+                sh.buckets[t].push_back(o);
+                if (pack_early && ((sh.counts[t]++)==0)) {
+                    sh.touched.push_back(t);
+                }
+            }
+            
+            for (auto t: sh.touched) {
+                int64 c = sh.counts[t];
+                sh.counts[t]=0;
+                int64 prev = remaining[t].fetch_sub(c);
+                if (prev==c) {
+                    //all shards have added their objects for this tile
+                    pack_tile(si, t);
+                    num_packed++;
+                } else if (prev < c) {
+                    throw std::domain_error("tile "+quadtree::string(tile_qts[t])+" has more objects than its weight");
+                }
+            }
+            sh.touched.clear();
+        }
+        
+        void pack_tile(size_t pi, size_t t) {
+            size_t tot=0;
+            for (auto& sh: shards) { tot += sh.buckets[t].size(); }
+            
+            auto nbl = std::make_shared<PrimitiveBlock>(t+1, tot);
+            nbl->SetEndDate(timestamp);
+            nbl->SetQuadtree(tile_qts[t]);
+            for (auto& sh: shards) {
+                for (auto& o: sh.buckets[t]) {
+                    nbl->add(o);
+                }
+                std::vector<ElementPtr> e;
+                sh.buckets[t].swap(e);
+            }
+            packers[pi % packers.size()](nbl);
+        }
+};
+
+int run_sortblocks_inmem_nothread(const std::string& origfn, const std::string& qtsfn, const std::string& outfn,
+    int64 timestamp, std::shared_ptr<QtTree> groups, bool fix_strs) {
         
     
     
     auto hh = std::make_shared<Header>();
     hh->SetBBox(bbox{-1800000000,-900000000,1800000000,900000000});
-    auto write_file_obj = make_pbffilewriter_filelocs(outfn, hh);//make_pbffilewriter_indexedinmem(outfn, hh);
+    auto write_file_obj = make_pbffilewriter_filelocs(outfn, hh);
     
     
-    auto packers2 = make_final_packers_sync(write_file_obj, numchan, timestamp, true,true);
+    auto packers2 = make_final_packers_sync(write_file_obj, 0, timestamp, true,true);
     
     
     std::vector<PrimitiveBlockPtr> outs;
@@ -299,11 +550,7 @@ int run_sortblocks_inmem(const std::string& origfn, const std::string& qtsfn, co
     if (qtsfn!="NONE") {
         resort = add_quadtreesup_callback({resort}, qtsfn);
     }
-    if (numchan==0) {
-        read_blocks_nothread_primitiveblock(origfn, resort, {}, nullptr, false, ReadBlockFlags::Empty);
-    } else {
-        read_blocks_primitiveblock(origfn, resort, {}, numchan, nullptr, false, ReadBlockFlags::Empty);
-    }
+    read_blocks_nothread_primitiveblock(origfn, resort, {}, nullptr, false, ReadBlockFlags::Empty);
     
     Logger::Message() << "finished";
     
@@ -323,11 +570,46 @@ int run_sortblocks_inmem(const std::string& origfn, const std::string& qtsfn, co
     Logger::Get().time("written to file");
     return 0;
 }
+
+int run_sortblocks_inmem(const std::string& origfn, const std::string& qtsfn, const std::string& outfn,
+    int64 timestamp, size_t numchan, std::shared_ptr<QtTree> groups, bool fix_strs, bool exact_weights) {
+    
+    if (numchan==0) {
+        return run_sortblocks_inmem_nothread(origfn, qtsfn, outfn, timestamp, groups, fix_strs);
+    }
+    
+    auto hh = std::make_shared<Header>();
+    hh->SetBBox(bbox{-1800000000,-900000000,1800000000,900000000});
+    auto write_file_obj = make_pbffilewriter_filelocs(outfn, hh);
+    
+    auto sorter = std::make_shared<ShardedSortTiles>(groups, numchan, timestamp, fix_strs, write_file_obj, exact_weights);
+    auto shards = sorter->make_shard_callbacks();
+    
+    primitiveblock_callback resort;
+    if (qtsfn!="NONE") {
+        resort = add_quadtreesup_callback(shards, qtsfn);
+    } else {
+        auto count = std::make_shared<size_t>(0);
+        resort = [shards, count](PrimitiveBlockPtr bl) {
+            if (!bl) {
+                for (auto& s: shards) { s(nullptr); }
+                return;
+            }
+            shards[((*count)++) % shards.size()](bl);
+        };
+    }
+    
+    read_blocks_primitiveblock(origfn, resort, {}, numchan, nullptr, false, ReadBlockFlags::Empty);
+    Logger::Get().time("sorted data");
+    
+    sorter->finish();
+    write_file_obj->finish();
+    Logger::Get().time("written to file");
+    return 0;
+}
     
     
     
-
-
 
 PrimitiveBlockPtr convert_primblock(std::shared_ptr<FileBlock> bl) {
     if (!bl) { return PrimitiveBlockPtr(); }
@@ -377,7 +659,7 @@ class SortBlocksImpl : public SortBlocks {
             for (size_t i=0; i < numchan; i++) {
                 auto cb = make_sortgroup_callback(tempobjs->add_func(i),groups,blocksplit, 1000000);
                 if (threaded) {
-                    cb = threaded_callback<PrimitiveBlock>::make(cb);
+                    cb = threaded_callback<PrimitiveBlock>::make(cb, "sort groups");
                 }
                 sgg.push_back(cb);
             }
@@ -426,7 +708,7 @@ int run_sortblocks(const std::string& origfn, const std::string& qtsfn, const st
     
    
     if (tempfn=="NONE") {
-        return run_sortblocks_inmem(origfn, qtsfn, outfn, timestamp, numchan, groups, fixstrs);
+        return run_sortblocks_inmem(origfn, qtsfn, outfn, timestamp, numchan, groups, fixstrs, false);
     }
     if (numchan==0) { throw std::domain_error("numchan must be >= 1"); }
     int64 orig_file_size = file_size(origfn) / 1024/1024;
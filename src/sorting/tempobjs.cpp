@@ -243,7 +243,7 @@ class TempObjsBlobstore: public TempObjs {
             
             std::vector<std::function<void(std::shared_ptr<KeyedBlob> kk)>> convs;
             for (auto oo:  outs) {
-                convs.push_back(threaded_callback<KeyedBlob>::make(make_conv_keyedblob_primblock(oo)));
+                convs.push_back(threaded_callback<KeyedBlob>::make(make_conv_keyedblob_primblock(oo), "decode temp blobs"));
             }
             blobstore->read(convs);
         }
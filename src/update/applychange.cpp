@@ -25,7 +25,6 @@
 #include "oqt/update/xmlchange.hpp"
 
 #include "oqt/pbfformat/writepbffile.hpp"
-#include "gzstream.hpp"
 #include "oqt/update/applychange.hpp"
 #include "oqt/sorting/final.hpp"
 #include "oqt/sorting/splitbyid.hpp"
@@ -39,62 +38,124 @@
 
 
 #include <algorithm>
+#include <atomic>
 
 namespace oqt {
 
+/*! Merges change objects into the blocks of a file sorted by type and id.
+ * Each block is merged by merge_block, which can be called from several
+ * threads at once: it only uses the change objects between the first and
+ * last objects of the block. The merged blocks are then passed to call in
+ * file order, which adds any change objects falling between blocks and
+ * passes the blocks on to the packers. */
 class ApplyChange { 
     public:
-        ApplyChange(std::function<void(ElementPtr)> collect_, typeid_element_map_ptr changeobjs_) :
-            collect(collect_), changeobjs(changeobjs_), finished(false), change_key(0) {
-            
-            change_iter = changeobjs->begin();
-            finished = change_iter == changeobjs->end();
-            if (!finished) {
-                change_key = change_iter->second->InternalId();
-            }
-        }
+        ApplyChange(std::vector<primitiveblock_callback> packers_, typeid_element_map_ptr changeobjs_) :
+            packers(packers_), changeobjs(changeobjs_), change_iter(changeobjs_->cbegin()),
+            idx(0), started(false), last_key(0),
+            replaced(0), inserted(0), removed(0), skipped(0) {}
         
-        void add_change_obj(bool has) {
-            auto o = change_iter->second;
-            if (o->ChangeType() >= changetype::Modify) {
-                
-                o->SetChangeType(changetype::Normal);
-                Logger::Message() << (has ? "replace with" : "insert") << " obj " << o->Type() << " " << o->Id();
-                collect(o);
-            } else {
-                Logger::Message() << (has ? "remove" : "skip") << " obj " << o->Type() << " " << o->Id() << " [" << change_iter->second->ChangeType() << "]";
+        PrimitiveBlockPtr merge_block(PrimitiveBlockPtr block) {
+            if ((!block) || block->size()==0) {
+                return block;
             }
-            change_iter++;
-            finished = change_iter == changeobjs->end();
-            if (!finished) {
-                change_key = change_iter->second->InternalId();
+            if (!std::is_sorted(block->Objects().begin(), block->Objects().end(),
+                    [](const ElementPtr& l, const ElementPtr& r) { return l->InternalId() < r->InternalId(); })) {
+                throw std::domain_error("block "+std::to_string(block->Index())+" not sorted by type and id");
             }
-        }
-        void apply(PrimitiveBlockPtr block) {
-            if (!block) {
-                while (!finished) {
-                    add_change_obj(false);
-                }
-                collect(nullptr);
-                return;
-            }   
+            
+            auto it = changeobjs->lower_bound(element_key(block->Objects().front()));
+            auto end = changeobjs->upper_bound(element_key(block->Objects().back()));
+            if (it==end) {
+                return block;
+            }
+            
+            auto result = std::make_shared<PrimitiveBlock>(block->Index(), block->size());
             for (auto obj: block->Objects()) {
-                while ((!finished) && (change_key < obj->InternalId())) {
-                    add_change_obj(false);                    
+                while ((it!=end) && (it->second->InternalId() < obj->InternalId())) {
+                    add_change_obj(result, it->second, false);
+                    it++;
                 }
-                if ((!finished) && (change_key == obj->InternalId())) {
-                    add_change_obj(true);
+                if ((it!=end) && (it->second->InternalId() == obj->InternalId())) {
+                    add_change_obj(result, it->second, true);
+                    it++;
                 } else {
-                    collect(obj);
+                    result->add(obj);
                 }
             }
+            return result;
+        }
+        
+        void call(PrimitiveBlockPtr block) {
+            if (!block) {
+                auto rest = std::make_shared<PrimitiveBlock>(0);
+                while (change_iter != changeobjs->cend()) {
+                    add_change_obj(rest, change_iter->second, false);
+                    change_iter++;
+                }
+                write_block(rest);
+                
+                Logger::Message() << "applychange: replaced " << replaced << ", inserted " << inserted
+                    << ", removed " << removed << ", skipped " << skipped << " objects";
+                for (auto pk: packers) { pk(nullptr); }
+                return;
+            }
+            if (block->size()==0) {
+                return;
+            }
+            
+            uint64 first_key = block->Objects().front()->InternalId();
+            if (started && (first_key <= last_key)) {
+                throw std::domain_error("blocks not sorted by type and id");
+            }
+            
+            //change objects between the previous block and this one
+            auto gap = std::make_shared<PrimitiveBlock>(0);
+            while ((change_iter != changeobjs->cend()) && (change_iter->second->InternalId() < first_key)) {
+                add_change_obj(gap, change_iter->second, false);
+                change_iter++;
+            }
+            write_block(gap);
+            
+            change_iter = changeobjs->upper_bound(element_key(block->Objects().back()));
+            last_key = block->Objects().back()->InternalId();
+            started=true;
+            write_block(block);
         }
+            
     private:
-        std::function<void(ElementPtr)> collect;
+        std::vector<primitiveblock_callback> packers;
         typeid_element_map_ptr changeobjs;
         typeid_element_map::const_iterator change_iter;
-        bool finished;
-        uint64 change_key;
+        size_t idx;
+        bool started;
+        uint64 last_key;
+        
+        std::atomic<size_t> replaced, inserted, removed, skipped;
+        
+        static std::pair<ElementType,int64> element_key(ElementPtr o) {
+            return std::make_pair(o->Type(), o->Id());
+        }
+        
+        void add_change_obj(PrimitiveBlockPtr result, ElementPtr o, bool has) {
+            if (o->ChangeType() >= changetype::Modify) {
+                o->SetChangeType(changetype::Normal);
+                result->add(o);
+                if (has) { replaced++; } else { inserted++; }
+            } else {
+                if (has) { removed++; } else { skipped++; }
+            }
+        }
+        
+        void write_block(PrimitiveBlockPtr block) {
+            if (block->size()==0) {
+                return;
+            }
+            auto out = std::make_shared<PrimitiveBlock>(idx, 0);
+            out->Objects().swap(block->Objects());
+            packers[idx % packers.size()](out);
+            idx++;
+        }
 };
 
 
@@ -104,24 +165,11 @@ void run_applychange(const std::string& origfn, const std::string& outfn, size_t
     auto change_objs = std::make_shared<typeid_element_map>();
     
     for (const auto& fn: changes) {
-        if (ends_with(fn,".osc.gz")) {
-            gzstream::igzstream src_fl(fn.c_str());
-            if (!src_fl.good()) {
-                throw std::domain_error("couldn't open "+fn);
-            }
-            read_xml_change_file_em(&src_fl, change_objs, false);
-            src_fl.close();
-        } else if (ends_with(fn,".osc")) {
-            std::ifstream src_fl(fn, std::ios::in);
-            if (!src_fl.good()) {
-                throw std::domain_error("couldn't open "+fn);
-            }
-            read_xml_change_file_em(&src_fl, change_objs, false);
-            src_fl.close();
-        } else {
+        if (!(ends_with(fn,".osc.gz") || ends_with(fn,".osc"))) {
             throw std::domain_error(fn+" not a osc file");
         }
     }
+    add_change_objects(change_objs, read_xml_change_files_parallel(changes, numchan, false));
     Logger::Get().time("read changes files");
     Logger::Message() << "have " << change_objs->size() << " change_objs";
     
@@ -143,45 +191,33 @@ void run_applychange(const std::string& origfn, const std::string& outfn, size_t
     } else {
         packers.push_back([](PrimitiveBlockPtr p) {});
     }
-    auto collect = make_collectobjs(packers, 8000);
-    
-    auto applychange = std::make_shared<ApplyChange>(collect,change_objs);
-    
-    
-    size_t nc=0;
-    auto fixtags = [applychange,&nc](PrimitiveBlockPtr pp) {
-        if (!pp) {
-            return applychange->apply(nullptr);
-        }
-        for (auto o: pp->Objects()) {
-            if (fix_tags(*o)) { nc++; };
-            if (o->Type()==ElementType::Relation) {
-                auto rel = std::dynamic_pointer_cast<Relation>(o);
-                if (fix_members(*rel)) {
-                    nc++;
-                }
-            }
-        }
-        applychange->apply(pp);
-    };
-    
+    auto applychange = std::make_shared<ApplyChange>(packers,change_objs);
     
-    auto cvf = [](std::shared_ptr<FileBlock> bl) {
+    std::atomic<size_t> nc(0);
+    auto cvf = [applychange,&nc](std::shared_ptr<FileBlock> bl) {
         if (!bl) { return PrimitiveBlockPtr(); }
         if ((bl->blocktype=="OSMData")) {
             std::string dd = bl->get_data();//decompress(std::get<2>(*bl), std::get<3>(*bl))
-            return read_primitive_block(bl->idx, dd, false,ReadBlockFlags::Empty,nullptr,nullptr);
-            
+            auto pp = read_primitive_block(bl->idx, dd, false,ReadBlockFlags::Empty,nullptr,nullptr);
+            for (auto o: pp->Objects()) {
+                if (fix_tags(*o)) { nc++; };
+                if (o->Type()==ElementType::Relation) {
+                    auto rel = std::dynamic_pointer_cast<Relation>(o);
+                    if (fix_members(*rel)) {
+                        nc++;
+                    }
+                }
+            }
+            return applychange->merge_block(pp);
         }
         return std::make_shared<PrimitiveBlock>(-1);
     };
     
     
-    //[applychange](PrimitiveBlockPtr bl) { applychange->apply(bl); }
-    read_blocks_convfunc_primitiveblock(origfn, fixtags, {}, numchan, cvf);
+    read_blocks_convfunc_primitiveblock(origfn, [applychange](PrimitiveBlockPtr bl) { applychange->call(bl); }, {}, numchan, cvf);
     Logger::Get().time("applied change");
     
-    Logger::Message() << nc << " objects with '\xef' character fixed";
+    Logger::Message() << nc.load() << " objects with '\xef' character fixed";
     if (writer) {
         writer->finish();
         Logger::Get().time("finished file");
@@ -0,0 +1,135 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/update/compactchanges.hpp"
+#include "oqt/elements/combineblocks.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
+#include "oqt/pbfformat/readblock.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/readfileparallel.hpp"
+#include "oqt/pbfformat/writeblock.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/utils/compress.hpp"
+#include "oqt/utils/date.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/multithreadedcallback.hpp"
+#include <fstream>
+
+namespace oqt {
+namespace compactchangesdetail {
+
+//the start and end dates of a change file, as set on its first data block
+std::pair<int64,int64> read_change_file_dates(const std::string& fn, int64 pos) {
+    std::ifstream infile(fn, std::ios::in | std::ios::binary);
+    infile.seekg(pos);
+    auto fb = read_file_block(0, infile);
+    if ((!fb) || (fb->blocktype!="OSMData")) {
+        throw std::domain_error("can't read first block of "+fn);
+    }
+    auto flags = ReadBlockFlags::SkipNodes | ReadBlockFlags::SkipWays | ReadBlockFlags::SkipRelations | ReadBlockFlags::SkipGeometries;
+    auto bl = read_primitive_block(0, fb->get_data(), true, flags);
+    return std::make_pair(bl->StartDate(), bl->EndDate());
+}
+
+}
+
+std::pair<int64,int64> merge_change_files(
+    const std::string& prfx, const std::vector<std::string>& fls,
+    const std::string& outfn, size_t numchan) {
+
+    if (fls.empty()) {
+        throw std::domain_error("no files to merge");
+    }
+
+    std::vector<std::string> filenames;
+    src_locs_map locs;
+    //the merged file covers from the start of the first file to the end of the last
+    int64 start_date=0, end_date=0;
+    for (size_t i=0; i < fls.size(); i++) {
+        filenames.push_back(prfx+fls[i]);
+        auto head = get_header_block(filenames.back());
+        if (head->Index().empty()) {
+            throw std::domain_error("not an indexed pbf file: "+filenames.back());
+        }
+        for (const auto& q: head->Index()) {
+            locs[std::get<0>(q)].push_back(std::make_pair(i, std::get<1>(q)));
+        }
+        if (i==0) {
+            start_date = compactchangesdetail::read_change_file_dates(filenames.back(), std::get<1>(head->Index().front())).first;
+        }
+        if (i+1==fls.size()) {
+            end_date = compactchangesdetail::read_change_file_dates(filenames.back(), std::get<1>(head->Index().front())).second;
+        }
+    }
+    Logger::Message() << "merge " << fls.size() << " change files, " << locs.size() << " tiles, "
+        << date_str(start_date) << " to " << date_str(end_date);
+
+    auto head = std::make_shared<Header>();
+    head->SetBBox(bbox{-1800000000,-900000000,1800000000,900000000});
+    auto out = make_pbffilewriter_indexedinmem(outfn, head);
+
+    auto write = multi_threaded_callback<keystring>::make([out](keystring_ptr p) {
+        if (p) {
+            out->writeBlock(p->first, p->second);
+        }
+    }, numchan);
+
+    //tiles with a single source are copied without decoding them, so
+    //keep the start and end dates of their own file
+    auto compress = make_compress_blob_callbacks(write, "OSMData", -1);
+    
+    std::function<std::shared_ptr<KeyedBlob>(std::shared_ptr<KeyedBlob>)> merge_tile = [start_date, end_date](std::shared_ptr<KeyedBlob> kb) {
+        if ((kb->idx % 1000)==0) {
+            Logger::Progress(kb->file_progress) << "merge tile " << quadtree::string(kb->key);
+        }
+        if (kb->blobs.size()==1) {
+            return kb;
+        }
+        std::vector<PrimitiveBlockPtr> blocks;
+        for (const auto& b: kb->blobs) {
+            blocks.push_back(read_primitive_block(kb->idx, decompress(b.first, b.second), true, ReadBlockFlags::Empty, nullptr));
+        }
+        //no main block: changetypes are kept, later files replace earlier
+        auto merged = combine_primitiveblock_many(nullptr, blocks);
+        merged->SetQuadtree(kb->key);
+        merged->SetStartDate(start_date);
+        merged->SetEndDate(end_date);
+        
+        auto result = std::make_shared<KeyedBlob>();
+        result->idx = kb->idx;
+        result->key = kb->key;
+        result->blobs.push_back(std::make_pair(pack_primitive_block(merged, true, true, true, true), 0));
+        result->file_progress = kb->file_progress;
+        return result;
+    };
+
+    read_some_split_locs_parallel_callback(filenames, wrap_callbacks(compress, merge_tile), locs);
+
+    auto ii = out->finish();
+    Logger::Progress(100) << "merged " << ii.size() << " tiles";
+    if (ii.empty()) {
+        return std::make_pair(0, 0);
+    }
+    return std::make_pair((int64) ii.size(), std::get<1>(ii.back())+std::get<2>(ii.back()));
+}
+
+}
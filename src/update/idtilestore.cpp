@@ -0,0 +1,459 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/update/idtilestore.hpp"
+#include "oqt/update/update.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/elements/minimalblock.hpp"
+#include "oqt/utils/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <experimental/filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace oqt {
+namespace idtilestoredetail {
+
+const char run_magic[] = "OQTIDTL1";
+const size_t run_header_size = 16;
+
+//! Newer runs need to be at least this factor smaller than the run before
+//! them, otherwise the two are merged.
+const size_t merge_ratio = 4;
+
+class MappedRun {
+    public:
+        MappedRun(const std::string& fn) : data(nullptr), length(0), count(0) {
+            int fd = open(fn.c_str(), O_RDONLY);
+            if (fd<0) {
+                throw std::domain_error("can't open "+fn);
+            }
+            struct stat st;
+            if (fstat(fd, &st)!=0) {
+                close(fd);
+                throw std::domain_error("can't stat "+fn);
+            }
+            length = st.st_size;
+            if (length < run_header_size) {
+                close(fd);
+                throw std::domain_error(fn+" is not an idtilestore run");
+            }
+            void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p==MAP_FAILED) {
+                throw std::domain_error("can't map "+fn);
+            }
+            data = static_cast<const char*>(p);
+            if (memcmp(data, run_magic, 8)!=0) {
+                munmap(const_cast<char*>(data), length);
+                throw std::domain_error(fn+" is not an idtilestore run");
+            }
+            memcpy(&count, data+8, 8);
+            if (run_header_size + count*sizeof(IdTileEntry) != length) {
+                munmap(const_cast<char*>(data), length);
+                throw std::domain_error(fn+" is truncated");
+            }
+        }
+
+        ~MappedRun() {
+            munmap(const_cast<char*>(data), length);
+        }
+
+        MappedRun(const MappedRun&) = delete;
+        MappedRun& operator=(const MappedRun&) = delete;
+
+        size_t size() const { return count; }
+        const IdTileEntry* begin() const { return reinterpret_cast<const IdTileEntry*>(data+run_header_size); }
+        const IdTileEntry* end() const { return begin()+count; }
+
+    private:
+        const char* data;
+        size_t length;
+        uint64 count;
+};
+
+//! Writes a run to a temporary file, which is renamed when finished
+class RunWriter {
+    public:
+        RunWriter(const std::string& fn_) : fn(fn_), count(0) {
+            outfile.open(fn+".tmp", std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!outfile.good()) {
+                throw std::domain_error("can't write "+fn);
+            }
+            outfile.write(run_magic, 8);
+            outfile.write(reinterpret_cast<const char*>(&count), 8);
+            buffer.reserve(buffer_size);
+        }
+
+        void add(const IdTileEntry& e) {
+            buffer.push_back(e);
+            if (buffer.size()==buffer_size) {
+                flush();
+            }
+        }
+
+        size_t finish() {
+            flush();
+            outfile.seekp(8);
+            outfile.write(reinterpret_cast<const char*>(&count), 8);
+            outfile.close();
+            if (std::rename((fn+".tmp").c_str(), fn.c_str())!=0) {
+                throw std::domain_error("can't rename "+fn+".tmp");
+            }
+            return count;
+        }
+
+    private:
+        static const size_t buffer_size = 1<<16;
+        std::string fn;
+        std::ofstream outfile;
+        std::vector<IdTileEntry> buffer;
+        uint64 count;
+
+        void flush() {
+            outfile.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()*sizeof(IdTileEntry));
+            count += buffer.size();
+            buffer.clear();
+        }
+};
+
+int64 make_key(ElementType ty, int64 id) {
+    return (((int64) ty)<<61) | id;
+}
+
+bool entry_less(const IdTileEntry& l, const IdTileEntry& r) {
+    return l.id < r.id;
+}
+
+IdTileEntry make_entry(uint64 id, size_t ct, int64 qt, int64 tile) {
+    if (ct==(size_t) changetype::Delete) {
+        return IdTileEntry{(int64) id, -1, -1};
+    }
+    return IdTileEntry{(int64) id, qt, tile};
+}
+
+template <class T>
+void add_minimal_entries(std::vector<IdTileEntry>& entries, const std::vector<T>& objs, ElementType ty, int64 tile) {
+    for (const auto& o: objs) {
+        if (o.changetype==(size_t) changetype::Remove) { continue; }
+        entries.push_back(make_entry(make_key(ty, o.id), o.changetype, o.quadtree, tile));
+    }
+}
+
+std::vector<IdTileEntry> read_file_entries(const std::string& fn, size_t numchan) {
+    std::vector<IdTileEntry> entries;
+    auto cb = [&entries](minimal::BlockPtr bl) {
+        if (!bl) { return; }
+        add_minimal_entries(entries, bl->nodes, ElementType::Node, bl->quadtree);
+        add_minimal_entries(entries, bl->ways, ElementType::Way, bl->quadtree);
+        add_minimal_entries(entries, bl->relations, ElementType::Relation, bl->quadtree);
+    };
+    read_blocks_minimalblock(fn, cb, {}, numchan, ReadBlockFlags::SkipInfo | ReadBlockFlags::SkipGeometries);
+    return entries;
+}
+
+class IdTileStoreImpl : public IdTileStore {
+    public:
+        IdTileStoreImpl(const std::string& path_) : path(path_), next_run(0) {
+            if (path.empty() || (path.back()!='/')) {
+                path += "/";
+            }
+        }
+
+        void load() {
+            std::ifstream manifest(path+"manifest");
+            if (!manifest.good()) {
+                throw std::domain_error("no idtilestore at "+path);
+            }
+            std::string key, val;
+            while (manifest >> key) {
+                if (key=="last_file") {
+                    manifest >> std::ws;
+                    std::getline(manifest, last_file_);
+                } else if (key=="next_run") {
+                    manifest >> next_run;
+                } else if (key=="run") {
+                    manifest >> val;
+                    runs.push_back(std::make_pair(val, std::make_shared<MappedRun>(path+val)));
+                } else {
+                    throw std::domain_error("unexpected key "+key+" in "+path+"manifest");
+                }
+            }
+        }
+
+        virtual const std::string& last_file() const { return last_file_; }
+        virtual size_t num_runs() const { return runs.size(); }
+        virtual size_t num_entries() const {
+            size_t tot=0;
+            for (const auto& r: runs) { tot += r.second->size(); }
+            return tot;
+        }
+
+        virtual std::vector<IdTileEntry> find(const std::vector<int64>& ids) const {
+            std::vector<IdTileEntry> result;
+            //ids are sorted, so each search can start from the previous position
+            std::vector<const IdTileEntry*> pos;
+            for (const auto& r: runs) {
+                pos.push_back(r.second->begin());
+            }
+            for (auto id: ids) {
+                IdTileEntry k{id, 0, 0};
+                for (size_t i=runs.size(); i > 0; i--) {
+                    auto& p = pos[i-1];
+                    p = std::lower_bound(p, runs[i-1].second->end(), k, entry_less);
+                    if ((p!=runs[i-1].second->end()) && (p->id==id)) {
+                        if (p->quadtree>=0) {
+                            result.push_back(*p);
+                        }
+                        break;
+                    }
+                }
+            }
+            return result;
+        }
+
+        virtual void add(std::vector<IdTileEntry> entries, const std::string& fn) {
+            //keep the last entry for each id
+            std::stable_sort(entries.begin(), entries.end(), entry_less);
+            auto last = std::unique(entries.rbegin(), entries.rend(),
+                [](const IdTileEntry& l, const IdTileEntry& r) { return l.id==r.id; });
+            entries.erase(entries.begin(), last.base());
+
+            bool drop_deleted = runs.empty();
+            auto fn_run = new_run_name();
+            RunWriter writer(path+fn_run);
+            for (const auto& e: entries) {
+                if (drop_deleted && (e.quadtree<0)) { continue; }
+                writer.add(e);
+            }
+            writer.finish();
+            runs.push_back(std::make_pair(fn_run, std::make_shared<MappedRun>(path+fn_run)));
+            last_file_ = fn;
+
+            while ((runs.size()>1) && (runs[runs.size()-1].second->size()*merge_ratio >= runs[runs.size()-2].second->size())) {
+                merge_last();
+            }
+            write_manifest();
+        }
+
+        virtual void compact() {
+            while (runs.size()>1) {
+                merge_last();
+            }
+            write_manifest();
+        }
+
+        virtual void set_last_file(const std::string& fn) {
+            last_file_ = fn;
+            write_manifest();
+        }
+
+    private:
+        std::string path;
+        std::string last_file_;
+        size_t next_run;
+        std::vector<std::pair<std::string,std::shared_ptr<MappedRun>>> runs;
+        std::vector<std::string> obsolete;
+
+        std::string new_run_name() {
+            std::string nm = "run"+std::to_string(next_run)+".dat";
+            next_run++;
+            return nm;
+        }
+
+        //! Merge the two newest runs. Deleted entries are dropped if the
+        //! result is the oldest run.
+        void merge_last() {
+            auto newer = runs.back().second;
+            auto older = runs[runs.size()-2].second;
+            bool drop_deleted = runs.size()==2;
+
+            auto fn_run = new_run_name();
+            RunWriter writer(path+fn_run);
+            auto add = [&writer,drop_deleted](const IdTileEntry& e) {
+                if (drop_deleted && (e.quadtree<0)) { return; }
+                writer.add(e);
+            };
+
+            auto a = older->begin(); auto b = newer->begin();
+            while ((a!=older->end()) || (b!=newer->end())) {
+                if (b==newer->end() || ((a!=older->end()) && (a->id < b->id))) {
+                    add(*a++);
+                } else {
+                    if ((a!=older->end()) && (a->id==b->id)) { a++; }
+                    add(*b++);
+                }
+            }
+            writer.finish();
+
+            obsolete.push_back(runs.back().first);
+            obsolete.push_back(runs[runs.size()-2].first);
+            runs.pop_back();
+            runs.back() = std::make_pair(fn_run, std::make_shared<MappedRun>(path+fn_run));
+        }
+
+        void write_manifest() {
+            {
+                std::ofstream manifest(path+"manifest.tmp", std::ios::out | std::ios::trunc);
+                manifest << "last_file " << last_file_ << "\n";
+                manifest << "next_run " << next_run << "\n";
+                for (const auto& r: runs) {
+                    manifest << "run " << r.first << "\n";
+                }
+                if (!manifest.good()) {
+                    throw std::domain_error("can't write "+path+"manifest.tmp");
+                }
+            }
+            if (std::rename((path+"manifest.tmp").c_str(), (path+"manifest").c_str())!=0) {
+                throw std::domain_error("can't rename "+path+"manifest.tmp");
+            }
+            //only remove the merged runs once the new manifest is in place
+            for (const auto& fn: obsolete) {
+                std::remove((path+fn).c_str());
+            }
+            obsolete.clear();
+        }
+};
+
+}
+
+std::shared_ptr<IdTileStore> open_idtilestore(const std::string& path) {
+    auto store = std::make_shared<idtilestoredetail::IdTileStoreImpl>(path);
+    store->load();
+    return store;
+}
+
+std::shared_ptr<IdTileStore> build_idtilestore(const std::string& path, const std::string& prfx, const std::vector<std::string>& fls, size_t numchan) {
+    namespace fs = std::experimental::filesystem;
+    if (fls.empty()) {
+        throw std::domain_error("no files");
+    }
+    if (fs::exists(fs::path(path) / "manifest")) {
+        throw std::domain_error("idtilestore at "+path+" already exists");
+    }
+    fs::create_directories(path);
+
+    auto store = std::make_shared<idtilestoredetail::IdTileStoreImpl>(path);
+    for (const auto& fl: fls) {
+        auto entries = idtilestoredetail::read_file_entries(prfx+fl, numchan);
+        Logger::Message() << "idtilestore: add " << entries.size() << " entries from " << fl;
+        store->add(std::move(entries), fl);
+    }
+    Logger::Message() << "idtilestore: " << store->num_entries() << " entries in " << store->num_runs() << " runs";
+    return store;
+}
+
+std::vector<IdTileEntry> find_idtile_entries(const std::vector<PrimitiveBlockPtr>& tiles) {
+    std::vector<IdTileEntry> entries;
+    for (const auto& bl: tiles) {
+        for (const auto& o: bl->Objects()) {
+            if (o->ChangeType()==changetype::Remove) { continue; }
+            entries.push_back(idtilestoredetail::make_entry(o->InternalId(), (size_t) o->ChangeType(), o->Quadtree(), bl->Quadtree()));
+        }
+    }
+    return entries;
+}
+
+std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtTree>> add_orig_elements_idtilestore(
+    typeid_element_map_ptr em, const std::string& prfx, const std::vector<std::string>& fls, std::shared_ptr<IdTileStore> store) {
+
+    auto ids = make_idset(em);
+    std::vector<int64> keys;
+    for (auto n: ids->nodes()) { keys.push_back(idtilestoredetail::make_key(ElementType::Node, n)); }
+    for (auto w: ids->ways()) { keys.push_back(idtilestoredetail::make_key(ElementType::Way, w)); }
+    for (auto r: ids->relations()) { keys.push_back(idtilestoredetail::make_key(ElementType::Relation, r)); }
+
+    auto entries = store->find(keys);
+    Logger::Message() << "found " << entries.size() << " of " << keys.size() << " objects in idtilestore";
+
+    auto allocs = make_qtstore_map();
+    auto qts = make_qtstore_map();
+    std::map<int64,int64> needed_nodes;
+    for (const auto& e: entries) {
+        allocs->expand(e.id, e.tile);
+        qts->expand(e.id, e.quadtree);
+        if ((e.id>>61)==0 && (em->count(std::make_pair(ElementType::Node, e.id))==0)) {
+            needed_nodes[e.id] = e.tile;
+        }
+    }
+
+    std::vector<HeaderPtr> headers;
+    for (const auto& f: fls) {
+        headers.push_back(get_header_block(prfx+f));
+    }
+    auto tree=make_tree_empty();
+    for (auto& q: headers[0]->Index()) {
+        tree->add(std::get<0>(q),1);
+    }
+
+    //the store gives the tile of each node, but not which file holds its
+    //latest version: check each file, latest first
+    for (size_t i=0; (i < fls.size()) && (!needed_nodes.empty()); i++) {
+        size_t j = fls.size()-i-1;
+        std::set<int64> tiles;
+        auto node_ids = std::make_shared<ObjsIdSet>();
+        for (const auto& n: needed_nodes) {
+            tiles.insert(n.second);
+            node_ids->add(ElementType::Node, n.first);
+        }
+
+        std::vector<int64> locs;
+        for (auto& p: headers[j]->Index()) {
+            if (tiles.count(std::get<0>(p))==1) {
+                locs.push_back(std::get<1>(p));
+            }
+        }
+        if (locs.empty()) { continue; }
+
+        Logger::Progress(i*100.0/fls.size()) << "need " << needed_nodes.size() << " nodes: read " << locs.size() << " blocks from " << fls[j];
+        auto bb = read_file_blocks(prfx+fls[j], locs, 4, 0, true, ReadBlockFlags::SkipWays | ReadBlockFlags::SkipRelations | ReadBlockFlags::SkipGeometries, node_ids);
+        for (auto bl: bb) {
+            for (auto o: bl->Objects()) {
+                if ((o->Type()!=ElementType::Node) || (o->ChangeType()==changetype::Remove) || (o->ChangeType()==changetype::Delete)) {
+                    continue;
+                }
+                auto it = needed_nodes.find(o->Id());
+                if ((it==needed_nodes.end()) || (it->second!=bl->Quadtree())) {
+                    continue;
+                }
+                o->SetChangeType(changetype::Normal);
+                (*em)[std::make_pair(ElementType::Node, o->Id())] = o;
+                needed_nodes.erase(it);
+            }
+        }
+    }
+    if (!needed_nodes.empty()) {
+        Logger::Message() << "idtilestore: " << needed_nodes.size() << " nodes not found";
+    }
+    Logger::Progress(100) << " have " << em->size() << "objs";
+
+    return std::make_tuple(allocs, qts, tree);
+}
+
+}
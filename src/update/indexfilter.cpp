@@ -0,0 +1,310 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/update/indexfilter.hpp"
+#include "oqt/update/update.hpp"
+#include "oqt/pbfformat/fileblock.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/writepbffile.hpp"
+#include "oqt/utils/pbf/packedint.hpp"
+#include "oqt/utils/pbf/protobuf.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/operatingsystem.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+namespace oqt {
+namespace indexfilterdetail {
+
+//! Number of id ranges in each FilterRanges block
+const size_t ranges_per_block = 1<<16;
+
+//! The id ranges of each element type found in one IndexBlock
+struct TileRanges {
+    int64 loc;
+    std::vector<int64> ranges[3];
+};
+
+std::shared_ptr<TileRanges> read_tile_ranges(std::shared_ptr<FileBlock> bl, size_t range_bits) {
+    if (bl->blocktype!="IndexBlock") {
+        throw std::domain_error("expected IndexBlock, not "+bl->blocktype);
+    }
+    auto result = std::make_shared<TileRanges>();
+    result->loc = bl->file_position;
+    
+    auto data = bl->get_data();
+    size_t pos=0;
+    for (auto tg = read_pbf_tag(data,pos); tg.tag>0; tg = read_pbf_tag(data,pos)) {
+        if ((tg.tag>=2) && (tg.tag<=4)) {
+            //ids are sorted, so each range appears in one run
+            auto& rr = result->ranges[tg.tag-2];
+            for (auto id: read_packed_delta(tg.data)) {
+                int64 r = id >> range_bits;
+                if (rr.empty() || (rr.back()!=r)) {
+                    rr.push_back(r);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+std::string make_ranges_block(size_t ty, std::vector<std::pair<int64,int64>>::const_iterator begin, std::vector<std::pair<int64,int64>>::const_iterator end) {
+    std::vector<int64> ranges, tiles;
+    std::vector<uint64> counts;
+    for (auto it=begin; it!=end; ++it) {
+        if (ranges.empty() || (ranges.back()!=it->first)) {
+            ranges.push_back(it->first);
+            counts.push_back(0);
+        }
+        counts.back()++;
+        tiles.push_back(it->second);
+    }
+    std::list<PbfTag> mm{
+        PbfTag{1, ty, ""},
+        PbfTag{2, 0, write_packed_delta(ranges)},
+        PbfTag{3, 0, write_packed_int(counts)},
+        PbfTag{4, 0, write_packed_delta(tiles)}};
+    return prepare_file_block("FilterRanges", pack_pbf_tags(mm));
+}
+
+//the size and modification time of fn-index.pbf when the filter file was
+//written. A filter file is only used if these still match.
+std::pair<int64,int64> index_file_stamp(const std::string& fn) {
+    return std::make_pair(file_size(fn+"-index.pbf"), file_timestamp(fn+"-index.pbf"));
+}
+
+std::string make_filter_header(const std::pair<int64,int64>& stamp, size_t range_bits) {
+    std::list<PbfTag> mm{PbfTag{1, zig_zag(stamp.first), ""}, PbfTag{2, zig_zag(stamp.second), ""}, PbfTag{3, range_bits, ""}};
+    return prepare_file_block("FilterHeader", pack_pbf_tags(mm));
+}
+
+//! The range_bits of \param fn-filter.pbf, or 0 if it should not be used
+size_t check_filter_header(const std::string& fn) {
+    std::ifstream infile(fn+"-filter.pbf", std::ios::in | std::ios::binary);
+    if (!infile.good()) { return 0; }
+    
+    auto fb = read_file_block(0, infile);
+    if (!fb || (fb->blocktype!="FilterHeader")) {
+        Logger::Message() << fn << "-filter.pbf has no header: not using";
+        return 0;
+    }
+    auto data = fb->get_data();
+    std::pair<int64,int64> stamp{-1,-1};
+    size_t range_bits=0;
+    size_t pos=0;
+    for (auto tg = read_pbf_tag(data,pos); tg.tag>0; tg = read_pbf_tag(data,pos)) {
+        if (tg.tag==1) { stamp.first = un_zig_zag(tg.value); }
+        else if (tg.tag==2) { stamp.second = un_zig_zag(tg.value); }
+        else if (tg.tag==3) { range_bits = tg.value; }
+    }
+    if (range_bits==0) {
+        Logger::Message() << fn << "-filter.pbf is in an older format: not using";
+        return 0;
+    }
+    if (stamp != index_file_stamp(fn)) {
+        Logger::Message() << fn << "-filter.pbf does not match " << fn << "-index.pbf: not using";
+        return 0;
+    }
+    return range_bits;
+}
+
+//! The tile locations, or the candidate tiles, from one block of the filter file
+struct FilterResult {
+    std::vector<int64> locs;
+    std::vector<int64> tiles;
+};
+
+/*! Find the tiles listed in a FilterRanges block for the ranges of
+ * \param ids, each of which is looked up once: ids and ranges are both
+ * sorted, so they are merged in one pass. */
+void find_range_tiles(const std::string& data, const std::vector<std::vector<int64>>& ids, size_t range_bits, std::vector<int64>& result) {
+    size_t ty=0;
+    std::vector<int64> ranges, tiles;
+    std::vector<uint64> counts;
+    size_t pos=0;
+    for (auto tg = read_pbf_tag(data,pos); tg.tag>0; tg = read_pbf_tag(data,pos)) {
+        if (tg.tag==1) { ty = tg.value; }
+        else if (tg.tag==2) { ranges = read_packed_delta(tg.data); }
+        else if (tg.tag==3) { counts = read_packed_int(tg.data); }
+        else if (tg.tag==4) { tiles = read_packed_delta(tg.data); }
+    }
+    if ((ty>2) || ranges.empty() || (counts.size()!=ranges.size())) {
+        throw std::domain_error("bad FilterRanges block");
+    }
+    
+    const auto& tyids = ids[ty];
+    auto it = std::lower_bound(tyids.begin(), tyids.end(), ranges.front() << range_bits);
+    size_t ri=0, ti=0;
+    for ( ; it!=tyids.end(); ++it) {
+        int64 r = (*it) >> range_bits;
+        while ((ri < ranges.size()) && (ranges[ri] < r)) {
+            ti += counts[ri];
+            ri++;
+        }
+        if (ri==ranges.size()) {
+            break;
+        }
+        if (ranges[ri]==r) {
+            result.insert(result.end(), tiles.begin()+ti, tiles.begin()+ti+counts[ri]);
+            //later ids in the same range add nothing
+            ti += counts[ri];
+            ri++;
+        }
+    }
+}
+
+}
+
+size_t write_index_filter_file(const std::string& fn, size_t numchan, size_t range_bits) {
+    using namespace indexfilterdetail;
+    if ((numchan==0) || (numchan > 8)) {
+        throw std::domain_error("numchan should be between 1 and 8");
+    }
+    if ((range_bits==0) || (range_bits > 32)) {
+        throw std::domain_error("range_bits should be between 1 and 32");
+    }
+    auto stamp = index_file_stamp(fn);
+    
+    //(range, tile) pairs for each element type
+    std::vector<std::vector<std::pair<int64,int64>>> ranges(3);
+    std::vector<int64> tile_locs;
+    auto conv_func = [range_bits](std::shared_ptr<FileBlock> bl) -> std::shared_ptr<TileRanges> {
+        if (!bl) { return nullptr; }
+        return read_tile_ranges(bl, range_bits);
+    };
+    //the callback is called in file order, so tiles are numbered as in the index file
+    auto cb = [&ranges, &tile_locs](std::shared_ptr<TileRanges> tr) {
+        if (!tr) { return; }
+        int64 tile = tile_locs.size();
+        tile_locs.push_back(tr->loc);
+        for (size_t ty=0; ty < 3; ty++) {
+            for (auto r: tr->ranges[ty]) {
+                ranges[ty].push_back(std::make_pair(r, tile));
+            }
+        }
+    };
+    read_blocks_convfunc<TileRanges>(fn+"-index.pbf", cb, {}, numchan, conv_func);
+    
+    auto out_obj = make_pbffilewriter(fn+"-filter.pbf", nullptr);
+    out_obj->writeBlock(-1, make_filter_header(stamp, range_bits));
+    out_obj->writeBlock(-1, prepare_file_block("FilterTiles", pack_pbf_tags({PbfTag{1, 0, write_packed_delta(tile_locs)}})));
+    
+    size_t num_entries=0;
+    for (size_t ty=0; ty < 3; ty++) {
+        auto& rr = ranges[ty];
+        std::sort(rr.begin(), rr.end());
+        num_entries += rr.size();
+        
+        //split between blocks at range boundaries
+        size_t num_ranges=0;
+        auto begin = rr.begin();
+        for (auto it=rr.begin(); it!=rr.end(); ++it) {
+            if ((it==rr.begin()) || (it->first != (it-1)->first)) {
+                if (num_ranges==ranges_per_block) {
+                    out_obj->writeBlock(-1, make_ranges_block(ty, begin, it));
+                    begin=it;
+                    num_ranges=0;
+                }
+                num_ranges++;
+            }
+        }
+        if (begin!=rr.end()) {
+            out_obj->writeBlock(-1, make_ranges_block(ty, begin, rr.end()));
+        }
+        std::vector<std::pair<int64,int64>> e;
+        rr.swap(e);
+    }
+    
+    auto ii = out_obj->finish();
+    Logger::Message() << "written filter for " << tile_locs.size() << " tiles, " << num_entries << " id ranges, "
+        << std::get<1>(ii.back())+std::get<2>(ii.back()) << " bytes";
+    return ii.size();
+}
+
+std::set<int64> check_index_filter_file(const std::string& fn, HeaderPtr head, size_t numchan, std::shared_ptr<ObjsIdSet> ids, size_t range_bits) {
+    using namespace indexfilterdetail;
+    if ((numchan==0) || (numchan > 8)) {
+        throw std::domain_error("numchan should be between 1 and 8");
+    }
+    
+    auto sorted_ids = std::make_shared<std::vector<std::vector<int64>>>(3);
+    (*sorted_ids)[0].assign(ids->nodes().begin(), ids->nodes().end());
+    (*sorted_ids)[1].assign(ids->ways().begin(), ids->ways().end());
+    (*sorted_ids)[2].assign(ids->relations().begin(), ids->relations().end());
+    
+    auto conv_func = [sorted_ids, range_bits](std::shared_ptr<FileBlock> bl) -> std::shared_ptr<FilterResult> {
+        if (!bl) { return nullptr; }
+        auto result = std::make_shared<FilterResult>();
+        if (bl->blocktype=="FilterTiles") {
+            auto data = bl->get_data();
+            size_t pos=0;
+            for (auto tg = read_pbf_tag(data,pos); tg.tag>0; tg = read_pbf_tag(data,pos)) {
+                if (tg.tag==1) { result->locs = read_packed_delta(tg.data); }
+            }
+        } else if (bl->blocktype=="FilterRanges") {
+            find_range_tiles(bl->get_data(), *sorted_ids, range_bits, result->tiles);
+        } else if (bl->blocktype!="FilterHeader") {
+            throw std::domain_error("expected FilterRanges, not "+bl->blocktype);
+        }
+        return result;
+    };
+    
+    std::vector<int64> tile_locs, tiles;
+    auto cb = [&tile_locs, &tiles](std::shared_ptr<FilterResult> p) {
+        if (!p) { return; }
+        if (!p->locs.empty()) {
+            tile_locs.swap(p->locs);
+        }
+        tiles.insert(tiles.end(), p->tiles.begin(), p->tiles.end());
+    };
+    read_blocks_convfunc<FilterResult>(fn+"-filter.pbf", cb, {}, numchan, conv_func);
+    
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+    if (tiles.empty()) {
+        Logger::Message() << fn << ": no tiles passed filter";
+        return std::set<int64>();
+    }
+    
+    std::vector<int64> locs;
+    for (auto t: tiles) {
+        locs.push_back(tile_locs.at(t));
+    }
+    auto result = check_index_file(fn+"-index.pbf", head, std::min(numchan, locs.size()), ids, locs);
+    Logger::Message() << fn << ": " << locs.size() << " of " << tile_locs.size() << " tiles passed filter, " << result.size() << " match";
+    return result;
+}
+
+std::set<int64> check_index(const std::string& fn, HeaderPtr head, size_t numchan, IdSetPtr ids) {
+    auto objs_ids = std::dynamic_pointer_cast<ObjsIdSet>(ids);
+    if (objs_ids) {
+        size_t range_bits = indexfilterdetail::check_filter_header(fn);
+        if (range_bits>0) {
+            return check_index_filter_file(fn, head, numchan, objs_ids, range_bits);
+        }
+    }
+    return check_index_file(fn+"-index.pbf", head, numchan, ids);
+}
+
+}
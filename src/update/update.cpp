@@ -21,8 +21,9 @@
  *****************************************************************************/
 
 #include "oqt/update/update.hpp"
+#include "oqt/update/idtilestore.hpp"
+#include "oqt/update/indexfilter.hpp"
 
-#include "gzstream.hpp"
 
 
 #include "oqt/pbfformat/readfile.hpp"
@@ -34,6 +35,7 @@
 #include "oqt/elements/way.hpp"
 #include "oqt/elements/relation.hpp"
 #include "oqt/pbfformat/objsidset.hpp"
+#include "oqt/pbfformat/idtileindex.hpp"
 
 
 #include "oqt/pbfformat/writeblock.hpp"
@@ -136,7 +138,7 @@ std::string makeIndexBlock(PrimitiveBlockPtr in) {
     return prepare_file_block("IndexBlock", dd);
 }
 
-size_t write_index_file(const std::string& fn, size_t numchan, const std::string& outfn_in) {
+size_t write_index_file(const std::string& fn, size_t numchan, const std::string& outfn_in, bool idtile) {
     if ((numchan==0) || (numchan > 8)) {
         throw std::domain_error("numchan should be between 1 and 8");
     }
@@ -145,15 +147,21 @@ size_t write_index_file(const std::string& fn, size_t numchan, const std::string
         outfn = fn + "-index.pbf";
     }
     
-    std::vector<int64> locs;
+    std::vector<int64> locs, qts;
     auto hh = get_header_block(fn);
     if (hh && (!hh->Index().empty())) {
         for (auto& l : hh->Index()) {
+            qts.push_back(std::get<0>(l));
             locs.push_back(std::get<1>(l));
         }
     } else {
         throw std::domain_error("not an indexed pbf file: "+fn);
     }
+    
+    std::shared_ptr<IdTileIndexBuilder> idtile_builder;
+    if (idtile) {
+        idtile_builder = std::make_shared<IdTileIndexBuilder>(qts, fn+"-idtile.idx");
+    }
         
     auto out_obj = make_pbffilewriter(outfn, nullptr);
     auto out_callback = multi_threaded_callback<keystring>::make([out_obj](keystring_ptr p) {
@@ -167,7 +175,7 @@ size_t write_index_file(const std::string& fn, size_t numchan, const std::string
     for (auto oo: out_callback) {
         bool prog=(converts.empty() && (fn[fn.size()-1]=='f'));
         converts.push_back(threaded_callback<PrimitiveBlock>::make(
-            [oo,prog](PrimitiveBlockPtr mb) {
+            [oo,prog,idtile_builder](PrimitiveBlockPtr mb) {
                 if (!mb) {
                     if (prog) {
                         Logger::Progress(100) << "write index file";
@@ -177,6 +185,9 @@ size_t write_index_file(const std::string& fn, size_t numchan, const std::string
                 if (prog && ((mb->Index() % 1680)==0)) {
                     Logger::Progress(mb->FileProgress()) << "write index file " << quadtree::string(mb->Quadtree());
                 }
+                if (idtile_builder) {
+                    idtile_builder->add(mb);
+                }
                 oo(std::make_shared<keystring>(mb->Quadtree(), makeIndexBlock(mb)));
             }
         ));
@@ -189,6 +200,9 @@ size_t write_index_file(const std::string& fn, size_t numchan, const std::string
     auto ii = out_obj->finish();
     
     Logger::Message() << "written " << ii.size() << " blocks, " << std::get<1>(ii.back())+std::get<2>(ii.back()) << " bytes";
+    if (idtile_builder) {
+        idtile_builder->finish(fn+"-idtile.idx");
+    }
     return ii.size();
 }
 
@@ -214,7 +228,7 @@ void checkIdxBlock(const std::string& ss, IdSetPtr ids, std::shared_ptr<std::set
     }
 }
 
-std::set<int64> check_index_file(const std::string& idxfn, HeaderPtr head, size_t numchan, IdSetPtr ids) {
+std::set<int64> check_index_file(const std::string& idxfn, HeaderPtr head, size_t numchan, IdSetPtr ids, std::vector<int64> locs) {
     if ((numchan==0) || (numchan > 8)) {
         throw std::domain_error("numchan should be between 1 and 8");
     }
@@ -243,7 +257,7 @@ std::set<int64> check_index_file(const std::string& idxfn, HeaderPtr head, size_
         }
     };
     
-    read_blocks_convfunc<std::set<int64>>(idxfn, cb, {}, numchan, conv_func);
+    read_blocks_convfunc<std::set<int64>>(idxfn, cb, locs, numchan, conv_func);
     
     return result;
 }
@@ -318,7 +332,7 @@ std::tuple<std::shared_ptr<QtTree>,std::vector<std::string>, src_locs_map> check
         
         
         Logger::Progress(i*100.0/fls.size()) << "scan " << fn+"-index.pbf [" << passed.size() << " locs]";
-        auto p = check_index_file(fn+"-index.pbf", hh, 4, ids);
+        auto p = check_index(fn, hh, 4, ids);
         for (auto& q: p) {
             passed.insert(q);
         }
@@ -380,7 +394,7 @@ std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtT
     for (auto& f: fls) {
         headers.push_back(get_header_block(prfx+f));
         Logger::Progress(fi*100/fls.size()) << "scan " << f+"-index.pbf [" << tt.size() << " locs]";
-        auto p = check_index_file(prfx+f+"-index.pbf", headers.back(), (headers.back()->Index().size()>20000 ? 4 : 1), ids);
+        auto p = check_index(prfx+f, headers.back(), (headers.back()->Index().size()>20000 ? 4 : 1), ids);
         for (auto& q: p) { tt.insert(q); }
         ++fi;
     }
@@ -458,7 +472,7 @@ std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtT
     for (auto& f: fls) {
         headers.push_back(get_header_block(prfx+f));
         Logger::Progress(fi*100/fls.size()) << "scan " << f+"-index.pbf [" << tt.size() << " locs]";
-        auto p = check_index_file(prfx+f+"-index.pbf", headers.back(), (headers.back()->Index().size()>20000 ? 4 : 1), ids);
+        auto p = check_index(prfx+f, headers.back(), (headers.back()->Index().size()>20000 ? 4 : 1), ids);
         for (auto& q: p) { tt.insert(q); }
         ++fi;
     }
@@ -479,7 +493,7 @@ std::tuple<std::shared_ptr<QtStore>,std::shared_ptr<QtStore>,std::shared_ptr<QtT
         std::set<int64> tt;
         auto head = get_header_block(fn);
         Logger::Progress(i*100/fls.size()) << "scan " << fn+"-index.pbf [" << tt.size() << " locs]";
-        auto p = check_index_file(fn+"-index.pbf", head, (head->Index().size()>20000 ? 4 : 1), ids);
+        auto p = check_index(fn, head, (head->Index().size()>20000 ? 4 : 1), ids);
         for (auto& q: p) { tt.insert(q); }
         
         std::vector<int64> locs;
@@ -699,19 +713,30 @@ std::vector<PrimitiveBlockPtr> find_change_tiles(
 
 
 
-std::pair<int64,int64> find_change_all(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn) {
+std::pair<int64,int64> find_change_all(const std::vector<std::string>& src_filenames, const std::string& prfx, const std::vector<std::string>& fls, int64 st, int64 et, const std::string& outfn, size_t numchan, const std::string& idtilestore) {
     typeid_element_map_ptr objs = std::make_shared<typeid_element_map>();
     
     if (src_filenames.empty()) {
         throw std::domain_error("no src_filenames");
     }
-    for (const auto& src: src_filenames) {
-        gzstream::igzstream src_fl(src.c_str());
-        read_xml_change_file_em(&src_fl, objs, true);
+    add_change_objects(objs, read_xml_change_files_parallel(src_filenames, numchan, true));
+
+    std::shared_ptr<IdTileStore> store;
+    if (!idtilestore.empty()) {
+        store = open_idtilestore(idtilestore);
+        if (store->last_file()!=fls.back()) {
+            Logger::Message() << "idtilestore " << idtilestore << " is at " << store->last_file() << ", not " << fls.back() << ": ignoring";
+            store.reset();
+        }
     }
+
     std::shared_ptr<QtStore> qts, orig_allocs;
     std::shared_ptr<QtTree> tree;
-    std::tie(orig_allocs,qts,tree) =  add_orig_elements(objs, prfx, fls);
+    if (store) {
+        std::tie(orig_allocs,qts,tree) =  add_orig_elements_idtilestore(objs, prfx, fls, store);
+    } else {
+        std::tie(orig_allocs,qts,tree) =  add_orig_elements(objs, prfx, fls);
+    }
     calc_change_qts(objs, qts);
     auto tiles = find_change_tiles(objs, orig_allocs, tree, st, et);
 
@@ -728,6 +753,15 @@ std::pair<int64,int64> find_change_all(const std::vector<std::string>& src_filen
 
     auto xx=out->finish();
     int64 gp = std::get<1>(xx.back())+std::get<2>(xx.back());
+
+    if (store) {
+        //the store holds file names relative to prfx, as in fls
+        std::string fn = outfn;
+        if ((!prfx.empty()) && (fn.compare(0, prfx.size(), prfx)==0)) {
+            fn = fn.substr(prfx.size());
+        }
+        store->add(find_idtile_entries(tiles), fn);
+    }
     
     return std::make_pair(tiles.size(), gp);
 }
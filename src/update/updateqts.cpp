@@ -0,0 +1,645 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/update/updateqts.hpp"
+#include "oqt/calcqts/qtstore.hpp"
+#include "oqt/calcqts/writeqts.hpp"
+#include "oqt/pbfformat/readfileblocks.hpp"
+#include "oqt/pbfformat/readminimal.hpp"
+
+#include "oqt/elements/node.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/elements/relation.hpp"
+
+#include "oqt/utils/pbf/packedint.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/string.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace oqt {
+namespace updateqtsdetail {
+
+typedef std::vector<int64> id_vec;
+typedef std::vector<std::pair<ElementType,int64>> member_vec;
+
+void sort_unique(id_vec& ids) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+bool contains_id(const id_vec& ids, int64 id) {
+    return std::binary_search(ids.begin(), ids.end(), id);
+}
+
+int64 internal_id(ElementType ty, int64 id) {
+    return (((int64) ty) << 61) | id;
+}
+
+member_vec read_relation_members(const std::string& tys_data, const std::string& refs_data) {
+    auto tys = read_packed_int(tys_data);
+    auto refs = read_packed_delta(refs_data);
+    member_vec result;
+    result.reserve(tys.size());
+    for (size_t i=0; i < tys.size(); i++) {
+        result.push_back(std::make_pair((ElementType) tys[i], refs.at(i)));
+    }
+    return result;
+}
+
+void add_change_object(typeid_element_map_ptr em, ElementPtr o) {
+    auto k = std::make_pair(o->Type(), o->Id());
+    auto it = em->find(k);
+    if (it==em->end()) {
+        (*em)[k]=o;
+    } else if (o->Info().version > it->second->Info().version) {
+        it->second=o;
+    }
+}
+
+//ways which are changed or have a changed node, and all relations
+struct WaysRelationsBlock {
+    std::vector<std::pair<int64,id_vec>> ways;
+    std::vector<std::pair<int64,member_vec>> relations;
+    double file_progress;
+};
+
+//locations of affected nodes, and (node,way) pairs for each affected node
+struct NodesWaysBlock {
+    std::vector<std::tuple<int64,int32,int32>> nodes;
+    std::vector<std::pair<int64,int64>> node_ways;
+    double file_progress;
+};
+
+struct QuadtreesBlock {
+    std::vector<std::pair<int64,int64>> qts;
+    double file_progress;
+};
+
+
+class UpdateQts {
+    public:
+        UpdateQts(typeid_element_map_ptr em_, double buffer_, size_t max_depth_)
+            : em(em_), buffer(buffer_), max_depth(max_depth_), nodes_sorted(false), missing_nodes(0) {
+
+            for (const auto& pp: *em) {
+                int64 id = pp.first.second;
+                bool deleted = pp.second->ChangeType()==changetype::Delete;
+                if (pp.first.first==ElementType::Node) {
+                    changed_nodes.push_back(id);
+                    affected_nodes.push_back(id);
+                } else if (pp.first.first==ElementType::Way) {
+                    changed_ways.push_back(id);
+                    if (!deleted) {
+                        auto w = std::dynamic_pointer_cast<Way>(pp.second);
+                        for (auto r: w->Refs()) {
+                            affected_nodes.push_back(r);
+                            node_parents.push_back(std::make_pair(r, id));
+                        }
+                    }
+                } else if (pp.first.first==ElementType::Relation) {
+                    changed_relations.push_back(id);
+                }
+            }
+            //typeid_element_map is ordered by type then id, so these are already sorted
+            Logger::Message() << "have " << changed_nodes.size() << " changed nodes, "
+                << changed_ways.size() << " changed ways, "
+                << changed_relations.size() << " changed relations";
+        }
+
+        std::shared_ptr<WaysRelationsBlock> filter_ways_relations(std::shared_ptr<FileBlock> fb) const {
+            auto result = std::make_shared<WaysRelationsBlock>();
+            result->file_progress = fb->file_progress;
+            if (fb->blocktype!="OSMData") { return result; }
+
+            auto mb = read_minimal_block(fb->idx, fb->get_data(),
+                ReadBlockFlags::SkipNodes | ReadBlockFlags::SkipInfo | ReadBlockFlags::SkipGeometries);
+
+            for (const auto& w: mb->ways) {
+                auto refs = read_packed_delta(w.refs_data);
+                bool keep = contains_id(changed_ways, w.id);
+                for (auto it=refs.begin(); (!keep) && (it < refs.end()); ++it) {
+                    keep = contains_id(changed_nodes, *it);
+                }
+                if (keep) {
+                    result->ways.push_back(std::make_pair((int64) w.id, std::move(refs)));
+                }
+            }
+            for (const auto& r: mb->relations) {
+                result->relations.push_back(std::make_pair((int64) r.id, read_relation_members(r.tys_data, r.refs_data)));
+            }
+            return result;
+        }
+
+        void add_ways_relations(std::shared_ptr<WaysRelationsBlock> bl) {
+            if (!bl) { return; }
+            Logger::Progress(bl->file_progress) << "find affected ways and relations: " << affected_ways.size() << " ways, " << affected_relations.size() << " relations";
+
+            for (auto& w: bl->ways) {
+                //also includes the original nodes of changed ways, which may have been removed
+                affected_nodes.insert(affected_nodes.end(), w.second.begin(), w.second.end());
+                nodes_sorted=false;
+                if (!contains_id(changed_ways, w.first)) {
+                    affected_ways[w.first] = std::move(w.second);
+                }
+            }
+            if (bl->relations.empty()) { return; }
+
+            if (!nodes_sorted) {
+                sort_unique(affected_nodes);
+                nodes_sorted=true;
+            }
+            for (auto& r: bl->relations) {
+                if (contains_id(changed_relations, r.first)) { continue; }
+
+                bool affected=false, has_relations=false;
+                for (const auto& m: r.second) {
+                    if (m.first==ElementType::Node) {
+                        affected = affected || contains_id(affected_nodes, m.second);
+                    } else if (m.first==ElementType::Way) {
+                        affected = affected || contains_id(changed_ways, m.second) || (affected_ways.count(m.second)>0);
+                    } else if (m.first==ElementType::Relation) {
+                        has_relations=true;
+                        affected = affected || contains_id(changed_relations, m.second);
+                    }
+                }
+                if (affected) {
+                    affected_relations.insert(r.first);
+                }
+                if (affected || has_relations) {
+                    relation_members[r.first] = std::move(r.second);
+                }
+            }
+        }
+
+        void finish_ways_relations() {
+            sort_unique(affected_nodes);
+            nodes_sorted=true;
+
+            std::multimap<int64,int64> parents;
+            for (const auto& rm: relation_members) {
+                for (const auto& m: rm.second) {
+                    if (m.first==ElementType::Relation) {
+                        parents.insert(std::make_pair(m.second, rm.first));
+                    }
+                }
+            }
+
+            std::vector<int64> queue(changed_relations.begin(), changed_relations.end());
+            queue.insert(queue.end(), affected_relations.begin(), affected_relations.end());
+            for (auto r: changed_relations) {
+                if (em->at(std::make_pair(ElementType::Relation, r))->ChangeType()!=changetype::Delete) {
+                    affected_relations.insert(r);
+                }
+            }
+            while (!queue.empty()) {
+                int64 r = queue.back();
+                queue.pop_back();
+                auto rng = parents.equal_range(r);
+                for (auto it=rng.first; it!=rng.second; ++it) {
+                    if (affected_relations.insert(it->second).second) {
+                        queue.push_back(it->second);
+                    }
+                }
+            }
+
+            for (auto it=relation_members.begin(); it!=relation_members.end(); ) {
+                if (affected_relations.count(it->first)==0) {
+                    it = relation_members.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            std::set_difference(affected_nodes.begin(), affected_nodes.end(),
+                changed_nodes.begin(), changed_nodes.end(),
+                std::back_inserter(location_nodes));
+
+            Logger::Message() << "have " << affected_nodes.size() << " affected nodes, "
+                << affected_ways.size() << " affected ways, "
+                << affected_relations.size() << " affected relations";
+        }
+
+        std::shared_ptr<NodesWaysBlock> filter_nodes_ways(std::shared_ptr<FileBlock> fb) const {
+            auto result = std::make_shared<NodesWaysBlock>();
+            result->file_progress = fb->file_progress;
+            if (fb->blocktype!="OSMData") { return result; }
+
+            auto mb = read_minimal_block(fb->idx, fb->get_data(),
+                ReadBlockFlags::SkipRelations | ReadBlockFlags::SkipInfo | ReadBlockFlags::SkipGeometries);
+
+            for (const auto& n: mb->nodes) {
+                if (contains_id(location_nodes, n.id)) {
+                    result->nodes.push_back(std::make_tuple((int64) n.id, n.lon, n.lat));
+                }
+            }
+            for (const auto& w: mb->ways) {
+                if (contains_id(changed_ways, w.id)) { continue; }
+                for (auto r: read_packed_delta(w.refs_data)) {
+                    if (contains_id(affected_nodes, r)) {
+                        result->node_ways.push_back(std::make_pair(r, (int64) w.id));
+                    }
+                }
+            }
+            return result;
+        }
+
+        void add_nodes_ways(std::shared_ptr<NodesWaysBlock> bl) {
+            if (!bl) { return; }
+            Logger::Progress(bl->file_progress) << "find node locations and parent ways: " << node_locations.size() << " locations, " << node_parents.size() << " parents";
+            node_locations.insert(node_locations.end(), bl->nodes.begin(), bl->nodes.end());
+            node_parents.insert(node_parents.end(), bl->node_ways.begin(), bl->node_ways.end());
+        }
+
+        void finish_nodes_ways() {
+            std::sort(node_locations.begin(), node_locations.end());
+            std::sort(node_parents.begin(), node_parents.end());
+            node_parents.erase(std::unique(node_parents.begin(), node_parents.end()), node_parents.end());
+        }
+
+        void calculate_ways() {
+            for (const auto& pp: *em) {
+                if ((pp.first.first==ElementType::Way)) {
+                    if (pp.second->ChangeType()==changetype::Delete) {
+                        new_qts[internal_id(ElementType::Way, pp.first.second)] = -1;
+                    } else {
+                        auto w = std::dynamic_pointer_cast<Way>(pp.second);
+                        calculate_way(w->Id(), w->Refs());
+                    }
+                }
+            }
+            for (const auto& w: affected_ways) {
+                calculate_way(w.first, w.second);
+            }
+            if (missing_nodes>0) {
+                Logger::Message() << "have " << missing_nodes << " missing way nodes";
+            }
+        }
+
+
+        id_vec needed_quadtrees() const {
+            id_vec result;
+            for (const auto& np: node_parents) {
+                int64 k = internal_id(ElementType::Way, np.second);
+                if (new_qts.count(k)==0) {
+                    result.push_back(k);
+                }
+            }
+            for (auto r: affected_relations) {
+                for (const auto& m: members(r)) {
+                    if (m.first==ElementType::Node) {
+                        if (!contains_id(affected_nodes, m.second)) {
+                            result.push_back(m.second);
+                        }
+                    } else if (m.first==ElementType::Way) {
+                        int64 k = internal_id(ElementType::Way, m.second);
+                        if (new_qts.count(k)==0) {
+                            result.push_back(k);
+                        }
+                    } else if (m.first==ElementType::Relation) {
+                        if (affected_relations.count(m.second)==0) {
+                            result.push_back(internal_id(ElementType::Relation, m.second));
+                        }
+                    }
+                }
+            }
+            sort_unique(result);
+            return result;
+        }
+
+        void add_orig_quadtrees(std::shared_ptr<QuadtreesBlock> bl) {
+            if (!bl) { return; }
+            Logger::Progress(bl->file_progress) << "read original quadtrees: have " << orig_qts.size();
+            orig_qts.insert(orig_qts.end(), bl->qts.begin(), bl->qts.end());
+        }
+
+        void calculate_nodes() {
+            std::sort(orig_qts.begin(), orig_qts.end());
+
+            for (auto n: affected_nodes) {
+                auto it = em->find(std::make_pair(ElementType::Node, n));
+                if ((it!=em->end()) && (it->second->ChangeType()==changetype::Delete)) {
+                    new_qts[n]=-1;
+                    continue;
+                }
+                int64 qt=-1;
+                auto rng = std::equal_range(node_parents.begin(), node_parents.end(),
+                    std::make_pair(n, int64(0)),
+                    [](const std::pair<int64,int64>& l, const std::pair<int64,int64>& r) { return l.first < r.first; });
+                for (auto pt=rng.first; pt < rng.second; ++pt) {
+                    int64 q = current_quadtree(internal_id(ElementType::Way, pt->second));
+                    if (q>=0) {
+                        qt = quadtree::common(qt, q);
+                    }
+                }
+                if (qt<0) {
+                    int32 lon, lat;
+                    if (find_location(n, lon, lat)) {
+                        qt = quadtree::calculate(lon, lat, lon, lat, buffer, max_depth);
+                    }
+                }
+                new_qts[n]=qt;
+            }
+        }
+
+        void calculate_relations() {
+            auto rel_qts = make_qtstore_map();
+            std::vector<std::pair<int64,int64>> rel_rels;
+            for (auto r: affected_relations) {
+                auto mems = members(r);
+                if (mems.empty()) {
+                    rel_qts->expand(r, 0);
+                }
+                for (const auto& m: mems) {
+                    if (m.first==ElementType::Relation) {
+                        rel_rels.push_back(std::make_pair(m.second, r));
+                    } else {
+                        int64 q = current_quadtree(internal_id(m.first, m.second));
+                        if (q>=0) {
+                            rel_qts->expand(r, q);
+                        }
+                    }
+                }
+            }
+
+            auto child_qt = [this, &rel_qts](int64 c) -> int64 {
+                if (affected_relations.count(c)>0) {
+                    return rel_qts->at(c);
+                }
+                return orig_quadtree(internal_id(ElementType::Relation, c));
+            };
+
+            //same as CalculateRelations::finish_alt
+            for (size_t i=0; i < 5; i++) {
+                for (const auto& rr: rel_rels) {
+                    int64 q = child_qt(rr.first);
+                    if (q>=0) {
+                        rel_qts->expand(rr.second, q);
+                    }
+                }
+            }
+            for (const auto& rr: rel_rels) {
+                if (!rel_qts->contains(rr.second)) {
+                    rel_qts->expand(rr.second, 0);
+                }
+            }
+
+            for (auto r: changed_relations) {
+                new_qts[internal_id(ElementType::Relation, r)] = -1;
+            }
+            for (auto r: affected_relations) {
+                new_qts[internal_id(ElementType::Relation, r)] = rel_qts->at(r);
+            }
+        }
+
+        const std::map<int64,int64>& new_quadtrees() const { return new_qts; }
+
+    private:
+
+        member_vec members(int64 r) const {
+            auto it = em->find(std::make_pair(ElementType::Relation, r));
+            if (it!=em->end()) {
+                member_vec result;
+                if (it->second->ChangeType()!=changetype::Delete) {
+                    auto rel = std::dynamic_pointer_cast<Relation>(it->second);
+                    for (const auto& m: rel->Members()) {
+                        result.push_back(std::make_pair(m.type, m.ref));
+                    }
+                }
+                return result;
+            }
+            return relation_members.at(r);
+        }
+
+        bool find_location(int64 n, int32& lon, int32& lat) const {
+            auto it = em->find(std::make_pair(ElementType::Node, n));
+            if (it!=em->end()) {
+                if (it->second->ChangeType()==changetype::Delete) {
+                    return false;
+                }
+                auto nd = std::dynamic_pointer_cast<Node>(it->second);
+                lon = nd->Lon();
+                lat = nd->Lat();
+                return true;
+            }
+            auto jt = std::lower_bound(node_locations.begin(), node_locations.end(), std::make_tuple(n, int32(-2147483647-1), int32(-2147483647-1)));
+            if ((jt==node_locations.end()) || (std::get<0>(*jt)!=n)) {
+                return false;
+            }
+            lon = std::get<1>(*jt);
+            lat = std::get<2>(*jt);
+            return true;
+        }
+
+        void calculate_way(int64 id, const id_vec& refs) {
+            bbox bx;
+            bool found=false;
+            for (auto r: refs) {
+                int32 lon, lat;
+                if (find_location(r, lon, lat)) {
+                    expand_point(bx, lon, lat);
+                    found=true;
+                } else {
+                    missing_nodes++;
+                }
+            }
+            int64 k = internal_id(ElementType::Way, id);
+            if (!found) {
+                new_qts[k] = -1;
+                return;
+            }
+            new_qts[k] = quadtree::calculate(bx.minx, bx.miny, bx.maxx, bx.maxy, buffer, max_depth);
+        }
+
+        int64 orig_quadtree(int64 k) const {
+            auto it = std::lower_bound(orig_qts.begin(), orig_qts.end(), std::make_pair(k, int64(-1)));
+            if ((it==orig_qts.end()) || (it->first!=k)) {
+                return -1;
+            }
+            return it->second;
+        }
+
+        int64 current_quadtree(int64 k) const {
+            auto it = new_qts.find(k);
+            if (it!=new_qts.end()) {
+                return it->second;
+            }
+            return orig_quadtree(k);
+        }
+
+
+        typeid_element_map_ptr em;
+        double buffer;
+        size_t max_depth;
+
+        id_vec changed_nodes;
+        id_vec changed_ways;
+        id_vec changed_relations;
+
+        id_vec affected_nodes;
+        bool nodes_sorted;
+        std::map<int64,id_vec> affected_ways;
+        std::set<int64> affected_relations;
+        std::map<int64,member_vec> relation_members;
+
+        id_vec location_nodes;
+        std::vector<std::tuple<int64,int32,int32>> node_locations;
+        std::vector<std::pair<int64,int64>> node_parents;
+
+        std::vector<std::pair<int64,int64>> orig_qts;
+        std::map<int64,int64> new_qts;
+        size_t missing_nodes;
+};
+
+}
+
+void read_change_files(const std::vector<std::string>& changes, typeid_element_map_ptr em, size_t numchan) {
+    std::vector<std::string> xml_changes;
+    for (const auto& fn: changes) {
+        if (ends_with(fn,".osc.gz") || ends_with(fn,".osc")) {
+            xml_changes.push_back(fn);
+        } else if (ends_with(fn,".pbfc")) {
+            //pbfc files also contain Remove and Unchanged copies of
+            //objects moved between tiles: only the actual changes are needed
+            auto cb = [em](PrimitiveBlockPtr bl) {
+                if (!bl) { return; }
+                for (auto o: bl->Objects()) {
+                    if ((o->ChangeType()==changetype::Delete) || (o->ChangeType()>=changetype::Modify)) {
+                        updateqtsdetail::add_change_object(em, o);
+                    }
+                }
+            };
+            read_blocks_primitiveblock(fn, cb, {}, numchan, nullptr, true, ReadBlockFlags::SkipGeometries);
+        } else {
+            throw std::domain_error(fn+" not a osc or pbfc file");
+        }
+    }
+    if (!xml_changes.empty()) {
+        add_change_objects(em, read_xml_change_files_parallel(xml_changes, numchan, true));
+    }
+}
+
+
+size_t run_update_qts(
+    const std::string& origfn, const std::string& qtsfn,
+    const std::vector<std::string>& changes, const std::string& outfn,
+    size_t numchan, double buffer, size_t max_depth) {
+
+    using namespace updateqtsdetail;
+
+    auto em = std::make_shared<typeid_element_map>();
+    read_change_files(changes, em, numchan);
+    Logger::Get().time("read change files");
+
+    auto update = std::make_shared<UpdateQts>(em, buffer, max_depth);
+
+    read_blocks_convfunc<WaysRelationsBlock>(origfn,
+        [update](std::shared_ptr<WaysRelationsBlock> bl) { update->add_ways_relations(bl); },
+        {}, numchan,
+        [update](std::shared_ptr<FileBlock> fb) { return update->filter_ways_relations(fb); });
+    update->finish_ways_relations();
+    Logger::Get().time("find affected ways and relations");
+
+    read_blocks_convfunc<NodesWaysBlock>(origfn,
+        [update](std::shared_ptr<NodesWaysBlock> bl) { update->add_nodes_ways(bl); },
+        {}, numchan,
+        [update](std::shared_ptr<FileBlock> fb) { return update->filter_nodes_ways(fb); });
+    update->finish_nodes_ways();
+    Logger::Get().time("find node locations");
+
+    update->calculate_ways();
+
+    auto needed = std::make_shared<id_vec>(update->needed_quadtrees());
+    read_blocks_convfunc<QuadtreesBlock>(qtsfn,
+        [update](std::shared_ptr<QuadtreesBlock> bl) { update->add_orig_quadtrees(bl); },
+        {}, numchan,
+        [needed](std::shared_ptr<FileBlock> fb) {
+            auto result = std::make_shared<QuadtreesBlock>();
+            result->file_progress = fb->file_progress;
+            if (fb->blocktype!="OSMData") { return result; }
+            auto qv = read_quadtree_vector_block(fb->get_data(), ReadBlockFlags::Empty);
+            for (size_t i=0; i < qv->ids.size(); i++) {
+                if (contains_id(*needed, qv->ids[i])) {
+                    result->qts.push_back(std::make_pair((int64) qv->ids[i], qv->quadtrees[i]));
+                }
+            }
+            return result;
+        });
+    Logger::Get().time("read original quadtrees");
+
+    update->calculate_nodes();
+    update->calculate_relations();
+    Logger::Get().time("calculate quadtrees");
+
+    const auto& new_qts = update->new_quadtrees();
+    auto out = make_collectqts(outfn, numchan, 8000);
+
+    auto it = new_qts.begin();
+    size_t num_added=0, num_replaced=0, num_removed=0;
+    auto add = [&out](int64 k, int64 qt) {
+        out->add(k>>61, k & ((1ll<<61)-1), qt);
+    };
+
+    auto merge_qts = [&](std::shared_ptr<quadtree_vector> qv) {
+        if (!qv) { return; }
+        Logger::Progress(qv->file_progress) << "write quadtrees: " << num_added << " added, "
+            << num_replaced << " replaced, " << num_removed << " removed";
+        for (size_t i=0; i < qv->ids.size(); i++) {
+            int64 k = qv->ids[i];
+            while ((it!=new_qts.end()) && (it->first < k)) {
+                if (it->second>=0) {
+                    add(it->first, it->second);
+                    num_added++;
+                }
+                ++it;
+            }
+            if ((it!=new_qts.end()) && (it->first == k)) {
+                if (it->second>=0) {
+                    add(it->first, it->second);
+                    num_replaced++;
+                } else {
+                    num_removed++;
+                }
+                ++it;
+            } else {
+                add(k, qv->quadtrees[i]);
+            }
+        }
+    };
+    read_blocks_quadtree_vector(qtsfn, merge_qts, {}, numchan, ReadBlockFlags::Empty);
+
+    for ( ; it!=new_qts.end(); ++it) {
+        if (it->second>=0) {
+            add(it->first, it->second);
+            num_added++;
+        }
+    }
+    out->finish();
+    Logger::Progress(100) << "write quadtrees: " << num_added << " added, "
+            << num_replaced << " replaced, " << num_removed << " removed";
+    Logger::Get().time("write quadtrees");
+
+    return new_qts.size();
+}
+}
@@ -0,0 +1,584 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/update/xmlchange.hpp"
+#include "oqt/elements/node.hpp"
+#include "oqt/elements/way.hpp"
+#include "oqt/elements/relation.hpp"
+#include "oqt/utils/compress.hpp"
+#include "oqt/utils/date.hpp"
+#include "oqt/utils/logger.hpp"
+#include "oqt/utils/string.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <string_view>
+
+namespace oqt {
+namespace xmlchangeparalleldetail {
+
+enum class Token { StartTag, EmptyElementTag, EndTag, Finished };
+
+typedef std::pair<std::string_view,std::string_view> attribute;
+
+//! Minimal xml tokenizer for osmChange documents. Tag names and attribute
+//! values are returned as views into the source buffer; nothing is copied
+//! until an element is constructed.
+class XmlTokenizer {
+    public:
+        XmlTokenizer(const char* begin, const char* end) : pos(begin), end_(end) {}
+
+        Token next() {
+            attributes_.clear();
+            while (true) {
+                pos = static_cast<const char*>(memchr(pos, '<', end_-pos));
+                if (!pos) {
+                    pos = end_;
+                    return Token::Finished;
+                }
+                pos++;
+                if (pos==end_) { throw std::domain_error("unexpected end of xml"); }
+
+                if (*pos=='?') {
+                    skip_past("?>");
+                } else if (*pos=='!') {
+                    if ((end_-pos > 3) && (pos[1]=='-') && (pos[2]=='-')) {
+                        skip_past("-->");
+                    } else {
+                        skip_past(">");
+                    }
+                } else if (*pos=='/') {
+                    pos++;
+                    name_ = read_name();
+                    skip_whitespace();
+                    expect('>');
+                    return Token::EndTag;
+                } else {
+                    name_ = read_name();
+                    return read_attributes();
+                }
+            }
+        }
+
+        std::string_view name() const { return name_; }
+        size_t attributes_count() const { return attributes_.size(); }
+        const attribute& attribute_at(size_t i) const { return attributes_[i]; }
+
+    private:
+        const char* pos;
+        const char* end_;
+        std::string_view name_;
+        std::vector<attribute> attributes_;
+
+        static bool is_whitespace(char c) {
+            return (c==' ') || (c=='\n') || (c=='\t') || (c=='\r');
+        }
+
+        void skip_whitespace() {
+            while ((pos<end_) && is_whitespace(*pos)) { pos++; }
+        }
+
+        void expect(char c) {
+            if ((pos==end_) || (*pos!=c)) {
+                throw std::domain_error(std::string("malformed xml: expected '")+c+"'");
+            }
+            pos++;
+        }
+
+        void skip_past(const char* tok) {
+            std::string_view rest(pos, end_-pos);
+            size_t p = rest.find(tok);
+            if (p==std::string_view::npos) { throw std::domain_error("unexpected end of xml"); }
+            pos += p + strlen(tok);
+        }
+
+        std::string_view read_name() {
+            const char* st = pos;
+            while ((pos<end_) && !is_whitespace(*pos) && (*pos!='/') && (*pos!='>') && (*pos!='=')) {
+                pos++;
+            }
+            if (pos==st) { throw std::domain_error("malformed xml: empty name"); }
+            return std::string_view(st, pos-st);
+        }
+
+        Token read_attributes() {
+            while (true) {
+                skip_whitespace();
+                if (pos==end_) { throw std::domain_error("unexpected end of xml"); }
+                if (*pos=='>') {
+                    pos++;
+                    return Token::StartTag;
+                }
+                if (*pos=='/') {
+                    pos++;
+                    expect('>');
+                    return Token::EmptyElementTag;
+                }
+                auto k = read_name();
+                skip_whitespace();
+                expect('=');
+                skip_whitespace();
+                if ((pos==end_) || ((*pos!='"') && (*pos!='\''))) {
+                    throw std::domain_error("malformed xml: expected quoted attribute value");
+                }
+                char q = *pos++;
+                const char* st = pos;
+                pos = static_cast<const char*>(memchr(pos, q, end_-pos));
+                if (!pos) { throw std::domain_error("unexpected end of xml"); }
+                attributes_.push_back(std::make_pair(k, std::string_view(st, pos-st)));
+                pos++;
+            }
+        }
+};
+
+void write_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(cp);
+    } else if (cp < 0x800) {
+        out.push_back(0xc0 | (cp>>6));
+        out.push_back(0x80 | (cp&0x3f));
+    } else if (cp < 0x10000) {
+        out.push_back(0xe0 | (cp>>12));
+        out.push_back(0x80 | ((cp>>6)&0x3f));
+        out.push_back(0x80 | (cp&0x3f));
+    } else {
+        out.push_back(0xf0 | (cp>>18));
+        out.push_back(0x80 | ((cp>>12)&0x3f));
+        out.push_back(0x80 | ((cp>>6)&0x3f));
+        out.push_back(0x80 | (cp&0x3f));
+    }
+}
+
+//! Copy an attribute value, expanding entity references and normalizing
+//! whitespace in the same way as xmlinspector.
+std::string read_string(std::string_view v) {
+    if (v.find_first_of("&\n\t\r")==std::string_view::npos) {
+        return std::string(v);
+    }
+    std::string out;
+    out.reserve(v.size());
+    for (size_t i=0; i < v.size(); i++) {
+        char c = v[i];
+        if ((c=='\n') || (c=='\t') || (c=='\r')) {
+            if ((c=='\r') && (i+1<v.size()) && (v[i+1]=='\n')) { i++; }
+            out.push_back(' ');
+        } else if (c=='&') {
+            size_t e = v.find(';', i);
+            if (e==std::string_view::npos) { throw std::domain_error("malformed xml: bad entity reference"); }
+            auto ent = v.substr(i+1, e-i-1);
+            if (ent=="lt") { out.push_back('<'); }
+            else if (ent=="gt") { out.push_back('>'); }
+            else if (ent=="amp") { out.push_back('&'); }
+            else if (ent=="quot") { out.push_back('"'); }
+            else if (ent=="apos") { out.push_back('\''); }
+            else if ((ent.size()>1) && (ent[0]=='#')) {
+                uint32_t cp=0;
+                if ((ent[1]=='x') || (ent[1]=='X')) {
+                    for (size_t j=2; j < ent.size(); j++) {
+                        char h=ent[j];
+                        cp = cp*16 + ((h>='0' && h<='9') ? h-'0' : ((h|0x20)-'a'+10));
+                    }
+                } else {
+                    for (size_t j=1; j < ent.size(); j++) {
+                        cp = cp*10 + (ent[j]-'0');
+                    }
+                }
+                write_utf8(out, cp);
+            } else {
+                out.append(v.substr(i, e-i+1));
+            }
+            i = e;
+        } else {
+            out.push_back(c);
+        }
+    }
+    return out;
+}
+
+int64 read_int(std::string_view s) {
+    int64 r=0;
+    size_t i=0;
+    bool neg=false;
+    if ((!s.empty()) && (s[0]=='-')) { neg=true; i=1; }
+    for ( ; i < s.size(); i++) {
+        if ((s[i]<'0') || (s[i]>'9')) { break; }
+        r = r*10 + (s[i]-'0');
+    }
+    return neg ? -r : r;
+}
+
+//! Read a decimal coordinate as an integer number of 1e-7 degrees,
+//! rounding away from zero as atof based reading did.
+int64 read_lonlat(std::string_view s) {
+    int64 r=0;
+    size_t i=0;
+    bool neg=false;
+    if ((!s.empty()) && (s[0]=='-')) { neg=true; i=1; }
+    for ( ; (i < s.size()) && (s[i]!='.'); i++) {
+        r = r*10 + (s[i]-'0');
+    }
+    int nd=0;
+    bool round_up=false;
+    if (i < s.size()) {
+        i++;
+        for ( ; i < s.size(); i++) {
+            if (nd==7) {
+                round_up = s[i]>='5';
+                break;
+            }
+            r = r*10 + (s[i]-'0');
+            nd++;
+        }
+    }
+    for ( ; nd < 7; nd++) { r*=10; }
+    if (round_up) { r++; }
+    return neg ? -r : r;
+}
+
+//! read_date calls mktime, which takes a global lock. Timestamps in a
+//! change file are clustered, so cache the value for the start of each hour.
+class DateReader {
+    public:
+        DateReader() : hour_value(0) {}
+
+        int64 read(std::string_view s) {
+            if ((s.size()<19) || (s[13]!=':') || (s[16]!=':')) {
+                return read_date(std::string(s));
+            }
+            if (s.substr(0,13)!=hour_key) {
+                hour_key = std::string(s.substr(0,13));
+                hour_value = read_date(hour_key+":00:00");
+            }
+            return hour_value + read_int(s.substr(14,2))*60 + read_int(s.substr(17,2));
+        }
+    private:
+        std::string hour_key;
+        int64 hour_value;
+};
+
+class ChangeReader {
+    public:
+        ChangeReader(const std::string& data, bool allow_missing_users_)
+            : tok(data.data(), data.data()+data.size()), allow_missing_users(allow_missing_users_) {}
+
+        std::vector<ElementPtr> read_all() {
+            std::vector<ElementPtr> result;
+            changetype mode=changetype::Normal;
+
+            while (true) {
+                auto tt = tok.next();
+                if (tt==Token::Finished) { break; }
+                auto nm = tok.name();
+                if (tt==Token::EndTag) {
+                    if ((nm=="delete") || (nm=="modify") || (nm=="create")) {
+                        mode=changetype::Normal;
+                    } else if (nm!="osmChange") {
+                        Logger::Message() << "EndTag name: " << std::string(nm);
+                    }
+                    continue;
+                }
+                bool empty = tt==Token::EmptyElementTag;
+                if (nm=="node") {
+                    result.push_back(read_node(mode, empty));
+                } else if (nm=="way") {
+                    result.push_back(read_way(mode, empty));
+                } else if (nm=="relation") {
+                    result.push_back(read_relation(mode, empty));
+                } else if (empty) {
+                    Logger::Message() << "EmptyElementTag name: " << std::string(nm);
+                } else if (nm=="delete") {
+                    mode=changetype::Delete;
+                } else if (nm=="modify") {
+                    mode=changetype::Modify;
+                } else if (nm=="create") {
+                    mode=changetype::Create;
+                } else if (nm!="osmChange") {
+                    Logger::Message() << "StartTag name: " << std::string(nm);
+                }
+            }
+            return result;
+        }
+
+    private:
+        XmlTokenizer tok;
+        bool allow_missing_users;
+        DateReader dates;
+
+        ElementInfo new_info() {
+            ElementInfo inf; inf.visible=true;
+            inf.user=""; inf.user_id=-1;
+            return inf;
+        }
+
+        bool check_info(const attribute& attr, ElementInfo& inf) {
+            if (attr.first == "version") { inf.version = read_int(attr.second); return true; }
+            if (attr.first == "changeset") { inf.changeset = read_int(attr.second); return true; }
+            if (attr.first == "timestamp") { inf.timestamp = dates.read(attr.second); return true; }
+            if (attr.first == "uid") { inf.user_id = read_int(attr.second); return true; }
+            if (attr.first == "user") { inf.user = read_string(attr.second); return true; }
+            return false;
+        }
+
+        void check_count(size_t expected) {
+            if ((!allow_missing_users) && (tok.attributes_count()!=expected)) {
+                throw std::domain_error("expected tag to have "+std::to_string(expected)+" attributes");
+            }
+        }
+
+        [[noreturn]] void unexpected_attribute(const attribute& attr) {
+            throw std::domain_error("unexpected attribute "+std::string(attr.first));
+        }
+
+        void add_tag(std::vector<Tag>& tags) {
+            if (tok.attributes_count()!=2) { throw std::domain_error("expected tag to have two attributes"); }
+            Tag t;
+            for (size_t i=0; i < 2; i++) {
+                const auto& attr = tok.attribute_at(i);
+                if (attr.first=="k") {
+                    t.key = read_string(attr.second);
+                } else if (attr.first=="v") {
+                    t.val = read_string(attr.second);
+                }
+            }
+            tags.push_back(std::move(t));
+        }
+
+        void add_ref(std::vector<int64>& refs) {
+            if ((tok.attributes_count()!=1) || (tok.attribute_at(0).first!="ref")) {
+                throw std::domain_error("expected nd to have 1 attribute, called ref");
+            }
+            refs.push_back(read_int(tok.attribute_at(0).second));
+        }
+
+        void add_member(std::vector<Member>& mems) {
+            if (tok.attributes_count()!=3) {
+                throw std::domain_error("expected member to have 3 attributes");
+            }
+            Member m;
+            for (size_t i=0; i < 3; i++) {
+                const auto& attr = tok.attribute_at(i);
+                if (attr.first=="ref") { m.ref = read_int(attr.second); }
+                else if (attr.first=="type") {
+                    if (attr.second=="node") { m.type = ElementType::Node; }
+                    else if (attr.second=="way") { m.type = ElementType::Way; }
+                    else if (attr.second=="relation") { m.type = ElementType::Relation; }
+                    else { throw std::domain_error("unexpected member type"); }
+                }
+                else if (attr.first=="role") { m.role = read_string(attr.second); }
+                else { unexpected_attribute(attr); }
+            }
+            mems.push_back(std::move(m));
+        }
+
+        //! Read the children of the current element until its end tag,
+        //! passing each start or empty tag to \param child.
+        template <class Func>
+        void read_children(std::string_view parent, Func child) {
+            while (true) {
+                auto tt = tok.next();
+                if (tt==Token::Finished) {
+                    throw std::domain_error("unexpected end of xml in "+std::string(parent));
+                }
+                if (tt==Token::EndTag) {
+                    if (tok.name()==parent) { return; }
+                    continue;
+                }
+                child(tok.name());
+                if (tt==Token::StartTag) {
+                    //skip to the child's end tag
+                    auto nm = tok.name();
+                    while (true) {
+                        auto t2 = tok.next();
+                        if (t2==Token::Finished) { throw std::domain_error("unexpected end of xml"); }
+                        if ((t2==Token::EndTag) && (tok.name()==nm)) { break; }
+                    }
+                }
+            }
+        }
+
+        ElementPtr read_node(changetype mode, bool empty) {
+            int64 id=0, lon=0, lat=0;
+            ElementInfo inf = new_info();
+            std::vector<Tag> tags;
+            check_count(8);
+            for (size_t i=0; i < tok.attributes_count(); i++) {
+                const auto& attr = tok.attribute_at(i);
+                if (attr.first == "id") { id = read_int(attr.second); }
+                else if (check_info(attr, inf)) { /*pass*/ }
+                else if (attr.first == "lon") { lon = read_lonlat(attr.second); }
+                else if (attr.first == "lat") { lat = read_lonlat(attr.second); }
+                else { unexpected_attribute(attr); }
+            }
+            if (!empty) {
+                read_children("node", [&](std::string_view nm) {
+                    if (nm=="tag") { add_tag(tags); }
+                    else { throw std::domain_error("unexpected element "+std::string(nm)); }
+                });
+            }
+            return std::make_shared<Node>(mode, id, -1, std::move(inf), std::move(tags), lon, lat);
+        }
+
+        ElementPtr read_way(changetype mode, bool empty) {
+            int64 id=0;
+            ElementInfo inf = new_info();
+            std::vector<Tag> tags;
+            std::vector<int64> refs;
+            check_count(6);
+            for (size_t i=0; i < tok.attributes_count(); i++) {
+                const auto& attr = tok.attribute_at(i);
+                if (attr.first == "id") { id = read_int(attr.second); }
+                else if (check_info(attr, inf)) { /*pass*/ }
+                else { unexpected_attribute(attr); }
+            }
+            if (!empty) {
+                read_children("way", [&](std::string_view nm) {
+                    if (nm=="tag") { add_tag(tags); }
+                    else if (nm=="nd") { add_ref(refs); }
+                    else { throw std::domain_error("unexpected element "+std::string(nm)); }
+                });
+            }
+            return std::make_shared<Way>(mode, id, -1, std::move(inf), std::move(tags), std::move(refs));
+        }
+
+        ElementPtr read_relation(changetype mode, bool empty) {
+            int64 id=0;
+            ElementInfo inf = new_info();
+            std::vector<Tag> tags;
+            std::vector<Member> mems;
+            check_count(6);
+            for (size_t i=0; i < tok.attributes_count(); i++) {
+                const auto& attr = tok.attribute_at(i);
+                if (attr.first == "id") { id = read_int(attr.second); }
+                else if (check_info(attr, inf)) { /*pass*/ }
+                else { unexpected_attribute(attr); }
+            }
+            if (!empty) {
+                read_children("relation", [&](std::string_view nm) {
+                    if (nm=="tag") { add_tag(tags); }
+                    else if (nm=="member") { add_member(mems); }
+                    else { throw std::domain_error("unexpected element "+std::string(nm)); }
+                });
+            }
+            return std::make_shared<Relation>(mode, id, -1, std::move(inf), std::move(tags), std::move(mems));
+        }
+};
+
+std::string read_change_file_data(const std::string& fn) {
+    std::ifstream infile(fn, std::ios::in | std::ios::binary);
+    if (!infile.good()) {
+        throw std::domain_error("can't open "+fn);
+    }
+    std::string data{std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>()};
+    if (ends_with(fn, ".gz")) {
+        return decompress_gzip(data);
+    }
+    return data;
+}
+
+}
+
+std::vector<ElementPtr> read_xml_change_objects(const std::string& data, bool allow_missing_users) {
+    xmlchangeparalleldetail::ChangeReader reader(data, allow_missing_users);
+    return reader.read_all();
+}
+
+void merge_change_objects(std::vector<ElementPtr>& objs) {
+    //stable, so that of two objects with the same version the first is kept,
+    //matching read_xml_change_file_em
+    std::stable_sort(objs.begin(), objs.end(), [](const ElementPtr& l, const ElementPtr& r) {
+        return l->InternalId() < r->InternalId();
+    });
+
+    size_t j=0;
+    for (size_t i=0; i < objs.size(); i++) {
+        if ((j>0) && (objs[j-1]->InternalId()==objs[i]->InternalId())) {
+            if (objs[i]->Info().version > objs[j-1]->Info().version) {
+                objs[j-1]=std::move(objs[i]);
+            }
+        } else {
+            if (i!=j) { objs[j]=std::move(objs[i]); }
+            j++;
+        }
+    }
+    objs.resize(j);
+}
+
+std::vector<ElementPtr> read_xml_change_files_parallel(const std::vector<std::string>& fns, size_t numchan, bool allow_missing_users) {
+
+    std::vector<std::vector<ElementPtr>> parts(fns.size());
+    std::atomic<size_t> next_file(0);
+
+    auto read_files = [&]() {
+        while (true) {
+            size_t i = next_file++;
+            if (i >= fns.size()) { return; }
+            auto data = xmlchangeparalleldetail::read_change_file_data(fns[i]);
+            parts[i] = read_xml_change_objects(data, allow_missing_users);
+        }
+    };
+
+    numchan = std::max<size_t>(1, std::min(numchan, fns.size()));
+    std::vector<std::future<void>> futs;
+    for (size_t i=1; i < numchan; i++) {
+        futs.push_back(std::async(std::launch::async, read_files));
+    }
+    read_files();
+    for (auto& f: futs) {
+        f.get();
+    }
+
+    size_t tot=0;
+    for (const auto& p: parts) { tot+=p.size(); }
+
+    std::vector<ElementPtr> result;
+    result.reserve(tot);
+    for (auto& p: parts) {
+        std::move(p.begin(), p.end(), std::back_inserter(result));
+        std::vector<ElementPtr>().swap(p);
+    }
+    merge_change_objects(result);
+    return result;
+}
+
+void add_change_objects(typeid_element_map_ptr em, const std::vector<ElementPtr>& objs) {
+    if (em->empty()) {
+        //objs is sorted by type and id, so each insert goes at the end
+        for (const auto& o: objs) {
+            em->emplace_hint(em->end(), std::make_pair(o->Type(), o->Id()), o);
+        }
+        return;
+    }
+    for (const auto& o: objs) {
+        auto k = std::make_pair(o->Type(), o->Id());
+        auto it = em->find(k);
+        if (it==em->end()) {
+            em->emplace(k, o);
+        } else if (o->Info().version > it->second->Info().version) {
+            it->second = o;
+        }
+    }
+}
+
+}
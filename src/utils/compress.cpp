@@ -22,6 +22,7 @@
 
 #include "oqt/utils/compress.hpp"
 #include "oqt/utils/pbf/fixedint.hpp"
+#include "oqt/utils/telemetry.hpp"
 
 #include <zlib.h>
 #include <stdexcept>
@@ -30,6 +31,7 @@ namespace oqt {
 
 
 std::string compress(const std::string& data, int level) {
+    StageTimer timer(Telemetry::Get().stage("compress", false), data.size());
     std::string out(data.size()+100,0);
 
     z_stream defstream;
@@ -59,6 +61,7 @@ std::string decompress(const std::string& data, size_t size) {
     if (size==0) {
         return data;
     }
+    StageTimer timer(Telemetry::Get().stage("decompress", false), size);
     std::string out(size,0);
 
     z_stream infstream;
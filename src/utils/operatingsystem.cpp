@@ -22,6 +22,7 @@
 
 #include "oqt/utils/operatingsystem.hpp"
 #include <experimental/filesystem>
+#include <chrono>
 #include <malloc.h>
 #include <fstream>
 #include <iostream>
@@ -37,6 +38,12 @@ int64 file_size(const std::string& fn) {
     
 }
 
+int64 file_timestamp(const std::string& fn) {
+    namespace fs = std::experimental::filesystem;
+    auto tm = fs::last_write_time(fs::path{fn});
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tm.time_since_epoch()).count();
+}
+
 
 
 std::string getmem(size_t pid) {
@@ -129,13 +129,24 @@ std::string write_packed_delta(const std::vector<int64>& vals) {
 
 std::string write_packed_int(const std::vector<uint64>& vals) {
     std::string out(10*vals.size(),0);
-    size_t pos=0;
+    size_t pos=write_packed_int_in_place(out,0,vals);
+    out.resize(pos);
+    return out;
+}
+
+size_t packed_int_length(const std::vector<uint64>& vals) {
+    size_t l=0;
+    for (auto v: vals) {
+        l += unsigned_varint_length(v);
+    }
+    return l;
+}
 
+size_t write_packed_int_in_place(std::string& out, size_t pos, const std::vector<uint64>& vals) {
     for (auto v: vals) {
         pos=write_unsigned_varint(out,pos,v);
     }
-    out.resize(pos);
-    return out;
+    return pos;
 }
     
     
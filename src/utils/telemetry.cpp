@@ -0,0 +1,272 @@
+/*****************************************************************************
+ *
+ * This file is part of osmquadtree
+ *
+ * Copyright (C) 2018 James Harris
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ *****************************************************************************/
+
+#include "oqt/utils/telemetry.hpp"
+#include "oqt/utils/logger.hpp"
+
+#include "picojson.h"
+
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <thread>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+namespace oqt {
+
+int64 telemetry_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64& telemetry_thread_push_wait() {
+    thread_local int64 push_wait = 0;
+    return push_wait;
+}
+
+int64 StageStats::start_push(bool have_item) {
+    //the end of input is not an item, and is never popped
+    if (have_item) {
+        int64 q = ++queued;
+        int64 m = max_queued;
+        while ((q > m) && !max_queued.compare_exchange_weak(m, q)) {}
+    }
+    return telemetry_now();
+}
+
+void StageStats::finish_push(int64 start) {
+    int64 w = telemetry_now()-start;
+    push_wait += w;
+    telemetry_thread_push_wait() += w;
+}
+
+int64 StageStats::start_pop() {
+    return telemetry_now();
+}
+
+void StageStats::finish_pop(int64 start, bool have_item) {
+    pop_wait += telemetry_now()-start;
+    if (have_item) {
+        queued--;
+    }
+}
+
+void StageStats::add_busy(int64 start, int64 nbytes, int64 blocked) {
+    int64 end = telemetry_now();
+    busy += end-start-blocked;
+    items++;
+    bytes += nbytes;
+    if (Telemetry::Get().tracing()) {
+        Telemetry::Get().add_trace_event(name, start, end);
+    }
+}
+
+
+Telemetry& Telemetry::Get() {
+    static Telemetry telemetry;
+    return telemetry;
+}
+
+void Telemetry::enable(bool trace) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!is_enabled) {
+        start_time = telemetry_now();
+    }
+    is_tracing = trace;
+    is_enabled = true;
+}
+
+void Telemetry::disable() {
+    is_enabled = false;
+    is_tracing = false;
+}
+
+void Telemetry::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stages.clear();
+    events.clear();
+    dropped_events = 0;
+    start_time = telemetry_now();
+}
+
+StageStatsPtr Telemetry::stage(const std::string& name, bool new_instance) {
+    if (!is_enabled) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = stages.find(name);
+    if (it==stages.end()) {
+        it = stages.insert(std::make_pair(name, std::make_shared<StageStats>(name))).first;
+    }
+    if (new_instance) {
+        it->second->instances++;
+    }
+    return it->second;
+}
+
+StageStatsPtr Telemetry::unique_stage(const std::string& prefix) {
+    if (!is_enabled) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i=1; ; i++) {
+        auto name = prefix+"#"+std::to_string(i);
+        if (stages.count(name)==0) {
+            auto st = std::make_shared<StageStats>(name);
+            st->instances++;
+            stages.insert(std::make_pair(name, st));
+            return st;
+        }
+    }
+}
+
+//threads are numbered in the order they first record an event
+static int64 trace_thread_id() {
+    static std::atomic<int64> next_id(1);
+    thread_local int64 tid = next_id++;
+    return tid;
+}
+
+//a long run would otherwise use a great deal of memory
+static const size_t max_trace_events = 4000000;
+
+void Telemetry::add_trace_event(const std::string& name, int64 start, int64 end) {
+    int64 tid = trace_thread_id();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= max_trace_events) {
+        dropped_events++;
+        return;
+    }
+    events.push_back(TraceEvent{name, 'X', tid, start, end-start});
+}
+
+void Telemetry::add_trace_marker(const std::string& name) {
+    if (!is_tracing) {
+        return;
+    }
+    int64 tid = trace_thread_id();
+    int64 now = telemetry_now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= max_trace_events) {
+        dropped_events++;
+        return;
+    }
+    events.push_back(TraceEvent{name, 'i', tid, now, 0});
+}
+
+static double ns_to_seconds(int64 ns) {
+    return double(ns) / 1000000000.0;
+}
+
+std::string Telemetry::report_json() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    picojson::array stages_arr;
+    for (const auto& st: stages) {
+        const auto& s = *st.second;
+        picojson::object obj;
+        obj["name"] = picojson::value(s.name);
+        obj["instances"] = picojson::value(double(s.instances));
+        obj["busy"] = picojson::value(ns_to_seconds(s.busy));
+        obj["push_wait"] = picojson::value(ns_to_seconds(s.push_wait));
+        obj["pop_wait"] = picojson::value(ns_to_seconds(s.pop_wait));
+        obj["items"] = picojson::value(double(s.items));
+        obj["bytes"] = picojson::value(double(s.bytes));
+        obj["max_queued"] = picojson::value(double(s.max_queued));
+        stages_arr.push_back(picojson::value(obj));
+    }
+    
+    picojson::object result;
+    result["elapsed"] = picojson::value(ns_to_seconds(telemetry_now()-start_time));
+    result["stages"] = picojson::value(stages_arr);
+    if (is_tracing) {
+        result["trace_events"] = picojson::value(double(events.size()));
+        result["dropped_trace_events"] = picojson::value(double(dropped_events));
+    }
+    return picojson::value(result).serialize(true);
+}
+
+std::string Telemetry::trace_json() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    //written directly: a picojson::value for each event takes too long
+    //for a large trace
+    std::stringstream strm;
+    strm << "{\"traceEvents\":[";
+    bool first=true;
+    for (const auto& ev: events) {
+        if (!first) { strm << ",\n"; }
+        first=false;
+        strm << "{\"name\":" << picojson::value(ev.name).serialize()
+             << ",\"cat\":\"oqt\",\"ph\":\"" << ev.phase << "\""
+             << ",\"pid\":1,\"tid\":" << ev.tid
+             << ",\"ts\":" << std::fixed << std::setprecision(3) << (ev.start-start_time)/1000.0;
+        if (ev.phase=='X') {
+            strm << ",\"dur\":" << ev.duration/1000.0;
+        } else {
+            strm << ",\"s\":\"g\"";
+        }
+        strm << "}";
+    }
+    strm << "],\"displayTimeUnit\":\"ms\"}";
+    return strm.str();
+}
+
+void Telemetry::write_report(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::out);
+    if (!out.good()) {
+        throw std::domain_error("can't open "+filename);
+    }
+    out << report_json();
+    Logger::Message() << "written telemetry report to " << filename;
+}
+
+void Telemetry::write_trace(const std::string& filename) const {
+    std::ofstream out(filename, std::ios::out);
+    if (!out.good()) {
+        throw std::domain_error("can't open "+filename);
+    }
+    out << trace_json();
+    Logger::Message() << "written telemetry trace to " << filename;
+}
+
+std::string demangle_type_name(const char* name) {
+#ifdef __GNUG__
+    int status=0;
+    char* res = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status==0 && res) {
+        std::string result(res);
+        std::free(res);
+        return result;
+    }
+#endif
+    return name;
+}
+
+int64 telemetry_item_bytes(const std::pair<int64,std::string>& ks) {
+    return ks.second.size();
+}
+
+}